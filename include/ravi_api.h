@@ -28,6 +28,48 @@
 
 #include <stdlib.h>
 
+/* Phases of the compilation pipeline run by raviX_compile() */
+enum Ravi_CompilerPhase {
+	RAVI_PHASE_PARSE,     /* raviX_parse() */
+	RAVI_PHASE_LOWER,     /* raviX_ast_lower() */
+	RAVI_PHASE_TYPECHECK, /* raviX_ast_typecheck() */
+	RAVI_PHASE_SIMPLIFY,  /* raviX_ast_simplify() */
+	RAVI_PHASE_LINEARIZE, /* raviX_ast_linearize() */
+	RAVI_PHASE_CFG,	      /* raviX_construct_cfg() */
+	RAVI_PHASE_OPTIMIZE,  /* IR optimization passes */
+	RAVI_PHASE_CODEGEN,   /* raviX_generate_C() */
+	RAVI_PHASE_COUNT
+};
+
+/* Statistics for a single phase */
+typedef struct Ravi_CompilerPhaseStats {
+	double elapsed_ms;		/* Wall clock time spent in the phase */
+	unsigned long long alloc_count; /* Number of calloc/realloc calls made through the memory_allocator */
+	unsigned long long alloc_bytes; /* Bytes requested through the memory_allocator */
+} Ravi_CompilerPhaseStats;
+
+/* Statistics collected by raviX_compile() when the "--stats" compiler option is given */
+typedef struct Ravi_CompilerStats {
+	Ravi_CompilerPhaseStats phases[RAVI_PHASE_COUNT];
+	unsigned ast_node_count;    /* AST nodes allocated by the parser and AST passes */
+	unsigned proc_count;	    /* Number of procs in the linearized IR */
+	unsigned basic_block_count; /* Number of reachable basic blocks across all procs */
+	unsigned instruction_count; /* Number of IR instructions across all procs */
+	size_t generated_code_size; /* Size of the generated C code in bytes */
+} Ravi_CompilerStats;
+
+/* Cache of generated code, see raviX_create_compile_cache() */
+typedef struct Ravi_CompileCache Ravi_CompileCache;
+
+/* Counters maintained by a compile cache */
+typedef struct Ravi_CompileCacheStats {
+	unsigned long long memory_hits; /* Lookups satisfied from the in-memory LRU */
+	unsigned long long disk_hits;	/* Lookups satisfied from the cache directory */
+	unsigned long long misses;	/* Lookups that had to run the compiler */
+	unsigned long long stores;	/* Generated code added to the cache */
+	unsigned long long evictions;	/* Entries dropped from the in-memory LRU */
+} Ravi_CompileCacheStats;
+
 typedef struct Ravi_CompilerInterface {
 	/* ------------------------ Inputs ------------------------------ */
 	void *context; /* Ravi supplied context, passed to debug_message/error_message callbacks */
@@ -35,19 +77,30 @@ typedef struct Ravi_CompilerInterface {
 	const char *source;	      /* Source code to be compiled - managed by Ravi */
 	size_t source_len;	      /* Size of source code */
 	const char *source_name;      /* Name of the source */
-	const char *compiler_options; /* flags to be passed to compiler */
+	const char *compiler_options; /* flags to be passed to compiler, e.g. -O1 enables the optimization passes,
+				       * -O2 also inlines small local functions (--inline-functions),
+				       * --inline-caches caches hash slots for constant string keyed table accesses */
 
 	char main_func_name[31]; /* Name of the generated function that when called will set up the Lua closure */
 
-	C_MemoryAllocator *memory_allocator; /* Memory allocator to use */
+	C_MemoryAllocator *memory_allocator; /* Memory allocator to use; if NULL the built-in region allocator is used */
+	Ravi_CompileCache *cache; /* Optional cache of generated code; if NULL the compiler is always run */
 
 	/* ------------------------- Outputs ------------------------------ */
 	const char *generated_code; /* Output of the compiler; call raviX_release() to free this */
+	Ravi_CompilerStats stats;   /* Only filled in if compiler_options contains "--stats" */
 
 	/* ------------------------ Debugging and error handling ----------------------------------------- */
 	/* context will be passed as first parameter */
 	void (*debug_message)(void *context, const char *filename, long long line, const char *message);
 	void (*error_message)(void *context, const char *message);
+
+	/* ------------------------ Optional streaming of output ----------------------------------------- */
+	/* If set, the generated code is passed to this function in chunks as each function is generated, rather than
+	 * being accumulated in generated_code, which is then left NULL. Chunks are not null terminated. Output is not
+	 * added to the cache when streamed, but cache hits are streamed. If compilation fails the chunks already passed
+	 * should be discarded. context will be passed as first parameter. */
+	void (*emit_code)(void *context, const char *code, size_t len);
 } Ravi_CompilerInterface;
 
 /**
@@ -57,7 +110,47 @@ typedef struct Ravi_CompilerInterface {
  * @return 0 for success, non-zero for failure
  */
 RAVICOMP_EXPORT int raviX_compile(Ravi_CompilerInterface *compiler_interface);
+/**
+ * Same as raviX_compile() but uses the supplied compiler state, which must have been created by
+ * raviX_init_compiler(). The compiler state is reset after compilation, retaining the string table,
+ * buffers and reserved words for the next compilation; this avoids repeated setup costs when
+ * compiling many chunks. The memory_allocator in compiler_interface is not used; the compiler state's
+ * allocator is used instead.
+ * @return 0 for success, non-zero for failure
+ */
+RAVICOMP_EXPORT int raviX_compile_with_state(CompilerState *compiler_state, Ravi_CompilerInterface *compiler_interface);
+/**
+ * Compiles a batch of independent jobs on a pool of worker threads; each job is compiled as by
+ * raviX_compile(). The callbacks of a job are invoked on the thread that compiles it, so they must be
+ * safe to call concurrently. Allocators are not required to be thread safe, so jobs must not share a
+ * memory_allocator; jobs with a NULL memory_allocator use a region allocator owned by the worker thread.
+ * @param jobs Array of jobs, each set up as for raviX_compile()
+ * @param num_jobs Number of jobs
+ * @param num_threads Number of threads to use, 0 means one per CPU
+ * @param results Optional array of num_jobs entries that receives the return code of each job
+ * @return Number of jobs that failed
+ */
+RAVICOMP_EXPORT int raviX_compile_batch(Ravi_CompilerInterface *jobs, unsigned num_jobs, unsigned num_threads,
+					int *results);
+/**
+ * Creates a cache of generated code that may be set in Ravi_CompilerInterface.cache. Entries are keyed on the
+ * source, compiler_options, main_func_name and the compiler version, which are stored with each entry and compared
+ * in full on lookup; on a hit the previously generated code
+ * is returned without running the compiler, and only generated_code_size is set in the stats. Only successful
+ * compilations are cached. The cache may be shared by threads, e.g. by the jobs of raviX_compile_batch().
+ * @param directory Optional directory where entries are also written so that they survive process restarts;
+ *                  it is created if it does not exist. NULL means the cache is held in memory only.
+ * @param max_entries Maximum number of entries held in memory, the least recently used entry is evicted first;
+ *                    0 means a default of 256
+ * @return The cache, or NULL if the directory could not be created
+ */
+RAVICOMP_EXPORT Ravi_CompileCache *raviX_create_compile_cache(const char *directory, unsigned max_entries);
+RAVICOMP_EXPORT void raviX_destroy_compile_cache(Ravi_CompileCache *cache);
+/* Returns a snapshot of the cache counters */
+RAVICOMP_EXPORT void raviX_compile_cache_stats(Ravi_CompileCache *cache, Ravi_CompileCacheStats *stats);
 /* Releases memory etc. held by the compiler context */
 RAVICOMP_EXPORT void raviX_release(Ravi_CompilerInterface *compiler_interface);
+/* Returns a short name for the phase, e.g. "parse" */
+RAVICOMP_EXPORT const char *raviX_compiler_phase_name(enum Ravi_CompilerPhase phase);
 
 #endif
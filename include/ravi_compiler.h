@@ -52,8 +52,9 @@ typedef double lua_Number;
  * Note that this struct below is also defined in allocate.h/chibicc.h and all
  * definitions must be kept in sync.
  *
- * Note that this need not be threadsafe as all processing in the compiler
- * happens in a single thread; hence a simple single threaded allocator is good enough.
+ * Note that this need not be threadsafe as a compiler state is only ever used by one thread
+ * at a time; hence a simple single threaded allocator is good enough. Independent compiler states
+ * may be used concurrently on different threads provided they do not share an allocator arena.
  */
 typedef struct C_MemoryAllocator {
 	void *arena;
@@ -65,11 +66,27 @@ typedef struct C_MemoryAllocator {
 } C_MemoryAllocator;
 #endif
 
+/* Sets up the allocator to use the compiler's built-in region (bump) allocator and creates a new arena.
+ * Objects are never freed individually; allocator->destroy_arena(allocator->arena) releases all memory
+ * in one go.
+ */
+RAVICOMP_EXPORT void raviX_init_arena_allocator(C_MemoryAllocator *allocator);
+
 /* Initialize the compiler state */
 /* During compilation all data structures are stored in the compiler state */
+/* If allocator is NULL then the compiler state uses its own region allocator, and all memory
+ * is released when the compiler state is destroyed.
+ */
 RAVICOMP_EXPORT CompilerState *raviX_init_compiler(C_MemoryAllocator *allocator);
 /* Destroy the compiler state, and free up all resources */
 RAVICOMP_EXPORT void raviX_destroy_compiler(CompilerState *compiler);
+/* Resets the compiler state so that it can be used for another compilation. The string table, buffers
+ * and reserved words are retained, but everything else from the previous compilation is discarded and
+ * must not be referenced any more. Any linearizer created for the previous compilation must be destroyed
+ * first. If the compiler state owns its allocator (see raviX_init_compiler()) then memory is released
+ * for reuse; otherwise it is left to the supplied allocator.
+ */
+RAVICOMP_EXPORT void raviX_reset_compiler(CompilerState *compiler);
 
 /* ------------------------ LEXICAL ANALYZER API -------------------------------*/
 /* Note: following enum was generated using utils/tokenenum.h                               */
@@ -140,7 +157,7 @@ typedef struct StringObject {
 	uint32_t len;	  /* length of the string */
 	int32_t reserved; /* if is this a keyword then enum TokenType value else -1 */
 	uint32_t hash;	  /* hash value of the string */
-	const char *str;  /* string data, may not be 0 terminated */
+	const char *str;  /* string data, not 0 terminated if borrowed from the source (see raviX_set_zero_copy_strings()) */
 } StringObject;
 
 /*
@@ -190,6 +207,14 @@ typedef struct {
  * matches the input string.
  */
 RAVICOMP_EXPORT const StringObject *raviX_create_string(CompilerState *compiler_state, const char *s, uint32_t len);
+/* Selects zero copy strings, which are off by default. When enabled the lexer interns names, and string literals
+ * without escape sequences, by pointing into the source buffer rather than copying them. Such strings are not 0
+ * terminated, so StringObject::str must be used with StringObject::len. The source buffer passed to raviX_parse()
+ * or raviX_init_lexer() must then remain valid and unchanged until raviX_reset_compiler() or
+ * raviX_destroy_compiler() is called, as the AST and IR refer to it. raviX_compile() and related functions always
+ * use zero copy strings, as the source of the compilation outlives the compiler state used for it.
+ */
+RAVICOMP_EXPORT void raviX_set_zero_copy_strings(CompilerState *compiler_state, bool enable);
 
 /* Initialize lexical analyser. Takes as input a buffer containing Lua/Ravi source and the source name. */
 RAVICOMP_EXPORT LexerState *raviX_init_lexer(CompilerState *compiler_state, const char *buf, size_t buflen,
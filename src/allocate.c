@@ -5,6 +5,8 @@
 
 #include "allocate.h"
 
+#include <ravi_compiler.h>
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -92,3 +94,196 @@ size_t raviX_del_array_element(void *a, size_t element_size, size_t array_size,
 	memset(p + newsize, 0, oldsize - newsize);
 	return new_array_size;
 }
+
+/*
+ * Region (bump) allocator.
+ * Memory is carved out of large chunks; individual objects are never freed, and all
+ * chunks are released together when the arena is destroyed. This suits the compiler
+ * as the AST, symbols and IR all live until the compilation completes.
+ */
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* The chunk header is padded to a multiple of ARENA_ALIGNMENT, data follows the header */
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size;	   /* usable bytes in data */
+	size_t used;	   /* bytes allocated so far */
+	unsigned sequence; /* order in which chunks were obtained */
+	char *data;
+} ArenaChunk;
+#define ARENA_CHUNK_HEADER_SIZE ((sizeof(ArenaChunk) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+typedef struct Arena {
+	ArenaChunk *chunks;	 /* Chunk we are allocating from, linked to earlier chunks */
+	ArenaChunk *spare;	 /* Chunks released by raviX_arena_release_to_mark(), kept for reuse */
+	void *last_alloc;	 /* Most recent allocation, can be resized in place */
+	size_t chunk_size;	 /* Default size of new chunks */
+	size_t total_size;	 /* Total bytes obtained from malloc */
+	unsigned sequence;	 /* Sequence number of the most recent chunk */
+	unsigned mark_sequence;	 /* Current chunk when the mark was set */
+	size_t mark_used;	 /* Bytes used in that chunk when the mark was set */
+} Arena;
+
+static inline size_t arena_align(size_t n) { return (n + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1); }
+
+static ArenaChunk *arena_new_chunk(Arena *arena, size_t size)
+{
+	ArenaChunk *chunk;
+	if (size == arena->chunk_size && arena->spare != NULL) {
+		chunk = arena->spare;
+		arena->spare = chunk->next;
+	} else {
+		chunk = (ArenaChunk *)raviX_malloc(ARENA_CHUNK_HEADER_SIZE + size);
+		chunk->data = (char *)chunk + ARENA_CHUNK_HEADER_SIZE;
+		chunk->size = size;
+		arena->total_size += ARENA_CHUNK_HEADER_SIZE + size;
+	}
+	chunk->used = 0;
+	chunk->sequence = ++arena->sequence;
+	return chunk;
+}
+
+static void arena_free_chunks(ArenaChunk *chunk)
+{
+	while (chunk) {
+		ArenaChunk *next = chunk->next;
+		raviX_free(chunk);
+		chunk = next;
+	}
+}
+
+void *raviX_arena_create(size_t initial_size, int locked)
+{
+	(void)locked;
+	Arena *arena = (Arena *)raviX_calloc(1, sizeof(Arena));
+	arena->chunk_size = initial_size > ARENA_CHUNK_SIZE ? arena_align(initial_size) : ARENA_CHUNK_SIZE;
+	arena->chunks = arena_new_chunk(arena, arena->chunk_size);
+	arena->chunks->next = NULL;
+	return arena;
+}
+
+size_t raviX_arena_destroy(void *p)
+{
+	Arena *arena = (Arena *)p;
+	size_t total_size = arena->total_size;
+	arena_free_chunks(arena->chunks);
+	arena_free_chunks(arena->spare);
+	raviX_free(arena);
+	return total_size;
+}
+
+void raviX_arena_set_mark(void *p)
+{
+	Arena *arena = (Arena *)p;
+	arena->mark_sequence = arena->chunks->sequence;
+	arena->mark_used = arena->chunks->used;
+}
+
+void raviX_arena_release_to_mark(void *p)
+{
+	Arena *arena = (Arena *)p;
+	ArenaChunk **pp = &arena->chunks;
+	while (*pp) {
+		ArenaChunk *chunk = *pp;
+		if (chunk->sequence <= arena->mark_sequence) {
+			pp = &chunk->next;
+			continue;
+		}
+		*pp = chunk->next;
+		if (chunk->size == arena->chunk_size) {
+			chunk->next = arena->spare;
+			arena->spare = chunk;
+		} else {
+			arena->total_size -= ARENA_CHUNK_HEADER_SIZE + chunk->size;
+			raviX_free(chunk);
+		}
+	}
+	/* The chunk that was current when the mark was set is current again */
+	assert(arena->chunks->sequence == arena->mark_sequence);
+	arena->chunks->used = arena->mark_used;
+	arena->last_alloc = NULL;
+}
+
+static void *arena_alloc(Arena *arena, size_t size)
+{
+	size = arena_align(size == 0 ? 1 : size);
+	ArenaChunk *chunk = arena->chunks;
+	if (chunk->size - chunk->used < size) {
+		if (size > arena->chunk_size / 4) {
+			/* Large objects get a chunk of their own, placed behind the current chunk
+			 * so that we carry on allocating from the current chunk */
+			ArenaChunk *large = arena_new_chunk(arena, size);
+			large->used = size;
+			large->next = chunk->next;
+			chunk->next = large;
+			arena->last_alloc = NULL;
+			return large->data;
+		}
+		chunk = arena_new_chunk(arena, arena->chunk_size);
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	void *ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->last_alloc = ptr;
+	return ptr;
+}
+
+void *raviX_arena_calloc(void *p, size_t n_elements, size_t elem_size)
+{
+	size_t size = n_elements * elem_size;
+	void *ptr = arena_alloc((Arena *)p, size);
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/* Finds the chunk that holds mem */
+static ArenaChunk *arena_find_chunk(Arena *arena, void *mem)
+{
+	for (ArenaChunk *chunk = arena->chunks; chunk; chunk = chunk->next) {
+		if ((char *)mem >= chunk->data && (char *)mem < chunk->data + chunk->used)
+			return chunk;
+	}
+	assert(0);
+	return NULL;
+}
+
+void *raviX_arena_realloc(void *p, void *mem, size_t newsize)
+{
+	Arena *arena = (Arena *)p;
+	if (mem == NULL)
+		return arena_alloc(arena, newsize);
+	ArenaChunk *chunk = arena_find_chunk(arena, mem);
+	size_t available = chunk->data + chunk->used - (char *)mem; /* upper bound on the old size */
+	if (mem == arena->last_alloc && chunk == arena->chunks) {
+		/* Most recent allocation - try to grow in place */
+		size_t size = arena_align(newsize == 0 ? 1 : newsize);
+		if (size <= available || size - available <= chunk->size - chunk->used) {
+			chunk->used = ((char *)mem - chunk->data) + size;
+			return mem;
+		}
+	}
+	/* We don't track object sizes, so copy whatever could belong to the old object */
+	void *ptr = arena_alloc(arena, newsize);
+	memcpy(ptr, mem, newsize < available ? newsize : available);
+	return ptr;
+}
+
+void raviX_arena_free(void *p, void *mem)
+{
+	/* Memory is released when the arena is destroyed */
+	(void)p;
+	(void)mem;
+}
+
+void raviX_init_arena_allocator(C_MemoryAllocator *allocator)
+{
+	allocator->arena = raviX_arena_create(0, 0);
+	allocator->realloc = raviX_arena_realloc;
+	allocator->calloc = raviX_arena_calloc;
+	allocator->free = raviX_arena_free;
+	allocator->create_arena = raviX_arena_create;
+	allocator->destroy_arena = raviX_arena_destroy;
+}
@@ -52,6 +52,22 @@ typedef struct C_MemoryAllocator {
 } C_MemoryAllocator;
 #endif
 
+/*
+Built-in region (bump) allocator. Objects are not freed individually; all memory held by
+an arena is released in one go by raviX_arena_destroy(). The functions match the signatures
+expected by C_MemoryAllocator, and raviX_init_arena_allocator() (see ravi_compiler.h) sets up
+an allocator to use them.
+*/
+extern void *raviX_arena_create(size_t initial_size, int locked);
+extern size_t raviX_arena_destroy(void *arena);
+extern void *raviX_arena_calloc(void *arena, size_t n_elements, size_t elem_size);
+extern void *raviX_arena_realloc(void *arena, void *mem, size_t newsize);
+extern void raviX_arena_free(void *arena, void *mem);
+/* Remembers the current allocation position of the arena */
+extern void raviX_arena_set_mark(void *arena);
+/* Releases everything allocated since raviX_arena_set_mark(); chunks are retained for reuse */
+extern void raviX_arena_release_to_mark(void *arena);
+
 /*
 Reallocate array from old_n to new_n. If new_n is 0 then array memory is freed.
 If new_n is greater than old_n then old data is copied across and the
@@ -78,7 +94,7 @@ extern size_t raviX_del_array_element(void *p, size_t element_size, size_t array
 #define array_push(A, type, value)                                                                                     \
 	{                                                                                                              \
 		if ((A)->count == (A)->capacity) {                                                                     \
-			unsigned newsize = (A)->capacity += 10;                                                        \
+			unsigned newsize = (A)->capacity ? (A)->capacity * 2 : 10;                                     \
 			(A)->data =                                                                                    \
 			    (type *)raviX_realloc_array((A)->data, sizeof((A)->data[0]), (A)->capacity, newsize);      \
 			(A)->capacity = newsize;                                                                       \
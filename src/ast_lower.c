@@ -181,7 +181,7 @@ static AstNode *var_is_nil(CompilerState *compiler_state, LuaSymbol *symbol)
 /* break */
 static AstNode *break_statment(CompilerState *compiler_state, Scope *goto_scope)
 {
-	const StringObject *label = raviX_create_string(compiler_state, "break", sizeof "break");
+	const StringObject *label = raviX_create_string(compiler_state, "break", sizeof "break" - 1);
 	AstNode *goto_stmt = raviX_allocate_ast_node_at_line(compiler_state, STMT_GOTO, 0); // TODO line number
 	goto_stmt->goto_stmt.name = label;
 	goto_stmt->goto_stmt.is_break = 1;
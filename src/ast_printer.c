@@ -67,7 +67,7 @@ static void printf_buf(TextBuffer *buf, const char *format, ...)
 			cp++;
 		} else if (cp[0] == '%' && cp[1] == 't') { /* string_object */
 			const StringObject *s = va_arg(ap, const StringObject *);
-			raviX_buffer_add_string(buf, s->str);
+			raviX_buffer_add_bytes(buf, s->str, s->len);
 			cp++;
 		} else if (cp[0] == '%' && cp[1] == 'T') { /* VariableType */
 			const VariableType *type;
@@ -75,7 +75,7 @@ static void printf_buf(TextBuffer *buf, const char *format, ...)
 			if (type->type_code == RAVI_TUSERDATA) {
 				const StringObject *s = type->type_name;
 				if (s != NULL)
-					raviX_buffer_add_string(buf, s->str);
+					raviX_buffer_add_bytes(buf, s->str, s->len);
 				else
 					raviX_buffer_add_string(buf, "userdata");
 			} else {
@@ -139,31 +139,32 @@ static void print_statement_list(TextBuffer *buf, AstNodeList *statement_list, i
 	print_ast_node_list(buf, statement_list, level + 1, NULL);
 }
 
-static inline const char *get_as_str(const StringObject *ts) { return ts ? ts->str : ""; }
+static const StringObject empty_string = {.len = 0, .reserved = -1, .str = ""};
+static inline const StringObject *string_or_empty(const StringObject *ts) { return ts ? ts : &empty_string; }
 
 static void print_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 {
 	switch (sym->symbol_type) {
 	case SYM_ENV: {
-		printf_buf(buf, "%p%t %c %s %s\n", level, sym->variable.var_name, "_ENV",
-			   raviX_get_type_name(sym->variable.value_type.type_code), get_as_str(sym->variable.value_type.type_name));
+		printf_buf(buf, "%p%t %c %s %t\n", level, sym->variable.var_name, "_ENV",
+			   raviX_get_type_name(sym->variable.value_type.type_code), string_or_empty(sym->variable.value_type.type_name));
 		break;
 	}
 	case SYM_GLOBAL: {
-		printf_buf(buf, "%p%t %c %s %s\n", level, sym->variable.var_name, "global symbol",
-			   raviX_get_type_name(sym->variable.value_type.type_code), get_as_str(sym->variable.value_type.type_name));
+		printf_buf(buf, "%p%t %c %s %t\n", level, sym->variable.var_name, "global symbol",
+			   raviX_get_type_name(sym->variable.value_type.type_code), string_or_empty(sym->variable.value_type.type_name));
 		break;
 	}
 	case SYM_LOCAL: {
-		printf_buf(buf, "%p%t %c %s %s %s\n", level, sym->variable.var_name, "local symbol",
-			   raviX_get_type_name(sym->variable.value_type.type_code), get_as_str(sym->variable.value_type.type_name),
+		printf_buf(buf, "%p%t %c %s %t %s\n", level, sym->variable.var_name, "local symbol",
+			   raviX_get_type_name(sym->variable.value_type.type_code), string_or_empty(sym->variable.value_type.type_name),
 			   (sym->variable.modified ? "" : " const"));
 		break;
 	}
 	case SYM_UPVALUE: {
-		printf_buf(buf, "%p%t %c %s %s\n", level, sym->upvalue.target_variable->variable.var_name, "upvalue",
+		printf_buf(buf, "%p%t %c %s %t\n", level, sym->upvalue.target_variable->variable.var_name, "upvalue",
 			   raviX_get_type_name(sym->upvalue.target_variable->variable.value_type.type_code),
-			   get_as_str(sym->upvalue.target_variable->variable.value_type.type_name));
+			   string_or_empty(sym->upvalue.target_variable->variable.value_type.type_name));
 		break;
 	}
 	default:
@@ -37,7 +37,7 @@ static void printf_buf(TextBuffer *buf, const char *format, ...)
 			cp++;
 		} else if (cp[0] == '%' && cp[1] == 't') { /* string_object */
 			const StringObject *s = va_arg(ap, const StringObject *);
-			raviX_buffer_add_string(buf, s->str);
+			raviX_buffer_add_bytes(buf, s->str, s->len);
 			cp++;
 		} else if (cp[0] == '%' && cp[1] == 'T') { /* VariableType */
 			const VariableType *type;
@@ -45,7 +45,7 @@ static void printf_buf(TextBuffer *buf, const char *format, ...)
 			if (type->type_code == RAVI_TUSERDATA) {
 				const StringObject *s = type->type_name;
 				if (s != NULL)
-					raviX_buffer_add_string(buf, s->str);
+					raviX_buffer_add_bytes(buf, s->str, s->len);
 				else
 					raviX_buffer_add_string(buf, "userdata");
 			} else {
@@ -124,7 +124,8 @@ static void dump_statement_list(TextBuffer *buf, AstNodeList *statement_list, in
 	dump_ast_node_list(buf, statement_list, level, ",");
 }
 
-static inline const char *get_as_str(const StringObject *ts) { return ts ? ts->str : ""; }
+static const StringObject empty_string = {.len = 0, .reserved = -1, .str = ""};
+static inline const StringObject *string_or_empty(const StringObject *ts) { return ts ? ts : &empty_string; }
 
 static void dump_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 {
@@ -135,7 +136,7 @@ static void dump_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 		printf_buf(buf, "%pname = '%t',\n", level + 1, sym->variable.var_name);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(sym->variable.value_type.type_code));
-		printf_buf(buf, "%ptype_name = %s,\n", level + 1, get_as_str(sym->variable.value_type.type_name));
+		printf_buf(buf, "%ptype_name = %t,\n", level + 1, string_or_empty(sym->variable.value_type.type_name));
 		printf_buf(buf, "%p}\n", level);
 		break;
 	}
@@ -145,7 +146,7 @@ static void dump_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 		printf_buf(buf, "%pname = '%t',\n", level + 1, sym->variable.var_name);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(sym->variable.value_type.type_code));
-		printf_buf(buf, "%ptype_name = '%s'\n", level + 1, get_as_str(sym->variable.value_type.type_name));
+		printf_buf(buf, "%ptype_name = '%t'\n", level + 1, string_or_empty(sym->variable.value_type.type_name));
 		printf_buf(buf, "%p}\n", level);
 		break;
 	}
@@ -155,7 +156,7 @@ static void dump_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 		printf_buf(buf, "%pname = '%t',\n", level + 1, sym->variable.var_name);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(sym->variable.value_type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(sym->variable.value_type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(sym->variable.value_type.type_name));
 		printf_buf(buf, "%pis_modified = %b,\n", level + 1, (lua_Integer)sym->variable.modified);
 		printf_buf(buf, "%pis_function_argument = %b,\n", level + 1,
 			   (lua_Integer)sym->variable.function_parameter);
@@ -171,8 +172,8 @@ static void dump_symbol(TextBuffer *buf, LuaSymbol *sym, int level)
 			   sym->upvalue.target_variable->variable.var_name);
 		printf_buf(buf, "%ptarget_type_code = %s,\n", level + 1,
 			   raviX_get_type_name(sym->upvalue.target_variable->variable.value_type.type_code));
-		printf_buf(buf, "%ptarget_type_name = '%s',\n", level + 1,
-			   get_as_str(sym->upvalue.target_variable->variable.value_type.type_name));
+		printf_buf(buf, "%ptarget_type_name = '%t',\n", level + 1,
+			   string_or_empty(sym->upvalue.target_variable->variable.value_type.type_name));
 		printf_buf(buf, "%pupvalue_index = %i\n", level + 1,
 			   (lua_Integer)(sym->upvalue.upvalue_index));
 		printf_buf(buf, "%p}\n", level);
@@ -273,7 +274,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 		printf_buf(buf, "%pparent_function_id = %P,\n", level + 1, node->function_expr.parent_function);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(node->function_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->function_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->function_expr.type.type_name));
 		printf_buf(buf, "%pis_vararg = %b,\n", level + 1, (lua_Integer)node->function_expr.is_vararg);
 		printf_buf(buf, "%pis_method = %b,\n", level + 1, (lua_Integer)node->function_expr.is_method);
 		printf_buf(buf, "%pneed_close = %b,\n", level + 1, (lua_Integer)node->function_expr.need_close);
@@ -495,7 +496,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 		printf_buf(buf, "%pExprSuffixed {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(node->suffixed_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->suffixed_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->suffixed_expr.type.type_name));
 		printf_buf(buf, "%pprimary = \n", level + 1);
 		raviX_dump_ast_node(buf, node->suffixed_expr.primary_expr, level + 2);
 		printf_buf(buf, "%p,\n", level + 1);
@@ -511,8 +512,8 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 		printf_buf(buf, "%pExprCall {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(node->function_call_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1,
-			   get_as_str(node->function_call_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1,
+			   string_or_empty(node->function_call_expr.type.type_name));
 		if (node->function_call_expr.method_name) {
 			printf_buf(buf, "%pmethod_name = '%t',\n", level + 1, node->function_call_expr.method_name);
 		}
@@ -535,7 +536,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 		printf_buf(buf, "%pExprBinary {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(node->binary_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->binary_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->binary_expr.type.type_name));
 		printf_buf(buf, "%pop = '%s',\n", level + 1, raviX_get_binary_opr_str(node->binary_expr.binary_op));
 		printf_buf(buf, "%pleft = \n", level + 1);
 		raviX_dump_ast_node(buf, node->binary_expr.expr_left, level + 2);
@@ -548,7 +549,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 	case EXPR_UNARY: {
 		printf_buf(buf, "%pExprUnary {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1, raviX_get_type_name(node->unary_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->unary_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->unary_expr.type.type_name));
 		printf_buf(buf, "%pop = '%s',\n", level + 1, raviX_get_unary_opr_str(node->unary_expr.unary_op));
 		printf_buf(buf, "%pexpr = \n", level + 1);
 		raviX_dump_ast_node(buf, node->unary_expr.expr, level + 2);
@@ -587,7 +588,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 	case EXPR_FIELD_SELECTOR: {
 		printf_buf(buf, "%pExprSelector {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1, raviX_get_type_name(node->index_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->index_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->index_expr.type.type_name));
 		printf_buf(buf, "%pselector = \n", level + 1);
 		raviX_dump_ast_node(buf, node->index_expr.expr, level + 2);
 		printf_buf(buf, "%p}\n", level);
@@ -596,7 +597,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 	case EXPR_Y_INDEX: {
 		printf_buf(buf, "%pExprIndex {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1, raviX_get_type_name(node->index_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->index_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->index_expr.type.type_name));
 		printf_buf(buf, "%pindex = \n", level + 1);
 		raviX_dump_ast_node(buf, node->index_expr.expr, level + 2);
 		printf_buf(buf, "%p}\n", level);
@@ -617,7 +618,7 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 	case EXPR_TABLE_LITERAL: {
 		printf_buf(buf, "%pExprTableLit {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1, raviX_get_type_name(node->table_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1, get_as_str(node->table_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1, string_or_empty(node->table_expr.type.type_name));
 		printf_buf(buf, "%pexpr_list = {\n", level + 1);
 		dump_ast_node_list(buf, node->table_expr.expr_list, level + 1, ",");
 		printf_buf(buf, "%p}\n", level + 1);
@@ -628,8 +629,8 @@ void raviX_dump_ast_node(TextBuffer *buf, AstNode *node, int level)
 		printf_buf(buf, "%pExprConcat {\n", level);
 		printf_buf(buf, "%ptype_code = %s,\n", level + 1,
 			   raviX_get_type_name(node->string_concatenation_expr.type.type_code));
-		printf_buf(buf, "%ptype_name = '%s',\n", level + 1,
-			   get_as_str(node->string_concatenation_expr.type.type_name));
+		printf_buf(buf, "%ptype_name = '%t',\n", level + 1,
+			   string_or_empty(node->string_concatenation_expr.type.type_name));
 		printf_buf(buf, "%pexpr_list = {\n", level + 1);
 		dump_ast_node_list(buf, node->string_concatenation_expr.expr_list, level + 1, ",");
 		printf_buf(buf, "%p}\n", level + 1);
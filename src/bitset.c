@@ -76,6 +76,8 @@ static void bitset_expand (BitSet * bm, size_t nb) {
 			bm->varr = (bitset_el_t *) raviX_realloc_array(bm->varr, sizeof(bitset_el_t), bm->size, new_len);
 			bm->size = new_len;
 		}
+		/* Words beyond els_num may hold stale bits from before the set was cleared or shrunk */
+		memset(bm->varr + bm->els_num, 0, (new_len - bm->els_num) * sizeof(bitset_el_t));
 		bm->els_num = new_len;
 	}
 }
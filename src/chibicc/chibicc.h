@@ -360,7 +360,8 @@ typedef struct {
 } C_VarScope;
 
 struct C_Parser {
-  int file_no;
+  int file_no; // Number of files tokenized by this parser
+  int unique_name_id; // Used to generate unique labels
   // Input file
   C_File *current_file;
 
@@ -422,6 +423,7 @@ void C_parser_destroy(C_Parser *parser);
 
 #ifdef RAVI_EXTENSIONS
 C_Node *C_parse_compound_statement(C_Scope *globalScope, C_Parser *parser, C_Token *tok);
+C_Scope *C_nested_scope(C_Parser *parser, C_Scope *parent);
 C_Obj *C_create_function(C_Scope *globalScope, C_Parser *parser, char *name_str);
 #endif
 
@@ -524,6 +526,7 @@ extern C_Type *C_ty_float;
 extern C_Type *C_ty_double;
 extern C_Type *C_ty_ldouble;
 
+bool C_is_builtin_type(C_Type *ty);
 bool C_is_integer(C_Type *ty);
 bool C_is_flonum(C_Type *ty);
 bool C_is_numeric(C_Type *ty);
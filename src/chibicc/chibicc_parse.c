@@ -156,6 +156,16 @@ C_Scope *C_global_scope(C_Parser *parser) {
   return sc;
 }
 
+#ifdef RAVI_EXTENSIONS
+// Creates a scope whose lookups fall back to the parent scope, so that
+// declarations parsed earlier can be reused without being modified.
+C_Scope *C_nested_scope(C_Parser *parser, C_Scope *parent) {
+  C_Scope *sc = C_global_scope(parser);
+  sc->next = parent;
+  return sc;
+}
+#endif
+
 static void enter_scope(C_Parser *parser) {
   C_Scope *sc = parser->memory_allocator->calloc(parser->memory_allocator->arena, 1, sizeof(C_Scope));
   sc->vars.allocator = parser->memory_allocator;
@@ -322,16 +332,15 @@ static C_Obj *new_gvar(C_Parser *parser, char *name, C_Type *ty) {
   return var;
 }
 
-static char *new_unique_name(C_MemoryAllocator *allocator) {
-  static int id = 0;
+static char *new_unique_name(C_Parser *parser) {
   char temp[64];
 
-  snprintf(temp, sizeof temp, ".L..%d", id++);
-  return str_dup(allocator, temp, strlen(temp));
+  snprintf(temp, sizeof temp, ".L..%d", parser->unique_name_id++);
+  return str_dup(parser->memory_allocator, temp, strlen(temp));
 }
 
 static C_Obj *new_anon_gvar(C_Parser *parser, C_Type *ty) {
-  return new_gvar(parser, new_unique_name(parser->memory_allocator), ty);
+  return new_gvar(parser, new_unique_name(parser), ty);
 }
 
 static C_Obj *new_string_literal(C_Parser *parser, char *p, C_Type *ty) {
@@ -699,6 +708,8 @@ static C_Type *declarator(C_Parser *parser, C_Token **rest, C_Token *tok, C_Type
   }
 
   ty = type_suffix(parser, rest, tok, ty);
+  if (C_is_builtin_type(ty))
+    ty = C_copy_type(parser, ty);
   ty->name = name;
   ty->name_pos = name_pos;
   return ty;
@@ -1581,7 +1592,7 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
     parser->current_switch = node;
 
     char *brk = parser->brk_label;
-    parser->brk_label = node->brk_label = new_unique_name(parser->memory_allocator);
+    parser->brk_label = node->brk_label = new_unique_name(parser);
 
     node->then = stmt(parser, rest, tok);
 
@@ -1608,7 +1619,7 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
     }
 
     tok = C_skip(parser, tok, ":");
-    node->label = new_unique_name(parser->memory_allocator);
+    node->label = new_unique_name(parser);
     node->lhs = stmt(parser, rest, tok);
     node->begin = begin;
     node->end = end;
@@ -1623,7 +1634,7 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
 
     C_Node *node = new_node(parser, ND_CASE, tok);
     tok = C_skip(parser, tok->next, ":");
-    node->label = new_unique_name(parser->memory_allocator);
+    node->label = new_unique_name(parser);
     node->lhs = stmt(parser, rest, tok);
     parser->current_switch->default_case = node;
     return node;
@@ -1637,8 +1648,8 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
 
     char *brk = parser->brk_label;
     char *cont = parser->cont_label;
-    parser->brk_label = node->brk_label = new_unique_name(parser->memory_allocator);
-    parser->cont_label = node->cont_label = new_unique_name(parser->memory_allocator);
+    parser->brk_label = node->brk_label = new_unique_name(parser);
+    parser->cont_label = node->cont_label = new_unique_name(parser);
 
     if (is_typename(parser, tok)) {
       C_Type *basety = declspec(parser, &tok, tok, NULL);
@@ -1671,8 +1682,8 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
 
     char *brk = parser->brk_label;
     char *cont = parser->cont_label;
-    parser->brk_label = node->brk_label = new_unique_name(parser->memory_allocator);
-    parser->cont_label = node->cont_label = new_unique_name(parser->memory_allocator);
+    parser->brk_label = node->brk_label = new_unique_name(parser);
+    parser->cont_label = node->cont_label = new_unique_name(parser);
 
     node->then = stmt(parser, rest, tok);
 
@@ -1686,8 +1697,8 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
 
     char *brk = parser->brk_label;
     char *cont = parser->cont_label;
-    parser->brk_label = node->brk_label = new_unique_name(parser->memory_allocator);
-    parser->cont_label = node->cont_label = new_unique_name(parser->memory_allocator);
+    parser->brk_label = node->brk_label = new_unique_name(parser);
+    parser->cont_label = node->cont_label = new_unique_name(parser);
 
     node->then = stmt(parser, &tok, tok->next);
 
@@ -1743,7 +1754,7 @@ static C_Node *stmt(C_Parser *parser, C_Token **rest, C_Token *tok) {
   if (tok->kind == TK_IDENT && C_equal(tok->next, ":")) {
     C_Node *node = new_node(parser, ND_LABEL, tok);
     node->label = str_dup(parser->memory_allocator, tok->loc, tok->len);
-    node->unique_label = new_unique_name(parser->memory_allocator);
+    node->unique_label = new_unique_name(parser);
     node->lhs = stmt(parser, rest, tok->next->next);
     node->goto_next = parser->labels;
     parser->labels = node;
@@ -2103,8 +2114,8 @@ static C_Node *to_assign(C_Parser *parser, C_Node *binary) {
                 tok);
 
     C_Node *loop = new_node(parser, ND_DO, tok);
-    loop->brk_label = new_unique_name(parser->memory_allocator);
-    loop->cont_label = new_unique_name(parser->memory_allocator);
+    loop->brk_label = new_unique_name(parser);
+    loop->cont_label = new_unique_name(parser);
 
     C_Node *body = new_binary(parser, ND_ASSIGN,
                             new_var_node(parser, new, tok),
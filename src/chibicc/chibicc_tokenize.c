@@ -136,7 +136,7 @@ void C_warn_tok(C_Parser *tokenizer, C_Token *tok, char *fmt, ...) {
 
 // Consumes the current token if it matches `op`.
 bool C_equal(C_Token *tok, char *op) {
-  return memcmp(tok->loc, op, tok->len) == 0 && op[tok->len] == '\0';
+  return strncmp(tok->loc, op, tok->len) == 0 && op[tok->len] == '\0';
 }
 
 // Ensure that the current token is `op`.
@@ -868,14 +868,14 @@ C_Token *C_tokenize_buffer(C_Parser *tokenizer, char *p) {
   convert_universal_chars(p);
 
   // Save the filename for assembler .file directive.
-  static int file_no;
+  int file_no = tokenizer->file_no;
   C_File *file = C_new_file(tokenizer, "", file_no + 1, p);
 
   // Save the filename for assembler .file directive.
   tokenizer->input_files = tokenizer->memory_allocator->realloc(tokenizer->memory_allocator->arena, tokenizer->input_files, sizeof(char *) * (file_no + 2));
   tokenizer->input_files[file_no] = file;
   tokenizer->input_files[file_no + 1] = NULL;
-  file_no++;
+  tokenizer->file_no++;
 
   return C_tokenize(tokenizer, file);
 }
@@ -51,6 +51,15 @@ static C_Type *new_type(C_Parser *parser, TypeKind kind, int size, int align) {
   return ty;
 }
 
+// The builtin types above are shared by all parsers and therefore
+// must never be modified; callers that need to annotate a type
+// should work on a copy.
+bool C_is_builtin_type(C_Type *ty) {
+  return ty == C_ty_void || ty == C_ty_bool || ty == C_ty_char || ty == C_ty_short || ty == C_ty_int ||
+         ty == C_ty_long || ty == C_ty_uchar || ty == C_ty_ushort || ty == C_ty_uint || ty == C_ty_ulong ||
+         ty == C_ty_float || ty == C_ty_double || ty == C_ty_ldouble;
+}
+
 bool C_is_integer(C_Type *ty) {
   TypeKind k = ty->kind;
   return k == TY_BOOL || k == TY_CHAR || k == TY_SHORT ||
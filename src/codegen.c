@@ -29,6 +29,7 @@
  */
 
 #include "codegen.h"
+#include "optimizer.h"
 #include "chibicc/chibicc.h"
 #include "ravi_api.h"
 
@@ -759,6 +760,62 @@ static const char Embedded_C_header[] =
     "} Ravi_NumberArray;\n"
     "int raviX__error_code;\n";
 
+/*
+ * Support for inline caches on string keyed table accesses (enabled by the --inline-caches option).
+ * Each access site remembers the hash slot where its key was last found; the slot is only a hint, it is
+ * checked against the key before use, so it is correct for any table the site sees. On a miss the key's
+ * hash chain is searched directly. The caller falls back to the generic function if the key is absent.
+ */
+static const char *Lua_inline_cache_helpers =
+    "static TValue *raviX__getshortstr_cached(Table *h, const TValue *key, unsigned int *slot) {\n"
+    " Node *n = &h->node[*slot & h->hmask];\n"
+    " if (ttisshrstring(&n->i_key.tvk) && val_(&n->i_key.tvk).gc == val_(key).gc)\n"
+    "  return &n->i_val;\n"
+    " n = &h->node[tsvalue(key)->hash & h->hmask];\n"
+    " for (;;) {\n"
+    "  if (ttisshrstring(&n->i_key.tvk) && val_(&n->i_key.tvk).gc == val_(key).gc) {\n"
+    "   *slot = (unsigned int)(n - h->node);\n"
+    "   return &n->i_val;\n"
+    "  }\n"
+    "  if (n->i_key.nk.next == 0)\n"
+    "   return NULL;\n"
+    "  n += n->i_key.nk.next;\n"
+    " }\n"
+    "}\n";
+
+/*
+ * Support for direct calls to the procs of the chunk. When the closure being called is known to be
+ * of a proc generated in this chunk, and that proc is not a vararg function, the caller sets up the
+ * callee's frame with the helper below and calls the C function directly, bypassing luaD_precall() and
+ * luaV_execute(). The helper returns 0 if the generic call sequence must be used instead: when hooks
+ * are active, the C stack limit is near, the Lua stack needs to grow, or a CallInfo must be allocated.
+ * The helper is only emitted if the chunk makes direct calls. The host may define LUAI_MAXCCALLS when
+ * compiling the code if its VM uses a C stack limit other than the default one of llimits.h.
+ */
+static const char *Lua_direct_call_helpers =
+    "#ifndef LUAI_MAXCCALLS\n"
+    "#define LUAI_MAXCCALLS 200\n"
+    "#endif\n"
+    "static int raviX__enter_frame(lua_State *L, StkId func, int nresults, int numparams, int fsize) {\n"
+    " CallInfo *ci = L->ci->next;\n"
+    " if (L->hookmask || L->nCcalls >= LUAI_MAXCCALLS || ci == NULL || L->stack_last - L->top <= fsize)\n"
+    "  return 0;\n"
+    " StkId base = func + 1;\n"
+    " while (L->top < base + numparams)\n"
+    "  setnilvalue(L->top++);\n"
+    " L->ci = ci;\n"
+    " ci->nresults = nresults;\n"
+    " ci->func = func;\n"
+    " ci->u.l.base = base;\n"
+    " L->top = ci->top = base + fsize;\n"
+    " ci->u.l.savedpc = clLvalue(func)->p->code;\n"
+    " ci->callstatus = CIST_LUA;\n"
+    " ci->jitstatus = 1;\n"
+    " L->nCcalls++;\n"
+    " L->nny++;\n"
+    " return 1;\n"
+    "}\n";
+
 typedef struct {
 	Proc *proc;
 	TextBuffer prologue;
@@ -766,12 +823,33 @@ typedef struct {
 	TextBuffer tb;			 // Temp buf
 	TextBuffer C_local_declarations; // Declarations of temp int/float vars required when analysing embedded C code
 	struct Ravi_CompilerInterface *api;
+	struct EmbeddedC *embedded_C;	 // Shared parse of the embedded C header and C__decl declarations
+	bool inline_caches;		 // Emit inline caches for constant string keyed table accesses
+	bool direct_calls;		 // Set if the function calls a proc of the chunk directly
+	Proc **known_callees;		 // Proc whose closure is known to be in each Lua stack temp, or NULL
+	struct TypedEntry *typed_entry;	 // Set when generating the entry point that takes unboxed arguments
+	unsigned num_stack_temps;
 	jmp_buf env;
 } Function;
 
+/*
+ * A proc whose parameters are all integers or numbers that do not escape keeps them in C variables
+ * (see linearize_function_args()); the stack slots of the parameters are only read by the type check
+ * and the move to the C variable of each parameter. Such a proc is generated as a C function that takes
+ * the arguments unboxed and does not check them; it is used by direct calls that have arguments of the
+ * right types. The Lua visible C function checks the arguments and forwards them.
+ */
+typedef struct TypedEntry {
+	unsigned num_params;
+	LuaSymbol **params;
+	Instruction **checks; /* TOINT / TOFLT of each parameter */
+	Instruction **moves;  /* move of each parameter to its C variable, NULL if the parameter is unused */
+} TypedEntry;
+
 /* readonly statics */
 static const char *int_var_prefix = "raviX__i_";
 static const char *flt_var_prefix = "raviX__f_";
+static const char *arg_var_prefix = "raviX__a_";
 // static Pseudo NIL_pseudo = {.type = PSEUDO_NIL};
 
 enum errorcode {
@@ -884,20 +962,50 @@ static void handle_error_bad_pseudo(Function *fn, const Pseudo *pseudo, const ch
 	longjmp(fn->env, 1);
 }
 
+static bool use_inline_caches(const struct Ravi_CompilerInterface *api)
+{
+	return api->compiler_options != NULL && strstr(api->compiler_options, "--inline-caches") != NULL;
+}
+
+static inline ravitype_t param_type(const TypedEntry *typed, unsigned i)
+{
+	return typed->params[i]->variable.value_type.type_code;
+}
+
+/* Outputs the signature of the C function that takes the arguments of the proc unboxed */
+static void emit_typed_entry_signature(Proc *proc, TextBuffer *mb)
+{
+	const TypedEntry *typed = (const TypedEntry *)proc->userdata;
+	raviX_buffer_add_fstring(mb, "static int %s_typed(lua_State *L", proc->funcname);
+	for (unsigned i = 0; i < typed->num_params; i++) {
+		raviX_buffer_add_fstring(mb, ", %s %s%u", param_type(typed, i) == RAVI_TNUMINT ? "lua_Integer" : "lua_Number",
+					 arg_var_prefix, i);
+	}
+	raviX_buffer_add_string(mb, ")");
+}
+
 /**
  * Starts generating a function.
  */
-static void initfn(Function *fn, Proc *proc, struct Ravi_CompilerInterface *api)
+static void initfn(Function *fn, Proc *proc, struct Ravi_CompilerInterface *api, struct EmbeddedC *embedded_C)
 {
 	fn->proc = proc;
 	fn->api = api;
-	/* Set a name that can be used later to retrieve the compiled code */
-	snprintf(proc->funcname, sizeof proc->funcname, "__ravifunc_%d", proc->id);
+	fn->embedded_C = embedded_C;
+	fn->inline_caches = use_inline_caches(api);
+	fn->direct_calls = false;
+	fn->num_stack_temps = raviX_max_reg(&proc->temp_pseudos);
+	fn->known_callees = (Proc **)raviX_calloc(fn->num_stack_temps + 1, sizeof(Proc *));
 	raviX_buffer_init(&fn->prologue, 4096);
 	raviX_buffer_init(&fn->body, 4096);
 	raviX_buffer_init(&fn->tb, 256);
 	raviX_buffer_init(&fn->C_local_declarations, 256);
-	raviX_buffer_add_fstring(&fn->prologue, "static int %s(lua_State *L) {\n", proc->funcname);
+	fn->typed_entry = (TypedEntry *)proc->userdata;
+	if (fn->typed_entry != NULL)
+		emit_typed_entry_signature(proc, &fn->prologue);
+	else
+		raviX_buffer_add_fstring(&fn->prologue, "static int %s(lua_State *L)", proc->funcname);
+	raviX_buffer_add_string(&fn->prologue, " {\n");
 	raviX_buffer_add_string(&fn->prologue, "int raviX__error_code = 0;\n");
 	raviX_buffer_add_string(&fn->prologue, "int result = 0;\n");
 	raviX_buffer_add_string(&fn->prologue, "CallInfo *ci = L->ci;\n");
@@ -929,6 +1037,7 @@ static void cleanup(Function *fn)
 	raviX_buffer_free(&fn->body);
 	raviX_buffer_free(&fn->tb);
 	raviX_buffer_free(&fn->C_local_declarations);
+	raviX_free(fn->known_callees);
 }
 
 /* Outputs an l-value/r-value variable name for a primitive C int / float type */
@@ -957,6 +1066,11 @@ static inline unsigned num_temps(Proc *proc) { return raviX_max_reg(&proc->temp_
  */
 static unsigned compute_max_stack_size(Proc *proc) { return num_locals(proc) + num_temps(proc); }
 
+static inline unsigned get_num_params(Proc *proc)
+{
+	return raviX_ptrlist_size((const PtrList *)proc->function_expr->function_expr.args);
+}
+
 // Gets the regnum of the register at L->top
 // this is equal to number of temps because the temps are above
 // locals - and when we access the register it needs to be temp range
@@ -1110,7 +1224,7 @@ static bool refers_to_same_register(Function *fn, Pseudo *src, Pseudo *dst)
 {
 	// C++ doesn't support the syntax using [] :-(
 	// What pseudo types map to registers?
-	static bool reg_pseudos[] = {
+	static const bool reg_pseudos[] = {
 	    /* [PSEUDO_SYMBOL] =*/true,	    /* An object of type lua_symbol representing local var or upvalue */
 	    /* [PSEUDO_TEMP_FLT] =*/false,  /* A floating point temp - may also be used for locals that don't escape */
 	    /* [PSEUDO_TEMP_INT] =*/false,  /* An integer temp - may also be used for locals that don't escape */
@@ -1433,6 +1547,13 @@ static int emit_op_ret(Function *fn, Instruction *insn)
 	return 0;
 }
 
+/* Is the pseudo a constant string that Lua represents as a short (interned) string? */
+static bool is_short_string_constant(const Pseudo *pseudo)
+{
+	return pseudo->type == PSEUDO_CONSTANT && pseudo->constant->type == RAVI_TSTRING &&
+	       pseudo->constant->s->len < 40;
+}
+
 /* Generate code for various types of load table operations */
 static int emit_op_load_table(Function *fn, Instruction *insn)
 {
@@ -1457,8 +1578,22 @@ static int emit_op_load_table(Function *fn, Instruction *insn)
 	emit_reg_accessor(fn, varname, 0);
 	raviX_buffer_add_string(&fn->body, ";\n TValue *dst = ");
 	emit_reg_accessor(fn, dst, 1);
-	raviX_buffer_add_fstring(&fn->body, ";\n %s(L, tab, key, dst);\n ", fname);
-	emit_reload_base(fn);
+	raviX_buffer_add_string(&fn->body, ";\n");
+	if (fn->inline_caches && is_short_string_constant(varname)) {
+		/* A non-nil value found in the table is the result; otherwise there may be an __index metamethod */
+		raviX_buffer_add_string(&fn->body, " static unsigned int slot = 0;\n");
+		raviX_buffer_add_string(&fn->body, " TValue *v;\n");
+		raviX_buffer_add_string(&fn->body, " if (ttisLtable(tab) && (v = raviX__getshortstr_cached(hvalue(tab), key, "
+						   "&slot)) != NULL && !ttisnil(v)) {\n");
+		raviX_buffer_add_string(&fn->body, "  setobj2s(L, dst, v);\n");
+		raviX_buffer_add_string(&fn->body, " } else {\n");
+		raviX_buffer_add_fstring(&fn->body, "  %s(L, tab, key, dst);\n  ", fname);
+		emit_reload_base(fn);
+		raviX_buffer_add_string(&fn->body, " }\n");
+	} else {
+		raviX_buffer_add_fstring(&fn->body, " %s(L, tab, key, dst);\n ", fname);
+		emit_reload_base(fn);
+	}
 	raviX_buffer_add_string(&fn->body, "}\n");
 	return 0;
 }
@@ -1508,12 +1643,58 @@ static int emit_op_store_table(Function *fn, Instruction *insn)
 	emit_reg_accessor(fn, varname, 0);
 	raviX_buffer_add_string(&fn->body, ";\n TValue *src = ");
 	emit_reg_accessor(fn, src, 1);
-	raviX_buffer_add_fstring(&fn->body, ";\n %s(L, tab, key, src);\n ", fname);
-	emit_reload_base(fn);
+	raviX_buffer_add_string(&fn->body, ";\n");
+	if (fn->inline_caches && is_short_string_constant(varname)) {
+		/* Overwriting a non-nil value never invokes __newindex; storing collectable values is left
+		 * to the generic function as it takes care of the GC barrier */
+		raviX_buffer_add_string(&fn->body, " static unsigned int slot = 0;\n");
+		raviX_buffer_add_string(&fn->body, " TValue *v;\n");
+		raviX_buffer_add_string(&fn->body, " if (ttisLtable(tab) && !iscollectable(src) && (v = "
+						   "raviX__getshortstr_cached(hvalue(tab), key, &slot)) != NULL && !ttisnil(v)) {\n");
+		raviX_buffer_add_string(&fn->body, "  setobj2t(L, v, src);\n");
+		raviX_buffer_add_string(&fn->body, " } else {\n");
+		raviX_buffer_add_fstring(&fn->body, "  %s(L, tab, key, src);\n  ", fname);
+		emit_reload_base(fn);
+		raviX_buffer_add_string(&fn->body, " }\n");
+	} else {
+		raviX_buffer_add_fstring(&fn->body, " %s(L, tab, key, src);\n ", fname);
+		emit_reload_base(fn);
+	}
 	raviX_buffer_add_string(&fn->body, "}\n");
 	return 0;
 }
 
+/* Can the arguments of the call be passed to the typed entry point of the callee, see TypedEntry */
+static bool has_typed_args(Instruction *insn, Proc *callee)
+{
+	const TypedEntry *typed = (const TypedEntry *)callee->userdata;
+	if (typed == NULL || get_num_operands(insn) != typed->num_params + 1)
+		return false;
+	for (unsigned i = 0; i < typed->num_params; i++) {
+		const Pseudo *arg = get_operand(insn, i + 1);
+		if (arg->type == PSEUDO_TEMP_INT || (arg->type == PSEUDO_CONSTANT && arg->constant->type == RAVI_TNUMINT))
+			continue; /* also accepted by a number parameter */
+		if (param_type(typed, i) == RAVI_TNUMFLT &&
+		    (arg->type == PSEUDO_TEMP_FLT || (arg->type == PSEUDO_CONSTANT && arg->constant->type == RAVI_TNUMFLT)))
+			continue;
+		return false;
+	}
+	return true;
+}
+
+static void emit_typed_arg(Function *fn, Pseudo *arg, ravitype_t type)
+{
+	bool is_int = arg->type == PSEUDO_TEMP_INT || (arg->type == PSEUDO_CONSTANT && arg->constant->type == RAVI_TNUMINT);
+	if (type == RAVI_TNUMFLT && is_int)
+		raviX_buffer_add_string(&fn->body, "(lua_Number)");
+	if (arg->type != PSEUDO_CONSTANT)
+		emit_varname(fn, arg);
+	else if (arg->constant->type == RAVI_TNUMINT)
+		raviX_buffer_add_fstring(&fn->body, "%lld", arg->constant->i);
+	else
+		raviX_buffer_add_double(&fn->body, arg->constant->n);
+}
+
 // From implementation point of view the main work is copy the registers to the
 // right place. If we assume that at any time there is a 'fixed' stack size for the
 // functions regular variables and temps and that when we call functions, we need
@@ -1550,6 +1731,35 @@ static int emit_op_call(Function *fn, Instruction *insn)
 	// then n will be on top of that
 	raviX_buffer_add_fstring(
 	    &fn->body, " if (stackoverflow(L,%d)) { luaD_growstack(L, %d); base = ci->u.l.base; }\n", n + 1, n + 1);
+	Pseudo *function = get_operand(insn, 0);
+	Proc *callee = function->type == PSEUDO_TEMP_ANY && function->regnum < fn->num_stack_temps
+			   ? fn->known_callees[function->regnum]
+			   : NULL;
+	bool typed = callee != NULL && has_typed_args(insn, callee);
+	if (typed) {
+		// The arguments are passed unboxed to the typed entry point, the generic call below is the fallback
+		Pseudo tmp = {.type = PSEUDO_TEMP_ANY, .regnum = target_register};
+		emit_move(fn, function, &tmp);
+		raviX_buffer_add_string(&fn->body, " L->top = ");
+		emit_reg_accessor(fn, target_base, 0);
+		raviX_buffer_add_string(&fn->body, " + 1;\n{\n TValue *ra = ");
+		emit_reg_accessor(fn, target_base, 0);
+		raviX_buffer_add_fstring(&fn->body,
+					 ";\n if (ttisLclosure(ra) && getproto(ra)->ravi_jit.jit_function == %s &&\n"
+					 "     raviX__enter_frame(L, ra, %d, %u, %u)) {\n",
+					 callee->funcname, nresults, get_num_params(callee), compute_max_stack_size(callee));
+		raviX_buffer_add_fstring(&fn->body, "  int result = %s_typed(L", callee->funcname);
+		for (unsigned j = 1; j < n; j++) {
+			raviX_buffer_add_string(&fn->body, ", ");
+			emit_typed_arg(fn, get_operand(insn, j), param_type((TypedEntry *)callee->userdata, j - 1));
+		}
+		raviX_buffer_add_string(&fn->body, ");\n");
+		raviX_buffer_add_string(&fn->body, "  L->nny--;\n  L->nCcalls--;\n");
+		raviX_buffer_add_string(&fn->body, "  if (result) L->top = ci->top;\n");
+		raviX_buffer_add_string(&fn->body, "  base = ci->u.l.base;\n");
+		raviX_buffer_add_string(&fn->body, " } else {\n");
+		callee = NULL;
+	}
 	bool set_top = true; // Do we need to set L->top?
 	if (n > 1) {
 		// We have function arguments (as n=0 is the function itself)
@@ -1589,7 +1799,7 @@ static int emit_op_call(Function *fn, Instruction *insn)
 		}
 	}
 	// Copy the rest of the args in reverse order
-	for (int j = n - 1; j >= 0; j--) {
+	for (int j = n - 1; j >= (typed ? 1 : 0); j--) {
 		Pseudo tmp = {.type = PSEUDO_TEMP_ANY, .regnum = target_register + j};
 		emit_move(fn, get_operand(insn, j), &tmp);
 	}
@@ -1602,7 +1812,22 @@ static int emit_op_call(Function *fn, Instruction *insn)
 	// Call the function
 	raviX_buffer_add_string(&fn->body, "{\n TValue *ra = ");
 	emit_reg_accessor(fn, get_target(insn, 0), 0);
-	raviX_buffer_add_fstring(&fn->body, ";\n int result = luaD_precall(L, ra, %d, 1);\n", nresults);
+	raviX_buffer_add_string(&fn->body, ";\n");
+	if (callee != NULL) {
+		// The closure is checked at runtime, so the direct call is only made if it is of the expected proc
+		fn->direct_calls = true;
+		raviX_buffer_add_fstring(&fn->body,
+					 " if (ttisLclosure(ra) && getproto(ra)->ravi_jit.jit_function == %s &&\n"
+					 "     raviX__enter_frame(L, ra, %d, %u, %u)) {\n",
+					 callee->funcname, nresults, get_num_params(callee), compute_max_stack_size(callee));
+		raviX_buffer_add_fstring(&fn->body, "  int result = %s(L);\n", callee->funcname);
+		raviX_buffer_add_string(&fn->body, "  L->nny--;\n  L->nCcalls--;\n");
+		raviX_buffer_add_string(&fn->body, "  if (result) L->top = ci->top;\n");
+		raviX_buffer_add_string(&fn->body, " } else {\n");
+	} else {
+		raviX_buffer_add_string(&fn->body, " {\n");
+	}
+	raviX_buffer_add_fstring(&fn->body, " int result = luaD_precall(L, ra, %d, 1);\n", nresults);
 	raviX_buffer_add_string(&fn->body, " if (result) {\n");
 	raviX_buffer_add_fstring(&fn->body, "  if (result == 1 && %d >= 0)\n", nresults);
 	raviX_buffer_add_string(&fn->body, "   L->top = ci->top;\n");
@@ -1611,8 +1836,11 @@ static int emit_op_call(Function *fn, Instruction *insn)
 	raviX_buffer_add_string(&fn->body, "  result = luaV_execute(L);\n");
 	raviX_buffer_add_string(&fn->body, "  if (result) L->top = ci->top;\n");
 	raviX_buffer_add_string(&fn->body, " }\n");
+	raviX_buffer_add_string(&fn->body, " }\n");
 	raviX_buffer_add_string(&fn->body, " base = ci->u.l.base;\n");
 	raviX_buffer_add_string(&fn->body, "}\n");
+	if (typed)
+		raviX_buffer_add_string(&fn->body, " }\n}\n");
 	return 0;
 }
 
@@ -1915,6 +2143,11 @@ static int emit_op_arrayget_ikey(Function *fn, Instruction *insn)
 		return -1;
 	}
 	raviX_buffer_add_string(&fn->body, ";\n");
+	if (!insn->key_in_bounds) {
+		raviX_buffer_add_string(&fn->body, " if (ukey >= (lua_Unsigned)(arr->len)) {\n");
+		raviX_buffer_add_fstring(&fn->body, "  raviX__error_code = %d;\n", Error_array_out_of_bounds);
+		raviX_buffer_add_string(&fn->body, "  goto Lraise_error;\n }\n");
+	}
 	raviX_buffer_add_fstring(&fn->body, " %siptr = (%s)arr->data;\n ", array_type, array_type);
 	if (dst->type == type) {
 		emit_varname(fn, dst);
@@ -1931,6 +2164,28 @@ static int emit_op_arrayget_ikey(Function *fn, Instruction *insn)
 	return 0;
 }
 
+/* Emits the value to be stored in an array element */
+static int emit_array_element_value(Function *fn, Pseudo *src, unsigned type, const char *getterfunc)
+{
+	if (src->type == type) {
+		emit_varname(fn, src);
+	} else if (src->type == PSEUDO_TEMP_ANY || src->type == PSEUDO_SYMBOL || src->type == PSEUDO_LUASTACK) {
+		raviX_buffer_add_fstring(&fn->body, "%s(", getterfunc);
+		emit_reg_accessor(fn, src, 0);
+		raviX_buffer_add_string(&fn->body, ")");
+	} else if (src->type == PSEUDO_CONSTANT) {
+		if (src->constant->type == RAVI_TNUMINT) {
+			raviX_buffer_add_fstring(&fn->body, "%lld", src->constant->i);
+		} else {
+			raviX_buffer_add_fstring(&fn->body, "%g", src->constant->n);
+		}
+	} else {
+		handle_error(fn, "Unexpected src pseudo");
+		return -1;
+	}
+	return 0;
+}
+
 static int emit_op_arrayput_val(Function *fn, Instruction *insn)
 {
 	const char *array_type = insn->opcode == op_iaput_ival ? "lua_Integer *" : "lua_Number *";
@@ -1964,39 +2219,22 @@ static int emit_op_arrayput_val(Function *fn, Instruction *insn)
 	}
 	raviX_buffer_add_string(&fn->body, ";\n");
 	raviX_buffer_add_fstring(&fn->body, " %siptr = (%s)arr->data;\n ", array_type, array_type);
+	if (insn->key_in_bounds) {
+		/* The linearizer proved that the key is a valid index */
+		raviX_buffer_add_string(&fn->body, "iptr[ukey] = ");
+		if (emit_array_element_value(fn, src, type, getterfunc) != 0)
+			return -1;
+		raviX_buffer_add_string(&fn->body, ";\n}\n");
+		return 0;
+	}
 	raviX_buffer_add_string(&fn->body, "if (ukey < (lua_Unsigned)(arr->len)) {\n");
 	raviX_buffer_add_string(&fn->body, " iptr[ukey] = ");
-	if (src->type == type) {
-		emit_varname(fn, src);
-	} else if (src->type == PSEUDO_TEMP_ANY || src->type == PSEUDO_SYMBOL || src->type == PSEUDO_LUASTACK) {
-		raviX_buffer_add_fstring(&fn->body, "%s(", getterfunc);
-		emit_reg_accessor(fn, src, 0);
-		raviX_buffer_add_string(&fn->body, ")");
-	} else if (src->type == PSEUDO_CONSTANT) {
-		if (src->constant->type == RAVI_TNUMINT) {
-			raviX_buffer_add_fstring(&fn->body, "%lld", src->constant->i);
-		} else {
-			raviX_buffer_add_fstring(&fn->body, "%g", src->constant->n);
-		}
-	} else {
-		handle_error(fn, "Unexpected src pseudo");
+	if (emit_array_element_value(fn, src, type, getterfunc) != 0)
 		return -1;
-	}
 	raviX_buffer_add_string(&fn->body, ";\n} else {\n");
 	raviX_buffer_add_fstring(&fn->body, " %s(L, arr, ukey, ", setterfunc);
-	if (src->type == type) {
-		emit_varname(fn, src);
-	} else if (src->type == PSEUDO_TEMP_ANY || src->type == PSEUDO_SYMBOL || src->type == PSEUDO_LUASTACK) {
-		raviX_buffer_add_fstring(&fn->body, "%s(", getterfunc);
-		emit_reg_accessor(fn, src, 0);
-		raviX_buffer_add_string(&fn->body, ")");
-	} else if (src->type == PSEUDO_CONSTANT) {
-		if (src->constant->type == RAVI_TNUMINT) {
-			raviX_buffer_add_fstring(&fn->body, "%lld", src->constant->i);
-		} else {
-			raviX_buffer_add_fstring(&fn->body, "%g", src->constant->n);
-		}
-	}
+	if (emit_array_element_value(fn, src, type, getterfunc) != 0)
+		return -1;
 	raviX_buffer_add_string(&fn->body, ");\n");
 	raviX_buffer_add_string(&fn->body, "}\n}\n");
 	return 0;
@@ -2070,13 +2308,37 @@ static int emit_op_tousertype(Function *fn, Instruction *insn)
 	return 0;
 }
 
+/* Encodes a table size as a 'floating point byte', the form taken by the B and C arguments of OP_NEWTABLE */
+static int size_to_fb(lua_Integer x)
+{
+	int e = 0; /* exponent */
+	if (x < 8)
+		return (int)x;
+	while (x >= (8 << 4)) { /* coarse steps */
+		x = (x + 0xf) >> 4; /* x = ceil(x / 16) */
+		e += 4;
+	}
+	while (x >= (8 << 1)) { /* fine steps */
+		x = (x + 1) >> 1; /* x = ceil(x / 2) */
+		e++;
+	}
+	return ((e + 1) << 3) | ((int)x - 8);
+}
+
 static int emit_op_newtable(Function *fn, Instruction *insn)
 {
 	Pseudo *target_pseudo = get_first_target(insn);
+	int array_size = 0;
+	int hash_size = 0;
+	if (get_num_operands(insn) == 2) {
+		/* Size hints from the table constructor */
+		array_size = size_to_fb(get_operand(insn, 0)->immediate);
+		hash_size = size_to_fb(get_operand(insn, 1)->immediate);
+	}
 	raviX_buffer_add_string(&fn->body, "{\n");
 	raviX_buffer_add_string(&fn->body, " TValue *ra = ");
 	emit_reg_accessor(fn, target_pseudo, 0);
-	raviX_buffer_add_string(&fn->body, ";\n raviV_op_newtable(L, ci, ra, 0, 0);\n");
+	raviX_buffer_add_fstring(&fn->body, ";\n raviV_op_newtable(L, ci, ra, %d, %d);\n", array_size, hash_size);
 	emit_reload_base(fn);
 	raviX_buffer_add_string(&fn->body, "}\n");
 	return 0;
@@ -2777,7 +3039,50 @@ static void walk_node(struct Ravi_CompilerInterface *api, C_Code_Analysis *analy
 	}
 }
 
-static int analyze_C_code(Function *fn, TextBuffer *user_code)
+/*
+ * Sets up an allocator with a fresh arena for use by the chibicc parser.
+ * The arena is created from the compiler's base allocator, because the compiler's own
+ * allocator may be a wrapper (e.g. when collecting statistics) whose arena cannot be substituted.
+ */
+static void init_C_parser_allocator(C_MemoryAllocator *allocator, LinearizerState *linearizer)
+{
+	*allocator = *linearizer->compiler_state->base_allocator;
+	allocator->arena = allocator->create_arena(0, 0);
+}
+
+/*
+ * The chibicc parse of Embedded_C_header, the dummy variables used by generated code, and the
+ * C__decl declarations of the chunk. These are parsed once per call to raviX_generate_C(), when
+ * first needed. Each piece of embedded C code is then analyzed in a scope nested inside,
+ * using a copy of the parser that allocates from its own arena, so that the shared
+ * declarations are not modified and the cost of an analysis depends only on the size of its code.
+ */
+typedef struct EmbeddedC {
+	TextBuffer header;	      /* chibicc tokens point into the source text, so it must be retained */
+	TextBuffer declarations;      /* copy of the C__decl declarations */
+	C_MemoryAllocator allocator;  /* allocator for the shared declarations */
+	C_Parser parser;
+	C_Scope *header_scope;	      /* Embedded_C_header and the dummy variables */
+	C_Scope *declarations_scope;  /* C__decl declarations, nested in header_scope */
+	int status;		      /* 0 if not parsed yet, 1 if parsed, -1 if parsing failed */
+} EmbeddedC;
+
+/* Parses declarations into the given scope */
+static int parse_C_declarations(C_Parser *parser, C_Scope *scope, char *code)
+{
+	C_Token *tok = C_tokenize_buffer(parser, code);
+	if (tok == NULL)
+		return -1;
+	C_convert_pp_tokens(parser, tok);
+	/* C_parse() returns the objects declared, so NULL is only an error if there is a message */
+	if (C_parse(scope, parser, tok) == NULL && parser->error_message != NULL)
+		return -1;
+	return 0;
+}
+
+/* Returns the scope containing the header and C__decl declarations, or NULL if these could not be parsed */
+static C_Scope *get_declarations_scope(EmbeddedC *embedded_C, LinearizerState *linearizer,
+				       struct Ravi_CompilerInterface *api)
 {
 	static const char *addition_decls = "\n"
 					    "TValue ival0;\n"
@@ -2789,39 +3094,91 @@ static int analyze_C_code(Function *fn, TextBuffer *user_code)
 					    "TValue ival2;\n"
 					    "TValue fval2;\n"
 					    "TValue bval2;\n";
-	TextBuffer canned_code;
-	raviX_buffer_init(&canned_code, 1024);
-	// setup types and symbols that are needed to check the canned_code
-	raviX_buffer_add_string(&canned_code, Embedded_C_header); // Dummy types and functions
-	raviX_buffer_add_string(&canned_code, addition_decls);	  // Dummy variables
-	if (fn->proc->linearizer->C_declarations.buf)
-		raviX_buffer_add_string(&canned_code, fn->proc->linearizer->C_declarations.buf);
-	if (fn->C_local_declarations.buf) /* declarations of temp integer and float vars */
-		raviX_buffer_add_string(&canned_code, fn->C_local_declarations.buf);
-
-	C_MemoryAllocator allocator = *fn->proc->linearizer->compiler_state->allocator;
-	allocator.arena = allocator.create_arena(0, 0);
+	if (embedded_C->status != 0)
+		return embedded_C->status > 0 ? embedded_C->declarations_scope : NULL;
+
+	// setup types and symbols that are needed to check the embedded code
+	raviX_buffer_init(&embedded_C->header, 1024);
+	raviX_buffer_add_string(&embedded_C->header, Embedded_C_header); // Dummy types and functions
+	raviX_buffer_add_string(&embedded_C->header, addition_decls);	  // Dummy variables
+	raviX_buffer_init(&embedded_C->declarations, 1024);
+	if (linearizer->C_declarations.buf)
+		raviX_buffer_add_string(&embedded_C->declarations, linearizer->C_declarations.buf);
+
+	init_C_parser_allocator(&embedded_C->allocator, linearizer);
+	C_parser_init(&embedded_C->parser, &embedded_C->allocator);
+	embedded_C->header_scope = C_global_scope(&embedded_C->parser);
+	embedded_C->declarations_scope = C_nested_scope(&embedded_C->parser, embedded_C->header_scope);
+	embedded_C->status = 1;
+	if (parse_C_declarations(&embedded_C->parser, embedded_C->header_scope, embedded_C->header.buf) != 0 ||
+	    parse_C_declarations(&embedded_C->parser, embedded_C->declarations_scope,
+				 embedded_C->declarations.buf) != 0) {
+		if (embedded_C->parser.error_message)
+			api->error_message(api->context, embedded_C->parser.error_message);
+		embedded_C->status = -1;
+		return NULL;
+	}
+	return embedded_C->declarations_scope;
+}
 
+static void destroy_embedded_C(EmbeddedC *embedded_C)
+{
+	if (embedded_C->status == 0)
+		return;
+	C_parser_destroy(&embedded_C->parser);
+	embedded_C->allocator.destroy_arena(embedded_C->allocator.arena);
+	raviX_buffer_free(&embedded_C->header);
+	raviX_buffer_free(&embedded_C->declarations);
+	embedded_C->status = 0;
+}
+
+/*
+ * Sets up parser to continue from the shared declarations, allocating from a new arena; returns
+ * the scope in which to parse, or NULL if the shared declarations could not be parsed.
+ * The arena must be destroyed by the caller.
+ */
+static C_Scope *begin_embedded_C_parse(Function *fn, C_Parser *parser, C_MemoryAllocator *allocator)
+{
+	C_Scope *declarations_scope = get_declarations_scope(fn->embedded_C, fn->proc->linearizer, fn->api);
+	if (declarations_scope == NULL)
+		return NULL;
+	init_C_parser_allocator(allocator, fn->proc->linearizer);
+	*parser = fn->embedded_C->parser;
+	parser->memory_allocator = allocator;
+	parser->file_no = 0;
+	parser->input_files = NULL;
+	parser->locals = NULL;
+	parser->globals = NULL;
+	parser->current_fn = NULL;
+	parser->gotos = NULL;
+	parser->labels = NULL;
+	parser->current_switch = NULL;
+	parser->brk_label = NULL;
+	parser->cont_label = NULL;
+	parser->error_message = NULL;
+	parser->embedded_mode = true;
+	return C_nested_scope(parser, declarations_scope);
+}
+
+static int analyze_C_code(Function *fn, TextBuffer *user_code)
+{
+	C_MemoryAllocator allocator;
 	C_Code_Analysis analysis = {0};
 	C_Parser parser;
 
-	C_parser_init(&parser, &allocator);
-	parser.embedded_mode = true;
+	C_Scope *scope = begin_embedded_C_parse(fn, &parser, &allocator);
+	if (scope == NULL)
+		return -1;
 
-	C_Scope *global_scope = C_global_scope(&parser);
-	C_Token *tok = C_tokenize_buffer(&parser, canned_code.buf);
-	if (tok == NULL) {
-		analysis.status = -1;
-		goto Lexit;
-	}
-	C_convert_pp_tokens(&parser, tok);
-	if (C_parse(global_scope, &parser, tok) == NULL) {
+	/* declarations of temp integer and float vars */
+	if (fn->C_local_declarations.buf &&
+	    parse_C_declarations(&parser, scope, fn->C_local_declarations.buf) != 0) {
 		analysis.status = -1;
 		goto Lexit;
 	}
 
 	/* Now parse the user supplied code */
-	tok = C_tokenize_buffer(&parser, user_code->buf);
+	C_Token *tok = C_tokenize_buffer(&parser, user_code->buf);
 	if (tok == NULL) {
 		analysis.status = -1;
 		goto Lexit;
@@ -2829,7 +3186,7 @@ static int analyze_C_code(Function *fn, TextBuffer *user_code)
 	C_convert_pp_tokens(&parser, tok);
 	/* Note user supplied code is parsed as compound statement in global scope - i.e.
 	 * not inside a function! */
-	C_Node *node = C_parse_compound_statement(global_scope, &parser, tok);
+	C_Node *node = C_parse_compound_statement(scope, &parser, tok);
 	if (node == NULL) {
 		analysis.status = -1;
 		goto Lexit;
@@ -2842,7 +3199,6 @@ Lexit:
 	}
 	C_parser_destroy(&parser);
 	allocator.destroy_arena(allocator.arena);
-	raviX_buffer_free(&canned_code);
 
 	return analysis.status;
 }
@@ -2856,63 +3212,58 @@ static void emit_userdata_C_variable_load(Function *fn, Instruction *insn, Pseud
 		return;
 	}
 	LuaSymbol *symbol = pseudo->type == PSEUDO_SYMBOL ? pseudo->symbol : pseudo->temp_for_local;
+	const char *name = symbol->variable.var_name->str;
+	int len = (int)symbol->variable.var_name->len;
 	ravitype_t type = symbol->variable.value_type.type_code;
 	if (type == RAVI_TNUMINT) {
-		raviX_buffer_add_fstring(&fn->body, " lua_Integer %s = ", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, " lua_Integer %.*s = ", len, name);
 		emit_varname_or_constant(fn, pseudo);
 		raviX_buffer_add_string(&fn->body, ";\n");
 		return;
 	} else if (type == RAVI_TNUMFLT) {
-		raviX_buffer_add_fstring(&fn->body, " lua_Number %s = ", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, " lua_Number %.*s = ", len, name);
 		emit_varname_or_constant(fn, pseudo);
 		raviX_buffer_add_string(&fn->body, ";\n");
 		return;
 	} else if (type == RAVI_TARRAYINT) {
-		raviX_buffer_add_fstring(&fn->body, " Ravi_IntegerArray %s = {0};\n", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, " Ravi_IntegerArray %.*s = {0};\n", len, name);
 	} else if (type == RAVI_TARRAYFLT) {
-		raviX_buffer_add_fstring(&fn->body, " Ravi_NumberArray %s = {0};\n", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, " Ravi_NumberArray %.*s = {0};\n", len, name);
 	} else if (type == RAVI_TSTRING || type == RAVI_TUSERDATA || type == RAVI_TANY) {
 		// We assume ANY is userdata - runtime check generated below.
-		raviX_buffer_add_fstring(&fn->body, " Ravi_StringOrUserData %s = {0};\n",
-					 symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, " Ravi_StringOrUserData %.*s = {0};\n", len, name);
 	} else {
 		handle_error_bad_pseudo(fn, pseudo, "Unsupported symbol type in C bind variable");
 		return;
 	}
 	raviX_buffer_add_string(&fn->body, " {\n");
-	raviX_buffer_add_fstring(&fn->body, "  TValue *raviX__%s = ", symbol->variable.var_name->str);
+	raviX_buffer_add_fstring(&fn->body, "  TValue *raviX__%.*s = ", len, name);
 	emit_reg_accessor(fn, symbol->variable.pseudo, 0);
 	raviX_buffer_add_string(&fn->body, ";\n");
 	if (type == RAVI_TARRAYINT) {
-		raviX_buffer_add_fstring(&fn->body, "  %s.ptr = (lua_Integer*) arrvalue(raviX__%s)->data;\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "  %s.len = (unsigned int) arrvalue(raviX__%s)->len;\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "  %.*s.ptr = (lua_Integer*) arrvalue(raviX__%.*s)->data;\n",
+					 len, name, len, name);
+		raviX_buffer_add_fstring(&fn->body, "  %.*s.len = (unsigned int) arrvalue(raviX__%.*s)->len;\n",
+					 len, name, len, name);
 	} else if (type == RAVI_TARRAYFLT) {
-		raviX_buffer_add_fstring(&fn->body, "  %s.ptr = (lua_Number *) arrvalue(raviX__%s)->data;\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "  %s.len = (unsigned int) arrvalue(raviX__%s)->len;\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "  %.*s.ptr = (lua_Number *) arrvalue(raviX__%.*s)->data;\n",
+					 len, name, len, name);
+		raviX_buffer_add_fstring(&fn->body, "  %.*s.len = (unsigned int) arrvalue(raviX__%.*s)->len;\n",
+					 len, name, len, name);
 	} else {
-		raviX_buffer_add_fstring(&fn->body, "  if (ttisfulluserdata(raviX__%s)) {\n",
-					 symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.ptr = getudatamem(uvalue(raviX__%s));\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.len = (unsigned int) sizeudata(gco2u(raviX__%s));\n",
-					 symbol->variable.var_name->str, symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "  if (ttisfulluserdata(raviX__%.*s)) {\n", len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.ptr = getudatamem(uvalue(raviX__%.*s));\n",
+					 len, name, len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.len = (unsigned int) sizeudata(gco2u(raviX__%.*s));\n",
+					 len, name, len, name);
 		raviX_buffer_add_string(&fn->body, "  }\n");
-		raviX_buffer_add_fstring(&fn->body, "  else if (ttislightuserdata(raviX__%s)) {\n",
-					 symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.ptr = pvalue(raviX__%s);\n", symbol->variable.var_name->str,
-					 symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.len = 0;\n", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "  else if (ttislightuserdata(raviX__%.*s)) {\n", len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.ptr = pvalue(raviX__%.*s);\n", len, name, len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.len = 0;\n", len, name);
 		raviX_buffer_add_string(&fn->body, "  }\n");
-		raviX_buffer_add_fstring(&fn->body, "  else if (ttisstring(raviX__%s)) {\n",
-					 symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.ptr = svalue(raviX__%s);\n", symbol->variable.var_name->str,
-					 symbol->variable.var_name->str);
-		raviX_buffer_add_fstring(&fn->body, "   %s.len = vslen(raviX__%s);\n", symbol->variable.var_name->str,
-					 symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "  else if (ttisstring(raviX__%.*s)) {\n", len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.ptr = svalue(raviX__%.*s);\n", len, name, len, name);
+		raviX_buffer_add_fstring(&fn->body, "   %.*s.len = vslen(raviX__%.*s);\n", len, name, len, name);
 		raviX_buffer_add_string(&fn->body, "  }\n");
 		raviX_buffer_add_string(&fn->body, "  else {\n");
 		raviX_buffer_add_fstring(&fn->body, "   raviX__error_code = %d;\n", Error_type_mismatch);
@@ -2926,6 +3277,8 @@ static void emit_userdata_C_variable_load(Function *fn, Instruction *insn, Pseud
 static void emit_userdata_C_variable_store(Function *fn, Instruction *insn, Pseudo *pseudo)
 {
 	LuaSymbol *symbol = pseudo->type == PSEUDO_SYMBOL ? pseudo->symbol : pseudo->temp_for_local;
+	const char *name = symbol->variable.var_name->str;
+	int len = (int)symbol->variable.var_name->len;
 	ravitype_t type = symbol->variable.value_type.type_code;
 	if (type != RAVI_TNUMINT && type != RAVI_TNUMFLT) {
 		return;
@@ -2936,18 +3289,18 @@ static void emit_userdata_C_variable_store(Function *fn, Instruction *insn, Pseu
 	    symbol->variable.pseudo->type == PSEUDO_TEMP_FLT) {
 		emit_varname(fn, symbol->variable.pseudo);
 		raviX_buffer_add_string(&fn->body, " = ");
-		raviX_buffer_add_fstring(&fn->body, "%s;\n", symbol->variable.var_name->str);
+		raviX_buffer_add_fstring(&fn->body, "%.*s;\n", len, name);
 	}
 	else if (symbol->variable.pseudo->type == PSEUDO_SYMBOL) {
 		raviX_buffer_add_string(&fn->body, " TValue *raviX__var = ");
 		emit_reg_accessor(fn, symbol->variable.pseudo, 0);
 		raviX_buffer_add_string(&fn->body, ";\n");
 		if (type == RAVI_TNUMINT) {
-			raviX_buffer_add_fstring(&fn->body, "setivalue(raviX__var, %s);\n", symbol->variable.var_name->str);
+			raviX_buffer_add_fstring(&fn->body, "setivalue(raviX__var, %.*s);\n", len, name);
 		}
 		else {
 			assert(type == RAVI_TNUMFLT);
-			raviX_buffer_add_fstring(&fn->body, "setfltvalue(raviX__var, %s);\n", symbol->variable.var_name->str);
+			raviX_buffer_add_fstring(&fn->body, "setfltvalue(raviX__var, %.*s);\n", len, name);
 		}
 	}
 	raviX_buffer_add_string(&fn->body, " }\n");
@@ -2978,7 +3331,7 @@ static int emit_op_C__unsafe(Function *fn, Instruction *insn)
 	Pseudo *C_code = get_first_target(insn);
 	assert(C_code->type == PSEUDO_CONSTANT && C_code->constant->type == RAVI_TSTRING);
 	raviX_buffer_add_string(&fn->body, " {\n");
-	raviX_buffer_add_string(&fn->body, C_code->constant->s->str);
+	raviX_buffer_add_bytes(&fn->body, C_code->constant->s->str, C_code->constant->s->len);
 	raviX_buffer_add_string(&fn->body, " }\n");
 
 	// Store values back to Ravi/Lua variables
@@ -2993,6 +3346,7 @@ static int emit_op_C__unsafe(Function *fn, Instruction *insn)
 	fn->body = saved; // Restore original output buffer
 
 	if (analyze_C_code(fn, &code) != 0) {
+		raviX_buffer_free(&code);
 		return -1;
 	}
 	raviX_buffer_add_string(&fn->body, code.buf);
@@ -3000,17 +3354,17 @@ static int emit_op_C__unsafe(Function *fn, Instruction *insn)
 	return 0;
 }
 
-static C_Type *get_typeof(Function *fn, C_Scope *global_scope, Pseudo *tagname) {
-	C_Type *ty = hashmap_get(&global_scope->tags, (char*)tagname->constant->s->str);
-	if (ty == NULL) {
-		C_VarScope *vc = hashmap_get(&global_scope->vars, (char*)tagname->constant->s->str);
-		if (vc && vc->type_def) {
-			ty = vc->type_def;
-		} else {
-			return NULL;
-		}
+static C_Type *get_typeof(Function *fn, C_Scope *scope, Pseudo *tagname) {
+	const StringObject *name = tagname->constant->s;
+	for (C_Scope *sc = scope; sc != NULL; sc = sc->next) {
+		C_Type *ty = hashmap_get2(&sc->tags, (char *)name->str, (int)name->len);
+		if (ty != NULL)
+			return ty;
+		C_VarScope *vc = hashmap_get2(&sc->vars, (char *)name->str, (int)name->len);
+		if (vc && vc->type_def)
+			return vc->type_def;
 	}
-	return ty;
+	return NULL;
 }
 
 static C_Member *get_flexible_member(C_Type *type) {
@@ -3025,10 +3379,11 @@ static C_Member *get_flexible_member(C_Type *type) {
 	return NULL;
 }
 
-static void emit_sizeof_expression(Function *fn, const char *main_type, C_Member *flexible_member) {
-	raviX_buffer_add_fstring(&fn->body, "sizeof(%s)", main_type);
+static void emit_sizeof_expression(Function *fn, const StringObject *main_type, C_Member *flexible_member) {
+	raviX_buffer_add_fstring(&fn->body, "sizeof(%.*s)", (int)main_type->len, main_type->str);
 	if (flexible_member != NULL) {
-		raviX_buffer_add_fstring(&fn->body, " + (sizeof ((%s){0}).%.*s[0])", main_type,
+		raviX_buffer_add_fstring(&fn->body, " + (sizeof ((%.*s){0}).%.*s[0])", (int)main_type->len,
+					 main_type->str,
 					 flexible_member->name->len,
 					 flexible_member->name->loc);
 	}
@@ -3036,41 +3391,22 @@ static void emit_sizeof_expression(Function *fn, const char *main_type, C_Member
 
 static int emit_op_C__new(Function *fn, Instruction *insn)
 {
-	LinearizerState *linearizer = fn->proc->linearizer;
-
-	TextBuffer code;
-	raviX_buffer_init(&code, 1024);
-	raviX_buffer_add_string(&code, Embedded_C_header);
-	raviX_buffer_add_string(&code, linearizer->C_declarations.buf);
-
-	int status = -1;
-
-	C_MemoryAllocator allocator = *fn->proc->linearizer->compiler_state->allocator;
-	allocator.arena = allocator.create_arena(0, 0);
-
-	C_Parser parser;
-	C_parser_init(&parser, &allocator);
-	C_Scope *global_scope = C_global_scope(&parser);
-	C_Token *tok = C_tokenize_buffer(&parser, code.buf);
-	if (tok == NULL) {
-		goto Lexit;
-	}
-	C_convert_pp_tokens(&parser, tok);
-	if (C_parse(global_scope, &parser, tok) == NULL) {
-		goto Lexit;
-	}
+	C_Scope *declarations_scope = get_declarations_scope(fn->embedded_C, fn->proc->linearizer, fn->api);
+	if (declarations_scope == NULL)
+		return -1;
 	Pseudo *tagname = get_operand(insn, 0);
 	Pseudo *size = get_operand(insn, 1);
 	Pseudo *target = get_target(insn, 0);
 	// Add utility in chibicc to find a type
-	C_Type *ty = get_typeof(fn, global_scope, tagname);
+	C_Type *ty = get_typeof(fn, declarations_scope, tagname);
 	if (ty == NULL) {
 		TextBuffer message;
 		raviX_buffer_init(&message, 128);
-		raviX_buffer_add_fstring(&message, "Unknown type '%s'", tagname->constant->s->str);
+		raviX_buffer_add_fstring(&message, "Unknown type '%.*s'", (int)tagname->constant->s->len,
+					 tagname->constant->s->str);
 		fn->api->error_message(fn->api->context, message.buf);
 		raviX_buffer_free(&message);
-		goto Lexit;
+		return -1;
 	}
 	C_Member *flexible_member = get_flexible_member(ty);
 
@@ -3085,7 +3421,7 @@ static int emit_op_C__new(Function *fn, Instruction *insn)
 	raviX_buffer_add_string(&fn->body, "  if (ttisinteger(raviX__elements)) {\n");
 	raviX_buffer_add_string(&fn->body, "   lua_Integer n = ivalue(raviX__elements);\n");
 	raviX_buffer_add_fstring(&fn->body, "   size_t raviX__size = ");
-	emit_sizeof_expression(fn, tagname->constant->s->str, flexible_member);
+	emit_sizeof_expression(fn, tagname->constant->s, flexible_member);
 	raviX_buffer_add_fstring(&fn->body, "* n;\n");
 	raviX_buffer_add_fstring(&fn->body, "   Udata *u = luaS_newudata(L, raviX__size);\n");
 	raviX_buffer_add_string(&fn->body, "   setuvalue(L, raviX__target, u);\n");
@@ -3096,14 +3432,23 @@ static int emit_op_C__new(Function *fn, Instruction *insn)
 	raviX_buffer_add_string(&fn->body, "   goto Lraise_error;\n");
 	raviX_buffer_add_string(&fn->body, "  }\n");
 	raviX_buffer_add_string(&fn->body, "}\n");
-	status = 0;
-
-Lexit:
-	C_parser_destroy(&parser);
-	allocator.destroy_arena(allocator.arena);
-	raviX_buffer_free(&code);
+	return 0;
+}
 
-	return status;
+/* In the typed entry point the parameters are C arguments, so the checks are omitted */
+static bool emit_typed_param(Function *fn, Instruction *insn)
+{
+	const TypedEntry *typed = fn->typed_entry;
+	for (unsigned i = 0; i < typed->num_params; i++) {
+		if (insn == typed->checks[i])
+			return true;
+		if (insn == typed->moves[i]) {
+			emit_varname(fn, get_first_target(insn));
+			raviX_buffer_add_fstring(&fn->body, " = %s%u;\n", arg_var_prefix, i);
+			return true;
+		}
+	}
+	return false;
 }
 
 static int output_instruction(Function *fn, Instruction *insn)
@@ -3116,6 +3461,9 @@ static int output_instruction(Function *fn, Instruction *insn)
 	raviX_buffer_add_fstring(&fn->body, "// %s\n", fn->tb.buf);
 	raviX_buffer_reset(&fn->tb);
 
+	if (fn->typed_entry != NULL && emit_typed_param(fn, insn))
+		return 0;
+
 	switch (insn->opcode) {
 	case op_ret:
 		rc = emit_op_ret(fn, insn);
@@ -3320,6 +3668,43 @@ static int output_instruction(Function *fn, Instruction *insn)
 	return rc;
 }
 
+/*
+ * Tracks the Lua stack temps that hold a closure of a known proc, so that a call through such a temp can
+ * call the proc directly. The closure is put in the temp by a move from a local variable, or upvalue, that
+ * is bound to the proc; any later write to the temp forgets it.
+ */
+static void track_known_callees(Function *fn, Instruction *insn)
+{
+	if (insn->opcode == op_call) {
+		/* The call overwrites everything from the function slot upwards */
+		for (unsigned reg = get_target(insn, 0)->regnum; reg < fn->num_stack_temps; reg++)
+			fn->known_callees[reg] = NULL;
+		return;
+	}
+	if (!raviX_opcode_defines_targets(insn->opcode))
+		return;
+	Pseudo *target;
+	FOR_EACH_PTR(insn->targets, Pseudo, target)
+	{
+		if (target->type == PSEUDO_TEMP_ANY && target->regnum < fn->num_stack_temps)
+			fn->known_callees[target->regnum] = NULL;
+		else if (target->type == PSEUDO_RANGE) {
+			for (unsigned reg = target->regnum; reg < fn->num_stack_temps; reg++)
+				fn->known_callees[reg] = NULL;
+		}
+	}
+	END_FOR_EACH_PTR(target)
+	if (insn->opcode != op_mov)
+		return;
+	target = get_target(insn, 0);
+	if (target->type == PSEUDO_TEMP_ANY && target->regnum < fn->num_stack_temps &&
+	    get_operand(insn, 0)->type == PSEUDO_SYMBOL) {
+		Proc *callee = raviX_bound_proc(fn->proc->linearizer, get_operand(insn, 0)->symbol);
+		if (callee != NULL && !callee->function_expr->function_expr.is_vararg)
+			fn->known_callees[target->regnum] = callee;
+	}
+}
+
 static int output_instructions(Function *fn, InstructionList *list)
 {
 	Instruction *insn;
@@ -3329,6 +3714,7 @@ static int output_instructions(Function *fn, InstructionList *list)
 		rc = output_instruction(fn, insn);
 		if (rc != 0)
 			break;
+		track_known_callees(fn, insn);
 	}
 	END_FOR_EACH_PTR(insn)
 	return rc;
@@ -3347,6 +3733,7 @@ static int output_basic_block(Function *fn, BasicBlock *bb)
 		return 0;
 	int rc = 0;
 	raviX_buffer_add_fstring(&fn->body, "L%d:\n", bb->index);
+	memset(fn->known_callees, 0, fn->num_stack_temps * sizeof(Proc *));
 	if (bb->index == ENTRY_BLOCK) {
 	} else if (bb->index == EXIT_BLOCK) {
 	} else {
@@ -3361,11 +3748,6 @@ static int output_basic_block(Function *fn, BasicBlock *bb)
 	return rc;
 }
 
-static inline unsigned get_num_params(Proc *proc)
-{
-	return raviX_ptrlist_size((const PtrList *)proc->function_expr->function_expr.args);
-}
-
 static inline unsigned get_num_upvalues(Proc *proc)
 {
 	return raviX_ptrlist_size((const PtrList *)proc->function_expr->function_expr.upvalues);
@@ -3437,7 +3819,8 @@ static int generate_lua_proc(Proc *proc, TextBuffer *mb)
 	{
 		raviX_buffer_add_fstring(mb, " f->upvalues[%u].instack = %u;\n", i, sym->upvalue.is_in_parent_stack);
 		raviX_buffer_add_fstring(mb, " f->upvalues[%u].idx = %u;\n", i, sym->upvalue.parent_upvalue_index);
-		raviX_buffer_add_fstring(mb, " f->upvalues[%u].name = NULL; // %s\n", i,
+		raviX_buffer_add_fstring(mb, " f->upvalues[%u].name = NULL; // %.*s\n", i,
+					 (int)sym->upvalue.target_variable->variable.var_name->len,
 					 sym->upvalue.target_variable->variable.var_name->str);
 		raviX_buffer_add_fstring(mb, " f->upvalues[%u].usertype = NULL;\n", i);
 		raviX_buffer_add_fstring(mb, " f->upvalues[%u].ravi_type = %d;\n", i,
@@ -3486,13 +3869,151 @@ static int generate_lua_closure(Proc *proc, const char *funcname, TextBuffer *mb
 	return 0;
 }
 
+/*
+ * If the caller wants the output streamed, hands over the code accumulated so far and empties the buffer,
+ * so that at most one function's worth of code is held in memory.
+ */
+static void flush_output(struct Ravi_CompilerInterface *ravi_interface, TextBuffer *mb)
+{
+	if (ravi_interface->emit_code == NULL || raviX_buffer_len(mb) == 0)
+		return;
+	ravi_interface->emit_code(ravi_interface->context, raviX_buffer_data(mb), raviX_buffer_len(mb));
+	ravi_interface->stats.generated_code_size += raviX_buffer_len(mb);
+	raviX_buffer_reset(mb);
+	mb->buf[0] = 0;
+}
+
+/* Returns the parameter whose stack slot the pseudo refers to, or -1 */
+static int param_index(const TypedEntry *typed, const Pseudo *pseudo)
+{
+	if (pseudo->type != PSEUDO_SYMBOL || pseudo->symbol->symbol_type != SYM_LOCAL ||
+	    pseudo->regnum >= typed->num_params)
+		return -1;
+	return (int)pseudo->regnum;
+}
+
+/* Checks that the only uses of the stack slot of the parameter are its type check and the move to its C variable */
+static bool find_param_uses(TypedEntry *typed, BasicBlock *bb, Instruction *insn)
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		int i = param_index(typed, pseudo);
+		if (i < 0)
+			continue;
+		if (bb->index != ENTRY_BLOCK || insn->opcode != op_mov || pseudo != get_first_operand(insn) ||
+		    pseudo->symbol != typed->params[i] || typed->checks[i] == NULL || typed->moves[i] != NULL)
+			return false;
+		Pseudo *target = get_first_target(insn);
+		if (target->type != (param_type(typed, i) == RAVI_TNUMINT ? PSEUDO_TEMP_INT : PSEUDO_TEMP_FLT))
+			return false;
+		typed->moves[i] = insn;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		int i = param_index(typed, pseudo);
+		if (i < 0)
+			continue;
+		if (bb->index != ENTRY_BLOCK ||
+		    insn->opcode != (param_type(typed, i) == RAVI_TNUMINT ? op_toint : op_toflt) ||
+		    pseudo->symbol != typed->params[i] || typed->checks[i] != NULL)
+			return false;
+		typed->checks[i] = insn;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return true;
+}
+
+/* Returns the typed entry point of the proc, or NULL if the proc cannot have one; see TypedEntry */
+static TypedEntry *find_typed_entry(Proc *proc)
+{
+	unsigned num_params = get_num_params(proc);
+	if (proc->function_expr->function_expr.is_vararg || num_params == 0)
+		return NULL;
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	TypedEntry *typed = (TypedEntry *)allocator->calloc(allocator->arena, 1, sizeof(TypedEntry));
+	typed->num_params = num_params;
+	typed->params = (LuaSymbol **)allocator->calloc(allocator->arena, num_params, sizeof(LuaSymbol *));
+	typed->checks = (Instruction **)allocator->calloc(allocator->arena, num_params, sizeof(Instruction *));
+	typed->moves = (Instruction **)allocator->calloc(allocator->arena, num_params, sizeof(Instruction *));
+	unsigned i = 0;
+	LuaSymbol *sym;
+	FOR_EACH_PTR(proc->function_expr->function_expr.args, LuaSymbol, sym)
+	{
+		ravitype_t type = sym->variable.value_type.type_code;
+		if (sym->variable.escaped || (type != RAVI_TNUMINT && type != RAVI_TNUMFLT))
+			return NULL;
+		typed->params[i++] = sym;
+	}
+	END_FOR_EACH_PTR(sym)
+	for (unsigned j = 0; j < proc->node_count; j++) {
+		BasicBlock *bb = proc->nodes[j];
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			if (!find_param_uses(typed, bb, insn))
+				return NULL;
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	for (i = 0; i < num_params; i++) {
+		if (typed->checks[i] == NULL)
+			return NULL;
+	}
+	return typed;
+}
+
+/* Outputs the Lua visible C function of a proc that has a typed entry point, it checks the arguments and forwards them */
+static void emit_typed_entry_caller(Proc *proc, TextBuffer *mb)
+{
+	const TypedEntry *typed = (const TypedEntry *)proc->userdata;
+	raviX_buffer_add_fstring(mb, "static int %s(lua_State *L) {\n", proc->funcname);
+	raviX_buffer_add_string(mb, " StkId base = L->ci->u.l.base;\n");
+	for (unsigned i = 0; i < typed->num_params; i++) {
+		if (param_type(typed, i) == RAVI_TNUMINT) {
+			raviX_buffer_add_fstring(mb, " lua_Integer %s%u = 0;\n", arg_var_prefix, i);
+			raviX_buffer_add_fstring(mb, " if (!tointegerns(R(%u), &%s%u))\n", i, arg_var_prefix, i);
+			raviX_buffer_add_fstring(mb, "  raviV_raise_error(L, %d);\n", Error_integer_expected);
+		} else {
+			raviX_buffer_add_fstring(mb, " lua_Number %s%u = 0;\n", arg_var_prefix, i);
+			raviX_buffer_add_fstring(mb, " if (!tonumberns(R(%u), %s%u))\n", i, arg_var_prefix, i);
+			raviX_buffer_add_fstring(mb, "  raviV_raise_error(L, %d);\n", Error_number_expected);
+		}
+	}
+	raviX_buffer_add_fstring(mb, " return %s_typed(L", proc->funcname);
+	for (unsigned i = 0; i < typed->num_params; i++)
+		raviX_buffer_add_fstring(mb, ", %s%u", arg_var_prefix, i);
+	raviX_buffer_add_string(mb, ");\n}\n");
+}
+
+/* Names the C functions of the procs and declares them, so that any proc can call another directly */
+static void declare_C_functions(Proc *proc, TextBuffer *mb)
+{
+	/* Set a name that can be used later to retrieve the compiled code */
+	snprintf(proc->funcname, sizeof proc->funcname, "__ravifunc_%d", proc->id);
+	raviX_buffer_add_fstring(mb, "static int %s(lua_State *L);\n", proc->funcname);
+	proc->userdata = find_typed_entry(proc);
+	if (proc->userdata != NULL) {
+		emit_typed_entry_signature(proc, mb);
+		raviX_buffer_add_string(mb, ";\n");
+	}
+	Proc *childproc;
+	FOR_EACH_PTR(proc->procs, Proc, childproc)
+	{
+		declare_C_functions(childproc, mb);
+	}
+	END_FOR_EACH_PTR(childproc)
+}
+
 /* Generate C code for each proc recursively */
-static int generate_C_code(struct Ravi_CompilerInterface *ravi_interface, Proc *proc, TextBuffer *mb)
+static int generate_C_code(struct Ravi_CompilerInterface *ravi_interface, EmbeddedC *embedded_C, Proc *proc,
+			   TextBuffer *mb, bool *have_direct_call_helpers)
 {
 	int rc = 0;
 	{
 		Function fn;
-		initfn(&fn, proc, ravi_interface);
+		initfn(&fn, proc, ravi_interface, embedded_C);
 		rc = setjmp(fn.env);
 		if (rc == 0) {
 			BasicBlock *bb;
@@ -3504,8 +4025,15 @@ static int generate_C_code(struct Ravi_CompilerInterface *ravi_interface, Proc *
 			}
 
 			raviX_buffer_add_string(&fn.body, "}\n");
+			if (fn.direct_calls && !*have_direct_call_helpers) {
+				raviX_buffer_add_string(mb, Lua_direct_call_helpers);
+				*have_direct_call_helpers = true;
+			}
 			raviX_buffer_add_string(mb, fn.prologue.buf);
 			raviX_buffer_add_string(mb, fn.body.buf);
+			if (fn.typed_entry != NULL)
+				emit_typed_entry_caller(proc, mb);
+			flush_output(ravi_interface, mb);
 		}
 		cleanup(&fn);
 	}
@@ -3515,7 +4043,7 @@ static int generate_C_code(struct Ravi_CompilerInterface *ravi_interface, Proc *
 	Proc *childproc;
 	FOR_EACH_PTR(proc->procs, Proc, childproc)
 	{
-		rc = generate_C_code(ravi_interface, childproc, mb);
+		rc = generate_C_code(ravi_interface, embedded_C, childproc, mb, have_direct_call_helpers);
 		if (rc != 0)
 			return rc;
 	}
@@ -3600,54 +4128,27 @@ static void preprocess_upvalues(Proc *proc)
 }
 
 /* Emits top level C__decl contents */
-static int emit_C__decl(LinearizerState *linearizer, struct Ravi_CompilerInterface *api, TextBuffer *mb)
+static int emit_C__decl(LinearizerState *linearizer, struct Ravi_CompilerInterface *api, EmbeddedC *embedded_C,
+			TextBuffer *mb)
 {
 	if (linearizer->C_declarations.buf == NULL || linearizer->C_declarations.buf[0] == 0)
 		return 0;
 
-	TextBuffer code;
-	raviX_buffer_init(&code, 1024);
-	raviX_buffer_add_string(&code, Embedded_C_header);
-	raviX_buffer_add_string(&code, linearizer->C_declarations.buf);
-
-	C_MemoryAllocator allocator = *linearizer->compiler_state->allocator;
-	allocator.arena = allocator.create_arena(0, 0);
-
-	C_Parser parser;
-	C_parser_init(&parser, &allocator);
-	C_Scope *global_scope = C_global_scope(&parser);
-	C_Decl_Analysis analysis = {&parser, global_scope, 0, 0, api};
-
-	C_Token *tok = C_tokenize_buffer(&parser, code.buf);
-	if (tok == NULL) {
-		analysis.status = -1;
-		goto Lexit;
-	}
-	C_convert_pp_tokens(&parser, tok);
-	if (C_parse(global_scope, &parser, tok) == NULL) {
-		analysis.status = -1;
-		goto Lexit;
-	}
+	C_Scope *declarations_scope = get_declarations_scope(embedded_C, linearizer, api);
+	if (declarations_scope == NULL)
+		return -1;
+	C_Decl_Analysis analysis = {&embedded_C->parser, declarations_scope, 0, 0, api};
 
 	// analyze declarations - do not allow pointers or unions in structs
 	// or global object declarations
 	analysis.is_tags = 1;
-	hashmap_foreach(&global_scope->tags, analyze_C_declarations, &analysis);
+	hashmap_foreach(&declarations_scope->tags, analyze_C_declarations, &analysis);
 	analysis.is_tags = 0;
-	hashmap_foreach(&global_scope->vars, analyze_C_declarations, &analysis);
+	hashmap_foreach(&declarations_scope->vars, analyze_C_declarations, &analysis);
 
 	if (analysis.status == 0) {
 		raviX_buffer_add_string(mb, linearizer->C_declarations.buf);
 	}
-
-Lexit:
-	if (analysis.status < 0 && parser.error_message) {
-		api->error_message(api->context, parser.error_message);
-	}
-	C_parser_destroy(&parser);
-	allocator.destroy_arena(allocator.arena);
-	raviX_buffer_free(&code);
-
 	return analysis.status;
 }
 
@@ -3657,7 +4158,7 @@ static void debug_message(void *context, const char *filename, long long line, c
 }
 static void error_message(void *context, const char *message) { fprintf(stderr, "%s\n", message); }
 
-static struct Ravi_CompilerInterface stub_compilerInterface = {
+static const struct Ravi_CompilerInterface stub_compilerInterface = {
     .context = NULL,
     .source = NULL,
     .source_len = 0,
@@ -3672,8 +4173,11 @@ static struct Ravi_CompilerInterface stub_compilerInterface = {
 /* Generate and compile C code */
 int raviX_generate_C(LinearizerState *linearizer, TextBuffer *mb, struct Ravi_CompilerInterface *ravi_interface)
 {
-	if (ravi_interface == NULL)
-		ravi_interface = &stub_compilerInterface;
+	struct Ravi_CompilerInterface stub_interface;
+	if (ravi_interface == NULL) {
+		stub_interface = stub_compilerInterface;
+		ravi_interface = &stub_interface;
+	}
 
 	// _ENV is the name of the Lua up-value that points to the globals table
 	raviX_create_string(linearizer->compiler_state, "_ENV", 4);
@@ -3681,32 +4185,52 @@ int raviX_generate_C(LinearizerState *linearizer, TextBuffer *mb, struct Ravi_Co
 	/* Add the common header portion */
 	// FIXME we need a way to customise this for 32-bit vs 64-bit
 	raviX_buffer_add_string(mb, Lua_header);
+	if (use_inline_caches(ravi_interface))
+		raviX_buffer_add_string(mb, Lua_inline_cache_helpers);
+
+	EmbeddedC embedded_C = {0};
 
 	/* emit C__decl statements in ravi code */
-	if (emit_C__decl(linearizer, ravi_interface, mb) != 0) {
+	if (emit_C__decl(linearizer, ravi_interface, &embedded_C, mb) != 0) {
+		destroy_embedded_C(&embedded_C);
 		return -1;
 	}
 
+	flush_output(ravi_interface, mb);
+
 	/* Preprocess upvalue attributes */
 	preprocess_upvalues(linearizer->main_proc);
 
+	declare_C_functions(linearizer->main_proc, mb);
+
 	/* Recursively generate C code for procs */
-	if (generate_C_code(ravi_interface, linearizer->main_proc, mb) != 0) {
+	bool have_direct_call_helpers = false;
+	int rc = generate_C_code(ravi_interface, &embedded_C, linearizer->main_proc, mb, &have_direct_call_helpers);
+	destroy_embedded_C(&embedded_C);
+	if (rc != 0) {
 		return -1;
 	}
 	generate_lua_closure(linearizer->main_proc, ravi_interface->main_func_name, mb);
+	flush_output(ravi_interface, mb);
 	return 0;
 }
 
-void raviX_generate_C_tofile(LinearizerState *linearizer, const char *mainfunc, FILE *fp)
+static void write_to_file(void *context, const char *code, size_t len) { fwrite(code, 1, len, (FILE *)context); }
+
+void raviX_generate_C_tofile(LinearizerState *linearizer, const char *mainfunc, const char *options, FILE *fp)
 {
-	struct Ravi_CompilerInterface *ravi_interface = &stub_compilerInterface;
-	raviX_string_copy(ravi_interface->main_func_name, (mainfunc != NULL ? mainfunc : "setup"),
-			  sizeof ravi_interface->main_func_name);
+	struct Ravi_CompilerInterface ravi_interface = stub_compilerInterface;
+	if (options != NULL)
+		ravi_interface.compiler_options = options;
+	raviX_string_copy(ravi_interface.main_func_name, (mainfunc != NULL ? mainfunc : "setup"),
+			  sizeof ravi_interface.main_func_name);
+	ravi_interface.context = fp;
+	ravi_interface.emit_code = write_to_file;
 	TextBuffer mb;
 	raviX_buffer_init(&mb, 4096);
-	raviX_generate_C(linearizer, &mb, NULL);
-	fprintf(fp, "%s\n", mb.buf);
+	raviX_generate_C(linearizer, &mb, &ravi_interface);
+	flush_output(&ravi_interface, &mb);
+	fputc('\n', fp);
 	raviX_buffer_free(&mb);
 }
 
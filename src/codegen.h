@@ -32,6 +32,8 @@
 #define RAVI_DEFER_STATEMENT
 
 RAVICOMP_EXPORT int raviX_generate_C(LinearizerState *linearizer, TextBuffer *mb, struct Ravi_CompilerInterface *ravi_interface);
-RAVICOMP_EXPORT void raviX_generate_C_tofile(LinearizerState *linearizer, const char *mainfunc, FILE *fp);
+/* options are as in Ravi_CompilerInterface.compiler_options; only the ones that affect code generation matter */
+RAVICOMP_EXPORT void raviX_generate_C_tofile(LinearizerState *linearizer, const char *mainfunc, const char *options,
+					     FILE *fp);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,422 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Content addressed cache of generated C code.
+ *
+ * Each compilation is identified by the compiler version and cache revision, compiler options,
+ * main function name and source; together these make up the identity of an entry. Entries are
+ * indexed by a 64-bit FNV-1a hash of the identity, but a hit requires the whole identity to match,
+ * so a hash collision is only a miss. Entries are held in memory in an LRU list indexed by a hash
+ * table, and optionally written to a directory as <hash>-<length>.c files, holding the identity
+ * followed by the code, so that a new process can reuse them. Files are written to a temporary
+ * name and then renamed so that concurrent writers and readers never see a partial entry.
+ */
+
+#include "compile_cache.h"
+
+#include "allocate.h"
+#include "fnv_hash.h"
+#include "hash_table.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifndef RAVICOMP_VERSION
+#define RAVICOMP_VERSION "unknown"
+#endif
+
+/*
+ * Must be bumped by every change to the generated code or to the layout of cache files that is not
+ * accompanied by a change in RAVICOMP_VERSION, so that disk caches written by an older build are
+ * not used.
+ */
+#define CACHE_FORMAT_REVISION "5"
+
+/* First line of a cache file */
+#define CACHE_FILE_MAGIC "ravicomp-cache\n"
+
+#define DEFAULT_MAX_ENTRIES 256
+
+typedef struct CacheKey {
+	uint64_t hash;
+	char *identity; /* version, options, main function name and source, each followed by a null */
+	size_t identity_len;
+} CacheKey;
+
+typedef struct CacheEntry {
+	CacheKey key; /* Must be first, the hash table is keyed on it */
+	char *code;
+	size_t code_len;
+	struct CacheEntry *prev; /* Towards the most recently used entry */
+	struct CacheEntry *next; /* Towards the least recently used entry */
+} CacheEntry;
+
+struct Ravi_CompileCache {
+	char *directory;
+	unsigned max_entries;
+	unsigned num_entries;
+	HashTable *entries; /* CacheKey -> CacheEntry */
+	CacheEntry *head;   /* Most recently used */
+	CacheEntry *tail;   /* Least recently used */
+	unsigned tmp_counter;
+	Ravi_CompileCacheStats stats;
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+static void cache_lock(Ravi_CompileCache *cache)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&cache->lock);
+#else
+	pthread_mutex_lock(&cache->lock);
+#endif
+}
+
+static void cache_unlock(Ravi_CompileCache *cache)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&cache->lock);
+#else
+	pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+static uint32_t hash_key(const void *key)
+{
+	const CacheKey *k = (const CacheKey *)key;
+	return (uint32_t)(k->hash ^ (k->hash >> 32));
+}
+
+static int key_equals(const void *a, const void *b)
+{
+	const CacheKey *k1 = (const CacheKey *)a;
+	const CacheKey *k2 = (const CacheKey *)b;
+	return k1->hash == k2->hash && k1->identity_len == k2->identity_len &&
+	       memcmp(k1->identity, k2->identity, k1->identity_len) == 0;
+}
+
+static char *append_field(char *p, const char *field, size_t len)
+{
+	memcpy(p, field, len);
+	p[len] = 0; /* so that the fields cannot run into each other */
+	return p + len + 1;
+}
+
+/* Builds the key of a compilation; the identity must be released with release_key() */
+static void make_key(const Ravi_CompilerInterface *compiler_interface, CacheKey *key)
+{
+	static const char version[] = RAVICOMP_VERSION "/" CACHE_FORMAT_REVISION;
+	const char *options = compiler_interface->compiler_options ? compiler_interface->compiler_options : "";
+	size_t options_len = strlen(options);
+	size_t name_len = 0;
+	while (name_len < sizeof compiler_interface->main_func_name && compiler_interface->main_func_name[name_len])
+		name_len++;
+	key->identity_len = sizeof version + options_len + 1 + name_len + 1 + compiler_interface->source_len + 1;
+	key->identity = (char *)raviX_malloc(key->identity_len);
+	char *p = append_field(key->identity, version, sizeof version - 1);
+	p = append_field(p, options, options_len);
+	p = append_field(p, compiler_interface->main_func_name, name_len);
+	append_field(p, compiler_interface->source, compiler_interface->source_len);
+	key->hash = fnv1_hash64_data(FNV1_HASH64_INIT, key->identity, key->identity_len);
+}
+
+static void release_key(CacheKey *key)
+{
+	raviX_free(key->identity);
+	key->identity = NULL;
+}
+
+static void unlink_entry(Ravi_CompileCache *cache, CacheEntry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void push_entry(Ravi_CompileCache *cache, CacheEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+	cache->head = entry;
+}
+
+static void free_entry(CacheEntry *entry)
+{
+	release_key(&entry->key);
+	raviX_free(entry->code);
+	raviX_free(entry);
+}
+
+/* Returns a null terminated copy of the code */
+static char *copy_string(const char *code, size_t code_len)
+{
+	char *copy = (char *)raviX_malloc(code_len + 1);
+	memcpy(copy, code, code_len);
+	copy[code_len] = 0;
+	return copy;
+}
+
+/*
+ * Adds code to the in-memory cache, evicting the least recently used entries if needed; the identity of
+ * the key is copied. Cache must be locked.
+ */
+static void insert_entry(Ravi_CompileCache *cache, const CacheKey *key, const char *code, size_t code_len)
+{
+	HashEntry *he = raviX_hash_table_search(cache->entries, key);
+	if (he != NULL) {
+		/* Another thread got here first */
+		CacheEntry *entry = (CacheEntry *)he->data;
+		unlink_entry(cache, entry);
+		push_entry(cache, entry);
+		return;
+	}
+	while (cache->num_entries >= cache->max_entries && cache->tail != NULL) {
+		CacheEntry *victim = cache->tail;
+		unlink_entry(cache, victim);
+		raviX_hash_table_remove(cache->entries, &victim->key);
+		free_entry(victim);
+		cache->num_entries--;
+		cache->stats.evictions++;
+	}
+	CacheEntry *entry = (CacheEntry *)raviX_calloc(1, sizeof(CacheEntry));
+	entry->key.hash = key->hash;
+	entry->key.identity = copy_string(key->identity, key->identity_len);
+	entry->key.identity_len = key->identity_len;
+	entry->code = copy_string(code, code_len);
+	entry->code_len = code_len;
+	raviX_hash_table_insert(cache->entries, &entry->key, entry);
+	push_entry(cache, entry);
+	cache->num_entries++;
+}
+
+static char *entry_path(const Ravi_CompileCache *cache, const CacheKey *key, const char *suffix)
+{
+	size_t n = strlen(cache->directory) + strlen(suffix) + 64;
+	char *path = (char *)raviX_malloc(n);
+	snprintf(path, n, "%s/%016llx-%llx%s", cache->directory, (unsigned long long)key->hash,
+		 (unsigned long long)key->identity_len, suffix);
+	return path;
+}
+
+/*
+ * Reads an entry from the cache directory; returns NULL if there is no such entry, or if the file
+ * belongs to a different compilation whose key has the same hash.
+ * A cache file holds CACHE_FILE_MAGIC, the identity of the key and then the code.
+ */
+static char *read_entry(Ravi_CompileCache *cache, const CacheKey *key, size_t *code_len)
+{
+	char *path = entry_path(cache, key, ".c");
+	FILE *fp = fopen(path, "rb");
+	raviX_free(path);
+	if (fp == NULL)
+		return NULL;
+	char *data = NULL;
+	long len = -1;
+	if (fseek(fp, 0, SEEK_END) == 0)
+		len = ftell(fp);
+	if (len >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+		data = (char *)raviX_malloc((size_t)len + 1);
+		if (fread(data, 1, (size_t)len, fp) != (size_t)len) {
+			raviX_free(data);
+			data = NULL;
+		}
+	}
+	fclose(fp);
+	if (data == NULL)
+		return NULL;
+	size_t header_len = sizeof CACHE_FILE_MAGIC - 1 + key->identity_len;
+	if ((size_t)len < header_len || memcmp(data, CACHE_FILE_MAGIC, sizeof CACHE_FILE_MAGIC - 1) != 0 ||
+	    memcmp(data + sizeof CACHE_FILE_MAGIC - 1, key->identity, key->identity_len) != 0) {
+		raviX_free(data);
+		return NULL;
+	}
+	*code_len = (size_t)len - header_len;
+	char *code = copy_string(data + header_len, *code_len);
+	raviX_free(data);
+	return code;
+}
+
+static void write_entry(Ravi_CompileCache *cache, const CacheKey *key, const char *code, size_t code_len)
+{
+	char suffix[64];
+	cache_lock(cache);
+	unsigned counter = cache->tmp_counter++;
+	cache_unlock(cache);
+#ifdef _WIN32
+	snprintf(suffix, sizeof suffix, ".%d.%u.tmp", _getpid(), counter);
+#else
+	snprintf(suffix, sizeof suffix, ".%ld.%u.tmp", (long)getpid(), counter);
+#endif
+	char *tmp_path = entry_path(cache, key, suffix);
+	char *path = entry_path(cache, key, ".c");
+	FILE *fp = fopen(tmp_path, "wb");
+	if (fp != NULL) {
+		int ok = fwrite(CACHE_FILE_MAGIC, 1, sizeof CACHE_FILE_MAGIC - 1, fp) == sizeof CACHE_FILE_MAGIC - 1;
+		ok = fwrite(key->identity, 1, key->identity_len, fp) == key->identity_len && ok;
+		ok = fwrite(code, 1, code_len, fp) == code_len && ok;
+		ok = fclose(fp) == 0 && ok;
+		if (!ok || rename(tmp_path, path) != 0)
+			remove(tmp_path);
+	}
+	raviX_free(path);
+	raviX_free(tmp_path);
+}
+
+static int make_directory(const char *directory)
+{
+	struct stat st;
+	if (stat(directory, &st) == 0)
+		return (st.st_mode & S_IFDIR) != 0 ? 0 : -1;
+#ifdef _WIN32
+	return _mkdir(directory);
+#else
+	return mkdir(directory, 0777);
+#endif
+}
+
+Ravi_CompileCache *raviX_create_compile_cache(const char *directory, unsigned max_entries)
+{
+	if (directory != NULL && make_directory(directory) != 0)
+		return NULL;
+	Ravi_CompileCache *cache = (Ravi_CompileCache *)raviX_calloc(1, sizeof(Ravi_CompileCache));
+	if (directory != NULL)
+		cache->directory = copy_string(directory, strlen(directory));
+	cache->max_entries = max_entries ? max_entries : DEFAULT_MAX_ENTRIES;
+	cache->entries = raviX_hash_table_create(hash_key, key_equals);
+#ifdef _WIN32
+	InitializeCriticalSection(&cache->lock);
+#else
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+	return cache;
+}
+
+void raviX_destroy_compile_cache(Ravi_CompileCache *cache)
+{
+	if (cache == NULL)
+		return;
+	CacheEntry *entry = cache->head;
+	while (entry != NULL) {
+		CacheEntry *next = entry->next;
+		free_entry(entry);
+		entry = next;
+	}
+	raviX_hash_table_destroy(cache->entries, NULL);
+#ifdef _WIN32
+	DeleteCriticalSection(&cache->lock);
+#else
+	pthread_mutex_destroy(&cache->lock);
+#endif
+	raviX_free(cache->directory);
+	raviX_free(cache);
+}
+
+void raviX_compile_cache_stats(Ravi_CompileCache *cache, Ravi_CompileCacheStats *stats)
+{
+	cache_lock(cache);
+	*stats = cache->stats;
+	cache_unlock(cache);
+}
+
+bool raviX_compile_cache_get(Ravi_CompileCache *cache, Ravi_CompilerInterface *compiler_interface)
+{
+	CacheKey key;
+	make_key(compiler_interface, &key);
+
+	cache_lock(cache);
+	HashEntry *he = raviX_hash_table_search(cache->entries, &key);
+	if (he != NULL) {
+		CacheEntry *entry = (CacheEntry *)he->data;
+		unlink_entry(cache, entry);
+		push_entry(cache, entry);
+		compiler_interface->generated_code = copy_string(entry->code, entry->code_len);
+		cache->stats.memory_hits++;
+		cache_unlock(cache);
+		release_key(&key);
+		return true;
+	}
+	cache_unlock(cache);
+
+	if (cache->directory != NULL) {
+		size_t code_len;
+		char *code = read_entry(cache, &key, &code_len);
+		if (code != NULL) {
+			cache_lock(cache);
+			insert_entry(cache, &key, code, code_len);
+			cache->stats.disk_hits++;
+			cache_unlock(cache);
+			compiler_interface->generated_code = code;
+			release_key(&key);
+			return true;
+		}
+	}
+
+	cache_lock(cache);
+	cache->stats.misses++;
+	cache_unlock(cache);
+	release_key(&key);
+	return false;
+}
+
+void raviX_compile_cache_put(Ravi_CompileCache *cache, const Ravi_CompilerInterface *compiler_interface)
+{
+	if (compiler_interface->generated_code == NULL)
+		return;
+	CacheKey key;
+	make_key(compiler_interface, &key);
+	size_t code_len = strlen(compiler_interface->generated_code);
+
+	cache_lock(cache);
+	insert_entry(cache, &key, compiler_interface->generated_code, code_len);
+	cache->stats.stores++;
+	cache_unlock(cache);
+
+	if (cache->directory != NULL)
+		write_entry(cache, &key, compiler_interface->generated_code, code_len);
+	release_key(&key);
+}
@@ -0,0 +1,39 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ravicomp_COMPILE_CACHE_H
+#define ravicomp_COMPILE_CACHE_H
+
+#include "ravi_api.h"
+
+#include <stdbool.h>
+
+/*
+ * Looks up the generated code for the compilation described by compiler_interface. On a hit
+ * compiler_interface->generated_code is set to a copy that must be released with raviX_release().
+ */
+bool raviX_compile_cache_get(Ravi_CompileCache *cache, Ravi_CompilerInterface *compiler_interface);
+/* Adds compiler_interface->generated_code to the cache; the caller retains ownership of it */
+void raviX_compile_cache_put(Ravi_CompileCache *cache, const Ravi_CompilerInterface *compiler_interface);
+
+#endif
@@ -67,6 +67,7 @@ void raviX_solve_dataflow(Graph *g, bool forward_p,
 	GraphNodeArray *pending;
 
 	init_data_flow(&ctx, g);
+	ctx.userdata = userdata;
 	worklist = &ctx.worklist;
 	pending = &ctx.pending;
 
@@ -75,8 +76,10 @@ void raviX_solve_dataflow(Graph *g, bool forward_p,
 
 	worklist->count = 0;
 	/* Initially the basic blocks are added to the worklist */
-	for (uint32_t i = 0; i < raviX_graph_size(ctx.g); i++) {
-		array_push(worklist, GraphNode *, raviX_graph_node(ctx.g, i));
+	for (uint32_t i = 0; i < raviX_graph_node_id_limit(ctx.g); i++) {
+		GraphNode *node = raviX_graph_node(ctx.g, i);
+		if (node != NULL)
+			array_push(worklist, GraphNode *, node);
 	}
 	iter = 0;
 	while (worklist->count != 0) {
@@ -25,14 +25,21 @@
  * Calculate variable liveness
  * This will use the Dataflow Framework.
  * Implementation inspired by one in MIR
+ *
+ * Each local on the Lua stack, typed temporary and stack temporary is a variable in the
+ * liveness bitsets. Escaped locals and upvalues are not tracked, as closures may access them
+ * at any time. Reads that are implicit in the IR, such as a call reading all the stack
+ * temporaries from the start of a range, are treated as uses of all the affected variables.
  */
 
-
-#include "bitset.h"
+#include "df_liveness.h"
 #include "dataflow_framework.h"
-#include "linearizer.h"
+#include "optimizer.h"
 #include "allocate.h"
 
+#include <assert.h>
+#include <string.h>
+
 struct liveness_info {
 	nodeId_t node_id;
 	BitSet in;
@@ -43,14 +50,16 @@ struct liveness_info {
 
 DECLARE_ARRAY(liveness_info_array, struct liveness_info *);
 
-struct liveness_data {
+struct LivenessData {
 	Proc *proc;
 	struct liveness_info_array lives;
+	unsigned base[VAR_CLASS_COUNT + 1]; /* Variable number of the first register of each class; last entry is the total */
 };
 
-static void init_liveness_data(Proc *proc, struct liveness_data *liveness_data)
+static void init_liveness_data(Proc *proc, LivenessData *liveness_data)
 {
 	memset(liveness_data, 0, sizeof(*liveness_data));
+	liveness_data->proc = proc;
 	for (unsigned i = 0; i < proc->node_count; i++) {
 		struct liveness_info *liveness_info = (struct liveness_info *)raviX_calloc(1, sizeof(struct liveness_info));
 		liveness_info->node_id = i;
@@ -62,18 +71,19 @@ static void init_liveness_data(Proc *proc, struct liveness_data *liveness_data)
 	}
 }
 
-static void destroy_liveness_data(struct liveness_data *liveness_data)
+static void destroy_liveness_data(LivenessData *liveness_data)
 {
 	for (unsigned i = 0; i < liveness_data->lives.count; i++) {
-		raviX_bitset_create(&liveness_data->lives.data[i]->use);
-		raviX_bitset_create(&liveness_data->lives.data[i]->def);
-		raviX_bitset_create(&liveness_data->lives.data[i]->in);
-		raviX_bitset_create(&liveness_data->lives.data[i]->out);
+		raviX_bitset_destroy(&liveness_data->lives.data[i]->use);
+		raviX_bitset_destroy(&liveness_data->lives.data[i]->def);
+		raviX_bitset_destroy(&liveness_data->lives.data[i]->in);
+		raviX_bitset_destroy(&liveness_data->lives.data[i]->out);
+		raviX_free(liveness_data->lives.data[i]);
 	}
 	array_clearmem(&liveness_data->lives);
 }
 
-static inline struct liveness_info *get_liveness_info(struct liveness_data *liveness_data, nodeId_t id)
+static inline struct liveness_info *get_liveness_info(LivenessData *liveness_data, nodeId_t id)
 {
 	return liveness_data->lives.data[id];
 }
@@ -81,10 +91,11 @@ static inline struct liveness_info *get_liveness_info(struct liveness_data *live
 /* Life analysis */
 static int live_join_func(void *userdata, nodeId_t id, bool init)
 {
-	struct liveness_data *liveness_data = (struct liveness_data *)userdata;
+	LivenessData *liveness_data = (LivenessData *)userdata;
 	struct liveness_info *liveness_info = get_liveness_info(liveness_data, id);
 	if (init) {
-		raviX_bitset_clear(&liveness_info->in);
+		// No successors so nothing is live on exit
+		raviX_bitset_clear(&liveness_info->out);
 		return 0;
 	} else {
 		GraphNodeList *successors = raviX_successors(raviX_graph_node(liveness_data->proc->cfg, id));
@@ -102,22 +113,186 @@ static int live_join_func(void *userdata, nodeId_t id, bool init)
 
 static int live_transfer_func(void *userdata, nodeId_t id)
 {
-	struct liveness_data *liveness_data = (struct liveness_data *)userdata;
+	LivenessData *liveness_data = (LivenessData *)userdata;
 	struct liveness_info *liveness_info = get_liveness_info(liveness_data, id);
-	// out[n] = use[n] U (out[n] - def[n])
-	// In bitset terms out[n] = use[n] | (out[n] & ~def[n])
+	// in[n] = use[n] U (out[n] - def[n])
+	// In bitset terms in[n] = use[n] | (out[n] & ~def[n])
 	return raviX_bitset_ior_and_compl(&liveness_info->in, &liveness_info->use, &liveness_info->out,
 					  &liveness_info->def);
 }
 
-// TODO
+/*
+ * Escaped locals are not tracked as they may be read through an upvalue at any time; ranges occupy
+ * TEMP_ANY registers.
+ */
+static int variable_class(const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_SYMBOL:
+		if (pseudo->symbol->symbol_type == SYM_LOCAL && pseudo->symbol->variable.escaped)
+			return -1;
+		break;
+	case PSEUDO_RANGE:
+	case PSEUDO_RANGE_SELECT:
+		return VAR_TEMP_ANY;
+	default:
+		break;
+	}
+	return raviX_variable_class(pseudo);
+}
 
-// Compute use/def sets of each node
-// If a reg appears as the target of an instruction that's a def
-// If a reg is used as operand then its a use
-// Need to handle ranges / var args too
-// Or should we restrict analysis to certain types of regs?
+int raviX_liveness_variable(LivenessData *liveness_data, const Pseudo *pseudo)
+{
+	int cls = variable_class(pseudo);
+	if (cls < 0 || pseudo->type == PSEUDO_RANGE)
+		return -1;
+	return (int)(liveness_data->base[cls] + pseudo->regnum);
+}
+
+/* Assigns variable numbers to the registers of each class */
+static void number_variables(LivenessData *liveness_data)
+{
+	unsigned count[VAR_CLASS_COUNT] = {0};
+	Proc *proc = liveness_data->proc;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+		{
+			Pseudo *pseudo;
+			FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+			{
+				int cls = variable_class(pseudo);
+				if (cls >= 0 && pseudo->regnum >= count[cls])
+					count[cls] = pseudo->regnum + 1;
+			}
+			END_FOR_EACH_PTR(pseudo)
+			FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+			{
+				int cls = variable_class(pseudo);
+				if (cls >= 0 && pseudo->regnum >= count[cls])
+					count[cls] = pseudo->regnum + 1;
+			}
+			END_FOR_EACH_PTR(pseudo)
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	unsigned n = 0;
+	for (unsigned i = 0; i < VAR_CLASS_COUNT; i++) {
+		liveness_data->base[i] = n;
+		n += count[i];
+	}
+	liveness_data->base[VAR_CLASS_COUNT] = n;
+}
+
+typedef void (*VariableCallback)(void *arg, unsigned var);
+
+static void for_each_use(LivenessData *liveness_data, Instruction *insn, VariableCallback callback, void *arg)
+{
+	bool targets_are_uses = !raviX_opcode_defines_targets(insn->opcode) || raviX_opcode_updates_in_place(insn->opcode);
+	for (int i = 0; i < 2; i++) {
+		PseudoList *list = i == 0 ? insn->operands : insn->targets;
+		if (i == 1 && !targets_are_uses)
+			break;
+		Pseudo *pseudo;
+		FOR_EACH_PTR(list, Pseudo, pseudo)
+		{
+			if (pseudo->type == PSEUDO_RANGE) {
+				/* Everything from the start of the range to the top of the stack */
+				for (unsigned var = liveness_data->base[VAR_TEMP_ANY] + pseudo->regnum;
+				     var < liveness_data->base[VAR_TEMP_ANY + 1]; var++)
+					callback(arg, var);
+			} else {
+				int var = raviX_liveness_variable(liveness_data, pseudo);
+				if (var >= 0)
+					callback(arg, (unsigned)var);
+			}
+		}
+		END_FOR_EACH_PTR(pseudo)
+	}
+}
+
+/*
+ * Registers that the instruction definitely writes. Implicit writes, such as a call
+ * overwriting the stack from its first argument onwards, are not reported; this is safe as
+ * it only makes more variables appear live.
+ */
+static void for_each_def(LivenessData *liveness_data, Instruction *insn, VariableCallback callback, void *arg)
+{
+	if (!raviX_opcode_defines_targets(insn->opcode) || raviX_opcode_updates_in_place(insn->opcode))
+		return;
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		int var = raviX_liveness_variable(liveness_data, pseudo);
+		if (var >= 0)
+			callback(arg, (unsigned)var);
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
 
-// Right now we have disjoint sets for temps / locals  - to do this efficiently we need a merged set of regs for each proc
-// Liveness analysis is a backward data flow problem
-// see calculate_func_cfg_live_info  in mir_genc.c
+static void add_block_use(void *arg, unsigned var)
+{
+	struct liveness_info *liveness_info = (struct liveness_info *)arg;
+	if (!raviX_bitset_bit_p(&liveness_info->def, var))
+		raviX_bitset_set_bit_p(&liveness_info->use, var);
+}
+
+static void add_block_def(void *arg, unsigned var)
+{
+	struct liveness_info *liveness_info = (struct liveness_info *)arg;
+	raviX_bitset_set_bit_p(&liveness_info->def, var);
+}
+
+/* Compute use/def sets of each node: a variable used before it is defined in the block is a use */
+static void compute_use_def(LivenessData *liveness_data)
+{
+	Proc *proc = liveness_data->proc;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		struct liveness_info *liveness_info = get_liveness_info(liveness_data, i);
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+		{
+			for_each_use(liveness_data, insn, add_block_use, liveness_info);
+			for_each_def(liveness_data, insn, add_block_def, liveness_info);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+}
+
+LivenessData *raviX_compute_liveness(Proc *proc)
+{
+	assert(proc->cfg != NULL);
+	LivenessData *liveness_data = (LivenessData *)raviX_calloc(1, sizeof(LivenessData));
+	init_liveness_data(proc, liveness_data);
+	number_variables(liveness_data);
+	compute_use_def(liveness_data);
+	// Liveness analysis is a backward data flow problem
+	raviX_solve_dataflow(proc->cfg, false, live_join_func, live_transfer_func, liveness_data);
+	return liveness_data;
+}
+
+void raviX_destroy_liveness(LivenessData *liveness_data)
+{
+	destroy_liveness_data(liveness_data);
+	raviX_free(liveness_data);
+}
+
+BitSet *raviX_live_in(LivenessData *liveness_data, nodeId_t block)
+{
+	return &get_liveness_info(liveness_data, block)->in;
+}
+
+BitSet *raviX_live_out(LivenessData *liveness_data, nodeId_t block)
+{
+	return &get_liveness_info(liveness_data, block)->out;
+}
+
+static void kill_variable(void *arg, unsigned var) { raviX_bitset_clear_bit_p((BitSet *)arg, var); }
+
+static void gen_variable(void *arg, unsigned var) { raviX_bitset_set_bit_p((BitSet *)arg, var); }
+
+void raviX_live_before_instruction(LivenessData *liveness_data, Instruction *insn, BitSet *live)
+{
+	for_each_def(liveness_data, insn, kill_variable, live);
+	for_each_use(liveness_data, insn, gen_variable, live);
+}
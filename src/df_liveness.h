@@ -0,0 +1,49 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ravicomp_DF_LIVENESS_H
+#define ravicomp_DF_LIVENESS_H
+
+#include "bitset.h"
+#include "linearizer.h"
+
+/*
+ * Live variable analysis over the CFG of a proc.
+ */
+typedef struct LivenessData LivenessData;
+
+/* Solves liveness for the proc; the CFG must have been constructed and the proc must not be in SSA form */
+extern LivenessData *raviX_compute_liveness(Proc *proc);
+extern void raviX_destroy_liveness(LivenessData *liveness_data);
+
+/* Returns the bit used for the pseudo in the liveness sets, or -1 if the pseudo is not tracked */
+extern int raviX_liveness_variable(LivenessData *liveness_data, const Pseudo *pseudo);
+
+/* Variables live on entry to and exit from the block */
+extern BitSet *raviX_live_in(LivenessData *liveness_data, nodeId_t block);
+extern BitSet *raviX_live_out(LivenessData *liveness_data, nodeId_t block);
+
+/* Given the variables live after the instruction, updates the set to those live before it */
+extern void raviX_live_before_instruction(LivenessData *liveness_data, Instruction *insn, BitSet *live);
+
+#endif
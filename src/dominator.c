@@ -54,13 +54,13 @@ array that describes the dominator tree.
 struct DominatorTree {
 	Graph *g;
 	GraphNode **IDOM; /* IDOM[] - array of immediate dominators, one per node in the graph, indexed by node id */
-	uint32_t N;	  /* sizeof IDOM */
+	uint32_t N;	  /* sizeof IDOM, node ids may be sparse */
 };
 
 DominatorTree *raviX_new_dominator_tree(Graph *g)
 {
 	DominatorTree *state = (DominatorTree *)raviX_calloc(1, sizeof(DominatorTree));
-	state->N = raviX_graph_size(g);
+	state->N = raviX_graph_node_id_limit(g);
 	state->IDOM = (GraphNode **)raviX_calloc(state->N, sizeof(GraphNode *));
 	state->g = g;
 	return state;
@@ -139,6 +139,8 @@ void raviX_calculate_dominator_tree(DominatorTree *state)
 			nodeId_t bid = raviX_node_index(b);
 			if (bid == ENTRY_BLOCK) // skip root
 				continue;
+			if (raviX_node_RPO(b) == 0) // not reachable from root, so has no dominator
+				continue;
 			GraphNodeList *predecessors = raviX_predecessors(b); // Predecessors of b
 			// NewIDom = first (processed) predecessor of b, pick one
 			GraphNode *firstpred = find_first_predecessor_with_idom(state, predecessors);
@@ -164,9 +166,29 @@ void raviX_calculate_dominator_tree(DominatorTree *state)
 	raviX_free(nodes_in_reverse_postorder);
 }
 
+GraphNode *raviX_immediate_dominator(DominatorTree *state, nodeId_t node)
+{
+	if (node >= state->N)
+		return NULL;
+	return state->IDOM[node];
+}
+
+bool raviX_dominates(DominatorTree *state, nodeId_t a, nodeId_t b)
+{
+	for (;;) {
+		if (a == b)
+			return true;
+		GraphNode *idom = raviX_immediate_dominator(state, b);
+		if (idom == NULL || raviX_node_index(idom) == b)
+			return false;
+		b = raviX_node_index(idom);
+	}
+}
+
 void raviX_dominator_tree_output(DominatorTree *tree, FILE *fp)
 {
 	for (uint32_t i = 0; i < tree->N; i++) {
-		fprintf(stdout, "IDOM[%d] = %d\n", i, raviX_node_index(tree->IDOM[i]));
+		if (tree->IDOM[i] != NULL)
+			fprintf(stdout, "IDOM[%d] = %d\n", i, raviX_node_index(tree->IDOM[i]));
 	}
 }
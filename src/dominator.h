@@ -26,12 +26,17 @@
 
 #include "graph.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef struct DominatorTree DominatorTree;
 
 DominatorTree *raviX_new_dominator_tree(Graph *g);
 void raviX_calculate_dominator_tree(DominatorTree *state);
+/* Returns the immediate dominator of the node, or NULL if the node is not reachable from the entry node */
+GraphNode *raviX_immediate_dominator(DominatorTree *state, nodeId_t node);
+/* Returns true if node a dominates node b; every node dominates itself */
+bool raviX_dominates(DominatorTree *state, nodeId_t a, nodeId_t b);
 void raviX_destroy_dominator_tree(DominatorTree *state);
 void raviX_dominator_tree_output(DominatorTree *tree, FILE *fp);
 
@@ -65,6 +65,20 @@ fnv1_hash_data(const void *data, size_t size)
 	return hash;
 }
 
+uint64_t
+fnv1_hash64_data(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = (uint8_t *)data;
+
+	while (size-- != 0) {
+		hash ^= *bytes;
+		hash = hash * 0x100000001b3ull;
+		bytes++;
+	}
+
+	return hash;
+}
+
 int
 string_key_equals(const void *a, const void *b)
 {
@@ -38,6 +38,10 @@
 uint32_t fnv1_hash_string(const char *key);
 uint32_t fnv1_hash_data(const void *data, size_t size);
 
+/* 64-bit FNV-1a; pass FNV1_HASH64_INIT as the initial hash, or a previous result to continue hashing */
+#define FNV1_HASH64_INIT 0xcbf29ce484222325ull
+uint64_t fnv1_hash64_data(uint64_t hash, const void *data, size_t size);
+
 int string_key_equals(const void *a, const void *b);
 
 #define hash_table_create_for_string() \
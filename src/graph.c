@@ -260,6 +260,11 @@ void raviX_for_each_node(Graph *g, void (*callback)(void *arg, Graph *g, nodeId_
 	}
 }
 
+nodeId_t raviX_graph_node_id_limit(Graph *g)
+{
+	return g->allocated;
+}
+
 /* says how many nodes are in the graph */
 uint32_t raviX_graph_size(Graph *g)
 {
@@ -352,8 +357,8 @@ void raviX_classify_edges(Graph *g)
 		if (g->nodes[i] != NULL) {
 			g->nodes[i]->pre = 0;
 			g->nodes[i]->rpost = 0;
-			for (unsigned i = 0; i < g->nodes[i]->succs.count; i++) {
-				struct GraphNodeLink *E = &g->nodes[i]->succs.links[i];
+			for (unsigned j = 0; j < g->nodes[i]->succs.count; j++) {
+				struct GraphNodeLink *E = &g->nodes[i]->succs.links[j];
 				E->edge_type = 0;
 			}
 		}
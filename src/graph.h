@@ -118,6 +118,8 @@ void raviX_sort_nodes_by_RPO(GraphNode **nodes, size_t count, bool forward);
 
 /* says how many nodes are in the graph */
 uint32_t raviX_graph_size(Graph *g);
+/* All node ids in the graph are less than this value; use it to size arrays indexed by node id */
+nodeId_t raviX_graph_node_id_limit(Graph *g);
 /* Generates GraphViz (dot) output */
 void raviX_draw_graph(Graph *g, FILE *fp);
 
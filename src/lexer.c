@@ -31,6 +31,18 @@
 #include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+#if (defined(SCAN_AVX2) || defined(SCAN_SSE2)) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 enum { EOZ = -1 }; /* end of stream */
 #define cast(t, v) ((t)v)
@@ -100,6 +112,39 @@ static const char *const luaX_tokens[] = {
 /* Says whether the given string represents a Lua/Ravi keyword  i.e. reserved word */
 static inline int is_reserved(const StringObject *s) { return s->reserved; }
 
+/*
+ * Perfect hash of the keywords, i.e. the entries of luaX_tokens that are names or '@' casts.
+ * A keyword's slot is (first char * 45 + last char * 7 + length) & 63, and no two keywords share
+ * a slot. Each slot holds the index of its keyword in luaX_tokens, or -1, and the keyword's length.
+ * raviX_create_reserved_words() checks the table against luaX_tokens in debug builds.
+ */
+enum { KEYWORD_MIN_LEN = 2, KEYWORD_MAX_LEN = 10 };
+static const struct {
+	signed char token;
+	unsigned char len;
+} keyword_slots[64] = {
+    {5, 3}, {10, 2}, {14, 7}, {-1, 0}, {-1, 0}, {18, 3}, {-1, 0}, {-1, 0},
+    {3, 4}, {40, 6}, {24, 5}, {42, 8}, {0, 3}, {17, 3}, {16, 6}, {7, 3},
+    {-1, 0}, {4, 6}, {21, 6}, {15, 9}, {39, 9}, {38, 10}, {-1, 0}, {-1, 0},
+    {41, 7}, {-1, 0}, {-1, 0}, {-1, 0}, {-1, 0}, {-1, 0}, {-1, 0}, {2, 2},
+    {-1, 0}, {-1, 0}, {-1, 0}, {19, 2}, {-1, 0}, {37, 7}, {36, 8}, {-1, 0},
+    {9, 4}, {-1, 0}, {22, 4}, {23, 4}, {1, 5}, {-1, 0}, {-1, 0}, {-1, 0},
+    {-1, 0}, {-1, 0}, {-1, 0}, {25, 5}, {-1, 0}, {12, 5}, {6, 5}, {13, 5},
+    {8, 8}, {11, 2}, {-1, 0}, {-1, 0}, {20, 6}, {-1, 0}, {-1, 0}, {-1, 0},
+};
+
+/* Returns the index of the keyword in luaX_tokens, or -1 if the string is not a keyword */
+static int find_keyword(const char *s, uint32_t len)
+{
+	if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN)
+		return -1;
+	unsigned slot = ((unsigned char)s[0] * 45u + (unsigned char)s[len - 1] * 7u + len) & 63u;
+	int token = keyword_slots[slot].token;
+	if (token < 0 || keyword_slots[slot].len != len || memcmp(luaX_tokens[token], s, len) != 0)
+		return -1;
+	return token;
+}
+
 enum { ALPHABIT = 0, DIGITBIT = 1, PRINTBIT = 2, SPACEBIT = 3, XDIGITBIT = 4 };
 
 #define MASK(B) (1 << (B))
@@ -146,43 +191,192 @@ static inline bool lisxdigit(int c) { return testprop(c, MASK(XDIGITBIT)); }
 static inline int ltolower(int c) { return ((c) | ('A' ^ 'a')); }
 
 /*
-Creates a new string object. string objects are interned in a hash set.
+ * Block scanning of the source text.
+ * Runs of identifier characters, blanks, comment bodies and long string contents are skipped a
+ * block of 32 (AVX2) or 16 (SSE2) bytes at a time; bytes left over at the end of the source are
+ * classified one at a time using the character table above.
+ */
+enum ScanClass {
+	SCAN_NAME,	  /* identifier characters */
+	SCAN_BLANK,	  /* spaces other than line breaks */
+	SCAN_LINE,	  /* anything up to a line break */
+	SCAN_LONG_STRING, /* anything up to a line break or ']' */
+};
+
+static inline bool in_scan_class(int c, enum ScanClass cls)
+{
+	switch (cls) {
+	case SCAN_NAME:
+		return lislalnum(c);
+	case SCAN_BLANK:
+		return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+	case SCAN_LINE:
+		return c != '\n' && c != '\r';
+	default:
+		return c != '\n' && c != '\r' && c != ']';
+	}
+}
+
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2)
+
+#if defined(SCAN_AVX2)
+#define SCAN_BLOCK_SIZE 32
+#define SCAN_ALL_BITS 0xFFFFFFFFu
+typedef __m256i ScanBlock;
+static inline ScanBlock block_load(const char *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline ScanBlock block_set(char c) { return _mm256_set1_epi8(c); }
+static inline ScanBlock block_eq(ScanBlock v, char c) { return _mm256_cmpeq_epi8(v, block_set(c)); }
+static inline ScanBlock block_gt(ScanBlock v, char c) { return _mm256_cmpgt_epi8(v, block_set(c)); }
+static inline ScanBlock block_lt(ScanBlock v, char c) { return _mm256_cmpgt_epi8(block_set(c), v); }
+static inline ScanBlock block_or(ScanBlock a, ScanBlock b) { return _mm256_or_si256(a, b); }
+static inline ScanBlock block_and(ScanBlock a, ScanBlock b) { return _mm256_and_si256(a, b); }
+static inline uint32_t block_mask(ScanBlock v) { return (uint32_t)_mm256_movemask_epi8(v); }
+#else
+#define SCAN_BLOCK_SIZE 16
+#define SCAN_ALL_BITS 0xFFFFu
+typedef __m128i ScanBlock;
+static inline ScanBlock block_load(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline ScanBlock block_set(char c) { return _mm_set1_epi8(c); }
+static inline ScanBlock block_eq(ScanBlock v, char c) { return _mm_cmpeq_epi8(v, block_set(c)); }
+static inline ScanBlock block_gt(ScanBlock v, char c) { return _mm_cmpgt_epi8(v, block_set(c)); }
+static inline ScanBlock block_lt(ScanBlock v, char c) { return _mm_cmpgt_epi8(block_set(c), v); }
+static inline ScanBlock block_or(ScanBlock a, ScanBlock b) { return _mm_or_si128(a, b); }
+static inline ScanBlock block_and(ScanBlock a, ScanBlock b) { return _mm_and_si128(a, b); }
+static inline uint32_t block_mask(ScanBlock v) { return (uint32_t)_mm_movemask_epi8(v); }
+#endif
+
+static inline unsigned first_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return (unsigned)i;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/*
+ * Returns a mask with a bit set for each byte of the block that is not in the class.
+ * The comparisons are signed, so bytes >= 0x80 fall outside all the ranges, as they do in the
+ * character table.
+ */
+static inline uint32_t block_stops(const char *p, enum ScanClass cls)
+{
+	ScanBlock v = block_load(p);
+	switch (cls) {
+	case SCAN_NAME: {
+		ScanBlock lower = block_or(v, block_set('A' ^ 'a'));
+		ScanBlock alpha = block_and(block_gt(lower, 'a' - 1), block_lt(lower, 'z' + 1));
+		ScanBlock digit = block_and(block_gt(v, '0' - 1), block_lt(v, '9' + 1));
+		return ~block_mask(block_or(block_or(alpha, digit), block_eq(v, '_'))) & SCAN_ALL_BITS;
+	}
+	case SCAN_BLANK: {
+		ScanBlock blank = block_or(block_or(block_eq(v, ' '), block_eq(v, '\t')),
+					   block_or(block_eq(v, '\v'), block_eq(v, '\f')));
+		return ~block_mask(blank) & SCAN_ALL_BITS;
+	}
+	case SCAN_LINE:
+		return block_mask(block_or(block_eq(v, '\n'), block_eq(v, '\r')));
+	default:
+		return block_mask(block_or(block_or(block_eq(v, '\n'), block_eq(v, '\r')), block_eq(v, ']')));
+	}
+}
+
+#endif
+
+/* Returns the first position in [p, end) whose character is not in the class, or end */
+static inline const char *skip_scan_class(const char *p, const char *end, enum ScanClass cls)
+{
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2)
+	while (end - p >= SCAN_BLOCK_SIZE) {
+		uint32_t stops = block_stops(p, cls);
+		if (stops != 0)
+			return p + first_bit(stops);
+		p += SCAN_BLOCK_SIZE;
+	}
+#endif
+	while (p < end && in_scan_class(cast_uchar(*p), cls))
+		p++;
+	return p;
+}
+
+enum {
+	STRING_POOL_CHUNK_SIZE = 8192,
+	STRING_POOL_ALIGN = sizeof(void *),
+};
+
+/*
+ * Allocates a string object followed by room for the given number of characters. String objects are
+ * carved out of chunks of the string pool, so that interning a name costs one allocation per chunk
+ * rather than two per string; large strings get an allocation of their own.
+ */
+static StringObject *allocate_string(CompilerState *compiler_state, size_t chars)
+{
+	C_MemoryAllocator *allocator = compiler_state->allocator;
+	size_t size = (sizeof(StringObject) + chars + STRING_POOL_ALIGN - 1) & ~((size_t)STRING_POOL_ALIGN - 1);
+	if (size > STRING_POOL_CHUNK_SIZE / 4)
+		return (StringObject *)allocator->calloc(allocator->arena, 1, size);
+	if (size > compiler_state->string_pool_avail) {
+		compiler_state->string_pool = (char *)allocator->calloc(allocator->arena, 1, STRING_POOL_CHUNK_SIZE);
+		compiler_state->string_pool_avail = STRING_POOL_CHUNK_SIZE;
+	}
+	StringObject *string = (StringObject *)compiler_state->string_pool;
+	compiler_state->string_pool += size;
+	compiler_state->string_pool_avail -= size;
+	return string;
+}
+
+/*
+Interns a string; if copy is false the new string object refers to the input rather than a copy of it.
 If the string matches a keyword then the reserved attribute will be set to the token id associated
 with the keyword else this attribute will be -1. The hash value of the string is stored the 'hash'
 attribute. Note that we need to allow strings that have embedded 0 character hence the length
-is explicit. But all tokens and reserved keywords are expected to be standard C strings.
+is explicit.
 */
-const StringObject *raviX_create_string(CompilerState *compiler_state, const char *input, uint32_t len)
+static const StringObject *intern_string(CompilerState *compiler_state, const char *input, uint32_t len, bool copy)
 {
 	StringObject temp = {.len = len, .reserved = -1, .hash = fnv1_hash_data(input, len), .str = input, };
 	SetEntry *entry = raviX_set_search_pre_hashed(compiler_state->strings, temp.hash, &temp);
 	if (entry != NULL)
 		/* found the string */
 		return (StringObject *)entry->key;
-	else {
-		C_MemoryAllocator *allocator = compiler_state->allocator;
-		StringObject *new_string = (StringObject *) allocator->calloc(allocator->arena, 1, sizeof(StringObject));
-		char *s = (char* )allocator->calloc(allocator->arena, len + 1, sizeof(char)); /* allow for 0 terminator */
+	StringObject *new_string;
+	if (copy) {
+		new_string = allocate_string(compiler_state, (size_t)len + 1);
+		char *s = (char *)(new_string + 1);
 		memcpy(s, input, len);
 		s[len] = 0; /* 0 terminate string, however string may contain embedded 0 characters */
 		new_string->str = s;
-		new_string->len = len;
-		new_string->hash = temp.hash;
-		new_string->reserved = -1;
-		/* Check if this is a keyword, linear search is okay as we do this only when we first
-		 * encounter a keyword
-		 */
-		for (int i = 0; i < ARRAY_SIZE(luaX_tokens); i++) {
-			if (lislalpha(luaX_tokens[i][0]) || luaX_tokens[i][0] == '@') {
-                            if (strcmp(luaX_tokens[i], s) == 0) {
-                                    new_string->reserved = i; /* save index of the keyword */
-                                    break;
-                            }
-                        }
-		}
-		raviX_set_add_pre_hashed(compiler_state->strings, temp.hash, new_string);
-		return new_string;
+	} else {
+		new_string = allocate_string(compiler_state, 0);
+		new_string->str = input;
 	}
+	new_string->len = len;
+	new_string->hash = temp.hash;
+	new_string->reserved = find_keyword(input, len); /* save index of the keyword */
+	raviX_set_add_pre_hashed(compiler_state->strings, temp.hash, new_string);
+	return new_string;
+}
+
+/*
+Creates a new string object. string objects are interned in a hash set. The characters are copied
+and 0 terminated.
+*/
+const StringObject *raviX_create_string(CompilerState *compiler_state, const char *input, uint32_t len)
+{
+	return intern_string(compiler_state, input, len, true);
+}
+
+void raviX_set_zero_copy_strings(CompilerState *compiler_state, bool enable)
+{
+	compiler_state->zero_copy_strings = enable;
+}
+
+bool raviX_string_equals(const StringObject *s, const char *cstr)
+{
+	size_t len = strlen(cstr);
+	return s->len == len && memcmp(s->str, cstr, len) == 0;
 }
 
 #define lua_str2number(s, p) ((lua_Number)strtod((s), (p)))
@@ -206,6 +400,10 @@ static void txtToken(LexerState *ls, int token)
 {
 	switch (token) {
 	case TOK_NAME:
+		/* names are not copied to the buffer */
+		raviX_buffer_add_fstring(&ls->compiler_state->error_message, "'%.*s'", (int)ls->t.seminfo.ts->len,
+					 ls->t.seminfo.ts->str);
+		break;
 	case TOK_STRING:
 	case TOK_FLT:
 	case TOK_INT:
@@ -251,6 +449,27 @@ static inline void save_and_next(LexerState *ls)
 	next(ls);
 }
 
+static void save_bytes(LexerState *ls, const char *s, size_t len)
+{
+	if (raviX_buffer_len(ls->buff) + len >= INT_MAX / 2)
+		lexerror(ls, "lexical element too long", 0);
+	raviX_buffer_add_bytes(ls->buff, s, len);
+}
+
+/*
+ * Skips the characters that follow the current one while they are in the class, leaving the
+ * first character outside the class as the current one. The current character must not be EOZ.
+ * Returns the position of the new current character in the source.
+ */
+static const char *skip_class(LexerState *ls, enum ScanClass cls)
+{
+	const char *q = skip_scan_class(ls->p, ls->p + ls->n, cls);
+	ls->n -= (size_t)(q - ls->p);
+	ls->p = q;
+	next(ls);
+	return q;
+}
+
 /*
 ** creates a new interned string.
 */
@@ -259,6 +478,14 @@ static const StringObject *luaX_newstring(LexerState *ls, const char *str, uint3
 	return raviX_create_string(ls->compiler_state, str, l);
 }
 
+/*
+** interns a string that appears verbatim in the source, in place if zero copy strings are enabled
+*/
+static const StringObject *source_string(LexerState *ls, const char *str, uint32_t l)
+{
+	return intern_string(ls->compiler_state, str, l, !ls->compiler_state->zero_copy_strings);
+}
+
 /*
 ** increment line number and skips newline sequence (any of
 ** \n, \r, \n\r, or \r\n)
@@ -291,10 +518,23 @@ LexerState *raviX_init_lexer(CompilerState *compiler_state, const char *buf, siz
 	ls->source = source;
 	ls->envn = raviX_create_string(ls->compiler_state, LUA_ENV, (uint32_t)strlen(LUA_ENV))->str; /* get env name */
 	ls->buff = &compiler_state->buff;
+	return ls;
+}
+
+/* Interns the reserved words; this is done once per compiler state rather than per lexer */
+void raviX_create_reserved_words(CompilerState *compiler_state)
+{
 	for (int i = 0; i < NUM_RESERVED; i++) {
-		raviX_create_string(ls->compiler_state, luaX_tokens[i], (uint32_t)strlen(luaX_tokens[i]));
+		compiler_state->reserved_words[i] =
+		    raviX_create_string(compiler_state, luaX_tokens[i], (uint32_t)strlen(luaX_tokens[i]));
 	}
-	return ls;
+#ifndef NDEBUG
+	/* The keyword hash must find every name or cast, and nothing else */
+	for (int i = 0; i < ARRAY_SIZE(luaX_tokens); i++) {
+		bool keyword = lislalpha(luaX_tokens[i][0]) || luaX_tokens[i][0] == '@';
+		assert(find_keyword(luaX_tokens[i], (uint32_t)strlen(luaX_tokens[i])) == (keyword ? i : -1));
+	}
+#endif
 }
 
 void raviX_destroy_lexer(LexerState *ls)
@@ -638,10 +878,10 @@ static void read_long_string(LexerState *ls, SemInfo *seminfo, int sep)
 			break;
 		}
 		default: {
+			const char *start = ls->p - 1; /* position of the current character */
+			const char *end = skip_class(ls, SCAN_LONG_STRING);
 			if (seminfo)
-				save_and_next(ls);
-			else
-				next(ls);
+				save_bytes(ls, start, (size_t)(end - start));
 		}
 		}
 	}
@@ -715,6 +955,8 @@ static int readdecesc(LexerState *ls)
 
 static void read_string(LexerState *ls, int del, SemInfo *seminfo)
 {
+	const char *start = ls->p; /* the contents follow the delimiter in the source */
+	bool escaped = false;
 	save_and_next(ls); /* keep delimiter (for error messages) */
 	while (ls->current != del) {
 		switch (ls->current) {
@@ -727,6 +969,7 @@ static void read_string(LexerState *ls, int del, SemInfo *seminfo)
 			break;		   /* to avoid warnings */
 		case '\\': {		   /* escape sequences */
 			int c;		   /* final character to be saved */
+			escaped = true;
 			save_and_next(ls); /* keep '\\' for error messages */
 			switch (ls->current) {
 			case 'a':
@@ -799,7 +1042,11 @@ static void read_string(LexerState *ls, int del, SemInfo *seminfo)
 		}
 	}
 	save_and_next(ls); /* skip delimiter */
-	seminfo->ts = luaX_newstring(ls, raviX_buffer_data(ls->buff) + 1, (uint32_t)(raviX_buffer_len(ls->buff) - 2));
+	uint32_t len = (uint32_t)(raviX_buffer_len(ls->buff) - 2);
+	if (escaped)
+		seminfo->ts = luaX_newstring(ls, raviX_buffer_data(ls->buff) + 1, len);
+	else
+		seminfo->ts = source_string(ls, start, len);
 }
 
 /*
@@ -851,7 +1098,7 @@ static int llex(LexerState *ls, SemInfo *seminfo)
 		case '\f':
 		case '\t':
 		case '\v': { /* spaces */
-			next(ls);
+			skip_class(ls, SCAN_BLANK);
 			break;
 		}
 		case '-': { /* '-' or '--' (comment) */
@@ -870,8 +1117,8 @@ static int llex(LexerState *ls, SemInfo *seminfo)
 				}
 			}
 			/* else short comment */
-			while (!currIsNewline(ls) && ls->current != EOZ)
-				next(ls); /* skip until end of line (or end of file) */
+			if (!currIsNewline(ls) && ls->current != EOZ)
+				skip_class(ls, SCAN_LINE); /* skip until end of line (or end of file) */
 			break;
 		}
 		case '[': { /* long string or simply '[' */
@@ -973,12 +1220,10 @@ static int llex(LexerState *ls, SemInfo *seminfo)
 		}
 		default: {
 			if (lislalpha(ls->current)) { /* identifier or reserved word? */
-				const StringObject *ts;
-				do {
-					save_and_next(ls);
-				} while (lislalnum(ls->current));
-				ts = raviX_create_string(ls->compiler_state, raviX_buffer_data(ls->buff),
-							 (int32_t)raviX_buffer_len(ls->buff));
+				/* The name is interned directly from the source text */
+				const char *start = ls->p - 1;
+				const char *end = skip_class(ls, SCAN_NAME);
+				const StringObject *ts = source_string(ls, start, (uint32_t)(end - start));
 				seminfo->ts = ts;
 				int tok = is_reserved(ts);
 				if (tok != -1) /* reserved word? */
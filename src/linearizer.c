@@ -36,6 +36,7 @@ The final instruction of a block must always be a branch instruction.
 
 #include "parser.h"
 #include "linearizer.h"
+#include "optimizer.h"
 #include "fnv_hash.h"
 #include "ptrlist.h"
 #include "graph.h"
@@ -83,35 +84,29 @@ static void handle_error(CompilerState *compiler_state, const char *msg)
 }
 
 /*
- * A simple register assignment system that uses a bit set 256 bits long.
- * It is not the most efficient as we don't use hard-ware intrinsics to scan for
- * next available bit.
+ * A simple register assignment system that uses a bit set to track registers in use.
+ * The bit set grows as needed so there is no fixed limit on the number of registers
+ * a generator can hand out. It is not the most efficient as we don't use hard-ware
+ * intrinsics to scan for next available bit.
  */
 
-/* sizeof field f in struct t */
-#define FIELD_SIZEOF(t, f) (sizeof(((t*)0)->f))
-/* sizeof array element f[0] in struct t */
-#define FIELD_E_SIZEOF(t, f) (sizeof(((t*)0)->f[0]))
-
 enum {
-	BITSET_SIZE = FIELD_SIZEOF(PseudoGenerator, bits),    /* total size of bits in #bytes */
-	BITSET_ESIZE = FIELD_E_SIZEOF(PseudoGenerator, bits), /* sizeof bits[0] in #bytes */
-	N_WORDS = BITSET_SIZE / BITSET_ESIZE,		      /* bits array size in #bytes */
-	ESIZE = BITSET_ESIZE * 8,			      /* bits in bits[0] */
-	MAXBIT = N_WORDS * ESIZE			      /* total bits */
+	ESIZE = sizeof(uint64_t) * 8, /* bits in bits[0] */
+	/* Registers that live on the Lua stack are limited by the size of a Lua frame
+	 * (Proto.maxstacksize is a byte); the limit applies to locals and stack temps combined.
+	 */
+	MAX_STACK_REGS = 255,
+	/* Integer and float temps are C variables so are only limited by the width of Pseudo.regnum */
+	MAX_TEMP_REGS = 0xFFFF
 };
 
-#if (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L)
-static_assert(N_WORDS == 4, "Invalid computation of bitset size"); /* must be kept in sync with PseudoGeneraotor.bits */
-#endif
-
 /* Identify the top most register allocated; this is useful when we need
  * to ensure that the next register goes to the top of the stack
  */
 static int top_reg(PseudoGenerator *generator)
 {
 	/* start from the last element of bits */
-	for (int i = N_WORDS-1; i >= 0; i--) {
+	for (int i = (int)generator->n_words - 1; i >= 0; i--) {
 		if (!generator->bits[i]) // no bit set
 			continue;
 		uint64_t bit = generator->bits[i];
@@ -131,18 +126,49 @@ static int top_reg(PseudoGenerator *generator)
  */
 static void pseudo_gen_free(PseudoGenerator *generator, unsigned reg)
 {
-	assert(reg < MAXBIT);
+	assert(reg < generator->max_reg);
 	unsigned n = reg / ESIZE;
 	reg = reg % ESIZE;
 	generator->bits[n] &= ~(1ull << reg);
 }
 
+/* Grows the bit set so that it has word i */
+static void grow_bits(C_MemoryAllocator *allocator, uint64_t **bits, unsigned *n_words, unsigned i)
+{
+	if (i < *n_words)
+		return;
+	unsigned new_size = *n_words ? *n_words * 2 : 4;
+	while (new_size <= i)
+		new_size *= 2;
+	uint64_t *new_bits = (uint64_t *)allocator->calloc(allocator->arena, new_size, sizeof(uint64_t));
+	assert(new_bits != NULL);
+	if (*n_words > 0) {
+		memcpy(new_bits, *bits, *n_words * sizeof(uint64_t));
+	}
+	*n_words = new_size;
+	*bits = new_bits;
+}
+
+/**
+ * Marks the given register as in use, growing the bit set if necessary
+ */
+static void pseudo_gen_set(C_MemoryAllocator *allocator, PseudoGenerator *generator, unsigned reg)
+{
+	unsigned i = reg / ESIZE;
+	unsigned j = reg % ESIZE;
+	grow_bits(allocator, &generator->bits, &generator->n_words, i);
+	generator->bits[i] |= (1ull << j);
+	assert(reg <= generator->max_reg);
+	if (reg == generator->max_reg)
+		generator->max_reg += 1;
+}
+
 /**
  * Allocate a register, if top is specified then ensure it is top of the
  * stack else look for a free register. Not the most efficient as we
  * don't yet use hardware intrinsics for bit scans.
  */
-static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
+static unsigned pseudo_gen_alloc(C_MemoryAllocator *allocator, PseudoGenerator *generator, bool top)
 {
 	unsigned reg;
 	if (top) {
@@ -152,13 +178,13 @@ static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
 		/* look for the first free reg */
 		reg = 0;
 		int is_set = 1;
-		for (int i = 0; is_set && i < N_WORDS; i++) {
+		for (unsigned i = 0; is_set && i < generator->n_words; i++) {
 			uint64_t bit = generator->bits[i];
 			if (bit == ~0ull) {
 				/* all bits set? skip */
 				reg += ESIZE;
 				continue;
-			} 
+			}
 			for (int j = 0; is_set && j < ESIZE; j++) {
 				is_set = (bit & (1ull << j)) != 0;
 				if (is_set)
@@ -166,12 +192,7 @@ static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
 			}
 		}
 	}
-	unsigned i = reg / ESIZE;
-	unsigned j = reg % ESIZE;
-	generator->bits[i] |= (1ull << j);
-	assert(reg <= generator->max_reg);
-	if (reg == generator->max_reg)
-		generator->max_reg += 1;
+	pseudo_gen_set(allocator, generator, reg);
 	return reg;
 }
 
@@ -237,9 +258,16 @@ static void check_regs_restored(Proc *proc, SavedRegs *saved_regs) {
  * allocating a new one, if top is set then ensure that the register is
  * top of the stack
  */
-static inline unsigned allocate_register(PseudoGenerator *generator, bool top)
+static unsigned allocate_register(Proc *proc, PseudoGenerator *generator, bool top)
 {
-	return pseudo_gen_alloc(generator, top);
+	unsigned reg = pseudo_gen_alloc(proc->linearizer->compiler_state->allocator, generator, top);
+	if (generator == &proc->local_pseudos || generator == &proc->temp_pseudos) {
+		if (raviX_max_reg(&proc->local_pseudos) + raviX_max_reg(&proc->temp_pseudos) > MAX_STACK_REGS)
+			handle_error(proc->linearizer->compiler_state, "function or expression needs too many registers");
+	} else if (reg >= MAX_TEMP_REGS) {
+		handle_error(proc->linearizer->compiler_state, "function or expression needs too many temporaries");
+	}
+	return reg;
 }
 
 /**
@@ -278,7 +306,7 @@ void raviX_destroy_linearizer(LinearizerState *linearizer)
 
 static void add_C_declaration(LinearizerState *linearizer, const StringObject *str)
 {
-	raviX_buffer_add_string(&linearizer->C_declarations, str->str);
+	raviX_buffer_add_bytes(&linearizer->C_declarations, str->str, str->len);
 }
 
 /**
@@ -442,6 +470,23 @@ Instruction *raviX_last_instruction(BasicBlock *block)
 	return (Instruction *)raviX_ptrlist_last((PtrList *)block->insns);
 }
 
+/*
+ * Returns the proc whose closures the local variable, or the local an upvalue refers to, holds.
+ * This is known if the local is initialized with a function expression and never assigned again.
+ */
+Proc *raviX_bound_proc(LinearizerState *linearizer, const LuaSymbol *symbol)
+{
+	if (symbol->symbol_type == SYM_UPVALUE)
+		symbol = symbol->upvalue.target_variable;
+	if (symbol->symbol_type != SYM_LOCAL || symbol->variable.modified ||
+	    symbol->variable.function_initializer == NULL)
+		return NULL;
+	uint32_t id = symbol->variable.function_initializer->function_expr.proc_id;
+	if (id == 0)
+		return NULL;
+	return (Proc *)raviX_ptrlist_nth_entry((PtrList *)linearizer->all_procs, id - 1);
+}
+
 /* allocates a pseudo to represent a symbol, if the symbol is local variable then
  * associates the pseudo to the symbol so that we can easily get to the pseudo
  * if we have the symbol */
@@ -469,6 +514,35 @@ static Pseudo *allocate_constant_pseudo(Proc *proc, const Constant *constant)
 	return pseudo;
 }
 
+static Pseudo *allocate_immediate_pseudo(Proc *proc, int value)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	Pseudo *pseudo = (Pseudo *) allocator->calloc(allocator->arena, 1, sizeof(Pseudo));
+	pseudo->type = PSEUDO_IMMEDIATE;
+	pseudo->immediate = value;
+	return pseudo;
+}
+
+/* Allocates a pseudo for an integer literal, adding the literal to the constant table if necessary */
+Pseudo *raviX_allocate_integer_constant_pseudo(Proc *proc, lua_Integer i)
+{
+	Constant c = {.type = RAVI_TNUMINT, .i = i};
+	return allocate_constant_pseudo(proc, add_constant(proc, &c));
+}
+
+/* Allocates a pseudo for a floating point literal, adding the literal to the constant table if necessary */
+Pseudo *raviX_allocate_float_constant_pseudo(Proc *proc, lua_Number n)
+{
+	Constant c = {.type = RAVI_TNUMFLT, .n = n};
+	return allocate_constant_pseudo(proc, add_constant(proc, &c));
+}
+
+/* Allocates a pseudo for a constant that may belong to another proc, adding it to the constant table if necessary */
+Pseudo *raviX_allocate_constant_pseudo(Proc *proc, const Constant *constant)
+{
+	return allocate_constant_pseudo(proc, add_constant(proc, constant));
+}
+
 static Pseudo *allocate_closure_pseudo(Proc *proc)
 {
 	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
@@ -496,6 +570,16 @@ static Pseudo *allocate_boolean_pseudo(Proc *proc, bool is_true)
 	return pseudo;
 }
 
+Pseudo *raviX_allocate_boolean_pseudo(Proc *proc, bool is_true)
+{
+	return allocate_boolean_pseudo(proc, is_true);
+}
+
+Pseudo *raviX_allocate_nil_pseudo(Proc *proc)
+{
+	return allocate_nil_pseudo(proc);
+}
+
 static Pseudo *allocate_block_pseudo(Proc *proc, BasicBlock *block)
 {
 	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
@@ -535,7 +619,7 @@ static Pseudo *allocate_temp_pseudo(Proc *proc, ravitype_t type, bool top)
 		pseudo_type = PSEUDO_TEMP_ANY;
 		break;
 	}
-	unsigned reg = allocate_register(gen, top);
+	unsigned reg = allocate_register(proc, gen, top);
 	Pseudo *pseudo = (Pseudo *) allocator->calloc(allocator->arena, 1, sizeof(Pseudo));
 	pseudo->type = pseudo_type;
 	pseudo->regnum = reg;
@@ -546,6 +630,63 @@ static Pseudo *allocate_temp_pseudo(Proc *proc, ravitype_t type, bool top)
 	return pseudo;
 }
 
+/*
+Allocates a numeric temp whose register has never been used in the proc, so that
+an optimization pass can introduce a value without disturbing existing temps.
+The register stays allocated. Returns NULL if the generator is exhausted.
+*/
+Pseudo *raviX_allocate_new_temp_pseudo(Proc *proc, ravitype_t type)
+{
+	assert(type == RAVI_TNUMINT || type == RAVI_TNUMFLT);
+	PseudoGenerator *gen = type == RAVI_TNUMINT ? &proc->temp_int_pseudos : &proc->temp_flt_pseudos;
+	unsigned reg = gen->max_reg;
+	if (reg >= MAX_TEMP_REGS)
+		return NULL;
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	pseudo_gen_set(allocator, gen, reg);
+	Pseudo *pseudo = (Pseudo *) allocator->calloc(allocator->arena, 1, sizeof(Pseudo));
+	pseudo->type = type == RAVI_TNUMINT ? PSEUDO_TEMP_INT : PSEUDO_TEMP_FLT;
+	pseudo->regnum = reg;
+	return pseudo;
+}
+
+/*
+Allocates a Lua stack slot for a compiler generated local variable of any type. The slot
+is never freed so the variable can hold a value for the whole proc. Returns NULL if the
+Lua frame would become too large.
+*/
+Pseudo *raviX_allocate_new_local_pseudo(Proc *proc, const StringObject *name)
+{
+	if (raviX_max_reg(&proc->local_pseudos) + raviX_max_reg(&proc->temp_pseudos) >= MAX_STACK_REGS)
+		return NULL;
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	LuaSymbol *sym = (LuaSymbol *) allocator->calloc(allocator->arena, 1, sizeof(LuaSymbol));
+	sym->symbol_type = SYM_LOCAL;
+	sym->variable.value_type.type_code = RAVI_TANY;
+	sym->variable.var_name = name;
+	sym->variable.block = proc->function_expr->function_expr.main_block;
+	unsigned reg = raviX_max_reg(&proc->local_pseudos);
+	pseudo_gen_set(allocator, &proc->local_pseudos, reg);
+	return allocate_symbol_pseudo(proc, sym, reg);
+}
+
+/*
+Extends the Lua stack temps so that registers 0..count-1 are all in use, allowing an
+optimization pass to place values in a region no other temp occupies. Returns false if
+the Lua frame would become too large.
+*/
+bool raviX_reserve_stack_temps(Proc *proc, unsigned count)
+{
+	if (count <= raviX_max_reg(&proc->temp_pseudos))
+		return true;
+	if (raviX_max_reg(&proc->local_pseudos) + count > MAX_STACK_REGS)
+		return false;
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	while (raviX_max_reg(&proc->temp_pseudos) < count)
+		pseudo_gen_set(allocator, &proc->temp_pseudos, raviX_max_reg(&proc->temp_pseudos));
+	return true;
+}
+
 /* Creates a range pseudo from a temp pesudo - marking the original as
  * freed
  */
@@ -561,6 +702,40 @@ static Pseudo *allocate_range_pseudo(Proc *proc, Pseudo *orig_pseudo)
 	return pseudo;
 }
 
+/* Returns true if the register is marked as picked from the range */
+static inline bool range_reg_in_use(const Pseudo *range_pseudo, unsigned regnum)
+{
+	unsigned i = regnum / ESIZE;
+	unsigned j = regnum % ESIZE;
+	return i < range_pseudo->range_in_use.n_words && (range_pseudo->range_in_use.bits[i] & (1ull << j)) != 0;
+}
+
+/* Returns true if no register of the range is picked */
+static inline bool range_not_in_use(const Pseudo *range_pseudo)
+{
+	for (unsigned i = 0; i < range_pseudo->range_in_use.n_words; i++) {
+		if (range_pseudo->range_in_use.bits[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+static void range_reg_set_in_use(C_MemoryAllocator *allocator, Pseudo *range_pseudo, unsigned regnum)
+{
+	unsigned i = regnum / ESIZE;
+	unsigned j = regnum % ESIZE;
+	grow_bits(allocator, &range_pseudo->range_in_use.bits, &range_pseudo->range_in_use.n_words, i);
+	range_pseudo->range_in_use.bits[i] |= (1ull << j);
+}
+
+static void range_reg_clear_in_use(Pseudo *range_pseudo, unsigned regnum)
+{
+	unsigned i = regnum / ESIZE;
+	unsigned j = regnum % ESIZE;
+	if (i < range_pseudo->range_in_use.n_words)
+		range_pseudo->range_in_use.bits[i] &= ~(1ull << j);
+}
+
 /*
 A PSEUDO_RANGE_SELECT picks or selects a particular offset in the range
 specified by a PSEUDO_RANGE. Pick of 0 means pick first value from the range.
@@ -572,18 +747,20 @@ Pseudo *raviX_allocate_range_select_pseudo(Proc *proc, Pseudo *range_pseudo, int
 	Pseudo *pseudo = (Pseudo *) allocator->calloc(allocator->arena, 1, sizeof(Pseudo));
 	pseudo->type = PSEUDO_RANGE_SELECT;
 	unsigned regnum = range_pseudo->regnum + pick;
-	unsigned regbit = (1u << regnum);
-	assert((range_pseudo->range_in_use & regbit) == 0);
+	assert(!range_reg_in_use(range_pseudo, regnum)); /* range_in_use is only an aid to catch misuse */
 	pseudo->regnum = regnum;
 	pseudo->range_pseudo = range_pseudo;
-	range_pseudo->range_in_use |= regbit;
+	range_reg_set_in_use(allocator, range_pseudo, regnum);
 	return pseudo;
 }
 
 static inline Pseudo *convert_range_to_temp(Pseudo *pseudo)
 {
 	assert(pseudo->type == PSEUDO_RANGE);
-	assert(pseudo->range_in_use == 0); // check no picks active on this range
+	assert(range_not_in_use(pseudo)); // check no picks active on this range
+	/* range_in_use shares storage with temp_for_local */
+	pseudo->range_in_use.bits = NULL;
+	pseudo->range_in_use.n_words = 0;
 	pseudo->type = PSEUDO_TEMP_ANY;
 	return pseudo;
 }
@@ -614,19 +791,17 @@ static void free_temp_pseudo(Proc *proc, Pseudo *pseudo, bool free_local)
 		gen = &proc->temp_pseudos;
 		if (pseudo->type == PSEUDO_RANGE) {
 			// all PSEUDO_RANGE_SELECT should have been freed if the range is being freed
-			assert(pseudo->range_in_use == 0);
+			assert(range_not_in_use(pseudo));
 		}
 		break;
 	case PSEUDO_INDEXED:
 		free_temp_pseudo(proc, pseudo->index_info.key, false);
 		free_temp_pseudo(proc, pseudo->index_info.container, false);
 		return;
-	case PSEUDO_RANGE_SELECT: {
-		unsigned regbit = (1u << pseudo->regnum);
+	case PSEUDO_RANGE_SELECT:
 		// mark the register as no longer used; its only 1 bit not a proper ref count
-		pseudo->range_pseudo->range_in_use &= ~regbit;
+		range_reg_clear_in_use(pseudo->range_pseudo, pseudo->regnum);
 		return;
-	}
 	default:
 		// Not a temp, so no need to do anything
 		return;
@@ -729,6 +904,15 @@ static void linearize_function_args(LinearizerState *linearizer)
 		/* The arg symbols already have register assigned by the local scope */
 		assert(sym->variable.pseudo); // We should already have a register assigned
 		instruct_totype(proc, sym->variable.pseudo, &sym->variable.value_type, func_expr->line_number);
+		ravitype_t type = sym->variable.value_type.type_code;
+		if (!sym->variable.escaped && (type == RAVI_TNUMINT || type == RAVI_TNUMFLT)) {
+			/* As with other numeric locals that do not escape, the rest of the function uses a
+			 * temp; the arg is copied into it once it has the right type */
+			Pseudo *pseudo = allocate_temp_pseudo(proc, type, true);
+			pseudo->temp_for_local = sym;
+			instruct_move(proc, op_mov, pseudo, sym->variable.pseudo, func_expr->line_number);
+			sym->variable.pseudo = pseudo;
+		}
 	}
 	END_FOR_EACH_PTR(sym)
 }
@@ -1311,6 +1495,41 @@ static Pseudo *indexed_load_from_global(Proc *proc, Pseudo *index_pseudo)
 	return target;
 }
 
+/*
+ * The index variable of a numeric for loop that is known to stay within the bounds of an array.
+ * Accesses to the array using the index are recorded as the loop body is linearized; they are
+ * only left unchecked if the body turns out not to assign to the index variable.
+ */
+struct ArrayIndexRange {
+	Pseudo *index;		/* pseudo of the loop's index variable */
+	const LuaSymbol *array; /* the array */
+	Instruction *index_init; /* the instruction that sets the index variable on each iteration */
+	InstructionList *accesses;
+	ArrayIndexRange *outer; /* range of an enclosing loop */
+};
+
+static void note_array_access(Proc *proc, Instruction *insn, const Pseudo *container, const Pseudo *key)
+{
+	if (container->type != PSEUDO_SYMBOL)
+		return;
+	switch (insn->opcode) {
+	case op_iaget_ikey:
+	case op_faget_ikey:
+	case op_iaput_ival:
+	case op_faput_fval:
+		break;
+	default:
+		return;
+	}
+	for (ArrayIndexRange *range = proc->array_index_ranges; range != NULL; range = range->outer) {
+		if (range->index == key && range->array == container->symbol) {
+			insn->key_in_bounds = 1;
+			raviX_ptrlist_add((PtrList **)&range->accesses, insn, proc->linearizer->compiler_state->allocator);
+			return;
+		}
+	}
+}
+
 static Pseudo *indexed_load(Proc *proc, Pseudo *index_pseudo)
 {
 	assert(index_pseudo->type == PSEUDO_INDEXED);
@@ -1355,6 +1574,7 @@ static Pseudo *indexed_load(Proc *proc, Pseudo *index_pseudo)
 		break;
 	}
 	Instruction *insn = allocate_instruction(proc, (enum opcode)op, line_number);
+	note_array_access(proc, insn, container_pseudo, key_pseudo);
 	Pseudo *tofree1 = add_instruction_operand(proc, insn, container_pseudo);
 	Pseudo *tofree2 = add_instruction_operand(proc, insn, key_pseudo);
 	free_temp_pseudo(proc, container_pseudo, false);
@@ -1461,6 +1681,7 @@ static void indexed_store(Proc *proc, Pseudo *index_pseudo, Pseudo *value_pseudo
 	assert(key_pseudo->type != PSEUDO_INDEXED);
 
 	Instruction *insn = allocate_instruction(proc, op, line_number);
+	note_array_access(proc, insn, container_pseudo, key_pseudo);
 	Pseudo *tofree = add_instruction_operand(proc, insn, value_pseudo);
 	add_instruction_target(proc, insn, container_pseudo);
 	add_instruction_target(proc, insn, key_pseudo);
@@ -1660,6 +1881,30 @@ static int linearize_indexed_assign(Proc *proc, Pseudo *table, ravitype_t table_
 	return next;
 }
 
+/*
+ * Records the number of list items and keyed items in the constructor as integer constant operands of the
+ * NEWTABLE instruction, so that the table can be created with the right size. A constructor without items
+ * gets no operands.
+ */
+static void add_table_size_hints(Proc *proc, Instruction *insn, AstNode *expr)
+{
+	int array_size = 0;
+	int hash_size = 0;
+	AstNode *ia;
+	FOR_EACH_PTR(expr->table_expr.expr_list, AstNode, ia)
+	{
+		if (ia->table_elem_assign_expr.key_expr)
+			hash_size++;
+		else
+			array_size++;
+	}
+	END_FOR_EACH_PTR(ia)
+	if (array_size == 0 && hash_size == 0)
+		return;
+	add_instruction_operand(proc, insn, allocate_immediate_pseudo(proc, array_size));
+	add_instruction_operand(proc, insn, allocate_immediate_pseudo(proc, hash_size));
+}
+
 static Pseudo *linearize_table_constructor(Proc *proc, AstNode *expr)
 {
 	/* constructor -> '{' [ field { sep field } [sep] ] '}' where sep -> ',' | ';' */
@@ -1670,6 +1915,8 @@ static Pseudo *linearize_table_constructor(Proc *proc, AstNode *expr)
 	else if (expr->table_expr.type.type_code == RAVI_TARRAYFLT)
 		op = op_newfarray;
 	Instruction *insn = allocate_instruction(proc, op, expr->line_number);
+	if (op == op_newtable)
+		add_table_size_hints(proc, insn, expr);
 	add_instruction_target(proc, insn, target);
 	add_instruction(proc, insn);
 
@@ -2498,6 +2745,74 @@ Lend:
 */
 //clang-format on
 
+/* Returns the local variable if the expression is just a reference to it */
+static LuaSymbol *local_variable_reference(AstNode *expr)
+{
+	if (expr->type == EXPR_SUFFIXED && expr->suffixed_expr.suffix_list == NULL)
+		expr = expr->suffixed_expr.primary_expr;
+	if (expr->type != EXPR_SYMBOL || expr->symbol_expr.var->symbol_type != SYM_LOCAL)
+		return NULL;
+	return expr->symbol_expr.var;
+}
+
+static bool is_nonnegative_integer_literal(AstNode *expr)
+{
+	return expr->type == EXPR_LITERAL && expr->literal_expr.type.type_code == RAVI_TNUMINT &&
+	       expr->literal_expr.u.i >= 0;
+}
+
+/*
+ * A loop with a positive step that starts at a non negative index and stops at #a or #a - k
+ * only visits valid indices of the array a, provided a is never reassigned; arrays do not shrink.
+ * Returns the array or NULL.
+ */
+static LuaSymbol *array_bounding_loop(AstNode *index_var_expr, AstNode *limit_expr)
+{
+	if (!is_nonnegative_integer_literal(index_var_expr))
+		return NULL;
+	if (limit_expr->type == EXPR_BINARY && limit_expr->binary_expr.binary_op == BINOPR_SUB &&
+	    is_nonnegative_integer_literal(limit_expr->binary_expr.expr_right))
+		limit_expr = limit_expr->binary_expr.expr_left;
+	if (limit_expr->type != EXPR_UNARY || limit_expr->unary_expr.unary_op != UNOPR_LEN)
+		return NULL;
+	LuaSymbol *array = local_variable_reference(limit_expr->unary_expr.expr);
+	if (array == NULL || array->variable.modified ||
+	    (array->variable.value_type.type_code != RAVI_TARRAYINT &&
+	     array->variable.value_type.type_code != RAVI_TARRAYFLT))
+		return NULL;
+	return array;
+}
+
+static bool assigns_to(Instruction *insn, Pseudo *var)
+{
+	PseudoList *updated = raviX_opcode_defines_targets(insn->opcode) ? insn->targets
+				: raviX_opcode_updates_in_place(insn->opcode) ? insn->operands : NULL;
+	Pseudo *pseudo;
+	FOR_EACH_PTR(updated, Pseudo, pseudo)
+	{
+		if (pseudo == var)
+			return true;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return false;
+}
+
+/* Checks whether the variable is assigned in the block or in any block created after first_block */
+static bool is_assigned_in_blocks(Proc *proc, BasicBlock *bb, nodeId_t first_block, Pseudo *var, Instruction *ignore)
+{
+	for (nodeId_t i = first_block; bb != NULL; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			if (insn != ignore && assigns_to(insn, var))
+				return true;
+		}
+		END_FOR_EACH_PTR(insn)
+		bb = i < proc->node_count ? proc->nodes[i] : NULL;
+	}
+	return false;
+}
+
 static void linearize_for_num_statement_positivestep(Proc *proc, AstNode *node)
 {
 	start_scope(proc->linearizer, proc, node->for_stmt.for_scope);
@@ -2563,10 +2878,28 @@ static void linearize_for_num_statement_positivestep(Proc *proc, AstNode *node)
 	start_block(proc, Lbody, node->line_number);
 	instruct_move(proc, op_mov, var_sym->variable.pseudo, index_var_pseudo, node->line_number);
 
+	ArrayIndexRange range = {.index = var_sym->variable.pseudo,
+				 .array = array_bounding_loop(index_var_expr, limit_expr),
+				 .index_init = raviX_last_instruction(Lbody),
+				 .outer = proc->array_index_ranges};
+	if (range.array != NULL && !var_sym->variable.escaped)
+		proc->array_index_ranges = &range;
+
 	start_scope(proc->linearizer, proc, node->for_stmt.for_body);
 	linearize_statement_list(proc, node->for_stmt.for_statement_list);
 	end_scope(proc->linearizer, proc, node->line_number);
 
+	if (proc->array_index_ranges == &range) {
+		proc->array_index_ranges = range.outer;
+		/* The index is only known to be in range if the body does not assign to it */
+		if (is_assigned_in_blocks(proc, Lbody, Lend->index + 1, range.index, range.index_init)) {
+			Instruction *insn;
+			FOR_EACH_PTR(range.accesses, Instruction, insn) { insn->key_in_bounds = 0; }
+			END_FOR_EACH_PTR(insn)
+		}
+		raviX_ptrlist_remove_all((PtrList **)&range.accesses);
+	}
+
 	/* If the fornum block has escaped local vars then we need to close */
 	if (proc->current_break_scope->need_close) {
 		/* Note we put close instruction in current basic block */
@@ -2944,6 +3277,11 @@ static BasicBlock *create_block(Proc *proc)
 	return new_block;
 }
 
+BasicBlock *raviX_create_block(Proc *proc)
+{
+	return create_block(proc);
+}
+
 /**
  * Takes a basic block as an argument and makes it the current block.
  *
@@ -2984,7 +3322,7 @@ static void start_scope(LinearizerState *linearizer, Proc *proc, Scope *scope)
 	FOR_EACH_PTR(scope->symbol_list, LuaSymbol, sym)
 	{
 		if (sym->symbol_type == SYM_LOCAL) {
-			uint8_t reg;
+			unsigned reg;
 			if (!sym->variable.escaped && !sym->variable.function_parameter &&
 			    (sym->variable.value_type.type_code == RAVI_TNUMFLT ||
 			     sym->variable.value_type.type_code == RAVI_TNUMINT)) {
@@ -2997,7 +3335,7 @@ static void start_scope(LinearizerState *linearizer, Proc *proc, Scope *scope)
 				pseudo->temp_for_local = sym; /* Note that this temp is for a local */
 			}
 			else {
-				reg = allocate_register(&proc->local_pseudos, true);
+				reg = allocate_register(proc, &proc->local_pseudos, true);
 				allocate_symbol_pseudo(proc, sym, reg);
 			}
 		}
@@ -3072,11 +3410,14 @@ void raviX_output_pseudo(const Pseudo *pseudo, TextBuffer *mb)
 			raviX_buffer_add_fstring(mb, "%lld", (long long)constant->i);
 			tc = "int";
 		} else {
-			raviX_buffer_add_fstring(mb, "'%s'", constant->s->str);
+			raviX_buffer_add_fstring(mb, "'%.*s'", (int)constant->s->len, constant->s->str);
 			tc = "s";
 		}
 		raviX_buffer_add_fstring(mb, " K%s(%d)", tc, pseudo->regnum);
 	} break;
+	case PSEUDO_IMMEDIATE:
+		raviX_buffer_add_fstring(mb, "Imm(%d)", pseudo->immediate);
+		break;
 	case PSEUDO_TEMP_INT:
 		raviX_buffer_add_fstring(mb, "Tint(%d)", pseudo->regnum);
 		break;
@@ -3107,24 +3448,27 @@ void raviX_output_pseudo(const Pseudo *pseudo, TextBuffer *mb)
 	case PSEUDO_SYMBOL:
 		switch (pseudo->symbol->symbol_type) {
 		case SYM_LOCAL: {
-			raviX_buffer_add_fstring(mb, "local(%s, %d)", pseudo->symbol->variable.var_name->str,
-						 pseudo->regnum);
+			raviX_buffer_add_fstring(mb, "local(%.*s, %d)", (int)pseudo->symbol->variable.var_name->len,
+						 pseudo->symbol->variable.var_name->str, pseudo->regnum);
 			break;
 		}
 		case SYM_UPVALUE: {
 			if (pseudo->symbol->upvalue.target_variable->symbol_type == SYM_LOCAL) {
-				raviX_buffer_add_fstring(mb, "Upval(%u, Proc%%%d, %s)", pseudo->regnum,
+				raviX_buffer_add_fstring(mb, "Upval(%u, Proc%%%d, %.*s)", pseudo->regnum,
 						 pseudo->symbol->upvalue.target_variable->variable.block->function->function_expr.proc_id,
+						 (int)pseudo->symbol->upvalue.target_variable->variable.var_name->len,
 						 pseudo->symbol->upvalue.target_variable->variable.var_name->str);
 			}
 			else if (pseudo->symbol->upvalue.target_variable->symbol_type == SYM_ENV) {
-				raviX_buffer_add_fstring(mb, "Upval(%s)", 
+				raviX_buffer_add_fstring(mb, "Upval(%.*s)",
+						 (int)pseudo->symbol->upvalue.target_variable->variable.var_name->len,
 						 pseudo->symbol->upvalue.target_variable->variable.var_name->str);
 			}
 			break;
 		}
 		case SYM_GLOBAL: {
-			raviX_buffer_add_string(mb, pseudo->symbol->variable.var_name->str);
+			raviX_buffer_add_bytes(mb, pseudo->symbol->variable.var_name->str,
+					       pseudo->symbol->variable.var_name->len);
 			break;
 		}
 		default:
@@ -3145,6 +3489,8 @@ void raviX_output_pseudo(const Pseudo *pseudo, TextBuffer *mb)
 		break;
 	}
 	}
+	if (pseudo->ssa_version)
+		raviX_buffer_add_fstring(mb, "#%u", pseudo->ssa_version);
 }
 
 // Simple optimization pass that replaces use of upvalues that point to literals
@@ -3223,7 +3569,7 @@ static const char *op_codenames[] = {
     "PUTik",	  "PUTsk",  "TPUT", "TPUTik", "TPUTsk",	    "IAPUT",	 "IAPUTiv",   "FAPUT",	   "FAPUTfv",
     "CBR",	  "BR",	    "MOV",  "MOVi",   "MOVif",	    "MOVf",	 "MOVfi",     "CALL",	   "GET",
     "GETik",	  "GETsk",  "TGET", "TGETik", "TGETsk",	    "IAGET",	 "IAGETik",   "FAGET",	   "FAGETik",
-    "STOREGLOBAL", "CLOSE", "CONCAT", "INIT", "C__UNSAFE",  "C__NEW"};
+    "STOREGLOBAL", "CLOSE", "CONCAT", "INIT", "C__UNSAFE",  "C__NEW",    "PHI"};
 
 static void output_pseudo_list(PseudoList *list, TextBuffer *mb)
 {
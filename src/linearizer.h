@@ -40,6 +40,7 @@ typedef struct Instruction Instruction;
 typedef struct BasicBlock BasicBlock;
 typedef struct Proc Proc;
 typedef struct Constant Constant;
+typedef struct ArrayIndexRange ArrayIndexRange;
 #ifndef RAVIX_GRAPH_DEFINED
 #define RAVIX_GRAPH_DEFINED
 typedef struct Graph Graph;
@@ -148,7 +149,8 @@ enum opcode {
 	op_concat,
 	op_init,
 	op_C__unsafe,
-	op_C__new
+	op_C__new,
+	op_phi /* SSA phi function, one operand per CFG predecessor in predecessor order; only present while in SSA form */
 	/* TODO need opcode for C declarations */
 };
 
@@ -177,9 +179,10 @@ enum PseudoType {
 	/* TODO we need a type for var args */
 	PSEUDO_LUASTACK, /* Specifies a Lua stack position - not used by linearizer - for use by codegen. This is
 			   relative to CI->func rather than 'base' */
-	PSEUDO_INDEXED    /* Index pseudo means that we have the key and container but we don't know how this will be used,
+	PSEUDO_INDEXED,   /* Index pseudo means that we have the key and container but we don't know how this will be used,
                              i.e. will it be a load or a store; all such pseudos should disappear by the time we get to
                              code generation */
+	PSEUDO_IMMEDIATE  /* An integer operand encoded in the instruction, not a Lua value, so not in the constant table */
 };
 
 /* structure to remember all the details re indexed load/store pending
@@ -202,16 +205,21 @@ typedef struct PseudoIndexInfo {
  */
 struct Pseudo {
 	unsigned type : 4, regnum : 16, freed : 1;
+	unsigned ssa_version; /* If non zero this pseudo is an SSA value (see ssa.c); values are numbered from 1 per proc */
 	union {
 		LuaSymbol *symbol;	   /* PSEUDO_SYMBOL */
 		const Constant *constant;  /* PSEUDO_CONSTANT */
 		LuaSymbol *temp_for_local; /* PSEUDO_TEMP - if the temp represents a local */
 		Proc *proc;		   /* PSEUDO_PROC */
 		BasicBlock *block;	   /* PSEUDO_BLOCK */
-		unsigned range_in_use;  /* PSEUDO_RANGE - a bitset tracking the regs that are in use from the range, used mainly to assert, can do ref counting, as only 1 bit per pick */
+		struct {
+			uint64_t *bits;   /* bitset indexed by register number */
+			unsigned n_words; /* size of bits array */
+		} range_in_use; /* PSEUDO_RANGE - a bitset tracking the regs that are in use from the range, used mainly to assert, can do ref counting, as only 1 bit per pick */
 		Pseudo *range_pseudo;	   /* PSEUDO_RANGE_SELECT */
 		int stackidx;		   /* PSEUDO_LUASTACK */
         PseudoIndexInfo index_info; /* PSEUDO_INDEXED */
+		int immediate;		   /* PSEUDO_IMMEDIATE */
 	};
 };
 
@@ -222,6 +230,7 @@ struct Pseudo {
  */
 struct Instruction {
 	unsigned opcode : 8;
+	unsigned key_in_bounds : 1; /* array access whose integer key is known to be a valid index, so needs no check */
 	PseudoList *operands;
 	PseudoList *targets;
 	BasicBlock *block; /* owning block, TODO do we need this anymore? */
@@ -239,11 +248,12 @@ struct BasicBlock {
 DECLARE_PTR_LIST(BasicBlockList, BasicBlock);
 
 /* Utility to allocate virtual registers; we use a bitset to track
- * registers in use.
+ * registers in use. The bitset grows on demand.
  * The max allocated register is tracked
  */
 typedef struct PseudoGenerator {
-	uint64_t bits[4]; /* bitset of registers */
+	uint64_t *bits;	  /* bitset of registers */
+	unsigned n_words; /* size of bits array */
 	unsigned max_reg;
 } PseudoGenerator;
 /* return the max reg ever allocated by this generator */
@@ -281,6 +291,7 @@ struct Proc {
 	BasicBlock *current_break_target; /* track the current break target, previous target must be saved /
 						     restored in stack discipline */
 	Scope *current_break_scope;	  /* as above track the block scope */
+	ArrayIndexRange *array_index_ranges; /* arrays that enclosing numeric for loops index within bounds */
 	PseudoGenerator local_pseudos;	  /* locals */
 	PseudoGenerator temp_int_pseudos; /* temporaries known to be integer type */
 	PseudoGenerator temp_flt_pseudos; /* temporaries known to be number type */
@@ -290,6 +301,7 @@ struct Proc {
 	uint16_t num_fltconstants;
 	uint16_t num_strconstants;
 	Graph *cfg;	   /* place holder for control flow graph; the linearizer does not create this */
+	unsigned num_ssa_values; /* Set while the proc is in SSA form; SSA values are numbered 1..num_ssa_values */
 	char funcname[30]; /* Each proc needs a name inside a C module - name is a short string */
 	void *userdata;	   /* For use by code generator */
 };
@@ -316,7 +328,23 @@ void raviX_output_instruction(Instruction *insn, TextBuffer *buffer);
 void raviX_output_basic_block_as_table(Proc *proc, BasicBlock *bb, TextBuffer *mb);
 // fix a range pseudo
 Pseudo *raviX_allocate_range_select_pseudo(Proc *proc, Pseudo *range_pseudo, int pick);
+// Allocate pseudos for literal values; used by optimizations that compute new constants
+Pseudo *raviX_allocate_integer_constant_pseudo(Proc *proc, lua_Integer i);
+Pseudo *raviX_allocate_float_constant_pseudo(Proc *proc, lua_Number n);
+Pseudo *raviX_allocate_boolean_pseudo(Proc *proc, bool is_true);
+Pseudo *raviX_allocate_nil_pseudo(Proc *proc);
+Pseudo *raviX_allocate_constant_pseudo(Proc *proc, const Constant *constant);
+// Allocate an integer or float temp that does not share its register with any other temp
+Pseudo *raviX_allocate_new_temp_pseudo(Proc *proc, ravitype_t type);
+// Allocate a local variable slot, not visible in the source, that lives for the whole proc
+Pseudo *raviX_allocate_new_local_pseudo(Proc *proc, const StringObject *name);
+// Mark the Lua stack temps below count as in use; false if the frame would be too large
+bool raviX_reserve_stack_temps(Proc *proc, unsigned count);
+// Append a new empty basic block to the proc
+BasicBlock *raviX_create_block(Proc *proc);
 
 Instruction *raviX_last_instruction(BasicBlock *block);
+// Find the proc that a local variable (or upvalue) is statically known to hold, or NULL
+Proc *raviX_bound_proc(LinearizerState *linearizer, const LuaSymbol *symbol);
 
 #endif
\ No newline at end of file
@@ -74,11 +74,11 @@ void raviX_buffer_reserve(TextBuffer *mb, size_t n)
 void raviX_buffer_free(TextBuffer *mb) { raviX_free(mb->buf); }
 void raviX_buffer_add_bytes(TextBuffer *mb, const char *str, size_t len)
 {
-	size_t required_size = mb->pos + len + 1; /* extra byte for NULL terminator */
-	raviX_buffer_resize(mb, required_size);
+	raviX_buffer_reserve(mb, len + 1); /* extra byte for NULL terminator */
 	assert(mb->capacity - mb->pos > len);
-	raviX_string_copy(&mb->buf[mb->pos], str, mb->capacity - mb->pos);
+	memcpy(&mb->buf[mb->pos], str, len);
 	mb->pos += len;
+	mb->buf[mb->pos] = 0;
 }
 void raviX_buffer_add_string(TextBuffer *mb, const char *str)
 {
@@ -0,0 +1,224 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Dead code elimination.
+ * Instructions that have no side effects are removed if none of their targets are live
+ * afterwards. Liveness is computed by df_liveness.c, so this works across blocks and loops.
+ * Instructions that may raise errors or invoke metamethods are never removed. Removing an
+ * instruction can make instructions in other blocks dead too, in which case liveness is recomputed
+ * and we repeat until nothing changes.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "df_liveness.h"
+#include "optimizer.h"
+
+static bool is_numeric_operand(const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_CONSTANT:
+		return pseudo->constant->type == RAVI_TNUMINT || pseudo->constant->type == RAVI_TNUMFLT;
+	case PSEUDO_TEMP_INT:
+	case PSEUDO_TEMP_FLT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_integer_operand(const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_CONSTANT:
+		return pseudo->constant->type == RAVI_TNUMINT;
+	case PSEUDO_TEMP_INT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool all_operands(const Instruction *insn, bool (*predicate)(const Pseudo *))
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		if (!predicate(pseudo))
+			return false;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return true;
+}
+
+/* Can the instruction be removed if its result is not used? */
+static bool has_no_side_effects(const Instruction *insn)
+{
+	switch (insn->opcode) {
+	case op_addff:
+	case op_addfi:
+	case op_addii:
+	case op_subff:
+	case op_subfi:
+	case op_subif:
+	case op_subii:
+	case op_mulff:
+	case op_mulfi:
+	case op_mulii:
+	case op_divff:
+	case op_divfi:
+	case op_divif:
+	case op_divii:
+	case op_bandii:
+	case op_borii:
+	case op_bxorii:
+	case op_shlii:
+	case op_shrii:
+	case op_eqii:
+	case op_eqff:
+	case op_ltii:
+	case op_ltff:
+	case op_leii:
+	case op_leff:
+	case op_unmi:
+	case op_unmf:
+	case op_not:
+	case op_mov:
+	case op_movi:
+	case op_movf:
+	case op_newtable:
+	case op_newiarray:
+	case op_newfarray:
+		return true;
+	case op_movif:
+		/* Converting an integer to a float cannot fail */
+		return all_operands(insn, is_integer_operand);
+	case op_add:
+	case op_sub:
+	case op_mul:
+	case op_div:
+	case op_pow:
+	case op_eq:
+	case op_lt:
+	case op_le:
+	case op_unm:
+		/* Only numbers are guaranteed not to invoke metamethods */
+		return all_operands(insn, is_numeric_operand);
+	case op_band:
+	case op_bor:
+	case op_bxor:
+	case op_shl:
+	case op_shr:
+	case op_bnot:
+		/* Bitwise operations on floats raise an error if the value has no integer representation */
+		return all_operands(insn, is_integer_operand);
+	default:
+		/* Note that idiv and mod can raise division by zero, and type assertions raise errors */
+		return false;
+	}
+}
+
+static bool is_dead(LivenessData *liveness_data, const Instruction *insn, BitSet *live)
+{
+	if (!has_no_side_effects(insn))
+		return false;
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		int var = raviX_liveness_variable(liveness_data, pseudo);
+		if (var < 0 || raviX_bitset_bit_p(live, var))
+			return false;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return true;
+}
+
+/*
+ * Removes dead instructions in the block, walking backwards from the end of the block so that
+ * instructions only feeding removed ones are removed too. Returns true if a removed instruction
+ * used a variable that is live on entry to the block, as definitions in other blocks may now be dead.
+ */
+static bool process_block(LivenessData *liveness_data, C_MemoryAllocator *allocator, BasicBlock *bb)
+{
+	BitSet live, uses;
+	InstructionList *reversed = NULL; /* the instructions we keep, in reverse order */
+	bool removed = false, live_in_changed = false;
+	raviX_bitset_create(&live);
+	raviX_bitset_create(&uses);
+	raviX_bitset_copy(&live, raviX_live_out(liveness_data, bb->index));
+	Instruction *insn;
+	FOR_EACH_PTR_REVERSE(bb->insns, Instruction, insn)
+	{
+		if (is_dead(liveness_data, insn, &live)) {
+			removed = true;
+			if (!live_in_changed) {
+				raviX_bitset_clear(&uses);
+				raviX_live_before_instruction(liveness_data, insn, &uses);
+				live_in_changed = raviX_bitset_intersect_p(&uses, raviX_live_in(liveness_data, bb->index));
+			}
+			continue;
+		}
+		raviX_live_before_instruction(liveness_data, insn, &live);
+		raviX_ptrlist_add((PtrList **)&reversed, insn, allocator);
+	}
+	END_FOR_EACH_PTR_REVERSE(insn)
+	if (removed) {
+		raviX_ptrlist_remove_all((PtrList **)&bb->insns);
+		FOR_EACH_PTR_REVERSE(reversed, Instruction, insn)
+		{
+			raviX_ptrlist_add((PtrList **)&bb->insns, insn, allocator);
+		}
+		END_FOR_EACH_PTR_REVERSE(insn)
+	}
+	raviX_ptrlist_remove_all((PtrList **)&reversed);
+	raviX_bitset_destroy(&uses);
+	raviX_bitset_destroy(&live);
+	return live_in_changed;
+}
+
+static void process_proc(Proc *proc)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		LivenessData *liveness_data = raviX_compute_liveness(proc);
+		for (unsigned i = 0; i < proc->node_count; i++) {
+			changed |= process_block(liveness_data, allocator, proc->nodes[i]);
+		}
+		raviX_destroy_liveness(liveness_data);
+	}
+}
+
+int raviX_remove_dead_code(LinearizerState *linearizer)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		if (proc->cfg != NULL && proc->num_ssa_values == 0)
+			process_proc(proc);
+	}
+	END_FOR_EACH_PTR(proc)
+	return 0;
+}
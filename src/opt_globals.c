@@ -0,0 +1,274 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Caching of global variables.
+ * This pass is only correct if globals are stable: a global that the chunk reads must not be
+ * changed by code outside the chunk, e.g. by a called function, while a proc that reads it is
+ * running. With that assumption, a global that is not assigned anywhere in the chunk has the
+ * same value throughout each call of a proc. If one of the loads of such a global dominates all
+ * the others, its value is also copied into a Lua stack slot reserved for the global, and the
+ * other loads become copies of the slot. The dominating load stays where it is, so no global is
+ * read on a path where the original code did not read it, and an __index metamethod on _ENV
+ * runs no earlier than before. Nothing is done if the chunk assigns to _ENV, indexes it other
+ * than to load or store a global, or refers to _G, as globals could then be changed through a
+ * table store that the pass cannot attribute to a name.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "dominator.h"
+#include "graph.h"
+#include "optimizer.h"
+
+#include <string.h>
+
+typedef struct CachedGlobal {
+	const LuaSymbol *env;	    /* _ENV upvalue of the proc */
+	const StringObject *name;   /* name of the global */
+	Instruction *first_load;    /* load that dominates all the others */
+	unsigned num_loads;
+	bool no_dominating_load;    /* no load dominates all the others */
+} CachedGlobal;
+
+DECLARE_ARRAY(CachedGlobalArray, CachedGlobal);
+DECLARE_ARRAY(NameArray, const StringObject *);
+
+static const StringObject *global_name(const Pseudo *pseudo)
+{
+	assert(pseudo->type == PSEUDO_CONSTANT && pseudo->constant->type == RAVI_TSTRING);
+	return pseudo->constant->s;
+}
+
+static const StringObject *symbol_name(const LuaSymbol *symbol)
+{
+	if (symbol->symbol_type == SYM_UPVALUE)
+		return symbol->upvalue.target_variable->variable.var_name;
+	return symbol->variable.var_name;
+}
+
+static bool is_env(const Pseudo *pseudo)
+{
+	return pseudo->type == PSEUDO_SYMBOL && raviX_string_equals(symbol_name(pseudo->symbol), "_ENV");
+}
+
+static bool contains_name(const NameArray *names, const StringObject *name)
+{
+	for (unsigned i = 0; i < names->count; i++) {
+		if (names->data[i] == name)
+			return true;
+	}
+	return false;
+}
+
+/* Says whether the pseudo at position idx of the list is _ENV */
+static bool is_env_at(PseudoList *list, int idx)
+{
+	return is_env((Pseudo *)raviX_ptrlist_nth_entry((PtrList *)list, idx));
+}
+
+/*
+ * Collects the globals assigned anywhere in the chunk. Returns false if globals may be changed in a
+ * way that does not name them: _ENV is assigned or used other than to load or store a global, or _G
+ * is loaded.
+ */
+static bool find_stored_globals(LinearizerState *linearizer, NameArray *stored)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		for (unsigned i = 0; i < proc->node_count; i++) {
+			Instruction *insn;
+			FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+			{
+				Pseudo *pseudo;
+				if (insn->opcode == op_storeglobal) {
+					const StringObject *name =
+					    global_name((Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->targets, 1));
+					if (!contains_name(stored, name))
+						array_push(stored, const StringObject *, name);
+					FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+					{
+						if (is_env(pseudo))
+							return false;
+					}
+					END_FOR_EACH_PTR(pseudo)
+					continue;
+				}
+				if (insn->opcode == op_loadglobal) {
+					if (raviX_string_equals(
+						global_name((Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 1)), "_G") ||
+					    is_env_at(insn->targets, 0))
+						return false;
+					continue;
+				}
+				FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+				{
+					if (is_env(pseudo))
+						return false;
+				}
+				END_FOR_EACH_PTR(pseudo)
+				FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+				{
+					if (is_env(pseudo))
+						return false;
+				}
+				END_FOR_EACH_PTR(pseudo)
+			}
+			END_FOR_EACH_PTR(insn)
+		}
+	}
+	END_FOR_EACH_PTR(proc)
+	return true;
+}
+
+/* Returns true if instruction a is executed before instruction b on every path that reaches b */
+static bool insn_dominates(DominatorTree *tree, Instruction *a, Instruction *b)
+{
+	if (a->block != b->block)
+		return raviX_dominates(tree, a->block->index, b->block->index);
+	Instruction *insn;
+	FOR_EACH_PTR(a->block->insns, Instruction, insn)
+	{
+		if (insn == a)
+			return true;
+		if (insn == b)
+			return false;
+	}
+	END_FOR_EACH_PTR(insn)
+	return false;
+}
+
+static void add_load(CachedGlobalArray *globals, DominatorTree *tree, Instruction *insn)
+{
+	const LuaSymbol *env = ((Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 0))->symbol;
+	const StringObject *name = global_name((Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 1));
+	for (unsigned i = 0; i < globals->count; i++) {
+		CachedGlobal *global = &globals->data[i];
+		if (global->env == env && global->name == name) {
+			global->num_loads++;
+			/* If the new load dominates the old candidate it dominates all the earlier loads too */
+			if (insn_dominates(tree, insn, global->first_load))
+				global->first_load = insn;
+			else if (!insn_dominates(tree, global->first_load, insn))
+				global->no_dominating_load = true;
+			return;
+		}
+	}
+	CachedGlobal global = {.env = env, .name = name, .first_load = insn, .num_loads = 1};
+	array_push(globals, CachedGlobal, global);
+}
+
+/* Rewrites the loads of the global other than the first as copies of the stack slot that caches it */
+static void replace_loads(Proc *proc, CachedGlobal *global, Pseudo *slot)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+		{
+			if (insn->opcode != op_loadglobal || insn == global->first_load)
+				continue;
+			Pseudo *env = (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 0);
+			Pseudo *name = (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 1);
+			if (env->type != PSEUDO_SYMBOL || env->symbol != global->env || global_name(name) != global->name)
+				continue;
+			insn->opcode = op_mov;
+			raviX_ptrlist_remove_all((PtrList **)&insn->operands);
+			raviX_ptrlist_add((PtrList **)&insn->operands, slot, allocator);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+}
+
+/* Copies the value of the first load into the slot, right after the load */
+static void fill_slot(Proc *proc, CachedGlobal *global, Pseudo *slot)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	Instruction *load = global->first_load;
+	Instruction *copy = (Instruction *)allocator->calloc(allocator->arena, 1, sizeof(Instruction));
+	copy->opcode = op_mov;
+	copy->block = load->block;
+	copy->line_number = load->line_number;
+	raviX_ptrlist_add((PtrList **)&copy->operands, raviX_ptrlist_nth_entry((PtrList *)load->targets, 0),
+			  allocator);
+	raviX_ptrlist_add((PtrList **)&copy->targets, slot, allocator);
+	InstructionList *insns = NULL;
+	Instruction *insn;
+	FOR_EACH_PTR(load->block->insns, Instruction, insn)
+	{
+		raviX_ptrlist_add((PtrList **)&insns, insn, allocator);
+		if (insn == load)
+			raviX_ptrlist_add((PtrList **)&insns, copy, allocator);
+	}
+	END_FOR_EACH_PTR(insn)
+	load->block->insns = insns;
+}
+
+static void process_proc(Proc *proc, const NameArray *stored)
+{
+	CachedGlobalArray globals = {0};
+	DominatorTree *tree = raviX_new_dominator_tree(proc->cfg);
+	raviX_calculate_dominator_tree(tree);
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+		{
+			if (insn->opcode != op_loadglobal)
+				continue;
+			Pseudo *env = (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 0);
+			if (env->type != PSEUDO_SYMBOL || env->symbol->symbol_type != SYM_UPVALUE)
+				continue;
+			add_load(&globals, tree, insn);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	for (unsigned i = 0; i < globals.count; i++) {
+		CachedGlobal *global = &globals.data[i];
+		if (global->num_loads < 2 || global->no_dominating_load || contains_name(stored, global->name))
+			continue;
+		Pseudo *slot = raviX_allocate_new_local_pseudo(proc, global->name);
+		if (slot == NULL)
+			break;
+		replace_loads(proc, global, slot);
+		fill_slot(proc, global, slot);
+	}
+	raviX_destroy_dominator_tree(tree);
+	array_clearmem(&globals);
+}
+
+int raviX_cache_globals(LinearizerState *linearizer)
+{
+	NameArray stored = {0};
+	if (find_stored_globals(linearizer, &stored)) {
+		Proc *proc;
+		FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+		{
+			if (proc->cfg != NULL && proc->num_ssa_values == 0)
+				process_proc(proc, &stored);
+		}
+		END_FOR_EACH_PTR(proc)
+	}
+	array_clearmem(&stored);
+	return 0;
+}
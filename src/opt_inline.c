@@ -0,0 +1,598 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Inlining of small local functions.
+ * A call is inlined when the called function is known statically: the callee is a local (or an
+ * upvalue referring to a local) that is initialized with a closure and never assigned again. The
+ * callee must be small, must not be recursive, must not take varargs, create closures or embed C
+ * code, and must return a fixed number of values. The callee's blocks are copied into the caller;
+ * the arguments are moved into Lua stack slots reserved in the caller for the callee's locals, and
+ * each return becomes a move of the return values into the registers where the call would have
+ * placed its results, followed by a jump to the instructions after the call.
+ * Callee temps that live on the Lua stack are placed above the caller's temps and the call's
+ * results, numeric temps are given fresh C variables in the caller.
+ * The pass runs on the linear IR before SSA construction; the CFGs are rebuilt afterwards.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "bitset.h"
+#include "cfg.h"
+#include "graph.h"
+#include "optimizer.h"
+
+#include <string.h>
+
+enum { MAX_INLINE_INSNS = 40 };
+
+/* What the caller needs in order to receive a copy of the callee */
+typedef struct InlinedProc {
+	Proc *callee;
+	bool failed;		/* callee cannot be inlined into this caller */
+	unsigned stack_temps;	/* Lua stack temps used by the callee, including call results */
+	unsigned num_locals;
+	unsigned num_int_temps;
+	unsigned num_flt_temps;
+	Pseudo **locals;	/* caller stack slot for each callee local */
+	Pseudo **int_temps;	/* caller C variable for each callee integer temp */
+	Pseudo **flt_temps;	/* caller C variable for each callee float temp */
+	Pseudo **upvalues;	/* caller pseudo for each callee upvalue */
+	const StringObject **local_names;
+} InlinedProc;
+
+DECLARE_ARRAY(InlinedProcArray, InlinedProc *);
+
+typedef struct Inliner {
+	Proc *proc;			/* the caller */
+	C_MemoryAllocator *allocator;
+	InlinedProcArray inlined;
+	BitSet visited;			/* blocks created by the pass, these are not searched for calls */
+	unsigned num_temps;		/* number of Lua stack temps of the caller before inlining */
+	Instruction **last_def;		/* instruction that last set each Lua stack temp of the caller */
+} Inliner;
+
+static Pseudo *get_operand(Instruction *insn, unsigned idx)
+{
+	return (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, idx);
+}
+
+static Pseudo *get_target(Instruction *insn, unsigned idx)
+{
+	return (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->targets, idx);
+}
+
+/* Returns the local symbol that a symbol pseudo refers to directly or as an upvalue */
+static const LuaSymbol *referenced_local(const Pseudo *pseudo)
+{
+	if (pseudo->type != PSEUDO_SYMBOL)
+		return NULL;
+	if (pseudo->symbol->symbol_type == SYM_LOCAL)
+		return pseudo->symbol;
+	if (pseudo->symbol->symbol_type == SYM_UPVALUE &&
+	    pseudo->symbol->upvalue.target_variable->symbol_type == SYM_LOCAL)
+		return pseudo->symbol->upvalue.target_variable;
+	return NULL;
+}
+
+/* Remembers the instruction that last set each Lua stack temp in the block */
+static void note_definition(Inliner *inliner, Instruction *insn)
+{
+	if (insn->opcode == op_call) {
+		/* The call sets its results and may overwrite anything above the function */
+		unsigned base = get_target(insn, 0)->regnum;
+		for (unsigned reg = base; reg < inliner->num_temps; reg++)
+			inliner->last_def[reg] = insn;
+		return;
+	}
+	if (!raviX_opcode_defines_targets(insn->opcode))
+		return;
+	Pseudo *target;
+	FOR_EACH_PTR(insn->targets, Pseudo, target)
+	{
+		if ((target->type == PSEUDO_TEMP_ANY || target->type == PSEUDO_RANGE) &&
+		    target->regnum < inliner->num_temps)
+			inliner->last_def[target->regnum] = insn;
+	}
+	END_FOR_EACH_PTR(target)
+}
+
+static bool check_pseudo(Inliner *inliner, InlinedProc *inlined, const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_SYMBOL:
+		if (pseudo->symbol->symbol_type == SYM_LOCAL) {
+			if (pseudo->regnum >= inlined->num_locals)
+				return false;
+			if (inlined->local_names[pseudo->regnum] == NULL)
+				inlined->local_names[pseudo->regnum] = pseudo->symbol->variable.var_name;
+			return true;
+		}
+		if (pseudo->symbol->symbol_type == SYM_UPVALUE) {
+			/* A function that refers to its own closure may be recursive */
+			return raviX_bound_proc(inliner->proc->linearizer, pseudo->symbol) != inlined->callee;
+		}
+		return false;
+	case PSEUDO_TEMP_ANY:
+	case PSEUDO_RANGE:
+	case PSEUDO_RANGE_SELECT:
+		if (pseudo->regnum + 1 > inlined->stack_temps)
+			inlined->stack_temps = pseudo->regnum + 1;
+		return true;
+	case PSEUDO_TEMP_INT:
+	case PSEUDO_TEMP_BOOL:
+		return pseudo->regnum < inlined->num_int_temps;
+	case PSEUDO_TEMP_FLT:
+		return pseudo->regnum < inlined->num_flt_temps;
+	case PSEUDO_CONSTANT:
+	case PSEUDO_IMMEDIATE:
+	case PSEUDO_NIL:
+	case PSEUDO_TRUE:
+	case PSEUDO_FALSE:
+	case PSEUDO_BLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool check_instruction(Inliner *inliner, InlinedProc *inlined, Instruction *insn)
+{
+	switch (insn->opcode) {
+	case op_closure:
+	case op_close:
+	case op_C__unsafe:
+	case op_C__new:
+	case op_phi:
+		return false;
+	default:
+		break;
+	}
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		/* The caller wants a fixed number of results */
+		if (insn->opcode == op_ret && pseudo->type == PSEUDO_RANGE)
+			return false;
+		if (!check_pseudo(inliner, inlined, pseudo))
+			return false;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		if (!check_pseudo(inliner, inlined, pseudo))
+			return false;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	if (insn->opcode == op_call) {
+		/* Results are placed from the function's register onwards */
+		Pseudo *results = get_target(insn, 0);
+		lua_Integer n = get_target(insn, 1)->constant->i;
+		if (n > 0 && results->regnum + n > inlined->stack_temps)
+			inlined->stack_temps = results->regnum + (unsigned)n;
+	}
+	return true;
+}
+
+/* Checks that the callee is small and only uses features that can be copied into the caller */
+static bool check_callee(Inliner *inliner, InlinedProc *inlined)
+{
+	Proc *callee = inlined->callee;
+	if (callee == inliner->proc || callee->function_expr->function_expr.is_vararg)
+		return false;
+	LuaSymbol *sym;
+	unsigned reg = 0;
+	FOR_EACH_PTR(callee->function_expr->function_expr.args, LuaSymbol, sym)
+	{
+		/* The parameters occupy the first local slots */
+		if (reg >= inlined->num_locals)
+			return false;
+		inlined->local_names[reg++] = sym->variable.var_name;
+	}
+	END_FOR_EACH_PTR(sym)
+	unsigned num_insns = 0;
+	for (unsigned i = 0; i < callee->node_count; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(callee->nodes[i]->insns, Instruction, insn)
+		{
+			if (++num_insns > MAX_INLINE_INSNS || !check_instruction(inliner, inlined, insn))
+				return false;
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	return true;
+}
+
+/* Returns the caller's pseudo for a variable that the callee accesses as an upvalue */
+static Pseudo *map_upvalue(Inliner *inliner, LuaSymbol *upvalue)
+{
+	LuaSymbol *var = upvalue->upvalue.target_variable;
+	AstNode *function_expr = inliner->proc->function_expr;
+	if (var->symbol_type == SYM_LOCAL && var->variable.block->function == function_expr) {
+		if (var->variable.pseudo == NULL || var->variable.pseudo->type != PSEUDO_SYMBOL)
+			return NULL;
+		return var->variable.pseudo;
+	}
+	LuaSymbol *sym;
+	FOR_EACH_PTR(function_expr->function_expr.upvalues, LuaSymbol, sym)
+	{
+		if (sym->upvalue.target_variable == var) {
+			Pseudo *pseudo = (Pseudo *)inliner->allocator->calloc(inliner->allocator->arena, 1, sizeof(Pseudo));
+			pseudo->type = PSEUDO_SYMBOL;
+			pseudo->symbol = sym;
+			pseudo->regnum = sym->upvalue.upvalue_index;
+			return pseudo;
+		}
+	}
+	END_FOR_EACH_PTR(sym)
+	return NULL;
+}
+
+/* Allocates the caller's slots and temps for the callee's variables */
+static bool map_variables(Inliner *inliner, InlinedProc *inlined)
+{
+	Proc *proc = inliner->proc;
+	for (unsigned reg = 0; reg < inlined->num_locals; reg++) {
+		if (inlined->local_names[reg] == NULL)
+			continue;
+		inlined->locals[reg] = raviX_allocate_new_local_pseudo(proc, inlined->local_names[reg]);
+		if (inlined->locals[reg] == NULL)
+			return false;
+	}
+	for (unsigned reg = 0; reg < inlined->num_int_temps; reg++) {
+		inlined->int_temps[reg] = raviX_allocate_new_temp_pseudo(proc, RAVI_TNUMINT);
+		if (inlined->int_temps[reg] == NULL)
+			return false;
+	}
+	for (unsigned reg = 0; reg < inlined->num_flt_temps; reg++) {
+		inlined->flt_temps[reg] = raviX_allocate_new_temp_pseudo(proc, RAVI_TNUMFLT);
+		if (inlined->flt_temps[reg] == NULL)
+			return false;
+	}
+	LuaSymbol *sym;
+	FOR_EACH_PTR(inlined->callee->function_expr->function_expr.upvalues, LuaSymbol, sym)
+	{
+		inlined->upvalues[sym->upvalue.upvalue_index] = map_upvalue(inliner, sym);
+		if (inlined->upvalues[sym->upvalue.upvalue_index] == NULL)
+			return false;
+	}
+	END_FOR_EACH_PTR(sym)
+	return true;
+}
+
+static InlinedProc *get_inlined_proc(Inliner *inliner, Proc *callee)
+{
+	for (unsigned i = 0; i < inliner->inlined.count; i++) {
+		if (inliner->inlined.data[i]->callee == callee)
+			return inliner->inlined.data[i];
+	}
+	C_MemoryAllocator *allocator = inliner->allocator;
+	InlinedProc *inlined = (InlinedProc *)allocator->calloc(allocator->arena, 1, sizeof(InlinedProc));
+	inlined->callee = callee;
+	inlined->num_locals = raviX_max_reg(&callee->local_pseudos);
+	inlined->num_int_temps = raviX_max_reg(&callee->temp_int_pseudos);
+	inlined->num_flt_temps = raviX_max_reg(&callee->temp_flt_pseudos);
+	unsigned num_upvalues = raviX_ptrlist_size((PtrList *)callee->function_expr->function_expr.upvalues);
+	inlined->local_names = (const StringObject **)allocator->calloc(allocator->arena, inlined->num_locals + 1,
+									 sizeof(const StringObject *));
+	inlined->locals = (Pseudo **)allocator->calloc(allocator->arena, inlined->num_locals + 1, sizeof(Pseudo *));
+	inlined->int_temps =
+	    (Pseudo **)allocator->calloc(allocator->arena, inlined->num_int_temps + 1, sizeof(Pseudo *));
+	inlined->flt_temps =
+	    (Pseudo **)allocator->calloc(allocator->arena, inlined->num_flt_temps + 1, sizeof(Pseudo *));
+	inlined->upvalues = (Pseudo **)allocator->calloc(allocator->arena, num_upvalues + 1, sizeof(Pseudo *));
+	inlined->failed = !check_callee(inliner, inlined) || !map_variables(inliner, inlined);
+	array_push(&inliner->inlined, InlinedProc *, inlined);
+	return inlined;
+}
+
+static Pseudo *copy_pseudo(Inliner *inliner, const Pseudo *pseudo)
+{
+	Pseudo *copy = (Pseudo *)inliner->allocator->calloc(inliner->allocator->arena, 1, sizeof(Pseudo));
+	memcpy(copy, pseudo, sizeof(Pseudo));
+	copy->ssa_version = 0;
+	return copy;
+}
+
+/* Translates a pseudo of the callee to the caller */
+static Pseudo *map_pseudo(Inliner *inliner, InlinedProc *inlined, unsigned base, BasicBlock **blocks,
+			  const Pseudo *pseudo)
+{
+	Pseudo *copy;
+	switch (pseudo->type) {
+	case PSEUDO_SYMBOL:
+		if (pseudo->symbol->symbol_type == SYM_LOCAL)
+			return copy_pseudo(inliner, inlined->locals[pseudo->regnum]);
+		return copy_pseudo(inliner, inlined->upvalues[pseudo->symbol->upvalue.upvalue_index]);
+	case PSEUDO_TEMP_INT:
+	case PSEUDO_TEMP_BOOL:
+		copy = copy_pseudo(inliner, inlined->int_temps[pseudo->regnum]);
+		copy->type = pseudo->type;
+		return copy;
+	case PSEUDO_TEMP_FLT:
+		return copy_pseudo(inliner, inlined->flt_temps[pseudo->regnum]);
+	case PSEUDO_TEMP_ANY:
+	case PSEUDO_RANGE:
+		copy = copy_pseudo(inliner, pseudo);
+		copy->regnum += base;
+		return copy;
+	case PSEUDO_RANGE_SELECT:
+		copy = copy_pseudo(inliner, pseudo);
+		copy->regnum += base;
+		copy->range_pseudo = map_pseudo(inliner, inlined, base, blocks, pseudo->range_pseudo);
+		return copy;
+	case PSEUDO_CONSTANT:
+		return raviX_allocate_constant_pseudo(inliner->proc, pseudo->constant);
+	case PSEUDO_IMMEDIATE:
+		return copy_pseudo(inliner, pseudo);
+	case PSEUDO_BLOCK:
+		copy = copy_pseudo(inliner, pseudo);
+		copy->block = blocks[pseudo->block->index];
+		assert(copy->block != NULL);
+		return copy;
+	default:
+		assert(pseudo->type == PSEUDO_NIL || pseudo->type == PSEUDO_TRUE || pseudo->type == PSEUDO_FALSE);
+		copy = copy_pseudo(inliner, pseudo);
+		copy->proc = inliner->proc;
+		return copy;
+	}
+}
+
+static Instruction *add_instruction(Inliner *inliner, BasicBlock *bb, enum opcode op, unsigned line_number)
+{
+	C_MemoryAllocator *allocator = inliner->allocator;
+	Instruction *insn = (Instruction *)allocator->calloc(allocator->arena, 1, sizeof(Instruction));
+	insn->opcode = op;
+	insn->line_number = line_number;
+	insn->block = bb;
+	raviX_ptrlist_add((PtrList **)&bb->insns, insn, allocator);
+	return insn;
+}
+
+static void add_move(Inliner *inliner, BasicBlock *bb, Pseudo *src, Pseudo *dst, unsigned line_number)
+{
+	Instruction *insn = add_instruction(inliner, bb, op_mov, line_number);
+	raviX_ptrlist_add((PtrList **)&insn->operands, src, inliner->allocator);
+	raviX_ptrlist_add((PtrList **)&insn->targets, dst, inliner->allocator);
+}
+
+static void add_branch(Inliner *inliner, BasicBlock *bb, BasicBlock *target, unsigned line_number)
+{
+	Pseudo *pseudo = (Pseudo *)inliner->allocator->calloc(inliner->allocator->arena, 1, sizeof(Pseudo));
+	pseudo->type = PSEUDO_BLOCK;
+	pseudo->block = target;
+	Instruction *insn = add_instruction(inliner, bb, op_br, line_number);
+	raviX_ptrlist_add((PtrList **)&insn->targets, pseudo, inliner->allocator);
+}
+
+static Pseudo *new_pseudo(Inliner *inliner, enum PseudoType type, unsigned regnum)
+{
+	Pseudo *pseudo = (Pseudo *)inliner->allocator->calloc(inliner->allocator->arena, 1, sizeof(Pseudo));
+	pseudo->type = type;
+	pseudo->regnum = regnum;
+	if (type == PSEUDO_NIL)
+		pseudo->proc = inliner->proc;
+	return pseudo;
+}
+
+/* Returns from the copy of the callee: the return values are moved to where the call would have put them */
+static void copy_return(Inliner *inliner, InlinedProc *inlined, unsigned base, BasicBlock **blocks, BasicBlock *bb,
+			Instruction *ret, Instruction *call, BasicBlock *continuation)
+{
+	unsigned results = get_target(call, 0)->regnum;
+	unsigned n = (unsigned)get_target(call, 1)->constant->i;
+	unsigned num_values = raviX_ptrlist_size((PtrList *)ret->operands);
+	for (unsigned i = 0; i < n; i++) {
+		Pseudo *src = i < num_values ? map_pseudo(inliner, inlined, base, blocks, get_operand(ret, i))
+					     : new_pseudo(inliner, PSEUDO_NIL, 0);
+		add_move(inliner, bb, src, new_pseudo(inliner, PSEUDO_TEMP_ANY, results + i), ret->line_number);
+	}
+	add_branch(inliner, bb, continuation, ret->line_number);
+}
+
+static void copy_instruction(Inliner *inliner, InlinedProc *inlined, unsigned base, BasicBlock **blocks,
+			     BasicBlock *bb, Instruction *insn)
+{
+	Instruction *copy = add_instruction(inliner, bb, insn->opcode, insn->line_number);
+	copy->key_in_bounds = insn->key_in_bounds;
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		raviX_ptrlist_add((PtrList **)&copy->operands, map_pseudo(inliner, inlined, base, blocks, pseudo),
+				  inliner->allocator);
+	}
+	END_FOR_EACH_PTR(pseudo)
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		raviX_ptrlist_add((PtrList **)&copy->targets, map_pseudo(inliner, inlined, base, blocks, pseudo),
+				  inliner->allocator);
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
+
+/*
+ * Replaces the call with a copy of the callee. The instructions after the call are moved to a
+ * new block, which is returned; NULL is returned if the caller's frame cannot hold the callee.
+ */
+static BasicBlock *inline_call(Inliner *inliner, InlinedProc *inlined, BasicBlock *bb, Instruction *call)
+{
+	Proc *proc = inliner->proc;
+	Proc *callee = inlined->callee;
+	unsigned n = (unsigned)get_target(call, 1)->constant->i;
+	/* The callee's stack temps go above the caller's temps and the call's results */
+	unsigned base = inliner->num_temps;
+	if (get_target(call, 0)->regnum + n > base)
+		base = get_target(call, 0)->regnum + n;
+	if (!raviX_reserve_stack_temps(proc, base + inlined->stack_temps))
+		return NULL;
+
+	BasicBlock **blocks = (BasicBlock **)inliner->allocator->calloc(inliner->allocator->arena, callee->node_count,
+									 sizeof(BasicBlock *));
+	for (unsigned i = 0; i < callee->node_count; i++) {
+		if (i == EXIT_BLOCK || raviX_ptrlist_size((PtrList *)callee->nodes[i]->insns) == 0)
+			continue;
+		blocks[i] = raviX_create_block(proc);
+		raviX_bitset_set_bit_p(&inliner->visited, blocks[i]->index);
+	}
+	BasicBlock *continuation = raviX_create_block(proc);
+	raviX_bitset_set_bit_p(&inliner->visited, continuation->index);
+	for (unsigned i = 0; i < callee->node_count; i++) {
+		if (blocks[i] == NULL)
+			continue;
+		Instruction *insn;
+		FOR_EACH_PTR(callee->nodes[i]->insns, Instruction, insn)
+		{
+			if (insn->opcode == op_ret)
+				copy_return(inliner, inlined, base, blocks, blocks[i], insn, call, continuation);
+			else
+				copy_instruction(inliner, inlined, base, blocks, blocks[i], insn);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+
+	/* Split the block at the call */
+	InstructionList *before = NULL;
+	bool after = false;
+	Instruction *insn;
+	FOR_EACH_PTR(bb->insns, Instruction, insn)
+	{
+		if (insn == call) {
+			after = true;
+		} else if (after) {
+			insn->block = continuation;
+			raviX_ptrlist_add((PtrList **)&continuation->insns, insn, inliner->allocator);
+		} else {
+			raviX_ptrlist_add((PtrList **)&before, insn, inliner->allocator);
+		}
+	}
+	END_FOR_EACH_PTR(insn)
+	bb->insns = before;
+
+	/* Pass the arguments, missing ones are nil */
+	unsigned num_args = raviX_ptrlist_size((PtrList *)call->operands) - 1;
+	unsigned num_params = raviX_ptrlist_size((PtrList *)callee->function_expr->function_expr.args);
+	for (unsigned i = 0; i < num_params; i++) {
+		Pseudo *src = i < num_args ? get_operand(call, i + 1) : new_pseudo(inliner, PSEUDO_NIL, 0);
+		add_move(inliner, bb, src, copy_pseudo(inliner, inlined->locals[i]), call->line_number);
+	}
+	add_branch(inliner, bb, blocks[ENTRY_BLOCK], call->line_number);
+	return continuation;
+}
+
+/* Returns the proc that is called if the call can be inlined */
+static Proc *inlinable_callee(Inliner *inliner, Instruction *call)
+{
+	Pseudo *function = get_operand(call, 0);
+	if (function->type != PSEUDO_TEMP_ANY || function->regnum >= inliner->num_temps)
+		return NULL;
+	Instruction *def = inliner->last_def[function->regnum];
+	if (def == NULL || def->opcode != op_mov)
+		return NULL;
+	const LuaSymbol *symbol = referenced_local(get_operand(def, 0));
+	if (symbol == NULL)
+		return NULL;
+	Pseudo *results = get_target(call, 1);
+	if (results->type != PSEUDO_CONSTANT || results->constant->type != RAVI_TNUMINT || results->constant->i < 0)
+		return NULL;
+	Pseudo *arg;
+	FOR_EACH_PTR(call->operands, Pseudo, arg)
+	{
+		if (arg->type == PSEUDO_RANGE)
+			return NULL;
+	}
+	END_FOR_EACH_PTR(arg)
+	return raviX_bound_proc(inliner->proc->linearizer, symbol);
+}
+
+/* Searches the block for calls to inline; if one is inlined the block holding the rest of the instructions is returned */
+static BasicBlock *process_block(Inliner *inliner, BasicBlock *bb)
+{
+	Instruction *insn;
+	FOR_EACH_PTR(bb->insns, Instruction, insn)
+	{
+		if (insn->opcode == op_call) {
+			Proc *callee = inlinable_callee(inliner, insn);
+			InlinedProc *inlined = callee ? get_inlined_proc(inliner, callee) : NULL;
+			if (inlined != NULL && !inlined->failed) {
+				BasicBlock *continuation = inline_call(inliner, inlined, bb, insn);
+				if (continuation != NULL) {
+					unsigned results = get_target(insn, 0)->regnum;
+					for (unsigned reg = results; reg < inliner->num_temps; reg++)
+						inliner->last_def[reg] = NULL;
+					return continuation;
+				}
+			}
+		}
+		note_definition(inliner, insn);
+	}
+	END_FOR_EACH_PTR(insn)
+	return NULL;
+}
+
+static bool process_proc(Inliner *inliner)
+{
+	Proc *proc = inliner->proc;
+	bool changed = false;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		if (raviX_bitset_bit_p(&inliner->visited, i))
+			continue;
+		memset(inliner->last_def, 0, inliner->num_temps * sizeof(Instruction *));
+		BasicBlock *bb = proc->nodes[i];
+		while ((bb = process_block(inliner, bb)) != NULL)
+			changed = true;
+	}
+	return changed;
+}
+
+int raviX_inline_procs(LinearizerState *linearizer)
+{
+	bool changed = false;
+	Proc *proc;
+	/* Nested procs come later in the list, so callees are usually processed before their callers */
+	FOR_EACH_PTR_REVERSE(linearizer->all_procs, Proc, proc)
+	{
+		Inliner inliner = {.proc = proc,
+				   .allocator = linearizer->compiler_state->allocator,
+				   .num_temps = raviX_max_reg(&proc->temp_pseudos)};
+		raviX_bitset_create(&inliner.visited);
+		inliner.last_def = (Instruction **)raviX_calloc(inliner.num_temps + 1, sizeof(Instruction *));
+		if (process_proc(&inliner))
+			changed = true;
+		raviX_free(inliner.last_def);
+		raviX_bitset_destroy(&inliner.visited);
+		array_clearmem(&inliner.inlined);
+	}
+	END_FOR_EACH_PTR_REVERSE(proc)
+	if (changed) {
+		FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+		{
+			if (proc->cfg != NULL) {
+				raviX_destroy_graph(proc->cfg);
+				proc->cfg = NULL;
+			}
+		}
+		END_FOR_EACH_PTR(proc)
+		raviX_construct_cfg(linearizer->main_proc);
+	}
+	return 0;
+}
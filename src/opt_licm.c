@@ -0,0 +1,555 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Loop invariant code motion.
+ * Natural loops are found from back edges, i.e. edges whose target dominates their source. An
+ * instruction in a loop is invariant if it computes a numeric value from operands that are not
+ * defined anywhere in the loop. Such instructions are moved to the loop's preheader, the single
+ * block outside the loop that jumps to the loop header. Only instructions that cannot raise errors
+ * or invoke metamethods are moved, as the loop body may not execute at all.
+ *
+ * Temps are reused heavily by the linearizer, so the target of a moved instruction may have other
+ * definitions in the loop. Rather than moving the instruction, we compute the value into a new temp
+ * in the preheader and replace the instruction with a copy of the new temp. Later uses of the old
+ * target in the same block are rewritten to use the new temp, which lets instructions that depend on
+ * the moved value be moved in turn. Inner loops are
+ * processed first, so a value moved to an inner preheader can be moved further out if it is also
+ * invariant in the enclosing loop.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "bitset.h"
+#include "dominator.h"
+#include "graph.h"
+#include "optimizer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Loop {
+	nodeId_t header;
+	unsigned num_blocks;
+	BitSet blocks;
+} Loop;
+
+DECLARE_ARRAY(LoopArray, Loop);
+DECLARE_ARRAY(NodeIdArray, nodeId_t);
+DECLARE_ARRAY(InstructionArray, Instruction *);
+
+/* Variables defined in a loop */
+typedef struct LoopDefinitions {
+	BitSet vars[VAR_CLASS_COUNT]; /* indexed by regnum */
+	unsigned min_clobbered_temp;  /* TEMP_ANY registers from here upwards are clobbered by calls */
+	bool may_resize_arrays;	      /* The loop may store to arrays or call arbitrary code */
+} LoopDefinitions;
+
+typedef struct LICMState {
+	Proc *proc;
+	C_MemoryAllocator *allocator;
+	DominatorTree *tree;
+	LoopArray loops;
+	BitSet new_temps[VAR_CLASS_COUNT]; /* temps created by us, these have a single definition */
+} LICMState;
+
+static Loop *find_or_add_loop(LICMState *state, nodeId_t header)
+{
+	for (unsigned i = 0; i < state->loops.count; i++) {
+		if (state->loops.data[i].header == header)
+			return &state->loops.data[i];
+	}
+	Loop loop = {.header = header, .num_blocks = 1};
+	raviX_bitset_create(&loop.blocks);
+	raviX_bitset_set_bit_p(&loop.blocks, header);
+	array_push(&state->loops, Loop, loop);
+	return &state->loops.data[state->loops.count - 1];
+}
+
+/* Adds the blocks of the natural loop of the back edge tail->header */
+static void add_natural_loop(LICMState *state, nodeId_t tail, nodeId_t header)
+{
+	Graph *g = state->proc->cfg;
+	Loop *loop = find_or_add_loop(state, header);
+	NodeIdArray worklist = {0};
+	if (raviX_bitset_set_bit_p(&loop->blocks, tail)) {
+		loop->num_blocks++;
+		array_push(&worklist, nodeId_t, tail);
+	}
+	while (worklist.count > 0) {
+		nodeId_t b = worklist.data[--worklist.count];
+		GraphNodeList *preds = raviX_predecessors(raviX_graph_node(g, b));
+		for (uint32_t i = 0; i < raviX_node_list_size(preds); i++) {
+			nodeId_t pred = raviX_node_list_at(preds, i);
+			if (raviX_bitset_set_bit_p(&loop->blocks, pred)) {
+				loop->num_blocks++;
+				array_push(&worklist, nodeId_t, pred);
+			}
+		}
+	}
+	array_clearmem(&worklist);
+}
+
+static void find_loops(LICMState *state)
+{
+	Graph *g = state->proc->cfg;
+	for (unsigned i = 0; i < state->proc->node_count; i++) {
+		nodeId_t b = state->proc->nodes[i]->index;
+		GraphNode *node = raviX_graph_node(g, b);
+		if (node == NULL || raviX_immediate_dominator(state->tree, b) == NULL)
+			continue;
+		GraphNodeList *succs = raviX_successors(node);
+		for (uint32_t j = 0; j < raviX_node_list_size(succs); j++) {
+			nodeId_t s = raviX_node_list_at(succs, j);
+			if (raviX_dominates(state->tree, s, b))
+				add_natural_loop(state, b, s);
+		}
+	}
+}
+
+static int compare_loops(const void *a, const void *b)
+{
+	const Loop *l1 = (const Loop *)a;
+	const Loop *l2 = (const Loop *)b;
+	if (l1->num_blocks != l2->num_blocks)
+		return l1->num_blocks < l2->num_blocks ? -1 : 1;
+	return l1->header < l2->header ? -1 : (l1->header > l2->header);
+}
+
+/* Returns the block outside the loop that is the only way into the loop header, or NULL */
+static BasicBlock *find_preheader(LICMState *state, Loop *loop)
+{
+	Graph *g = state->proc->cfg;
+	GraphNodeList *preds = raviX_predecessors(raviX_graph_node(g, loop->header));
+	nodeId_t preheader = 0;
+	unsigned count = 0;
+	for (uint32_t i = 0; i < raviX_node_list_size(preds); i++) {
+		nodeId_t pred = raviX_node_list_at(preds, i);
+		if (!raviX_bitset_bit_p(&loop->blocks, pred)) {
+			preheader = pred;
+			count++;
+		}
+	}
+	if (count != 1 || raviX_node_list_size(raviX_successors(raviX_graph_node(g, preheader))) != 1)
+		return NULL;
+	BasicBlock *bb = state->proc->nodes[preheader];
+	Instruction *last = raviX_last_instruction(bb);
+	if (last == NULL || last->opcode != op_br)
+		return NULL;
+	return bb;
+}
+
+static void note_clobbered_temp(LoopDefinitions *defs, const Pseudo *pseudo)
+{
+	if (pseudo->regnum < defs->min_clobbered_temp)
+		defs->min_clobbered_temp = pseudo->regnum;
+}
+
+static void note_def(LoopDefinitions *defs, const Pseudo *pseudo)
+{
+	int cls = raviX_variable_class(pseudo);
+	if (cls >= 0)
+		raviX_bitset_set_bit_p(&defs->vars[cls], pseudo->regnum);
+	else if (pseudo->type == PSEUDO_RANGE)
+		note_clobbered_temp(defs, pseudo);
+	else if (pseudo->type == PSEUDO_RANGE_SELECT)
+		note_clobbered_temp(defs, pseudo->range_pseudo);
+}
+
+/*
+ * Instructions that neither store to arrays nor run code that might; note that
+ * generic operations may invoke metamethods and allocations may run finalizers.
+ */
+static bool preserves_array_lengths(unsigned opcode)
+{
+	switch (opcode) {
+	case op_addff:
+	case op_addfi:
+	case op_addii:
+	case op_subff:
+	case op_subfi:
+	case op_subif:
+	case op_subii:
+	case op_mulff:
+	case op_mulfi:
+	case op_mulii:
+	case op_divff:
+	case op_divfi:
+	case op_divif:
+	case op_divii:
+	case op_bandii:
+	case op_borii:
+	case op_bxorii:
+	case op_shlii:
+	case op_shrii:
+	case op_eqii:
+	case op_eqff:
+	case op_ltii:
+	case op_ltff:
+	case op_leii:
+	case op_leff:
+	case op_unmi:
+	case op_unmf:
+	case op_leni:
+	case op_not:
+	case op_toint:
+	case op_toflt:
+	case op_toiarray:
+	case op_tofarray:
+	case op_br:
+	case op_cbr:
+	case op_mov:
+	case op_movi:
+	case op_movif:
+	case op_movf:
+	case op_movfi:
+	case op_iaget:
+	case op_iaget_ikey:
+	case op_faget:
+	case op_faget_ikey:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void collect_definitions(LICMState *state, Loop *loop, LoopDefinitions *defs)
+{
+	Proc *proc = state->proc;
+	for (int cls = 0; cls < VAR_CLASS_COUNT; cls++)
+		raviX_bitset_create(&defs->vars[cls]);
+	defs->min_clobbered_temp = ~0u;
+	defs->may_resize_arrays = false;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		BasicBlock *bb = proc->nodes[i];
+		if (!raviX_bitset_bit_p(&loop->blocks, bb->index))
+			continue;
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			bool in_place = raviX_opcode_updates_in_place(insn->opcode);
+			bool defines = raviX_opcode_defines_targets(insn->opcode);
+			if (!preserves_array_lengths(insn->opcode))
+				defs->may_resize_arrays = true;
+			Pseudo *pseudo;
+			FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+			{
+				/* A range extends to the top of the stack */
+				if (pseudo->type == PSEUDO_RANGE)
+					note_clobbered_temp(defs, pseudo);
+				else if (pseudo->type == PSEUDO_RANGE_SELECT)
+					note_clobbered_temp(defs, pseudo->range_pseudo);
+				else if (in_place && !defines)
+					note_def(defs, pseudo);
+			}
+			END_FOR_EACH_PTR(pseudo)
+			FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+			{
+				if (defines) {
+					note_def(defs, pseudo);
+					if (insn->opcode == op_call && pseudo->type == PSEUDO_TEMP_ANY)
+						note_clobbered_temp(defs, pseudo);
+				}
+			}
+			END_FOR_EACH_PTR(pseudo)
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+}
+
+static void destroy_definitions(LoopDefinitions *defs)
+{
+	for (int cls = 0; cls < VAR_CLASS_COUNT; cls++)
+		raviX_bitset_destroy(&defs->vars[cls]);
+}
+
+/* Does the pseudo have the same value throughout the loop? */
+static bool is_invariant(LoopDefinitions *defs, const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_CONSTANT:
+	case PSEUDO_NIL:
+	case PSEUDO_TRUE:
+	case PSEUDO_FALSE:
+		return true;
+	case PSEUDO_SYMBOL:
+		/* Upvalues and escaped locals may be updated by closures called in the loop */
+		if (pseudo->symbol->symbol_type != SYM_LOCAL || pseudo->symbol->variable.escaped)
+			return false;
+		break;
+	case PSEUDO_TEMP_ANY:
+		if (pseudo->regnum >= defs->min_clobbered_temp)
+			return false;
+		break;
+	case PSEUDO_TEMP_INT:
+	case PSEUDO_TEMP_BOOL:
+	case PSEUDO_TEMP_FLT:
+		break;
+	default:
+		return false;
+	}
+	return !raviX_bitset_bit_p(&defs->vars[raviX_variable_class(pseudo)], pseudo->regnum);
+}
+
+static bool is_integer_value(const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_CONSTANT:
+		return pseudo->constant->type == RAVI_TNUMINT;
+	case PSEUDO_TEMP_INT:
+		return true;
+	case PSEUDO_SYMBOL:
+		return pseudo->symbol->symbol_type == SYM_LOCAL &&
+		       pseudo->symbol->variable.value_type.type_code == RAVI_TNUMINT;
+	default:
+		return false;
+	}
+}
+
+/* Can the instruction be executed before the loop instead of in it? */
+static bool is_hoistable(LoopDefinitions *defs, Instruction *insn)
+{
+	if (raviX_ptrlist_size((const PtrList *)insn->targets) != 1)
+		return false;
+	Pseudo *target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+	if (target->type != PSEUDO_TEMP_INT && target->type != PSEUDO_TEMP_FLT)
+		return false;
+	Pseudo *operand = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->operands);
+	switch (insn->opcode) {
+	case op_addff:
+	case op_addfi:
+	case op_addii:
+	case op_subff:
+	case op_subfi:
+	case op_subif:
+	case op_subii:
+	case op_mulff:
+	case op_mulfi:
+	case op_mulii:
+	case op_divff:
+	case op_divfi:
+	case op_divif:
+	case op_divii:
+	case op_bandii:
+	case op_borii:
+	case op_bxorii:
+	case op_shlii:
+	case op_shrii:
+	case op_unmi:
+	case op_unmf:
+		break;
+	case op_mov:
+	case op_movi:
+	case op_movf:
+		/* Copies between temps are not worth moving, loads from the Lua stack are */
+		if (operand == NULL || (operand->type != PSEUDO_SYMBOL && operand->type != PSEUDO_TEMP_ANY))
+			return false;
+		break;
+	case op_movif:
+		/* Converting an integer to a float cannot fail */
+		if (operand == NULL || !is_integer_value(operand))
+			return false;
+		break;
+	case op_leni:
+		if (defs->may_resize_arrays)
+			return false;
+		break;
+	default:
+		/* Note that idiv and mod can raise division by zero */
+		return false;
+	}
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		if (!is_invariant(defs, pseudo))
+			return false;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return true;
+}
+
+static void insert_before_branch(LICMState *state, BasicBlock *bb, Instruction *insn)
+{
+	Instruction *br = (Instruction *)raviX_ptrlist_delete_last((PtrList **)&bb->insns);
+	raviX_ptrlist_add((PtrList **)&bb->insns, insn, state->allocator);
+	raviX_ptrlist_add((PtrList **)&bb->insns, br, state->allocator);
+	insn->block = bb;
+}
+
+static bool is_same_variable(const Pseudo *a, int cls, unsigned regnum)
+{
+	return raviX_variable_class(a) == cls && a->regnum == regnum;
+}
+
+/*
+ * The value of the instruction's target is now also held by an invariant temp. Uses of the target
+ * that follow the instruction in its block, up to the next definition of the target, are made to
+ * refer to the temp instead so that instructions depending on the value can become invariant too.
+ */
+static void replace_uses(Instruction *insn, const Pseudo *target, Pseudo *temp)
+{
+	int cls = raviX_variable_class(target);
+	unsigned regnum = target->regnum;
+	bool found = false;
+	Instruction *use;
+	FOR_EACH_PTR(insn->block->insns, Instruction, use)
+	{
+		if (!found) {
+			found = use == insn;
+			continue;
+		}
+		Pseudo *pseudo;
+		FOR_EACH_PTR(use->operands, Pseudo, pseudo)
+		{
+			if (is_same_variable(pseudo, cls, regnum))
+				REPLACE_CURRENT_PTR(Pseudo, pseudo, temp);
+		}
+		END_FOR_EACH_PTR(pseudo)
+		bool redefined = false;
+		FOR_EACH_PTR(use->targets, Pseudo, pseudo)
+		{
+			if (!is_same_variable(pseudo, cls, regnum))
+				continue;
+			/* Targets of stores and branches are uses, the rest are definitions */
+			if (raviX_opcode_defines_targets(use->opcode))
+				redefined = true;
+			else
+				REPLACE_CURRENT_PTR(Pseudo, pseudo, temp);
+		}
+		END_FOR_EACH_PTR(pseudo)
+		if (redefined)
+			return;
+	}
+	END_FOR_EACH_PTR(use)
+}
+
+/*
+ * Moves the computation done by the instruction to the preheader. Returns true if the instruction
+ * itself was moved, in which case the caller must remove it from its block.
+ */
+static bool hoist(LICMState *state, LoopDefinitions *defs, BasicBlock *preheader, Instruction *insn)
+{
+	Pseudo *target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+	int cls = raviX_variable_class(target);
+	if (raviX_bitset_bit_p(&state->new_temps[cls], target->regnum)) {
+		/* A temp we created has no other definitions, so the instruction can move as it is */
+		insert_before_branch(state, preheader, insn);
+		raviX_bitset_clear_bit_p(&defs->vars[cls], target->regnum);
+		return true;
+	}
+	Pseudo *temp = raviX_allocate_new_temp_pseudo(state->proc, cls == VAR_TEMP_INT ? RAVI_TNUMINT : RAVI_TNUMFLT);
+	if (temp == NULL)
+		return false;
+	raviX_bitset_set_bit_p(&state->new_temps[cls], temp->regnum);
+	Instruction *hoisted = (Instruction *)state->allocator->calloc(state->allocator->arena, 1, sizeof(Instruction));
+	hoisted->opcode = insn->opcode;
+	hoisted->line_number = insn->line_number;
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		raviX_ptrlist_add((PtrList **)&hoisted->operands, pseudo, state->allocator);
+	}
+	END_FOR_EACH_PTR(pseudo)
+	raviX_ptrlist_add((PtrList **)&hoisted->targets, temp, state->allocator);
+	insert_before_branch(state, preheader, hoisted);
+	/* The original instruction becomes a copy of the new temp, for uses in other blocks */
+	insn->opcode = cls == VAR_TEMP_INT ? op_movi : op_movf;
+	raviX_ptrlist_remove_all((PtrList **)&insn->operands);
+	raviX_ptrlist_add((PtrList **)&insn->operands, temp, state->allocator);
+	replace_uses(insn, target, temp);
+	return false;
+}
+
+static void process_loop(LICMState *state, Loop *loop)
+{
+	Proc *proc = state->proc;
+	BasicBlock *preheader = find_preheader(state, loop);
+	if (preheader == NULL)
+		return;
+	LoopDefinitions defs;
+	collect_definitions(state, loop, &defs);
+	InstructionArray moved = {0};
+	bool changed = true;
+	/* Moving an instruction out can make instructions that use its result invariant */
+	while (changed) {
+		changed = false;
+		for (unsigned i = 0; i < proc->node_count; i++) {
+			BasicBlock *bb = proc->nodes[i];
+			if (!raviX_bitset_bit_p(&loop->blocks, bb->index))
+				continue;
+			Instruction *insn;
+			FOR_EACH_PTR(bb->insns, Instruction, insn)
+			{
+				if (!is_hoistable(&defs, insn))
+					continue;
+				if (hoist(state, &defs, preheader, insn)) {
+					array_push(&moved, Instruction *, insn);
+					changed = true;
+				}
+			}
+			END_FOR_EACH_PTR(insn)
+			for (unsigned j = 0; j < moved.count; j++)
+				raviX_ptrlist_remove((PtrList **)&bb->insns, moved.data[j], 1);
+			moved.count = 0;
+		}
+	}
+	array_clearmem(&moved);
+	destroy_definitions(&defs);
+}
+
+static void process_proc(Proc *proc)
+{
+	LICMState state;
+	memset(&state, 0, sizeof state);
+	state.proc = proc;
+	state.allocator = proc->linearizer->compiler_state->allocator;
+	for (int cls = 0; cls < VAR_CLASS_COUNT; cls++)
+		raviX_bitset_create(&state.new_temps[cls]);
+	raviX_classify_edges(proc->cfg);
+	state.tree = raviX_new_dominator_tree(proc->cfg);
+	raviX_calculate_dominator_tree(state.tree);
+	find_loops(&state);
+	/* Inner loops have fewer blocks than the loops enclosing them */
+	if (state.loops.count > 1)
+		qsort(state.loops.data, state.loops.count, sizeof(Loop), compare_loops);
+	for (unsigned i = 0; i < state.loops.count; i++)
+		process_loop(&state, &state.loops.data[i]);
+	for (unsigned i = 0; i < state.loops.count; i++)
+		raviX_bitset_destroy(&state.loops.data[i].blocks);
+	array_clearmem(&state.loops);
+	raviX_destroy_dominator_tree(state.tree);
+	for (int cls = 0; cls < VAR_CLASS_COUNT; cls++)
+		raviX_bitset_destroy(&state.new_temps[cls]);
+}
+
+int raviX_hoist_loop_invariants(LinearizerState *linearizer)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		if (proc->cfg != NULL && proc->num_ssa_values == 0)
+			process_proc(proc);
+	}
+	END_FOR_EACH_PTR(proc)
+	return 0;
+}
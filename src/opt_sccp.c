@@ -0,0 +1,1033 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Sparse conditional constant propagation, as described in Wegman and Zadeck, 'Constant Propagation
+ * with Conditional Branches'. Operates on procs in SSA form.
+ *
+ * Each SSA value starts out as undefined (top) and can only move down to a constant and then to
+ * overdefined (bottom). Blocks are only evaluated once an edge into them is found to be executable,
+ * so values that flow in along branches that are never taken do not spoil phis.
+ *
+ * When the analysis is done, instructions computing constants are replaced by moves of the constant,
+ * uses of constants are replaced by the constant where the code generator can handle that, conditional
+ * branches on constants become unconditional, and blocks that were never reached are deleted.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "graph.h"
+#include "optimizer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+enum LatticeState { LATTICE_TOP, LATTICE_CONSTANT, LATTICE_BOTTOM };
+enum ValueKind { VALUE_NIL, VALUE_FALSE, VALUE_TRUE, VALUE_INTEGER, VALUE_FLOAT, VALUE_STRING };
+
+typedef struct LatticeValue {
+	enum LatticeState state;
+	enum ValueKind kind;
+	union {
+		lua_Integer i;
+		lua_Number n;
+		const StringObject *s;
+	};
+	Pseudo *literal; /* The literal the value came from, if any */
+} LatticeValue;
+
+typedef struct CFGEdge {
+	nodeId_t from;
+	nodeId_t to;
+} CFGEdge;
+
+DECLARE_ARRAY(InstructionArray, Instruction *);
+DECLARE_ARRAY(EdgeArray, CFGEdge);
+
+typedef struct SCCPState {
+	Proc *proc;
+	LatticeValue *values;	       /* Indexed by SSA version */
+	InstructionArray *uses;	       /* Instructions that use each SSA value */
+	bool *executable_blocks;       /* Indexed by block */
+	bool **executable_edges;       /* For each block, whether the edge from each predecessor is executable */
+	EdgeArray cfg_worklist;
+	InstructionArray ssa_worklist;
+} SCCPState;
+
+static const LatticeValue bottom = {.state = LATTICE_BOTTOM};
+static const LatticeValue top = {.state = LATTICE_TOP};
+
+static LatticeValue make_integer(lua_Integer i)
+{
+	LatticeValue v = {.state = LATTICE_CONSTANT, .kind = VALUE_INTEGER, .i = i};
+	return v;
+}
+
+static LatticeValue make_float(lua_Number n)
+{
+	LatticeValue v = {.state = LATTICE_CONSTANT, .kind = VALUE_FLOAT, .n = n};
+	return v;
+}
+
+static LatticeValue make_boolean(bool b)
+{
+	LatticeValue v = {.state = LATTICE_CONSTANT, .kind = b ? VALUE_TRUE : VALUE_FALSE};
+	return v;
+}
+
+static bool is_number(const LatticeValue *v) { return v->kind == VALUE_INTEGER || v->kind == VALUE_FLOAT; }
+
+static bool is_truthy(const LatticeValue *v) { return v->kind != VALUE_NIL && v->kind != VALUE_FALSE; }
+
+static lua_Number to_float(const LatticeValue *v) { return v->kind == VALUE_FLOAT ? v->n : (lua_Number)v->i; }
+
+/* Converts a float with an integral value to an integer, as Lua does for bitwise operators */
+static bool to_integer(const LatticeValue *v, lua_Integer *i)
+{
+	if (v->kind == VALUE_INTEGER) {
+		*i = v->i;
+		return true;
+	}
+	if (v->kind != VALUE_FLOAT || floor(v->n) != v->n || !(v->n >= (lua_Number)LUA_MININTEGER) ||
+	    !(v->n < -(lua_Number)LUA_MININTEGER))
+		return false;
+	*i = (lua_Integer)v->n;
+	return true;
+}
+
+static bool same_value(const LatticeValue *a, const LatticeValue *b)
+{
+	if (a->state != b->state)
+		return false;
+	if (a->state != LATTICE_CONSTANT)
+		return true;
+	if (a->kind != b->kind)
+		return false;
+	switch (a->kind) {
+	case VALUE_INTEGER:
+		return a->i == b->i;
+	case VALUE_FLOAT:
+		/* Compare the representation so that 0.0 and -0.0 differ and NaN equals itself */
+		return memcmp(&a->n, &b->n, sizeof a->n) == 0;
+	case VALUE_STRING:
+		return a->s == b->s;
+	default:
+		return true;
+	}
+}
+
+static LatticeValue meet(const LatticeValue *a, const LatticeValue *b)
+{
+	if (a->state == LATTICE_TOP)
+		return *b;
+	if (b->state == LATTICE_TOP)
+		return *a;
+	if (a->state == LATTICE_BOTTOM || b->state == LATTICE_BOTTOM || !same_value(a, b))
+		return bottom;
+	return *a;
+}
+
+static LatticeValue value_of(SCCPState *state, Pseudo *pseudo)
+{
+	if (pseudo->ssa_version != 0)
+		return state->values[pseudo->ssa_version];
+	LatticeValue v = bottom;
+	switch (pseudo->type) {
+	case PSEUDO_CONSTANT:
+		if (pseudo->constant->type == RAVI_TNUMINT)
+			v = make_integer(pseudo->constant->i);
+		else if (pseudo->constant->type == RAVI_TNUMFLT)
+			v = make_float(pseudo->constant->n);
+		else if (pseudo->constant->type == RAVI_TSTRING) {
+			v.state = LATTICE_CONSTANT;
+			v.kind = VALUE_STRING;
+			v.s = pseudo->constant->s;
+		}
+		break;
+	case PSEUDO_TRUE:
+	case PSEUDO_FALSE:
+		v = make_boolean(pseudo->type == PSEUDO_TRUE);
+		break;
+	case PSEUDO_NIL:
+		v.state = LATTICE_CONSTANT;
+		v.kind = VALUE_NIL;
+		break;
+	default:
+		return v;
+	}
+	v.literal = pseudo;
+	return v;
+}
+
+/* Adjusts a value to what the target's storage will hold after it is assigned */
+static LatticeValue coerce_to_storage(const LatticeValue *v, const Pseudo *target)
+{
+	if (v->state != LATTICE_CONSTANT)
+		return *v;
+	switch (target->type) {
+	case PSEUDO_TEMP_FLT:
+		return is_number(v) ? make_float(to_float(v)) : bottom;
+	case PSEUDO_TEMP_INT:
+		if (v->kind == VALUE_INTEGER)
+			return *v;
+		if (v->kind == VALUE_TRUE || v->kind == VALUE_FALSE)
+			return make_integer(v->kind == VALUE_TRUE);
+		return bottom;
+	case PSEUDO_TEMP_BOOL:
+		if (v->kind == VALUE_INTEGER)
+			return make_boolean(v->i != 0);
+		if (v->kind == VALUE_TRUE || v->kind == VALUE_FALSE)
+			return *v;
+		return bottom;
+	default:
+		return *v;
+	}
+}
+
+static lua_Integer integer_arith(unsigned opcode, lua_Integer a, lua_Integer b)
+{
+	/* Lua integer arithmetic wraps around */
+	lua_Unsigned x = (lua_Unsigned)a;
+	lua_Unsigned y = (lua_Unsigned)b;
+	switch (opcode) {
+	case op_add:
+	case op_addii:
+		return (lua_Integer)(x + y);
+	case op_sub:
+	case op_subii:
+		return (lua_Integer)(x - y);
+	case op_mul:
+	case op_mulii:
+		return (lua_Integer)(x * y);
+	case op_band:
+	case op_bandii:
+		return (lua_Integer)(x & y);
+	case op_bor:
+	case op_borii:
+		return (lua_Integer)(x | y);
+	case op_bxor:
+	case op_bxorii:
+		return (lua_Integer)(x ^ y);
+	default:
+		assert(0);
+		return 0;
+	}
+}
+
+/* Shift left, or right if the shift is negative, as in luaV_shiftl() */
+static lua_Integer shift_left(lua_Integer x, lua_Integer y)
+{
+	if (y < 0) {
+		if (y <= -64)
+			return 0;
+		return (lua_Integer)((lua_Unsigned)x >> (-y));
+	}
+	if (y >= 64)
+		return 0;
+	return (lua_Integer)((lua_Unsigned)x << y);
+}
+
+/* Integer floor division and modulo; the divisor must not be 0 */
+static lua_Integer integer_idiv(lua_Integer m, lua_Integer n)
+{
+	if (n == -1)
+		return (lua_Integer)(0u - (lua_Unsigned)m);
+	lua_Integer q = m / n;
+	if ((m ^ n) < 0 && m % n != 0)
+		q -= 1;
+	return q;
+}
+
+static lua_Integer integer_mod(lua_Integer m, lua_Integer n)
+{
+	if (n == -1)
+		return 0;
+	lua_Integer r = m % n;
+	if (r != 0 && (r ^ n) < 0)
+		r += n;
+	return r;
+}
+
+static lua_Number float_mod(lua_Number a, lua_Number b)
+{
+	lua_Number m = fmod(a, b);
+	if (m * b < 0)
+		m += b;
+	return m;
+}
+
+static LatticeValue float_arith(unsigned opcode, lua_Number a, lua_Number b)
+{
+	switch (opcode) {
+	case op_add:
+	case op_addff:
+	case op_addfi:
+		return make_float(a + b);
+	case op_sub:
+	case op_subff:
+	case op_subfi:
+	case op_subif:
+		return make_float(a - b);
+	case op_mul:
+	case op_mulff:
+	case op_mulfi:
+		return make_float(a * b);
+	case op_div:
+	case op_divff:
+	case op_divfi:
+	case op_divif:
+		return make_float(a / b);
+	case op_idiv:
+		return make_float(floor(a / b));
+	case op_mod:
+		return make_float(float_mod(a, b));
+	case op_pow:
+		return make_float(pow(a, b));
+	default:
+		assert(0);
+		return bottom;
+	}
+}
+
+/* Whether the integer converts to a float without loss, as l_intfitsf() in Lua */
+static bool integer_fits_float(lua_Integer i)
+{
+	return -((lua_Integer)1 << 53) <= i && i <= ((lua_Integer)1 << 53);
+}
+
+/* Converts the float to an integer rounding by the given function, failing if it is out of range or NaN */
+static bool float_to_integer(lua_Number n, lua_Number (*round)(lua_Number), lua_Integer *i)
+{
+	n = round(n);
+	if (!(n >= (lua_Number)LUA_MININTEGER) || !(n < -(lua_Number)LUA_MININTEGER))
+		return false;
+	*i = (lua_Integer)n;
+	return true;
+}
+
+/* Mixed comparisons follow luaV_equalobj(), LTnum() and LEnum() so that large integers compare exactly */
+static bool number_eq(const LatticeValue *a, const LatticeValue *b)
+{
+	if (a->kind == VALUE_INTEGER && b->kind == VALUE_INTEGER)
+		return a->i == b->i;
+	if (a->kind == VALUE_FLOAT && b->kind == VALUE_FLOAT)
+		return a->n == b->n;
+	lua_Integer i = a->kind == VALUE_INTEGER ? a->i : b->i;
+	lua_Number f = a->kind == VALUE_FLOAT ? a->n : b->n;
+	lua_Integer fi;
+	return floor(f) == f && float_to_integer(f, floor, &fi) && fi == i;
+}
+
+static bool number_lt(const LatticeValue *a, const LatticeValue *b)
+{
+	lua_Integer fi;
+	if (a->kind == VALUE_INTEGER && b->kind == VALUE_INTEGER)
+		return a->i < b->i;
+	if (a->kind == VALUE_FLOAT && b->kind == VALUE_FLOAT)
+		return a->n < b->n;
+	if (a->kind == VALUE_INTEGER) {
+		if (integer_fits_float(a->i))
+			return (lua_Number)a->i < b->n;
+		/* i < f <=> i < ceil(f) */
+		return float_to_integer(b->n, ceil, &fi) ? a->i < fi : b->n > 0;
+	}
+	if (integer_fits_float(b->i))
+		return a->n < (lua_Number)b->i;
+	/* f < i <=> floor(f) < i */
+	return float_to_integer(a->n, floor, &fi) ? fi < b->i : a->n < 0;
+}
+
+static bool number_le(const LatticeValue *a, const LatticeValue *b)
+{
+	lua_Integer fi;
+	if (a->kind == VALUE_INTEGER && b->kind == VALUE_INTEGER)
+		return a->i <= b->i;
+	if (a->kind == VALUE_FLOAT && b->kind == VALUE_FLOAT)
+		return a->n <= b->n;
+	if (a->kind == VALUE_INTEGER) {
+		if (integer_fits_float(a->i))
+			return (lua_Number)a->i <= b->n;
+		/* i <= f <=> i <= floor(f) */
+		return float_to_integer(b->n, floor, &fi) ? a->i <= fi : b->n > 0;
+	}
+	if (integer_fits_float(b->i))
+		return a->n <= (lua_Number)b->i;
+	/* f <= i <=> ceil(f) <= i */
+	return float_to_integer(a->n, ceil, &fi) ? fi <= b->i : a->n < 0;
+}
+
+static LatticeValue compare(unsigned opcode, const LatticeValue *a, const LatticeValue *b)
+{
+	switch (opcode) {
+	case op_eq:
+	case op_eqii:
+	case op_eqff:
+		if (is_number(a) && is_number(b))
+			return make_boolean(number_eq(a, b));
+		/* No metamethods are involved for these types */
+		return make_boolean(a->kind == b->kind && (a->kind != VALUE_STRING || a->s == b->s));
+	case op_lt:
+	case op_ltii:
+	case op_ltff:
+		if (!is_number(a) || !is_number(b))
+			return bottom;
+		return make_boolean(number_lt(a, b));
+	case op_le:
+	case op_leii:
+	case op_leff:
+		if (!is_number(a) || !is_number(b))
+			return bottom;
+		return make_boolean(number_le(a, b));
+	default:
+		assert(0);
+		return bottom;
+	}
+}
+
+static LatticeValue fold_binary(unsigned opcode, const LatticeValue *a, const LatticeValue *b)
+{
+	switch (opcode) {
+	case op_eq:
+	case op_eqii:
+	case op_eqff:
+	case op_lt:
+	case op_ltii:
+	case op_ltff:
+	case op_le:
+	case op_leii:
+	case op_leff:
+		return compare(opcode, a, b);
+	default:
+		break;
+	}
+	if (!is_number(a) || !is_number(b))
+		return bottom;
+	switch (opcode) {
+	case op_addii:
+	case op_subii:
+	case op_mulii:
+	case op_bandii:
+	case op_borii:
+	case op_bxorii:
+		if (a->kind != VALUE_INTEGER || b->kind != VALUE_INTEGER)
+			return bottom;
+		return make_integer(integer_arith(opcode, a->i, b->i));
+	case op_shlii:
+	case op_shrii:
+		if (a->kind != VALUE_INTEGER || b->kind != VALUE_INTEGER)
+			return bottom;
+		return make_integer(shift_left(a->i, opcode == op_shlii ? b->i : (lua_Integer)(0u - (lua_Unsigned)b->i)));
+	case op_band:
+	case op_bor:
+	case op_bxor:
+	case op_shl:
+	case op_shr: {
+		lua_Integer x, y;
+		if (!to_integer(a, &x) || !to_integer(b, &y))
+			return bottom;
+		if (opcode == op_shl)
+			return make_integer(shift_left(x, y));
+		if (opcode == op_shr)
+			return make_integer(shift_left(x, (lua_Integer)(0u - (lua_Unsigned)y)));
+		return make_integer(integer_arith(opcode, x, y));
+	}
+	case op_add:
+	case op_sub:
+	case op_mul:
+		if (a->kind == VALUE_INTEGER && b->kind == VALUE_INTEGER)
+			return make_integer(integer_arith(opcode, a->i, b->i));
+		return float_arith(opcode, to_float(a), to_float(b));
+	case op_idiv:
+	case op_mod:
+		if (a->kind == VALUE_INTEGER && b->kind == VALUE_INTEGER) {
+			if (b->i == 0)
+				return bottom; /* Raises an error at runtime */
+			return make_integer(opcode == op_idiv ? integer_idiv(a->i, b->i) : integer_mod(a->i, b->i));
+		}
+		return float_arith(opcode, to_float(a), to_float(b));
+	case op_div:
+	case op_pow:
+	case op_addff:
+	case op_subff:
+	case op_mulff:
+	case op_divff:
+	case op_addfi:
+	case op_subfi:
+	case op_mulfi:
+	case op_divfi:
+	case op_subif:
+	case op_divif:
+		return float_arith(opcode, to_float(a), to_float(b));
+	default:
+		return bottom;
+	}
+}
+
+static LatticeValue fold_unary(unsigned opcode, const LatticeValue *a)
+{
+	switch (opcode) {
+	case op_mov:
+	case op_movi:
+	case op_movf:
+		return *a;
+	case op_movif:
+		return is_number(a) ? make_float(to_float(a)) : bottom;
+	case op_movfi: {
+		lua_Integer i;
+		return to_integer(a, &i) ? make_integer(i) : bottom;
+	}
+	case op_not:
+		return make_boolean(!is_truthy(a));
+	case op_unm:
+	case op_unmi:
+	case op_unmf:
+		if (a->kind == VALUE_INTEGER)
+			return make_integer((lua_Integer)(0u - (lua_Unsigned)a->i));
+		if (a->kind == VALUE_FLOAT)
+			return make_float(-a->n);
+		return bottom;
+	case op_bnot: {
+		lua_Integer i;
+		return to_integer(a, &i) ? make_integer(~i) : bottom;
+	}
+	default:
+		return bottom;
+	}
+}
+
+static bool is_unary_foldable(unsigned opcode)
+{
+	switch (opcode) {
+	case op_mov:
+	case op_movi:
+	case op_movf:
+	case op_movif:
+	case op_movfi:
+	case op_not:
+	case op_unm:
+	case op_unmi:
+	case op_unmf:
+	case op_bnot:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_binary_foldable(unsigned opcode)
+{
+	switch (opcode) {
+	case op_add:
+	case op_addff:
+	case op_addfi:
+	case op_addii:
+	case op_sub:
+	case op_subff:
+	case op_subfi:
+	case op_subif:
+	case op_subii:
+	case op_mul:
+	case op_mulff:
+	case op_mulfi:
+	case op_mulii:
+	case op_div:
+	case op_divff:
+	case op_divfi:
+	case op_divif:
+	case op_idiv:
+	case op_band:
+	case op_bandii:
+	case op_bor:
+	case op_borii:
+	case op_bxor:
+	case op_bxorii:
+	case op_shl:
+	case op_shlii:
+	case op_shr:
+	case op_shrii:
+	case op_eq:
+	case op_eqii:
+	case op_eqff:
+	case op_lt:
+	case op_ltii:
+	case op_ltff:
+	case op_le:
+	case op_leii:
+	case op_leff:
+	case op_mod:
+	case op_pow:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Computes the value an instruction assigns to its only target */
+static LatticeValue evaluate(SCCPState *state, Instruction *insn)
+{
+	unsigned num_operands = raviX_ptrlist_size((const PtrList *)insn->operands);
+	LatticeValue operands[2];
+	if (is_unary_foldable(insn->opcode) && num_operands == 1) {
+		operands[0] = value_of(state, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->operands));
+	} else if (is_binary_foldable(insn->opcode) && num_operands == 2) {
+		operands[0] = value_of(state, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->operands));
+		operands[1] = value_of(state, (Pseudo *)raviX_ptrlist_last((PtrList *)insn->operands));
+	} else {
+		return bottom;
+	}
+	for (unsigned i = 0; i < num_operands; i++) {
+		if (operands[i].state == LATTICE_BOTTOM)
+			return bottom;
+	}
+	for (unsigned i = 0; i < num_operands; i++) {
+		if (operands[i].state == LATTICE_TOP)
+			return top;
+	}
+	if (num_operands == 1) {
+		LatticeValue v = fold_unary(insn->opcode, &operands[0]);
+		if (insn->opcode != op_mov && insn->opcode != op_movi && insn->opcode != op_movf)
+			v.literal = NULL;
+		return v;
+	}
+	return fold_binary(insn->opcode, &operands[0], &operands[1]);
+}
+
+static void set_value(SCCPState *state, Pseudo *target, const LatticeValue *v)
+{
+	LatticeValue *current = &state->values[target->ssa_version];
+	LatticeValue new_value = meet(current, v);
+	if (current->state == new_value.state && same_value(current, &new_value))
+		return;
+	*current = new_value;
+	InstructionArray *uses = &state->uses[target->ssa_version];
+	for (unsigned i = 0; i < uses->count; i++)
+		array_push(&state->ssa_worklist, Instruction *, uses->data[i]);
+}
+
+static GraphNodeList *predecessors(SCCPState *state, nodeId_t block)
+{
+	return raviX_predecessors(raviX_graph_node(state->proc->cfg, block));
+}
+
+static void add_edge(SCCPState *state, nodeId_t from, Pseudo *to)
+{
+	assert(to->type == PSEUDO_BLOCK);
+	CFGEdge edge = {.from = from, .to = to->block->index};
+	array_push(&state->cfg_worklist, CFGEdge, edge);
+}
+
+static void visit_phi(SCCPState *state, Instruction *insn)
+{
+	bool *executable_edges = state->executable_edges[insn->block->index];
+	LatticeValue v = top;
+	unsigned i = 0;
+	Pseudo *operand;
+	FOR_EACH_PTR(insn->operands, Pseudo, operand)
+	{
+		if (executable_edges[i++]) {
+			LatticeValue arg = value_of(state, operand);
+			v = meet(&v, &arg);
+		}
+	}
+	END_FOR_EACH_PTR(operand)
+	v.literal = NULL;
+	set_value(state, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets), &v);
+}
+
+static void visit_instruction(SCCPState *state, Instruction *insn)
+{
+	nodeId_t block = insn->block->index;
+	switch (insn->opcode) {
+	case op_phi:
+		visit_phi(state, insn);
+		break;
+	case op_br:
+		add_edge(state, block, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets));
+		break;
+	case op_cbr: {
+		LatticeValue cond = value_of(state, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->operands));
+		if (cond.state == LATTICE_TOP)
+			break;
+		if (cond.state == LATTICE_BOTTOM || is_truthy(&cond))
+			add_edge(state, block, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets));
+		if (cond.state == LATTICE_BOTTOM || !is_truthy(&cond))
+			add_edge(state, block, (Pseudo *)raviX_ptrlist_last((PtrList *)insn->targets));
+		break;
+	}
+	default:
+		if (!raviX_opcode_defines_targets(insn->opcode))
+			break;
+		if (raviX_ptrlist_size((const PtrList *)insn->targets) == 1) {
+			Pseudo *target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+			if (target->ssa_version != 0) {
+				LatticeValue v = evaluate(state, insn);
+				v = coerce_to_storage(&v, target);
+				set_value(state, target, &v);
+			}
+		} else {
+			Pseudo *target;
+			FOR_EACH_PTR(insn->targets, Pseudo, target)
+			{
+				if (target->ssa_version != 0)
+					set_value(state, target, &bottom);
+			}
+			END_FOR_EACH_PTR(target)
+		}
+		break;
+	}
+}
+
+static void visit_edge(SCCPState *state, CFGEdge edge)
+{
+	GraphNodeList *preds = predecessors(state, edge.to);
+	uint32_t i = 0;
+	while (i < raviX_node_list_size(preds) && raviX_node_list_at(preds, i) != edge.from)
+		i++;
+	assert(i < raviX_node_list_size(preds));
+	if (state->executable_edges[edge.to][i])
+		return;
+	state->executable_edges[edge.to][i] = true;
+	bool first_visit = !state->executable_blocks[edge.to];
+	state->executable_blocks[edge.to] = true;
+	Instruction *insn;
+	FOR_EACH_PTR(state->proc->nodes[edge.to]->insns, Instruction, insn)
+	{
+		/* Other instructions only need evaluating the first time the block is reached */
+		if (insn->opcode != op_phi && !first_visit)
+			break;
+		visit_instruction(state, insn);
+	}
+	END_FOR_EACH_PTR(insn)
+}
+
+static void add_use(SCCPState *state, Pseudo *pseudo, Instruction *insn)
+{
+	if (pseudo->ssa_version != 0)
+		array_push(&state->uses[pseudo->ssa_version], Instruction *, insn);
+}
+
+static void init_state(SCCPState *state, Proc *proc)
+{
+	memset(state, 0, sizeof *state);
+	state->proc = proc;
+	state->values = (LatticeValue *)raviX_calloc(proc->num_ssa_values + 1, sizeof(LatticeValue));
+	state->uses = (InstructionArray *)raviX_calloc(proc->num_ssa_values + 1, sizeof(InstructionArray));
+	state->executable_blocks = (bool *)raviX_calloc(proc->node_count, sizeof(bool));
+	state->executable_edges = (bool **)raviX_calloc(proc->node_count, sizeof(bool *));
+	/* Values without a defining instruction are the values of variables on entry to the proc */
+	for (unsigned i = 0; i <= proc->num_ssa_values; i++)
+		state->values[i] = bottom;
+	for (unsigned b = 0; b < proc->node_count; b++) {
+		BasicBlock *bb = proc->nodes[b];
+		uint32_t num_preds = raviX_node_list_size(predecessors(state, b));
+		state->executable_edges[b] = (bool *)raviX_calloc(num_preds + 1, sizeof(bool));
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			bool defines = raviX_opcode_defines_targets(insn->opcode);
+			Pseudo *pseudo;
+			FOR_EACH_PTR(insn->operands, Pseudo, pseudo) { add_use(state, pseudo, insn); }
+			END_FOR_EACH_PTR(pseudo)
+			FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+			{
+				if (!defines)
+					add_use(state, pseudo, insn);
+				else if (pseudo->ssa_version != 0)
+					state->values[pseudo->ssa_version] = top;
+			}
+			END_FOR_EACH_PTR(pseudo)
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+}
+
+static void destroy_state(SCCPState *state)
+{
+	for (unsigned i = 0; i <= state->proc->num_ssa_values; i++)
+		array_clearmem(&state->uses[i]);
+	for (unsigned b = 0; b < state->proc->node_count; b++)
+		raviX_free(state->executable_edges[b]);
+	raviX_free(state->executable_edges);
+	raviX_free(state->executable_blocks);
+	raviX_free(state->uses);
+	raviX_free(state->values);
+	array_clearmem(&state->cfg_worklist);
+	array_clearmem(&state->ssa_worklist);
+}
+
+static void solve(SCCPState *state)
+{
+	BasicBlock *entry = state->proc->nodes[ENTRY_BLOCK];
+	state->executable_blocks[ENTRY_BLOCK] = true;
+	Instruction *insn;
+	FOR_EACH_PTR(entry->insns, Instruction, insn) { visit_instruction(state, insn); }
+	END_FOR_EACH_PTR(insn)
+	while (state->cfg_worklist.count > 0 || state->ssa_worklist.count > 0) {
+		while (state->cfg_worklist.count > 0) {
+			CFGEdge edge = state->cfg_worklist.data[--state->cfg_worklist.count];
+			visit_edge(state, edge);
+		}
+		while (state->ssa_worklist.count > 0) {
+			insn = state->ssa_worklist.data[--state->ssa_worklist.count];
+			if (state->executable_blocks[insn->block->index])
+				visit_instruction(state, insn);
+		}
+	}
+}
+
+/* Returns a literal pseudo for the value in the form the given storage needs, or NULL */
+static Pseudo *materialize(SCCPState *state, const LatticeValue *v, enum PseudoType storage)
+{
+	if (v->state != LATTICE_CONSTANT)
+		return NULL;
+	LatticeValue value = *v;
+	if (storage == PSEUDO_TEMP_FLT) {
+		if (!is_number(v))
+			return NULL;
+		value = make_float(to_float(v));
+	} else if (storage == PSEUDO_TEMP_INT || storage == PSEUDO_TEMP_BOOL) {
+		/* The C variable holds 0 or 1 for booleans */
+		if (v->kind == VALUE_TRUE || v->kind == VALUE_FALSE)
+			value = make_integer(v->kind == VALUE_TRUE);
+		else if (v->kind != VALUE_INTEGER)
+			return NULL;
+	}
+	if (v->literal != NULL && same_value(v, &value))
+		return v->literal;
+	switch (value.kind) {
+	case VALUE_INTEGER:
+		/* LUA_MININTEGER cannot be written as a C literal */
+		if (value.i == LUA_MININTEGER)
+			return NULL;
+		return raviX_allocate_integer_constant_pseudo(state->proc, value.i);
+	case VALUE_FLOAT:
+		/* Constants are looked up by value; 0.0 and -0.0 compare equal, NaN never does */
+		if (!isfinite(value.n) || (value.n == 0.0 && signbit(value.n)))
+			return NULL;
+		return raviX_allocate_float_constant_pseudo(state->proc, value.n);
+	case VALUE_TRUE:
+	case VALUE_FALSE:
+		return raviX_allocate_boolean_pseudo(state->proc, value.kind == VALUE_TRUE);
+	default:
+		/* nil and strings are only propagated as the original literal */
+		return v->literal;
+	}
+}
+
+static bool is_register(const Pseudo *pseudo)
+{
+	return pseudo->type == PSEUDO_TEMP_ANY || pseudo->type == PSEUDO_SYMBOL || pseudo->type == PSEUDO_RANGE_SELECT;
+}
+
+/*
+ * Returns the storage a constant for the given operand needs to suit, PSEUDO_TEMP_ANY if any literal will do,
+ * or PSEUDO_CONSTANT if the operand must not be replaced by a literal.
+ */
+static enum PseudoType operand_storage(Instruction *insn, unsigned i)
+{
+	switch (insn->opcode) {
+	case op_mov:
+	case op_movi:
+	case op_movf: {
+		Pseudo *target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+		return target->type == PSEUDO_TEMP_FLT || target->type == PSEUDO_TEMP_INT ||
+			       target->type == PSEUDO_TEMP_BOOL
+			   ? (enum PseudoType)target->type
+			   : PSEUDO_TEMP_ANY;
+	}
+	case op_addii:
+	case op_subii:
+	case op_mulii:
+	case op_divii:
+	case op_bandii:
+	case op_borii:
+	case op_bxorii:
+	case op_shlii:
+	case op_shrii:
+	case op_eqii:
+	case op_ltii:
+	case op_leii:
+	case op_unmi:
+		return PSEUDO_TEMP_INT;
+	case op_addff:
+	case op_subff:
+	case op_mulff:
+	case op_divff:
+	case op_eqff:
+	case op_ltff:
+	case op_leff:
+	case op_unmf:
+		return PSEUDO_TEMP_FLT;
+	case op_addfi:
+	case op_subfi:
+	case op_mulfi:
+	case op_divfi:
+		return i == 0 ? PSEUDO_TEMP_FLT : PSEUDO_TEMP_INT;
+	case op_subif:
+	case op_divif:
+		return i == 0 ? PSEUDO_TEMP_INT : PSEUDO_TEMP_FLT;
+	case op_add:
+	case op_sub:
+	case op_mul: {
+		/* The generated code uses the same scratch TValue for both operands unless they are registers */
+		Pseudo *other = (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, 1 - i);
+		return is_register(other) ? PSEUDO_TEMP_ANY : PSEUDO_CONSTANT;
+	}
+	case op_div:
+	case op_idiv:
+	case op_band:
+	case op_bor:
+	case op_bxor:
+	case op_shl:
+	case op_shr:
+	case op_mod:
+	case op_pow:
+	case op_eq:
+	case op_lt:
+	case op_le:
+	case op_ret:
+		return PSEUDO_TEMP_ANY;
+	default:
+		return PSEUDO_CONSTANT;
+	}
+}
+
+static void replace_operands(SCCPState *state, Instruction *insn)
+{
+	unsigned i = 0;
+	Pseudo *operand;
+	FOR_EACH_PTR(insn->operands, Pseudo, operand)
+	{
+		unsigned index = i++;
+		if (operand->ssa_version == 0)
+			continue;
+		enum PseudoType storage = operand_storage(insn, index);
+		if (storage == PSEUDO_CONSTANT)
+			continue;
+		Pseudo *literal = materialize(state, &state->values[operand->ssa_version], storage);
+		if (literal != NULL) {
+			REPLACE_CURRENT_PTR(Pseudo, operand, literal);
+		}
+	}
+	END_FOR_EACH_PTR(operand)
+}
+
+/* Replaces an instruction that computes a constant by a move of the constant */
+static bool replace_with_move(SCCPState *state, Instruction *insn)
+{
+	if (!is_unary_foldable(insn->opcode) && !is_binary_foldable(insn->opcode))
+		return false;
+	if (raviX_ptrlist_size((const PtrList *)insn->targets) != 1)
+		return false;
+	Pseudo *target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+	if (target->ssa_version == 0)
+		return false;
+	enum PseudoType storage = (enum PseudoType)target->type;
+	if (storage != PSEUDO_TEMP_FLT && storage != PSEUDO_TEMP_INT && storage != PSEUDO_TEMP_BOOL)
+		storage = PSEUDO_TEMP_ANY;
+	Pseudo *literal = materialize(state, &state->values[target->ssa_version], storage);
+	if (literal == NULL)
+		return false;
+	C_MemoryAllocator *allocator = state->proc->linearizer->compiler_state->allocator;
+	insn->opcode = storage == PSEUDO_TEMP_FLT ? op_movf
+		       : storage == PSEUDO_TEMP_INT || storage == PSEUDO_TEMP_BOOL ? op_movi
+										    : op_mov;
+	insn->operands = NULL;
+	raviX_ptrlist_add((PtrList **)&insn->operands, literal, allocator);
+	return true;
+}
+
+/* Turns a conditional branch on a constant into a jump, and removes the edge that is never taken */
+static void fold_branch(SCCPState *state, Instruction *insn)
+{
+	LatticeValue cond = value_of(state, (Pseudo *)raviX_ptrlist_first((PtrList *)insn->operands));
+	if (cond.state != LATTICE_CONSTANT)
+		return;
+	C_MemoryAllocator *allocator = state->proc->linearizer->compiler_state->allocator;
+	Pseudo *true_target = (Pseudo *)raviX_ptrlist_first((PtrList *)insn->targets);
+	Pseudo *false_target = (Pseudo *)raviX_ptrlist_last((PtrList *)insn->targets);
+	Pseudo *taken = is_truthy(&cond) ? true_target : false_target;
+	Pseudo *not_taken = is_truthy(&cond) ? false_target : true_target;
+	insn->opcode = op_br;
+	insn->operands = NULL;
+	insn->targets = NULL;
+	raviX_ptrlist_add((PtrList **)&insn->targets, taken, allocator);
+	if (not_taken->block != taken->block)
+		raviX_delete_cfg_edge(state->proc, insn->block->index, not_taken->block->index);
+}
+
+static void remove_block(SCCPState *state, BasicBlock *bb)
+{
+	GraphNodeList *successors = raviX_successors(raviX_graph_node(state->proc->cfg, bb->index));
+	while (raviX_node_list_size(successors) > 0)
+		raviX_delete_cfg_edge(state->proc, bb->index, raviX_node_list_at(successors, 0));
+	raviX_ptrlist_remove_all((PtrList **)&bb->insns);
+}
+
+static void rewrite(SCCPState *state)
+{
+	Proc *proc = state->proc;
+	for (unsigned b = 0; b < proc->node_count; b++) {
+		BasicBlock *bb = proc->nodes[b];
+		if (b == ENTRY_BLOCK || b == EXIT_BLOCK || state->executable_blocks[b])
+			continue;
+		remove_block(state, bb);
+	}
+	for (unsigned b = 0; b < proc->node_count; b++) {
+		if (!state->executable_blocks[b])
+			continue;
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[b]->insns, Instruction, insn)
+		{
+			if (insn->opcode == op_phi)
+				continue;
+			if (insn->opcode == op_cbr)
+				fold_branch(state, insn);
+			else if (!replace_with_move(state, insn))
+				replace_operands(state, insn);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+}
+
+static void propagate_constants(Proc *proc)
+{
+	SCCPState state;
+	init_state(&state, proc);
+	solve(&state);
+	rewrite(&state);
+	destroy_state(&state);
+}
+
+int raviX_propagate_constants(LinearizerState *linearizer)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		if (proc->cfg != NULL && proc->num_ssa_values != 0)
+			propagate_constants(proc);
+	}
+	END_FOR_EACH_PTR(proc)
+	return 0;
+}
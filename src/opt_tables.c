@@ -0,0 +1,363 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Scalar replacement of table literals.
+ * A table constructor whose keys are constant strings or integers, and whose table is only held by a
+ * local variable that is never reassigned, does not escape the proc if the local is only used to get
+ * and put fields with constant keys. Such a table is never allocated: each of its fields lives in a
+ * local variable of its own, the stores of the constructor and the puts become moves into the field's
+ * variable, and the gets become moves out of it. Fields that the constructor does not set start as nil.
+ * A table without a metatable has no hooks on get and put, and the table literal cannot be given one
+ * without escaping, so this preserves its behaviour.
+ * The pass runs on the linear IR before SSA construction, so later passes see the fields as plain
+ * variables; it does not change the CFG.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "optimizer.h"
+
+#include <string.h>
+
+typedef struct TableField {
+	const Constant *key;
+	Pseudo *pseudo; /* local variable holding the field */
+	bool initialized; /* set by the constructor */
+} TableField;
+
+DECLARE_ARRAY(TableFieldArray, TableField);
+
+typedef struct ReplacedTable {
+	Instruction *newtable;
+	Instruction *init;	  /* move of the new table to the local variable */
+	const LuaSymbol *symbol;  /* the local variable */
+	TableFieldArray fields;
+	bool escapes;
+} ReplacedTable;
+
+DECLARE_ARRAY(ReplacedTableArray, ReplacedTable);
+
+static Pseudo *get_operand(Instruction *insn, unsigned idx)
+{
+	return (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->operands, idx);
+}
+
+static Pseudo *get_target(Instruction *insn, unsigned idx)
+{
+	return (Pseudo *)raviX_ptrlist_nth_entry((PtrList *)insn->targets, idx);
+}
+
+static bool is_get(unsigned opcode)
+{
+	return opcode == op_get || opcode == op_get_ikey || opcode == op_get_skey || opcode == op_tget ||
+	       opcode == op_tget_ikey || opcode == op_tget_skey;
+}
+
+static bool is_put(unsigned opcode)
+{
+	return opcode == op_put || opcode == op_put_ikey || opcode == op_put_skey || opcode == op_tput ||
+	       opcode == op_tput_ikey || opcode == op_tput_skey;
+}
+
+/* Returns the key if the pseudo is a constant that can name a field */
+static const Constant *field_key(const Pseudo *key)
+{
+	if (key->type != PSEUDO_CONSTANT ||
+	    (key->constant->type != RAVI_TSTRING && key->constant->type != RAVI_TNUMINT))
+		return NULL;
+	return key->constant;
+}
+
+static TableField *find_field(ReplacedTable *table, const Constant *key)
+{
+	for (unsigned i = 0; i < table->fields.count; i++) {
+		const Constant *k = table->fields.data[i].key;
+		if (k->type == key->type && (k->type == RAVI_TSTRING ? k->s == key->s : k->i == key->i))
+			return &table->fields.data[i];
+	}
+	TableField field = {.key = key};
+	array_push(&table->fields, TableField, field);
+	return &table->fields.data[table->fields.count - 1];
+}
+
+/* Does the instruction refer to the Lua stack temp that holds the table being constructed? */
+static bool refers_to_temp(Instruction *insn, unsigned reg)
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		if ((pseudo->type == PSEUDO_TEMP_ANY && pseudo->regnum == reg) ||
+		    ((pseudo->type == PSEUDO_RANGE || pseudo->type == PSEUDO_RANGE_SELECT) && pseudo->regnum <= reg))
+			return true;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		if ((pseudo->type == PSEUDO_TEMP_ANY && pseudo->regnum == reg) ||
+		    ((pseudo->type == PSEUDO_RANGE || pseudo->type == PSEUDO_RANGE_SELECT) && pseudo->regnum <= reg))
+			return true;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	return false;
+}
+
+/*
+ * Checks that the table created by the newtable instruction is only given constant keyed fields and is then
+ * moved to a local variable that is never reassigned; the instructions must all be in the same block.
+ */
+static bool find_constructor(ReplacedTable *table, BasicBlock *bb)
+{
+	unsigned reg = get_target(table->newtable, 0)->regnum;
+	bool found = false;
+	Instruction *insn;
+	FOR_EACH_PTR(bb->insns, Instruction, insn)
+	{
+		if (insn == table->newtable) {
+			found = true;
+			continue;
+		}
+		if (!found)
+			continue;
+		if (is_put(insn->opcode) && get_target(insn, 0)->type == PSEUDO_TEMP_ANY &&
+		    get_target(insn, 0)->regnum == reg) {
+			const Constant *key = field_key(get_target(insn, 1));
+			Pseudo *value = get_operand(insn, 0);
+			if (key == NULL || value->type == PSEUDO_RANGE ||
+			    (value->type == PSEUDO_TEMP_ANY && value->regnum == reg))
+				return false;
+			find_field(table, key)->initialized = true;
+			continue;
+		}
+		if (insn->opcode == op_mov && get_operand(insn, 0)->type == PSEUDO_TEMP_ANY &&
+		    get_operand(insn, 0)->regnum == reg) {
+			Pseudo *target = get_target(insn, 0);
+			if (target->type != PSEUDO_SYMBOL || target->symbol->symbol_type != SYM_LOCAL ||
+			    target->symbol->variable.modified || target->symbol->variable.escaped)
+				return false;
+			table->init = insn;
+			table->symbol = target->symbol;
+			return true;
+		}
+		if (refers_to_temp(insn, reg))
+			return false;
+	}
+	END_FOR_EACH_PTR(insn)
+	return false;
+}
+
+static bool is_table(const ReplacedTable *table, const Pseudo *pseudo)
+{
+	return pseudo->type == PSEUDO_SYMBOL && pseudo->symbol == table->symbol;
+}
+
+/* Checks how an instruction uses the local variable that holds the table, the table escapes on any use
+ * other than a get or put of a constant key */
+static void check_uses(ReplacedTable *table, Instruction *insn)
+{
+	if (insn == table->init)
+		return;
+	if (is_get(insn->opcode) && is_table(table, get_operand(insn, 0))) {
+		const Constant *key = field_key(get_operand(insn, 1));
+		if (key == NULL)
+			table->escapes = true;
+		else
+			find_field(table, key);
+		return;
+	}
+	if (is_put(insn->opcode) && is_table(table, get_target(insn, 0))) {
+		const Constant *key = field_key(get_target(insn, 1));
+		Pseudo *value = get_operand(insn, 0);
+		if (key == NULL || value->type == PSEUDO_RANGE || is_table(table, value))
+			table->escapes = true;
+		else
+			find_field(table, key);
+		return;
+	}
+	Pseudo *pseudo;
+	FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+	{
+		if (is_table(table, pseudo))
+			table->escapes = true;
+	}
+	END_FOR_EACH_PTR(pseudo)
+	FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+	{
+		if (is_table(table, pseudo))
+			table->escapes = true;
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
+
+static Instruction *new_move(Proc *proc, Pseudo *src, Pseudo *dst, Instruction *at)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	Instruction *insn = (Instruction *)allocator->calloc(allocator->arena, 1, sizeof(Instruction));
+	insn->opcode = op_mov;
+	insn->block = at->block;
+	insn->line_number = at->line_number;
+	raviX_ptrlist_add((PtrList **)&insn->operands, src, allocator);
+	raviX_ptrlist_add((PtrList **)&insn->targets, dst, allocator);
+	return insn;
+}
+
+/* Turns a get or put of a field of the table into a move */
+static void replace_access(Proc *proc, ReplacedTable *table, Instruction *insn)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	if (is_get(insn->opcode)) {
+		Pseudo *field = find_field(table, field_key(get_operand(insn, 1)))->pseudo;
+		raviX_ptrlist_remove_all((PtrList **)&insn->operands);
+		raviX_ptrlist_add((PtrList **)&insn->operands, field, allocator);
+	} else {
+		Pseudo *field = find_field(table, field_key(get_target(insn, 1)))->pseudo;
+		raviX_ptrlist_remove_all((PtrList **)&insn->targets);
+		raviX_ptrlist_add((PtrList **)&insn->targets, field, allocator);
+	}
+	insn->opcode = op_mov;
+}
+
+/* Returns the replaced table that the instruction creates or accesses through the local variable */
+static ReplacedTable *replaced_table(ReplacedTableArray *tables, Instruction *insn)
+{
+	for (unsigned i = 0; i < tables->count; i++) {
+		ReplacedTable *table = &tables->data[i];
+		if (table->escapes)
+			continue;
+		if (insn == table->newtable)
+			return table;
+		if (is_get(insn->opcode) && is_table(table, get_operand(insn, 0)))
+			return table;
+		if (is_put(insn->opcode) && is_table(table, get_target(insn, 0)))
+			return table;
+	}
+	return NULL;
+}
+
+static void rewrite_block(Proc *proc, ReplacedTableArray *tables, BasicBlock *bb)
+{
+	C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+	InstructionList *insns = NULL;
+	ReplacedTable *constructing = NULL; /* table whose constructor is being rewritten */
+	Instruction *insn;
+	FOR_EACH_PTR(bb->insns, Instruction, insn)
+	{
+		if (constructing != NULL) {
+			if (insn == constructing->init) {
+				constructing = NULL;
+				continue;
+			}
+			Pseudo *target = is_put(insn->opcode) ? get_target(insn, 0) : NULL;
+			if (target != NULL && target->type == PSEUDO_TEMP_ANY &&
+			    target->regnum == get_target(constructing->newtable, 0)->regnum) {
+				replace_access(proc, constructing, insn);
+				raviX_ptrlist_add((PtrList **)&insns, insn, allocator);
+				continue;
+			}
+		}
+		ReplacedTable *table = replaced_table(tables, insn);
+		if (table == NULL) {
+			raviX_ptrlist_add((PtrList **)&insns, insn, allocator);
+		} else if (insn == table->newtable) {
+			/* Fields not set by the constructor are nil */
+			for (unsigned i = 0; i < table->fields.count; i++) {
+				TableField *field = &table->fields.data[i];
+				if (!field->initialized)
+					raviX_ptrlist_add((PtrList **)&insns,
+							  new_move(proc, raviX_allocate_nil_pseudo(proc), field->pseudo, insn),
+							  allocator);
+			}
+			constructing = table;
+		} else {
+			replace_access(proc, table, insn);
+			raviX_ptrlist_add((PtrList **)&insns, insn, allocator);
+		}
+	}
+	END_FOR_EACH_PTR(insn)
+	bb->insns = insns;
+}
+
+static void process_proc(Proc *proc)
+{
+	ReplacedTableArray tables = {0};
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		BasicBlock *bb = proc->nodes[i];
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			if (insn->opcode != op_newtable || get_target(insn, 0)->type != PSEUDO_TEMP_ANY)
+				continue;
+			ReplacedTable table = {.newtable = insn};
+			if (find_constructor(&table, bb)) {
+				array_push(&tables, ReplacedTable, table);
+			} else {
+				array_clearmem(&table.fields);
+			}
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	if (tables.count == 0)
+		return;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[i]->insns, Instruction, insn)
+		{
+			for (unsigned j = 0; j < tables.count; j++)
+				check_uses(&tables.data[j], insn);
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	bool changed = false;
+	for (unsigned j = 0; j < tables.count; j++) {
+		ReplacedTable *table = &tables.data[j];
+		for (unsigned i = 0; i < table->fields.count && !table->escapes; i++) {
+			TableField *field = &table->fields.data[i];
+			const StringObject *name =
+			    field->key->type == RAVI_TSTRING ? field->key->s : table->symbol->variable.var_name;
+			field->pseudo = raviX_allocate_new_local_pseudo(proc, name);
+			if (field->pseudo == NULL)
+				table->escapes = true; /* Lua frame is full */
+		}
+		if (!table->escapes)
+			changed = true;
+	}
+	if (changed) {
+		for (unsigned i = 0; i < proc->node_count; i++)
+			rewrite_block(proc, &tables, proc->nodes[i]);
+	}
+	for (unsigned j = 0; j < tables.count; j++)
+		array_clearmem(&tables.data[j].fields);
+	array_clearmem(&tables);
+}
+
+int raviX_replace_tables(LinearizerState *linearizer)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		if (proc->cfg != NULL && proc->num_ssa_values == 0)
+			process_proc(proc);
+	}
+	END_FOR_EACH_PTR(proc)
+	return 0;
+}
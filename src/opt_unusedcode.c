@@ -58,7 +58,7 @@ static int process_block(LinearizerState *linearizer, Proc *proc, BasicBlock *bb
 	}
 	for (uint32_t i = 0; i < count; i++) {
 		// Remove edge from bb to the successor node
-		raviX_delete_edge(proc->cfg, bb->index, nodes[i]);
+		raviX_delete_cfg_edge(proc, bb->index, nodes[i]);
 	}
 	raviX_free(nodes);
 	assert(raviX_node_list_size(successors) == 0); // All should be gone
@@ -30,4 +30,81 @@
  */
 extern int raviX_remove_unreachable_blocks(LinearizerState *linearizer);
 
+/**
+ * Puts the proc and its child procs into SSA form. The CFG must have been constructed.
+ * Each version of a variable is a copy of the variable's pseudo with a distinct ssa_version,
+ * and phi instructions are added at the start of blocks where versions merge.
+ */
+extern void raviX_construct_ssa(Proc *proc);
+
+/**
+ * Takes the proc and its child procs out of SSA form by removing phis and reinstating the
+ * original pseudos. Must be done before generating code.
+ */
+extern void raviX_destruct_ssa(Proc *proc);
+
+/* Classes of variables tracked by the optimizer; registers are numbered separately in each class */
+enum VariableClass { VAR_LOCAL, VAR_TEMP_INT, VAR_TEMP_FLT, VAR_TEMP_ANY, VAR_CLASS_COUNT };
+
+/**
+ * Returns the VariableClass of a local variable or temp pseudo, or -1 if the pseudo is not a variable.
+ * Bool temps share the integer temp registers.
+ */
+extern int raviX_variable_class(const Pseudo *pseudo);
+
+/**
+ * Returns false for instructions whose targets are read rather than written, such as stores and branches.
+ */
+extern bool raviX_opcode_defines_targets(unsigned opcode);
+
+/**
+ * Returns true for instructions that read and write the same target, such as type assertions.
+ */
+extern bool raviX_opcode_updates_in_place(unsigned opcode);
+
+/**
+ * Deletes a CFG edge. If the proc is in SSA form the phis in the target block lose the
+ * argument for the edge.
+ */
+extern void raviX_delete_cfg_edge(Proc *proc, nodeId_t from, nodeId_t to);
+
+/**
+ * Sparse conditional constant propagation. Procs must be in SSA form, others are skipped.
+ * Conditional branches on constants are replaced by jumps and blocks that cannot be reached
+ * are deleted.
+ */
+extern int raviX_propagate_constants(LinearizerState *linearizer);
+
+/**
+ * Removes instructions without side effects whose results are not live. Procs in SSA
+ * form are skipped.
+ */
+extern int raviX_remove_dead_code(LinearizerState *linearizer);
+
+/**
+ * Moves instructions that compute the same numeric value on every iteration of a loop to the
+ * block that precedes the loop. Procs in SSA form are skipped.
+ */
+extern int raviX_hoist_loop_invariants(LinearizerState *linearizer);
+
+/**
+ * Caches each global that a proc reads repeatedly in a stack slot filled by the load that dominates
+ * the others, and replaces the other loads by copies. Only correct if globals read by the chunk are
+ * not changed by other code while a proc runs; globals assigned by the chunk are not cached, and
+ * nothing is cached if the chunk may change globals through _ENV or _G. Procs in SSA form are skipped.
+ */
+extern int raviX_cache_globals(LinearizerState *linearizer);
+
+/**
+ * Replaces calls to small local functions that are never reassigned by a copy of the function's
+ * body. Must run before SSA construction; the CFGs of all procs are rebuilt if anything changes.
+ */
+extern int raviX_inline_procs(LinearizerState *linearizer);
+
+/**
+ * Replaces table literals that do not escape the proc, and are only accessed with constant keys,
+ * by a local variable per field. Must run before SSA construction; the CFGs are not changed.
+ */
+extern int raviX_replace_tables(LinearizerState *linearizer);
+
 #endif
\ No newline at end of file
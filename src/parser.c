@@ -78,6 +78,7 @@ AstNode *raviX_allocate_ast_node_at_line(CompilerState *compiler_state, enum Ast
 	AstNode *node = (AstNode *)compiler_state->allocator->calloc(compiler_state->allocator->arena, 1, sizeof(AstNode));
 	node->type = type;
 	node->line_number = line_num;
+	compiler_state->ast_node_count++;
 	return node;
 }
 
@@ -198,6 +199,7 @@ LuaSymbol *raviX_new_local_symbol(CompilerState *compiler_state, Scope *scope, c
 	symbol->variable.escaped = 0;
 	symbol->variable.modified = 0;
 	symbol->variable.literal_initializer = NULL;
+	symbol->variable.function_initializer = NULL;
 	return symbol;
 }
 
@@ -666,22 +668,20 @@ static const StringObject *parse_user_defined_type_name(LexerState *ls,
 	size_t len = 0;
 	if (testnext(ls, '.')) {
 		char buffer[256] = {0};
-		const char *str = type_name->str;
-		len = strlen(str);
+		len = type_name->len;
 		if (len >= sizeof buffer) {
 			raviX_syntaxerror(ls, "User defined type name is too long");
 			return type_name;
 		}
-		snprintf(buffer, sizeof buffer, "%s", str);
+		snprintf(buffer, sizeof buffer, "%.*s", (int)type_name->len, type_name->str);
 		do {
 			type_name = check_name_and_next(ls);
-			str = type_name->str;
-			size_t newlen = len + strlen(str) + 1;
+			size_t newlen = len + type_name->len + 1;
 			if (newlen >= sizeof buffer) {
 				raviX_syntaxerror(ls, "User defined type name is too long");
 				return type_name;
 			}
-			snprintf(buffer + len, sizeof buffer - len, ".%s", str);
+			snprintf(buffer + len, sizeof buffer - len, ".%.*s", (int)type_name->len, type_name->str);
 			len = newlen;
 		} while (testnext(ls, '.'));
 		type_name = raviX_create_string(ls->compiler_state, buffer, (uint32_t)strlen(buffer));
@@ -703,23 +703,22 @@ static LuaSymbol *parse_local_variable_declaration(ParserState *parser)
 	const StringObject *pusertype = NULL;
 	if (testnext(ls, ':')) {
 		const StringObject *type_name = check_name_and_next(ls); /* we expect a type name */
-		const char *str = type_name->str;
 		/* following is not very nice but easy as
 		 * the lexer doesn't need to be changed
 		 */
-		if (strcmp(str, "integer") == 0)
+		if (raviX_string_equals(type_name, "integer"))
 			tt = RAVI_TNUMINT;
-		else if (strcmp(str, "number") == 0)
+		else if (raviX_string_equals(type_name, "number"))
 			tt = RAVI_TNUMFLT;
-		else if (strcmp(str, "closure") == 0)
+		else if (raviX_string_equals(type_name, "closure"))
 			tt = RAVI_TFUNCTION;
-		else if (strcmp(str, "table") == 0)
+		else if (raviX_string_equals(type_name, "table"))
 			tt = RAVI_TTABLE;
-		else if (strcmp(str, "string") == 0)
+		else if (raviX_string_equals(type_name, "string"))
 			tt = RAVI_TSTRING;
-		else if (strcmp(str, "boolean") == 0)
+		else if (raviX_string_equals(type_name, "boolean"))
 			tt = RAVI_TBOOLEAN;
-		else if (strcmp(str, "any") == 0)
+		else if (raviX_string_equals(type_name, "any"))
 			tt = RAVI_TANY;
 		else {
 			/* default is a userdata type */
@@ -1233,7 +1232,7 @@ static AstNode *parse_goto_statment(ParserState *parser)
 		label = check_name_and_next(ls);
 	else {
 		raviX_next(ls); /* skip break */
-		label = raviX_create_string(ls->compiler_state, "break", sizeof "break");
+		label = raviX_create_string(ls->compiler_state, "break", sizeof "break" - 1);
 		is_break = 1;
 	}
 	// Resolve labels in the end?
@@ -1541,6 +1540,7 @@ static AstNode *parse_local_function_statement(ParserState *parser)
 	stmt->local_stmt.expr_list = NULL;
 	raviX_add_symbol(parser->compiler_state, &stmt->local_stmt.var_list, symbol);
 	add_ast_node(parser->compiler_state, &stmt->local_stmt.expr_list, function_ast);
+	symbol->variable.function_initializer = function_ast;
 	return stmt;
 }
 
@@ -1566,7 +1566,7 @@ static inline int min_int(int a, int b) {
 }
 
 /**
- * Marks locals that have an initializer with literal value
+ * Marks locals that have an initializer with literal value or a function expression
  */
 static void detect_constant_assignments(LocalStatement *local_statement) {
 	int maxele = min_int(raviX_ptrlist_size((const PtrList *)local_statement->var_list), raviX_ptrlist_size((const PtrList *)local_statement->expr_list));
@@ -1576,6 +1576,9 @@ static void detect_constant_assignments(LocalStatement *local_statement) {
 		if (expr->type == EXPR_LITERAL) {
 			assert(symbol->symbol_type == SYM_LOCAL);
 			symbol->variable.literal_initializer = expr;
+		} else if (expr->type == EXPR_FUNCTION) {
+			assert(symbol->symbol_type == SYM_LOCAL);
+			symbol->variable.function_initializer = expr;
 		}
 	}
 }
@@ -1958,7 +1961,12 @@ static uint32_t string_hash(const void *c)
 CompilerState *raviX_init_compiler(C_MemoryAllocator *allocator)
 {
 	CompilerState *compiler_state = (CompilerState *)raviX_calloc(1, sizeof(CompilerState));
+	if (allocator == NULL) {
+		raviX_init_arena_allocator(&compiler_state->arena_allocator);
+		allocator = &compiler_state->arena_allocator;
+	}
 	compiler_state->allocator = allocator;
+	compiler_state->base_allocator = allocator;
 	raviX_buffer_init(&compiler_state->buff, 1024);
 	raviX_buffer_init(&compiler_state->error_message, 256);
 	compiler_state->strings = raviX_set_create(string_hash, string_equal);
@@ -1966,9 +1974,37 @@ CompilerState *raviX_init_compiler(C_MemoryAllocator *allocator)
 	compiler_state->killed = false;
 	compiler_state->linearizer = NULL;
 	compiler_state->_ENV = raviX_create_string(compiler_state, "_ENV", 4);
+	raviX_create_reserved_words(compiler_state);
+	if (compiler_state->allocator == &compiler_state->arena_allocator) {
+		/* raviX_reset_compiler() releases memory back to this point */
+		raviX_arena_set_mark(compiler_state->arena_allocator.arena);
+	}
 	return compiler_state;
 }
 
+void raviX_reset_compiler(CompilerState *compiler_state)
+{
+	assert(!compiler_state->killed);
+	assert(compiler_state->linearizer == NULL);
+	compiler_state->main_function = NULL;
+	compiler_state->ast_node_count = 0;
+	raviX_buffer_reset(&compiler_state->buff);
+	raviX_buffer_reset(&compiler_state->error_message);
+	/* Only the strings created by raviX_init_compiler() survive */
+	raviX_set_clear(compiler_state->strings);
+	raviX_set_add_pre_hashed(compiler_state->strings, compiler_state->_ENV->hash, compiler_state->_ENV);
+	for (int i = 0; i < NUM_RESERVED; i++) {
+		const StringObject *s = compiler_state->reserved_words[i];
+		raviX_set_add_pre_hashed(compiler_state->strings, s->hash, s);
+	}
+	/* The current chunk may be released below, so the next string starts a new one */
+	compiler_state->string_pool = NULL;
+	compiler_state->string_pool_avail = 0;
+	if (compiler_state->allocator == &compiler_state->arena_allocator) {
+		raviX_arena_release_to_mark(compiler_state->arena_allocator.arena);
+	}
+}
+
 void raviX_destroy_compiler(CompilerState *compiler_state)
 {
 	if (!compiler_state->killed) {
@@ -1979,6 +2015,10 @@ void raviX_destroy_compiler(CompilerState *compiler_state)
 		raviX_set_destroy(compiler_state->strings, NULL);
 		raviX_buffer_free(&compiler_state->buff);
 		raviX_buffer_free(&compiler_state->error_message);
+		if (compiler_state->allocator == &compiler_state->arena_allocator) {
+			/* Releases the AST, symbols, strings and IR in one go */
+			raviX_arena_destroy(compiler_state->arena_allocator.arena);
+		}
 		compiler_state->killed = true;
 	}
 	raviX_free(compiler_state);
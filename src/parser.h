@@ -59,6 +59,9 @@ typedef unsigned char lu_byte;
 
 typedef struct AstNode AstNode;
 
+/* number of reserved words */
+#define NUM_RESERVED ((int)(TOK_while - FIRST_RESERVED + 1))
+
 /*
  * Encapsulate all the compiler state.
  * All memory is held by this object or sub-objects. Memory is freed when
@@ -66,6 +69,8 @@ typedef struct AstNode AstNode;
  */
 struct CompilerState {
 	C_MemoryAllocator *allocator;
+	C_MemoryAllocator *base_allocator; /* The allocator that allocator wraps, if it is a wrapper; else the same */
+	C_MemoryAllocator arena_allocator; /* Built-in region allocator, used if no allocator was supplied */
 	Set *strings;
 	AstNode *main_function;
 	LinearizerState *linearizer;
@@ -75,11 +80,13 @@ struct CompilerState {
 	TextBuffer error_message; /* For error handling, error message is saved here */
 	bool killed;		 /* flag to check if this is already destroyed */
 	const StringObject *_ENV; /* name of the env variable */
+	unsigned ast_node_count;  /* number of AST nodes allocated, for statistics */
+	const StringObject *reserved_words[NUM_RESERVED]; /* interned once, retained by raviX_reset_compiler() */
+	bool zero_copy_strings;	  /* intern names and plain string literals in place, see raviX_set_zero_copy_strings() */
+	char *string_pool;	  /* next free byte in the current chunk of the string pool */
+	size_t string_pool_avail; /* bytes left in the current chunk */
 };
 
-/* number of reserved words */
-#define NUM_RESERVED ((int)(TOK_while - FIRST_RESERVED + 1))
-
 /* state of the lexer plus state of the parser when shared by all
    functions */
 struct LexerState {
@@ -98,6 +105,9 @@ struct LexerState {
 	const char *envn;   /* environment variable name */
 };
 void raviX_syntaxerror(LexerState *ls, const char *msg);
+void raviX_create_reserved_words(CompilerState *compiler_state);
+/* Compares an interned string with a 0 terminated C string; interned strings need not be 0 terminated */
+bool raviX_string_equals(const StringObject *s, const char *cstr);
 
 DECLARE_PTR_LIST(AstNodeList, AstNode);
 
@@ -189,6 +199,7 @@ struct LuaVariableSymbol {
 	    modified : 1;	     /*There is an update to the variable post initialization */
 	Pseudo *pseudo;	   /* backend data for the symbol */
 	AstNode *literal_initializer; /* Was initialized with literal */
+	AstNode *function_initializer; /* Was initialized with a function expression */
 };
 struct LuaLabelSymbol {
 	const StringObject *label_name;
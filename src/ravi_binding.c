@@ -28,76 +28,576 @@
 
 #include "cfg.h"
 #include "codegen.h"
+#include "compile_cache.h"
 #include "optimizer.h"
 
-int raviX_compile(struct Ravi_CompilerInterface *compiler_interface)
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/*
+ * When statistics are requested the compiler's memory allocator is wrapped so that
+ * we can count the allocations made during each phase. The wrapper's arena points to
+ * this structure.
+ */
+typedef struct StatsAllocator {
+	C_MemoryAllocator *allocator; /* The allocator being wrapped */
+	unsigned long long alloc_count;
+	unsigned long long alloc_bytes;
+} StatsAllocator;
+
+static void *stats_realloc(void *arena, void *mem, size_t newsize)
+{
+	StatsAllocator *stats_allocator = (StatsAllocator *)arena;
+	stats_allocator->alloc_count++;
+	stats_allocator->alloc_bytes += newsize;
+	return stats_allocator->allocator->realloc(stats_allocator->allocator->arena, mem, newsize);
+}
+
+static void *stats_calloc(void *arena, size_t n_elements, size_t elem_size)
+{
+	StatsAllocator *stats_allocator = (StatsAllocator *)arena;
+	stats_allocator->alloc_count++;
+	stats_allocator->alloc_bytes += n_elements * elem_size;
+	return stats_allocator->allocator->calloc(stats_allocator->allocator->arena, n_elements, elem_size);
+}
+
+static void stats_free(void *arena, void *p)
+{
+	StatsAllocator *stats_allocator = (StatsAllocator *)arena;
+	stats_allocator->allocator->free(stats_allocator->allocator->arena, p);
+}
+
+/* Tracks the start of the current phase */
+typedef struct PhaseTimer {
+	Ravi_CompilerStats *stats; /* NULL if statistics are not being collected */
+	StatsAllocator *stats_allocator;
+	struct timespec start_time;
+	unsigned long long start_alloc_count;
+	unsigned long long start_alloc_bytes;
+} PhaseTimer;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+	return (double)(end->tv_sec - start->tv_sec) * 1000.0 + (double)(end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void begin_phase(PhaseTimer *timer)
+{
+	if (timer->stats == NULL)
+		return;
+	timer->start_alloc_count = timer->stats_allocator->alloc_count;
+	timer->start_alloc_bytes = timer->stats_allocator->alloc_bytes;
+	timespec_get(&timer->start_time, TIME_UTC);
+}
+
+static void end_phase(PhaseTimer *timer, enum Ravi_CompilerPhase phase)
 {
-	int rc = 0;
-	int dump_ir = 0;
-	int dump_ast = 0;
+	if (timer->stats == NULL)
+		return;
+	struct timespec end_time;
+	timespec_get(&end_time, TIME_UTC);
+	Ravi_CompilerPhaseStats *phase_stats = &timer->stats->phases[phase];
+	phase_stats->elapsed_ms += elapsed_ms(&timer->start_time, &end_time);
+	phase_stats->alloc_count += timer->stats_allocator->alloc_count - timer->start_alloc_count;
+	phase_stats->alloc_bytes += timer->stats_allocator->alloc_bytes - timer->start_alloc_bytes;
+}
+
+static const char *phase_names[RAVI_PHASE_COUNT] = {"parse",	 "lower", "typecheck", "simplify",
+						    "linearize", "cfg",	  "optimize",  "codegen"};
+
+const char *raviX_compiler_phase_name(enum Ravi_CompilerPhase phase)
+{
+	if (phase < 0 || phase >= RAVI_PHASE_COUNT)
+		return "unknown";
+	return phase_names[phase];
+}
+
+/* Counts procs, live basic blocks and instructions in the IR */
+static void collect_ir_stats(LinearizerState *linearizer, Ravi_CompilerStats *stats)
+{
+	Proc *proc;
+	FOR_EACH_PTR(linearizer->all_procs, Proc, proc)
+	{
+		stats->proc_count++;
+		for (unsigned i = 0; i < proc->node_count; i++) {
+			BasicBlock *bb = proc->nodes[i];
+			int count = raviX_ptrlist_size((const PtrList *)bb->insns);
+			if (count == 0)
+				continue; /* Deleted block */
+			stats->basic_block_count++;
+			stats->instruction_count += count;
+		}
+	}
+	END_FOR_EACH_PTR(proc)
+}
+
+static void report_stats(struct Ravi_CompilerInterface *compiler_interface)
+{
+	Ravi_CompilerStats *stats = &compiler_interface->stats;
+	TextBuffer mb;
+	raviX_buffer_init(&mb, 1024);
+	raviX_buffer_add_string(&mb, "compiler statistics:\n");
+	double total_ms = 0.0;
+	for (int i = 0; i < RAVI_PHASE_COUNT; i++) {
+		Ravi_CompilerPhaseStats *phase_stats = &stats->phases[i];
+		raviX_buffer_add_fstring(&mb, "  %-10s %10.3f ms %10llu allocs %12llu bytes\n", phase_names[i],
+					 phase_stats->elapsed_ms, phase_stats->alloc_count, phase_stats->alloc_bytes);
+		total_ms += phase_stats->elapsed_ms;
+	}
+	raviX_buffer_add_fstring(&mb, "  %-10s %10.3f ms\n", "total", total_ms);
+	raviX_buffer_add_fstring(&mb, "  ast nodes %u, procs %u, basic blocks %u, instructions %u, C bytes %llu\n",
+				 stats->ast_node_count, stats->proc_count, stats->basic_block_count,
+				 stats->instruction_count, (unsigned long long)stats->generated_code_size);
+	if (compiler_interface->debug_message != NULL)
+		compiler_interface->debug_message(compiler_interface->context, compiler_interface->source_name, 0,
+						  raviX_buffer_data(&mb));
+	raviX_buffer_free(&mb);
+}
+
+typedef struct CompileOptions {
+	int dump_ir;
+	int dump_ast;
+	int collect_stats;
+	int ssa;
+	int sccp;
+	int dce;
+	int licm;
+	int stable_globals;
+	int inline_procs;
+	int replace_tables;
+} CompileOptions;
+
+/* Returns n for -On in the options, 1 for a plain -O and 0 if not given */
+static int optimization_level(const char *compiler_options)
+{
+	const char *opt = strstr(compiler_options, "-O");
+	if (opt == NULL)
+		return 0;
+	if (opt[2] >= '0' && opt[2] <= '9')
+		return opt[2] - '0';
+	return 1;
+}
+
+static void parse_options(struct Ravi_CompilerInterface *compiler_interface, CompileOptions *options)
+{
+	memset(options, 0, sizeof *options);
 	if (compiler_interface->compiler_options != NULL) {
-		dump_ir = strstr(compiler_interface->compiler_options, "--dump-ir") != NULL;
-		dump_ast = strstr(compiler_interface->compiler_options, "--dump-ast") != NULL;
+		options->dump_ir = strstr(compiler_interface->compiler_options, "--dump-ir") != NULL;
+		options->dump_ast = strstr(compiler_interface->compiler_options, "--dump-ast") != NULL;
+		options->collect_stats = strstr(compiler_interface->compiler_options, "--stats") != NULL;
+		int level = optimization_level(compiler_interface->compiler_options);
+		options->licm = level >= 1 || strstr(compiler_interface->compiler_options, "--licm") != NULL;
+		options->dce = level >= 1 || strstr(compiler_interface->compiler_options, "--dce") != NULL;
+		options->sccp = level >= 1 || strstr(compiler_interface->compiler_options, "--sccp") != NULL;
+		options->inline_procs = level >= 2 || strstr(compiler_interface->compiler_options, "--inline-functions") != NULL;
+		options->replace_tables = level >= 1 || strstr(compiler_interface->compiler_options, "--replace-tables") != NULL;
+		options->ssa = options->sccp || strstr(compiler_interface->compiler_options, "--ssa") != NULL;
+		/* Not implied by -O as it changes behaviour if globals are modified by other code */
+		options->stable_globals = strstr(compiler_interface->compiler_options, "--stable-globals") != NULL;
 	}
-	compiler_interface->generated_code = NULL;
-	CompilerState *compiler_state = raviX_init_compiler(compiler_interface->memory_allocator);
-	LinearizerState *linearizer = raviX_init_linearizer(compiler_state);
-	rc = raviX_parse(compiler_state, compiler_interface->source, compiler_interface->source_len,
-			 compiler_interface->source_name);
+}
+
+/* Sets up the allocator wrapper that counts allocations */
+static void init_stats_allocator(C_MemoryAllocator *stats_wrapper, StatsAllocator *stats_allocator,
+				 C_MemoryAllocator *allocator)
+{
+	stats_allocator->allocator = allocator;
+	stats_allocator->alloc_count = 0;
+	stats_allocator->alloc_bytes = 0;
+	*stats_wrapper = *allocator;
+	stats_wrapper->arena = stats_allocator;
+	stats_wrapper->realloc = stats_realloc;
+	stats_wrapper->calloc = stats_calloc;
+	stats_wrapper->free = stats_free;
+}
+
+/* Hands the output to the caller, either as generated_code or through the emit_code callback */
+static void set_output(struct Ravi_CompilerInterface *compiler_interface, TextBuffer *buf)
+{
+	size_t len = raviX_buffer_len(buf);
+	compiler_interface->stats.generated_code_size += len;
+	if (compiler_interface->emit_code == NULL) {
+		compiler_interface->generated_code = raviX_buffer_data(buf);
+		return;
+	}
+	if (len > 0)
+		compiler_interface->emit_code(compiler_interface->context, raviX_buffer_data(buf), len);
+	raviX_buffer_free(buf);
+}
+
+/* Runs the compilation pipeline; the parse phase must have been started by the caller */
+static int run_pipeline(CompilerState *compiler_state, LinearizerState *linearizer,
+			struct Ravi_CompilerInterface *compiler_interface, const CompileOptions *options,
+			PhaseTimer *timer)
+{
+	int rc = raviX_parse(compiler_state, compiler_interface->source, compiler_interface->source_len,
+			     compiler_interface->source_name);
+	end_phase(timer, RAVI_PHASE_PARSE);
 	if (rc != 0) {
 		compiler_interface->error_message(compiler_interface->context, raviX_get_last_error(compiler_state));
-		goto L_exit;
+		return rc;
 	}
-	if (dump_ast) {
+	if (options->dump_ast) {
 		TextBuffer mbuf;
 		raviX_buffer_init(&mbuf, 1024);
 		raviX_dump_ast_to_buffer(compiler_state, &mbuf);
-		compiler_interface->generated_code = mbuf.buf;
-		goto L_exit;
+		set_output(compiler_interface, &mbuf);
+		return rc;
 	}
+	begin_phase(timer);
 	rc = raviX_ast_lower(compiler_state);
+	end_phase(timer, RAVI_PHASE_LOWER);
 	if (rc != 0) {
 		compiler_interface->error_message(compiler_interface->context, raviX_get_last_error(compiler_state));
-		goto L_exit;
+		return rc;
 	}
+	begin_phase(timer);
 	rc = raviX_ast_typecheck(compiler_state);
+	end_phase(timer, RAVI_PHASE_TYPECHECK);
 	if (rc != 0) {
 		compiler_interface->error_message(compiler_interface->context, raviX_get_last_error(compiler_state));
-		goto L_exit;
+		return rc;
 	}
+	begin_phase(timer);
 	rc = raviX_ast_simplify(compiler_state);
+	end_phase(timer, RAVI_PHASE_SIMPLIFY);
 	if (rc != 0) {
 		compiler_interface->error_message(compiler_interface->context, raviX_get_last_error(compiler_state));
-		goto L_exit;
+		return rc;
 	}
+	begin_phase(timer);
 	rc = raviX_ast_linearize(linearizer);
+	end_phase(timer, RAVI_PHASE_LINEARIZE);
 	if (rc != 0) {
 		compiler_interface->error_message(compiler_interface->context, raviX_get_last_error(compiler_state));
-		goto L_exit;
+		return rc;
 	}
+	begin_phase(timer);
 	raviX_construct_cfg(linearizer->main_proc);
+	end_phase(timer, RAVI_PHASE_CFG);
+	begin_phase(timer);
 	raviX_remove_unreachable_blocks(linearizer);
 	raviX_optimize_upvalues(linearizer);
+	if (options->inline_procs)
+		raviX_inline_procs(linearizer);
+	if (options->replace_tables)
+		raviX_replace_tables(linearizer);
+	if (options->ssa)
+		raviX_construct_ssa(linearizer->main_proc);
+	if (options->sccp) {
+		raviX_propagate_constants(linearizer);
+		raviX_remove_unreachable_blocks(linearizer);
+	}
+	/* The remaining passes work on the final IR, so SSA form must be dropped first */
+	if (options->ssa && (options->licm || options->dce || options->stable_globals))
+		raviX_destruct_ssa(linearizer->main_proc);
+	if (options->licm)
+		raviX_hoist_loop_invariants(linearizer);
+	if (options->dce)
+		raviX_remove_dead_code(linearizer);
+	if (options->stable_globals)
+		raviX_cache_globals(linearizer);
+	end_phase(timer, RAVI_PHASE_OPTIMIZE);
 
 	TextBuffer buf;
 	raviX_buffer_init(&buf, 4096);
-	if (dump_ir) {
+	if (options->dump_ir) {
 		raviX_buffer_add_string(&buf, "#if 0\n");
 		raviX_buffer_add_string(&buf, "// Following is an IR Dump from the compiler\n");
 		raviX_show_linearizer(linearizer, &buf);
 		raviX_buffer_add_string(&buf, "\n// End of IR dump\n");
 		raviX_buffer_add_string(&buf, "#endif\n");
 	}
+	if (options->ssa)
+		raviX_destruct_ssa(linearizer->main_proc);
+	begin_phase(timer);
 	rc = raviX_generate_C(linearizer, &buf, compiler_interface);
-	compiler_interface->generated_code = buf.buf;
+	end_phase(timer, RAVI_PHASE_CODEGEN);
+	set_output(compiler_interface, &buf);
+	if (timer->stats)
+		collect_ir_stats(linearizer, timer->stats);
+	return rc;
+}
+
+static int compile_chunk(struct Ravi_CompilerInterface *compiler_interface)
+{
+	CompileOptions options;
+	parse_options(compiler_interface, &options);
+	compiler_interface->generated_code = NULL;
+	memset(&compiler_interface->stats, 0, sizeof compiler_interface->stats);
+
+	C_MemoryAllocator *allocator = compiler_interface->memory_allocator;
+	C_MemoryAllocator arena_allocator = {NULL};
+	StatsAllocator stats_allocator;
+	C_MemoryAllocator stats_wrapper;
+	PhaseTimer timer = {NULL, &stats_allocator};
+	if (options.collect_stats) {
+		if (allocator == NULL) {
+			/* The compiler would use its own arena; we need one we can wrap */
+			raviX_init_arena_allocator(&arena_allocator);
+			allocator = &arena_allocator;
+		}
+		init_stats_allocator(&stats_wrapper, &stats_allocator, allocator);
+		allocator = &stats_wrapper;
+		timer.stats = &compiler_interface->stats;
+	}
 
-L_exit:
+	begin_phase(&timer);
+	CompilerState *compiler_state = raviX_init_compiler(allocator);
+	if (options.collect_stats)
+		compiler_state->base_allocator = stats_allocator.allocator;
+	/* The source outlives the compiler state, so strings can refer to it */
+	raviX_set_zero_copy_strings(compiler_state, true);
+	LinearizerState *linearizer = raviX_init_linearizer(compiler_state);
+	int rc = run_pipeline(compiler_state, linearizer, compiler_interface, &options, &timer);
+	if (options.collect_stats) {
+		compiler_interface->stats.ast_node_count = compiler_state->ast_node_count;
+		report_stats(compiler_interface);
+	}
 	raviX_destroy_linearizer(linearizer);
 	raviX_destroy_compiler(compiler_state);
+	if (arena_allocator.arena != NULL)
+		raviX_arena_destroy(arena_allocator.arena);
+
+	return rc;
+}
+
+static int compile_chunk_with_state(CompilerState *compiler_state, struct Ravi_CompilerInterface *compiler_interface)
+{
+	CompileOptions options;
+	parse_options(compiler_interface, &options);
+	compiler_interface->generated_code = NULL;
+	memset(&compiler_interface->stats, 0, sizeof compiler_interface->stats);
+
+	/* When collecting stats we temporarily route the compiler's allocations through the counting wrapper */
+	C_MemoryAllocator *allocator = compiler_state->allocator;
+	StatsAllocator stats_allocator;
+	C_MemoryAllocator stats_wrapper;
+	PhaseTimer timer = {NULL, &stats_allocator};
+	if (options.collect_stats) {
+		init_stats_allocator(&stats_wrapper, &stats_allocator, allocator);
+		compiler_state->allocator = &stats_wrapper;
+		timer.stats = &compiler_interface->stats;
+	}
+
+	begin_phase(&timer);
+	/* Strings that refer to the source are discarded by the reset below, before the source goes away */
+	bool zero_copy_strings = compiler_state->zero_copy_strings;
+	raviX_set_zero_copy_strings(compiler_state, true);
+	LinearizerState *linearizer = raviX_init_linearizer(compiler_state);
+	int rc = run_pipeline(compiler_state, linearizer, compiler_interface, &options, &timer);
+	if (options.collect_stats) {
+		compiler_interface->stats.ast_node_count = compiler_state->ast_node_count;
+		report_stats(compiler_interface);
+	}
+	raviX_destroy_linearizer(linearizer);
+	compiler_state->allocator = allocator;
+	raviX_reset_compiler(compiler_state);
+	raviX_set_zero_copy_strings(compiler_state, zero_copy_strings);
+
+	return rc;
+}
+
+/* Returns true if the generated code was found in the cache */
+static bool cache_lookup(struct Ravi_CompilerInterface *compiler_interface)
+{
+	if (compiler_interface->cache == NULL)
+		return false;
+	compiler_interface->generated_code = NULL;
+	memset(&compiler_interface->stats, 0, sizeof compiler_interface->stats);
+	if (!raviX_compile_cache_get(compiler_interface->cache, compiler_interface))
+		return false;
+	size_t len = strlen(compiler_interface->generated_code);
+	compiler_interface->stats.generated_code_size = len;
+	if (compiler_interface->emit_code != NULL) {
+		compiler_interface->emit_code(compiler_interface->context, compiler_interface->generated_code, len);
+		raviX_release(compiler_interface);
+	}
+	return true;
+}
+
+static void cache_store(struct Ravi_CompilerInterface *compiler_interface, int rc)
+{
+	if (compiler_interface->cache != NULL && rc == 0)
+		raviX_compile_cache_put(compiler_interface->cache, compiler_interface);
+}
+
+int raviX_compile(struct Ravi_CompilerInterface *compiler_interface)
+{
+	if (cache_lookup(compiler_interface))
+		return 0;
+	int rc = compile_chunk(compiler_interface);
+	cache_store(compiler_interface, rc);
+	return rc;
+}
 
+int raviX_compile_with_state(CompilerState *compiler_state, struct Ravi_CompilerInterface *compiler_interface)
+{
+	if (cache_lookup(compiler_interface))
+		return 0;
+	int rc = compile_chunk_with_state(compiler_state, compiler_interface);
+	cache_store(compiler_interface, rc);
 	return rc;
 }
 
+/*
+ * Batch compilation.
+ * Worker threads pick the next job from a shared counter. Jobs without their own allocator are compiled
+ * with a compiler state owned by the worker so that its setup cost is paid once per thread.
+ */
+typedef struct BatchState {
+	Ravi_CompilerInterface *jobs;
+	int *results;
+	unsigned num_jobs;
+	unsigned next_job;
+	unsigned failures;
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} BatchState;
+
+static void batch_lock(BatchState *batch)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&batch->lock);
+#else
+	pthread_mutex_lock(&batch->lock);
+#endif
+}
+
+static void batch_unlock(BatchState *batch)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&batch->lock);
+#else
+	pthread_mutex_unlock(&batch->lock);
+#endif
+}
+
+static void batch_worker(BatchState *batch)
+{
+	CompilerState *compiler_state = NULL;
+	for (;;) {
+		batch_lock(batch);
+		unsigned job = batch->next_job;
+		if (job < batch->num_jobs)
+			batch->next_job++;
+		batch_unlock(batch);
+		if (job >= batch->num_jobs)
+			break;
+		Ravi_CompilerInterface *compiler_interface = &batch->jobs[job];
+		int rc;
+		if (compiler_interface->memory_allocator == NULL) {
+			if (compiler_state == NULL)
+				compiler_state = raviX_init_compiler(NULL);
+			rc = raviX_compile_with_state(compiler_state, compiler_interface);
+		} else {
+			rc = raviX_compile(compiler_interface);
+		}
+		if (batch->results)
+			batch->results[job] = rc;
+		if (rc != 0) {
+			batch_lock(batch);
+			batch->failures++;
+			batch_unlock(batch);
+		}
+	}
+	if (compiler_state)
+		raviX_destroy_compiler(compiler_state);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI batch_thread(LPVOID arg)
+{
+	batch_worker((BatchState *)arg);
+	return 0;
+}
+#else
+static void *batch_thread(void *arg)
+{
+	batch_worker((BatchState *)arg);
+	return NULL;
+}
+#endif
+
+static unsigned number_of_cpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (unsigned)info.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#endif
+}
+
+/* Runs the batch on num_threads threads, one of which is the calling thread */
+static void run_batch_threads(BatchState *batch, unsigned num_threads)
+{
+#ifdef _WIN32
+	HANDLE *threads = (HANDLE *)raviX_calloc(num_threads, sizeof(HANDLE));
+#else
+	pthread_t *threads = (pthread_t *)raviX_calloc(num_threads, sizeof(pthread_t));
+#endif
+	unsigned started = 0;
+	for (unsigned i = 0; i < num_threads - 1; i++) {
+#ifdef _WIN32
+		threads[i] = CreateThread(NULL, 0, batch_thread, batch, 0, NULL);
+		if (threads[i] == NULL)
+			break;
+#else
+		if (pthread_create(&threads[i], NULL, batch_thread, batch) != 0)
+			break;
+#endif
+		started++;
+	}
+	batch_worker(batch);
+	for (unsigned i = 0; i < started; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+	raviX_free(threads);
+}
+
+int raviX_compile_batch(Ravi_CompilerInterface *jobs, unsigned num_jobs, unsigned num_threads, int *results)
+{
+	BatchState batch = {jobs, results, num_jobs, 0, 0};
+	if (num_threads == 0)
+		num_threads = number_of_cpus();
+	if (num_threads > num_jobs)
+		num_threads = num_jobs;
+	/* The worker takes the lock even when it runs alone */
+#ifdef _WIN32
+	InitializeCriticalSection(&batch.lock);
+#else
+	pthread_mutex_init(&batch.lock, NULL);
+#endif
+	if (num_threads <= 1)
+		batch_worker(&batch);
+	else
+		run_batch_threads(&batch, num_threads);
+#ifdef _WIN32
+	DeleteCriticalSection(&batch.lock);
+#else
+	pthread_mutex_destroy(&batch.lock);
+#endif
+	return (int)batch.failures;
+}
+
 void raviX_release(struct Ravi_CompilerInterface *compiler_interface)
 {
 	if (compiler_interface->generated_code != NULL) {
@@ -152,6 +152,17 @@ void raviX_set_destroy(Set *set, void (*delete_function)(SetEntry *entry))
 	raviX_free(set);
 }
 
+/**
+ * Removes all entries from the set, retaining the table so that it
+ * does not need to grow again.
+ */
+void raviX_set_clear(Set *set)
+{
+	memset(set->table, 0, set->size * sizeof(*set->table));
+	set->entries = 0;
+	set->deleted_entries = 0;
+}
+
 /* Does the set contain an entry with the given key.
  */
 bool raviX_set_contains(Set *set, const void *key)
@@ -54,6 +54,8 @@ Set *raviX_set_create(uint32_t (*hash_function)(const void *key),
 void raviX_set_destroy(Set *set,
 	    void (*delete_function)(SetEntry *entry));
 
+void raviX_set_clear(Set *set);
+
 SetEntry *raviX_set_add(Set *set, const void *key);
 
 bool raviX_set_contains(Set *set, const void *key);
@@ -0,0 +1,635 @@
+/******************************************************************************
+ * Copyright (C) 2020-2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * SSA construction and destruction.
+ *
+ * Construction follows Cytron et al, 'Efficiently Computing Static Single Assignment Form and the
+ * Control Dependence Graph'; dominance frontiers are computed as described in 'A Simple, Fast
+ * Dominance Algorithm' by Cooper, Harvey and Kennedy. Phis are only placed for variables that are
+ * live on entry to some block (semi-pruned SSA), because most temporaries never leave the block that
+ * defines them.
+ *
+ * A variable is identified by its storage: a local's stack slot, or a temporary's register number
+ * within its register class. Renaming does not change the storage; each version of a variable is a
+ * copy of the original pseudo with a distinct ssa_version. So the IR remains valid for the code
+ * generator, and SSA destruction only has to remove the phis and reinstate the original pseudos.
+ * The flip side is that passes working on SSA form must not make the live ranges of two versions of
+ * the same variable overlap.
+ *
+ * Only variables whose every read and write is visible as an instruction operand or target are put
+ * into SSA form. Locals captured as upvalues, variables referenced by embedded C code or updated in
+ * place by type assertions, and stack temporaries in the region that calls and multiple value ranges
+ * may overwrite are left alone.
+ */
+
+#include "linearizer.h"
+#include "allocate.h"
+#include "dominator.h"
+#include "graph.h"
+#include "optimizer.h"
+
+#include <assert.h>
+#include <string.h>
+
+DECLARE_ARRAY(NodeIdArray, nodeId_t);
+
+typedef struct SSAVariable {
+	Pseudo *original;    /* Template for new versions */
+	Pseudo *entry_value; /* Version that stands for the value on entry to the proc, created on demand */
+	Pseudo **stack;	     /* Renaming stack, top is the version that reaches the current point */
+	unsigned stack_top;
+	unsigned stack_size;
+	unsigned excluded : 1, /* Not put in SSA form */
+	    live_in : 1;       /* Used in some block before being defined there */
+	unsigned def_stamp;    /* Block index + 1 of the block being scanned, if the variable is defined there */
+	NodeIdArray def_blocks;
+} SSAVariable;
+
+typedef struct Phi {
+	Instruction *insn;
+	unsigned var;
+	Pseudo *target;
+	Pseudo **args; /* One per predecessor */
+	unsigned num_args;
+	struct Phi *next; /* Next phi in the same block */
+} Phi;
+
+typedef struct SSABuilder {
+	Proc *proc;
+	C_MemoryAllocator *allocator;
+	DominatorTree *tree;
+	nodeId_t num_nodes;		    /* Node ids are less than this */
+	unsigned *var_index[VAR_CLASS_COUNT]; /* regnum -> variable index + 1 */
+	unsigned var_index_size[VAR_CLASS_COUNT];
+	SSAVariable *vars;
+	unsigned num_vars;
+	unsigned vars_size;
+	unsigned min_clobbered_temp; /* Stack temporaries from this register up may be written implicitly */
+	NodeIdArray *frontiers;	     /* Dominance frontier of each node */
+	NodeIdArray *children;	     /* Children of each node in the dominator tree */
+	Phi **phis;		     /* Phis of each block */
+	unsigned *log;		     /* Variables whose renaming stack was pushed, so that they can be popped */
+	unsigned log_top;
+	unsigned log_size;
+	unsigned num_values;
+} SSABuilder;
+
+bool raviX_opcode_defines_targets(unsigned opcode)
+{
+	switch (opcode) {
+	case op_ret:
+	case op_cbr:
+	case op_br:
+	case op_put:
+	case op_put_ikey:
+	case op_put_skey:
+	case op_tput:
+	case op_tput_ikey:
+	case op_tput_skey:
+	case op_iaput:
+	case op_iaput_ival:
+	case op_faput:
+	case op_faput_fval:
+	case op_storeglobal:
+	case op_C__unsafe:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* Instructions that read and write the same operand or target; we cannot rename those */
+bool raviX_opcode_updates_in_place(unsigned opcode)
+{
+	switch (opcode) {
+	case op_toint:
+	case op_toflt:
+	case op_toclosure:
+	case op_tostring:
+	case op_toiarray:
+	case op_tofarray:
+	case op_totable:
+	case op_totype:
+	case op_C__unsafe:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int raviX_variable_class(const Pseudo *pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_SYMBOL:
+		return pseudo->symbol->symbol_type == SYM_LOCAL ? VAR_LOCAL : -1;
+	case PSEUDO_TEMP_INT:
+	case PSEUDO_TEMP_BOOL:
+		return VAR_TEMP_INT;
+	case PSEUDO_TEMP_FLT:
+		return VAR_TEMP_FLT;
+	case PSEUDO_TEMP_ANY:
+		return VAR_TEMP_ANY;
+	default:
+		return -1;
+	}
+}
+
+/* Returns the variable for the pseudo or NULL if the pseudo is not a variable */
+static SSAVariable *find_variable(SSABuilder *builder, const Pseudo *pseudo)
+{
+	int cls = raviX_variable_class(pseudo);
+	if (cls < 0 || pseudo->regnum >= builder->var_index_size[cls])
+		return NULL;
+	unsigned index = builder->var_index[cls][pseudo->regnum];
+	return index ? &builder->vars[index - 1] : NULL;
+}
+
+static SSAVariable *add_variable(SSABuilder *builder, Pseudo *pseudo)
+{
+	int cls = raviX_variable_class(pseudo);
+	if (cls < 0)
+		return NULL;
+	if (pseudo->regnum >= builder->var_index_size[cls]) {
+		unsigned new_size = pseudo->regnum + 16;
+		builder->var_index[cls] = (unsigned *)raviX_realloc_array(
+		    builder->var_index[cls], sizeof(unsigned), builder->var_index_size[cls], new_size);
+		builder->var_index_size[cls] = new_size;
+	}
+	unsigned index = builder->var_index[cls][pseudo->regnum];
+	if (index)
+		return &builder->vars[index - 1];
+	if (builder->num_vars == builder->vars_size) {
+		unsigned new_size = builder->vars_size ? builder->vars_size * 2 : 16;
+		builder->vars = (SSAVariable *)raviX_realloc_array(builder->vars, sizeof(SSAVariable),
+								   builder->vars_size, new_size);
+		builder->vars_size = new_size;
+	}
+	SSAVariable *var = &builder->vars[builder->num_vars++];
+	var->original = pseudo;
+	builder->var_index[cls][pseudo->regnum] = builder->num_vars;
+	if (pseudo->type == PSEUDO_SYMBOL && pseudo->symbol->variable.escaped)
+		var->excluded = 1;
+	return var;
+}
+
+static void note_clobbered_temp(SSABuilder *builder, const Pseudo *pseudo)
+{
+	if (pseudo->regnum < builder->min_clobbered_temp)
+		builder->min_clobbered_temp = pseudo->regnum;
+}
+
+static void note_use(SSABuilder *builder, Pseudo *pseudo, unsigned stamp, bool in_place)
+{
+	if (pseudo->type == PSEUDO_RANGE) {
+		note_clobbered_temp(builder, pseudo);
+	} else if (pseudo->type == PSEUDO_RANGE_SELECT) {
+		note_clobbered_temp(builder, pseudo->range_pseudo);
+	}
+	SSAVariable *var = add_variable(builder, pseudo);
+	if (var == NULL)
+		return;
+	if (in_place)
+		var->excluded = 1;
+	if (var->def_stamp != stamp)
+		var->live_in = 1;
+}
+
+static void note_def(SSABuilder *builder, Instruction *insn, Pseudo *pseudo, nodeId_t block, unsigned stamp)
+{
+	if (pseudo->type == PSEUDO_RANGE || (insn->opcode == op_call && pseudo->type == PSEUDO_TEMP_ANY)) {
+		note_clobbered_temp(builder, pseudo);
+	} else if (pseudo->type == PSEUDO_RANGE_SELECT) {
+		note_clobbered_temp(builder, pseudo->range_pseudo);
+	}
+	SSAVariable *var = add_variable(builder, pseudo);
+	if (var == NULL)
+		return;
+	if (var->def_stamp != stamp) {
+		var->def_stamp = stamp;
+		array_push(&var->def_blocks, nodeId_t, block);
+	}
+}
+
+/* Finds the variables, the blocks that define them and whether they are live across blocks */
+static void collect_variables(SSABuilder *builder)
+{
+	Proc *proc = builder->proc;
+	for (unsigned i = 0; i < proc->node_count; i++) {
+		BasicBlock *bb = proc->nodes[i];
+		unsigned stamp = bb->index + 1;
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			bool in_place = raviX_opcode_updates_in_place(insn->opcode);
+			bool defines = raviX_opcode_defines_targets(insn->opcode);
+			Pseudo *pseudo;
+			FOR_EACH_PTR(insn->operands, Pseudo, pseudo) { note_use(builder, pseudo, stamp, in_place); }
+			END_FOR_EACH_PTR(pseudo)
+			FOR_EACH_PTR(insn->targets, Pseudo, pseudo)
+			{
+				if (in_place || !defines)
+					note_use(builder, pseudo, stamp, in_place);
+				else
+					note_def(builder, insn, pseudo, bb->index, stamp);
+			}
+			END_FOR_EACH_PTR(pseudo)
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	for (unsigned i = 0; i < builder->num_vars; i++) {
+		SSAVariable *var = &builder->vars[i];
+		if (var->original->type == PSEUDO_TEMP_ANY && var->original->regnum >= builder->min_clobbered_temp)
+			var->excluded = 1;
+	}
+}
+
+static bool is_reachable(SSABuilder *builder, nodeId_t node)
+{
+	return raviX_immediate_dominator(builder->tree, node) != NULL;
+}
+
+static nodeId_t idom(SSABuilder *builder, nodeId_t node)
+{
+	return raviX_node_index(raviX_immediate_dominator(builder->tree, node));
+}
+
+/* Computes the dominance frontiers and the dominator tree children of every reachable node */
+static void compute_frontiers(SSABuilder *builder)
+{
+	Graph *g = builder->proc->cfg;
+	for (nodeId_t b = 0; b < builder->num_nodes; b++) {
+		if (raviX_graph_node(g, b) == NULL || !is_reachable(builder, b))
+			continue;
+		if (b != ENTRY_BLOCK)
+			array_push(&builder->children[idom(builder, b)], nodeId_t, b);
+		GraphNodeList *preds = raviX_predecessors(raviX_graph_node(g, b));
+		if (raviX_node_list_size(preds) < 2)
+			continue;
+		for (uint32_t i = 0; i < raviX_node_list_size(preds); i++) {
+			nodeId_t runner = raviX_node_list_at(preds, i);
+			if (!is_reachable(builder, runner))
+				continue;
+			while (runner != idom(builder, b)) {
+				NodeIdArray *df = &builder->frontiers[runner];
+				if (df->count == 0 || df->data[df->count - 1] != b)
+					array_push(df, nodeId_t, b);
+				runner = idom(builder, runner);
+			}
+		}
+	}
+}
+
+static Instruction *new_phi_instruction(SSABuilder *builder, BasicBlock *bb)
+{
+	Instruction *insn = (Instruction *)builder->allocator->calloc(builder->allocator->arena, 1, sizeof(Instruction));
+	insn->opcode = op_phi;
+	insn->block = bb;
+	return insn;
+}
+
+/* Places phis at the iterated dominance frontier of the blocks that define each variable */
+static void insert_phis(SSABuilder *builder)
+{
+	Graph *g = builder->proc->cfg;
+	unsigned *has_phi = (unsigned *)raviX_calloc(builder->num_nodes, sizeof(unsigned));
+	unsigned *on_worklist = (unsigned *)raviX_calloc(builder->num_nodes, sizeof(unsigned));
+	NodeIdArray worklist = {0};
+	for (unsigned v = 0; v < builder->num_vars; v++) {
+		SSAVariable *var = &builder->vars[v];
+		if (var->excluded || !var->live_in)
+			continue;
+		unsigned stamp = v + 1;
+		worklist.count = 0;
+		for (unsigned i = 0; i < var->def_blocks.count; i++) {
+			nodeId_t b = var->def_blocks.data[i];
+			if (b < builder->num_nodes && is_reachable(builder, b)) {
+				on_worklist[b] = stamp;
+				array_push(&worklist, nodeId_t, b);
+			}
+		}
+		while (worklist.count > 0) {
+			nodeId_t b = worklist.data[--worklist.count];
+			NodeIdArray *df = &builder->frontiers[b];
+			for (unsigned i = 0; i < df->count; i++) {
+				nodeId_t d = df->data[i];
+				if (has_phi[d] == stamp)
+					continue;
+				has_phi[d] = stamp;
+				Phi *phi = (Phi *)raviX_calloc(1, sizeof(Phi));
+				phi->insn = new_phi_instruction(builder, builder->proc->nodes[d]);
+				phi->var = v;
+				phi->num_args = raviX_node_list_size(raviX_predecessors(raviX_graph_node(g, d)));
+				phi->args = (Pseudo **)raviX_calloc(phi->num_args, sizeof(Pseudo *));
+				phi->next = builder->phis[d];
+				builder->phis[d] = phi;
+				if (on_worklist[d] != stamp) {
+					on_worklist[d] = stamp;
+					array_push(&worklist, nodeId_t, d);
+				}
+			}
+		}
+	}
+	array_clearmem(&worklist);
+	raviX_free(on_worklist);
+	raviX_free(has_phi);
+}
+
+static Pseudo *new_version(SSABuilder *builder, const Pseudo *template)
+{
+	Pseudo *pseudo = (Pseudo *)builder->allocator->calloc(builder->allocator->arena, 1, sizeof(Pseudo));
+	*pseudo = *template;
+	pseudo->ssa_version = ++builder->num_values;
+	return pseudo;
+}
+
+static void push_version(SSABuilder *builder, SSAVariable *var, Pseudo *pseudo)
+{
+	if (var->stack_top == var->stack_size) {
+		unsigned new_size = var->stack_size ? var->stack_size * 2 : 4;
+		var->stack = (Pseudo **)raviX_realloc_array(var->stack, sizeof(Pseudo *), var->stack_size, new_size);
+		var->stack_size = new_size;
+	}
+	var->stack[var->stack_top++] = pseudo;
+	if (builder->log_top == builder->log_size) {
+		unsigned new_size = builder->log_size ? builder->log_size * 2 : 64;
+		builder->log = (unsigned *)raviX_realloc_array(builder->log, sizeof(unsigned), builder->log_size, new_size);
+		builder->log_size = new_size;
+	}
+	builder->log[builder->log_top++] = (unsigned)(var - builder->vars);
+}
+
+/* Returns the version of the variable that reaches the current point */
+static Pseudo *current_version(SSABuilder *builder, SSAVariable *var)
+{
+	if (var->stack_top > 0)
+		return var->stack[var->stack_top - 1];
+	if (var->entry_value == NULL)
+		var->entry_value = new_version(builder, var->original);
+	return var->entry_value;
+}
+
+static void rename_uses(SSABuilder *builder, PseudoList *list)
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(list, Pseudo, pseudo)
+	{
+		SSAVariable *var = find_variable(builder, pseudo);
+		if (var && !var->excluded) {
+			REPLACE_CURRENT_PTR(Pseudo, pseudo, current_version(builder, var));
+		}
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
+
+static void rename_defs(SSABuilder *builder, PseudoList *list)
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(list, Pseudo, pseudo)
+	{
+		SSAVariable *var = find_variable(builder, pseudo);
+		if (var && !var->excluded) {
+			Pseudo *version = new_version(builder, pseudo);
+			push_version(builder, var, version);
+			REPLACE_CURRENT_PTR(Pseudo, pseudo, version);
+		}
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
+
+/* Renames variables in the block and then in the blocks it dominates */
+static void rename_block(SSABuilder *builder, nodeId_t b)
+{
+	Graph *g = builder->proc->cfg;
+	BasicBlock *bb = builder->proc->nodes[b];
+	unsigned saved_log_top = builder->log_top;
+
+	for (Phi *phi = builder->phis[b]; phi != NULL; phi = phi->next) {
+		SSAVariable *var = &builder->vars[phi->var];
+		phi->target = new_version(builder, var->original);
+		push_version(builder, var, phi->target);
+	}
+	Instruction *insn;
+	FOR_EACH_PTR(bb->insns, Instruction, insn)
+	{
+		rename_uses(builder, insn->operands);
+		if (raviX_opcode_defines_targets(insn->opcode))
+			rename_defs(builder, insn->targets);
+		else
+			rename_uses(builder, insn->targets);
+	}
+	END_FOR_EACH_PTR(insn)
+
+	GraphNodeList *succs = raviX_successors(raviX_graph_node(g, b));
+	for (uint32_t i = 0; i < raviX_node_list_size(succs); i++) {
+		nodeId_t s = raviX_node_list_at(succs, i);
+		GraphNodeList *preds = raviX_predecessors(raviX_graph_node(g, s));
+		for (uint32_t j = 0; j < raviX_node_list_size(preds); j++) {
+			if (raviX_node_list_at(preds, j) != b)
+				continue;
+			for (Phi *phi = builder->phis[s]; phi != NULL; phi = phi->next)
+				phi->args[j] = current_version(builder, &builder->vars[phi->var]);
+		}
+	}
+
+	NodeIdArray *children = &builder->children[b];
+	for (unsigned i = 0; i < children->count; i++)
+		rename_block(builder, children->data[i]);
+
+	while (builder->log_top > saved_log_top) {
+		SSAVariable *var = &builder->vars[builder->log[--builder->log_top]];
+		var->stack_top--;
+	}
+}
+
+/* Puts the phis at the start of their blocks */
+static void add_phis_to_blocks(SSABuilder *builder)
+{
+	for (nodeId_t b = 0; b < builder->num_nodes; b++) {
+		if (builder->phis[b] == NULL)
+			continue;
+		BasicBlock *bb = builder->proc->nodes[b];
+		InstructionList *insns = NULL;
+		for (Phi *phi = builder->phis[b]; phi != NULL; phi = phi->next) {
+			SSAVariable *var = &builder->vars[phi->var];
+			for (unsigned i = 0; i < phi->num_args; i++) {
+				/* Arguments from unreachable predecessors are never set */
+				Pseudo *arg = phi->args[i] ? phi->args[i] : current_version(builder, var);
+				raviX_ptrlist_add((PtrList **)&phi->insn->operands, arg, builder->allocator);
+			}
+			raviX_ptrlist_add((PtrList **)&phi->insn->targets, phi->target, builder->allocator);
+			raviX_ptrlist_add((PtrList **)&insns, phi->insn, builder->allocator);
+		}
+		Instruction *insn;
+		FOR_EACH_PTR(bb->insns, Instruction, insn)
+		{
+			raviX_ptrlist_add((PtrList **)&insns, insn, builder->allocator);
+		}
+		END_FOR_EACH_PTR(insn)
+		bb->insns = insns;
+	}
+}
+
+static void destroy_builder(SSABuilder *builder)
+{
+	for (unsigned i = 0; i < builder->num_vars; i++) {
+		raviX_free(builder->vars[i].stack);
+		array_clearmem(&builder->vars[i].def_blocks);
+	}
+	raviX_free(builder->vars);
+	for (unsigned i = 0; i < VAR_CLASS_COUNT; i++)
+		raviX_free(builder->var_index[i]);
+	for (nodeId_t b = 0; b < builder->num_nodes; b++) {
+		array_clearmem(&builder->frontiers[b]);
+		array_clearmem(&builder->children[b]);
+		Phi *phi = builder->phis[b];
+		while (phi != NULL) {
+			Phi *next = phi->next;
+			raviX_free(phi->args);
+			raviX_free(phi);
+			phi = next;
+		}
+	}
+	raviX_free(builder->frontiers);
+	raviX_free(builder->children);
+	raviX_free(builder->phis);
+	raviX_free(builder->log);
+	raviX_destroy_dominator_tree(builder->tree);
+}
+
+static void construct_ssa(Proc *proc)
+{
+	assert(proc->num_ssa_values == 0);
+	SSABuilder builder;
+	memset(&builder, 0, sizeof builder);
+	builder.proc = proc;
+	builder.allocator = proc->linearizer->compiler_state->allocator;
+	builder.min_clobbered_temp = ~0u;
+	builder.num_nodes = raviX_graph_node_id_limit(proc->cfg);
+	if (builder.num_nodes < proc->node_count)
+		builder.num_nodes = proc->node_count;
+
+	collect_variables(&builder);
+
+	raviX_classify_edges(proc->cfg);
+	builder.tree = raviX_new_dominator_tree(proc->cfg);
+	raviX_calculate_dominator_tree(builder.tree);
+	builder.frontiers = (NodeIdArray *)raviX_calloc(builder.num_nodes, sizeof(NodeIdArray));
+	builder.children = (NodeIdArray *)raviX_calloc(builder.num_nodes, sizeof(NodeIdArray));
+	builder.phis = (Phi **)raviX_calloc(builder.num_nodes, sizeof(Phi *));
+	compute_frontiers(&builder);
+
+	insert_phis(&builder);
+	rename_block(&builder, ENTRY_BLOCK);
+	add_phis_to_blocks(&builder);
+	/* A proc that has no variables in SSA form still counts as being in SSA form */
+	proc->num_ssa_values = builder.num_values ? builder.num_values : 1;
+
+	destroy_builder(&builder);
+}
+
+void raviX_construct_ssa(Proc *proc)
+{
+	if (proc->cfg != NULL)
+		construct_ssa(proc);
+	Proc *childproc;
+	FOR_EACH_PTR(proc->procs, Proc, childproc) { raviX_construct_ssa(childproc); }
+	END_FOR_EACH_PTR(childproc)
+}
+
+static void restore_pseudos(PseudoList *list)
+{
+	Pseudo *pseudo;
+	FOR_EACH_PTR(list, Pseudo, pseudo)
+	{
+		if (pseudo->ssa_version == 0)
+			continue;
+		if (pseudo->type == PSEUDO_SYMBOL) {
+			REPLACE_CURRENT_PTR(Pseudo, pseudo, pseudo->symbol->variable.pseudo);
+		} else {
+			/* Versions of temporaries are exact copies of the original, so this is enough */
+			pseudo->ssa_version = 0;
+		}
+	}
+	END_FOR_EACH_PTR(pseudo)
+}
+
+void raviX_destruct_ssa(Proc *proc)
+{
+	if (proc->num_ssa_values != 0) {
+		C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+		for (unsigned i = 0; i < proc->node_count; i++) {
+			BasicBlock *bb = proc->nodes[i];
+			InstructionList *insns = NULL;
+			bool has_phis = false;
+			Instruction *insn;
+			FOR_EACH_PTR(bb->insns, Instruction, insn)
+			{
+				if (insn->opcode == op_phi) {
+					has_phis = true;
+					continue;
+				}
+				restore_pseudos(insn->operands);
+				restore_pseudos(insn->targets);
+				raviX_ptrlist_add((PtrList **)&insns, insn, allocator);
+			}
+			END_FOR_EACH_PTR(insn)
+			if (has_phis)
+				bb->insns = insns;
+		}
+		proc->num_ssa_values = 0;
+	}
+	Proc *childproc;
+	FOR_EACH_PTR(proc->procs, Proc, childproc) { raviX_destruct_ssa(childproc); }
+	END_FOR_EACH_PTR(childproc)
+}
+
+void raviX_delete_cfg_edge(Proc *proc, nodeId_t from, nodeId_t to)
+{
+	if (proc->num_ssa_values != 0) {
+		/* Drop the phi arguments that correspond to the edge */
+		C_MemoryAllocator *allocator = proc->linearizer->compiler_state->allocator;
+		GraphNodeList *preds = raviX_predecessors(raviX_graph_node(proc->cfg, to));
+		uint32_t pred_index = 0;
+		while (pred_index < raviX_node_list_size(preds) && raviX_node_list_at(preds, pred_index) != from)
+			pred_index++;
+		Instruction *insn;
+		FOR_EACH_PTR(proc->nodes[to]->insns, Instruction, insn)
+		{
+			if (insn->opcode != op_phi)
+				break;
+			PseudoList *operands = NULL;
+			uint32_t i = 0;
+			Pseudo *pseudo;
+			FOR_EACH_PTR(insn->operands, Pseudo, pseudo)
+			{
+				if (i++ != pred_index)
+					raviX_ptrlist_add((PtrList **)&operands, pseudo, allocator);
+			}
+			END_FOR_EACH_PTR(pseudo)
+			insn->operands = operands;
+		}
+		END_FOR_EACH_PTR(insn)
+	}
+	raviX_delete_edge(proc->cfg, from, to);
+}
@@ -284,7 +284,8 @@ static void typecheck_var_assignment(CompilerState *compiler_state, VariableType
 	if (var_type->type_code == RAVI_TANY)
 		// Any value can be assigned to type ANY
 		return;
-	const char *variable_name = var_name ? var_name->str : "unknown-TODO";
+	static const StringObject unknown_name = {.len = 12, .reserved = -1, .str = "unknown-TODO"};
+	const StringObject *variable_name = var_name ? var_name : &unknown_name;
 	VariableType *expr_type = &expr->common_expr.type;
 
 	// If expr is ANY type then allow it as a runtime check will be
@@ -301,8 +302,8 @@ static void typecheck_var_assignment(CompilerState *compiler_state, VariableType
 			;
 		} else if (expr_type->type_code != RAVI_TNUMINT) {
 			char tempbuf[256];
-			snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %s is not type compatible\n",
-				 expr->line_number, variable_name);
+			snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %.*s is not type compatible\n",
+				 expr->line_number, (int)variable_name->len, variable_name->str);
 			handle_error(compiler_state, tempbuf);
 		}
 		return;
@@ -313,8 +314,8 @@ static void typecheck_var_assignment(CompilerState *compiler_state, VariableType
 			;
 		} else if (expr_type->type_code != RAVI_TNUMFLT) {
 			char tempbuf[256];
-			snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %s is not type compatible\n",
-				 expr->line_number, variable_name);
+			snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %.*s is not type compatible\n",
+				 expr->line_number, (int)variable_name->len, variable_name->str);
 			handle_error(compiler_state, tempbuf);
 		}
 		return;
@@ -341,8 +342,8 @@ static void typecheck_var_assignment(CompilerState *compiler_state, VariableType
 	// all other types must strictly match
 	if (!is_type_same(var_type, expr_type)) { // We should probably check type convert-ability here
 		char tempbuf[256];
-		snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %s is not type compatible\n",
-			 expr->line_number, variable_name);
+		snprintf(tempbuf, sizeof tempbuf, "%d: Assignment to local symbol %.*s is not type compatible\n",
+			 expr->line_number, (int)variable_name->len, variable_name->str);
 		handle_error(compiler_state, tempbuf);
 	}
 }
@@ -0,0 +1,475 @@
+/******************************************************************************
+ * Copyright (C) 2022 Dibyendu Majumdar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Compiler throughput benchmark.
+ * Runs the full pipeline via raviX_compile() repeatedly over the given input files
+ * and over synthetic sources of increasing size, and reports per phase throughput.
+ * Files ending in .in are split into chunks separated by a line containing just '#',
+ * as used by trun.
+ */
+
+#include "ravi_api.h"
+#include "ravi_compiler.h"
+
+#include "parser.h"
+#include "tcommon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct BenchInput {
+	char *name;
+	char *source;
+	size_t len;
+	unsigned lines;
+	unsigned tokens;
+	int compiles;	/* Set if the input compiles successfully */
+	struct BenchInput *next;
+} BenchInput;
+
+typedef struct BenchTotals {
+	double lex_ms;
+	double phase_ms[RAVI_PHASE_COUNT];
+	double wall_ms; /* Wall clock time of the raviX_compile() calls, includes cache lookups */
+	unsigned long long lines;
+	unsigned long long tokens;
+	unsigned long long source_bytes;
+	unsigned long long C_bytes;
+	unsigned long long alloc_bytes;
+	unsigned compiles;
+	unsigned failures;
+} BenchTotals;
+
+static BenchInput *inputs = NULL;
+static int use_builtin_arena = 0; /* Use the compiler's region allocator rather than dlmalloc mspace */
+static CompilerState *shared_compiler_state = NULL; /* Reused across compilations if --reuse was given */
+static Ravi_CompileCache *compile_cache = NULL; /* Set if --cache or --cache-dir was given */
+static char compiler_options[256] = "--stats"; /* Extra options can be given with --compiler-options */
+static BenchInput **last_input = &inputs;
+
+static void debug_message(void *context, const char *filename, long long line, const char *message) {}
+static void error_message(void *context, const char *message) {}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+	return (double)(end->tv_sec - start->tv_sec) * 1000.0 + (double)(end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static unsigned count_lines(const char *s, size_t len)
+{
+	unsigned lines = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] == '\n')
+			lines++;
+	}
+	if (len > 0 && s[len - 1] != '\n')
+		lines++;
+	return lines;
+}
+
+/* Runs the lexer over the input; returns number of tokens or -1 on error. Time taken is added to *ms */
+static int count_tokens(const char *source, size_t len, double *ms)
+{
+	C_MemoryAllocator allocator;
+	create_allocator(&allocator);
+	CompilerState *compiler_state = raviX_init_compiler(&allocator);
+	volatile int tokens = 0;
+	struct timespec start, end;
+	timespec_get(&start, TIME_UTC);
+	LexerState *ls = raviX_init_lexer(compiler_state, source, len, "bench");
+	if (setjmp(compiler_state->env) != 0) {
+		tokens = -1;
+		goto L_exit;
+	}
+	const LexerInfo *li = raviX_get_lexer_info(ls);
+	for (;;) {
+		raviX_next(ls);
+		if (li->t.token == TOK_EOS)
+			break;
+		tokens++;
+	}
+L_exit:
+	timespec_get(&end, TIME_UTC);
+	*ms += elapsed_ms(&start, &end);
+	raviX_destroy_lexer(ls);
+	raviX_destroy_compiler(compiler_state);
+	destroy_allocator(&allocator);
+	return tokens;
+}
+
+static void add_input(const char *name, const char *source, size_t len)
+{
+	BenchInput *input = (BenchInput *)calloc(1, sizeof(BenchInput));
+	if (input == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	input->name = strdup(name);
+	input->source = (char *)malloc(len + 1);
+	if (input->name == NULL || input->source == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memcpy(input->source, source, len);
+	input->source[len] = 0;
+	input->len = len;
+	input->lines = count_lines(source, len);
+	*last_input = input;
+	last_input = &input->next;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s);
+	size_t m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/* Splits trun style input into chunks separated by a line starting with '#' */
+static void add_chunks(const char *filename, const char *code)
+{
+	const char *cp = code;
+	const char *chunk_start = code;
+	unsigned chunk = 0;
+	char name[1024];
+	for (;;) {
+		const char *eol = strchr(cp, '\n');
+		const char *next = eol ? eol + 1 : cp + strlen(cp);
+		if (*cp == '#' || *cp == 0) {
+			if (cp > chunk_start) {
+				snprintf(name, sizeof name, "%s[%u]", filename, chunk);
+				add_input(name, chunk_start, cp - chunk_start);
+			}
+			chunk++;
+			chunk_start = next;
+		}
+		if (*cp == 0)
+			break;
+		cp = next;
+	}
+}
+
+static void add_file(const char *filename)
+{
+	const char *code = read_file(filename);
+	if (code == NULL)
+		exit(1);
+	if (has_suffix(filename, ".in"))
+		add_chunks(filename, code);
+	else
+		add_input(filename, code, strlen(code));
+	free((void *)code);
+}
+
+/* Generates a chunk containing the given number of functions, each with loops, arithmetic and table access */
+static void add_synthetic(unsigned nfunctions)
+{
+	TextBuffer mb;
+	raviX_buffer_init(&mb, 4096);
+	for (unsigned i = 0; i < nfunctions; i++) {
+		raviX_buffer_add_fstring(&mb,
+					 "function f%u(n: integer, x: number, t: table)\n"
+					 "  local sum: number = 0.0\n"
+					 "  local arr: number[] = {}\n"
+					 "  for i = 1, n do\n"
+					 "    arr[i] = x * i\n"
+					 "    sum = sum + arr[i]\n"
+					 "    if sum > 1000.0 then\n"
+					 "      sum = sum - 1000.0\n"
+					 "    elseif sum < 0.0 then\n"
+					 "      sum = -sum\n"
+					 "    end\n"
+					 "  end\n"
+					 "  t.total = sum\n"
+					 "  t[%u] = #arr\n"
+					 "  local g = function(y) return y + sum end\n"
+					 "  return g(t.total), t['key%u']\n"
+					 "end\n",
+					 i, i, i);
+	}
+	char name[64];
+	snprintf(name, sizeof name, "synthetic[%u functions]", nfunctions);
+	add_input(name, raviX_buffer_data(&mb), raviX_buffer_len(&mb));
+	raviX_buffer_free(&mb);
+}
+
+/* Compiles the input once, accumulating statistics; returns 0 on success */
+static int compile_input(BenchInput *input, BenchTotals *totals, BenchTotals *input_totals)
+{
+	C_MemoryAllocator allocator;
+	if (use_builtin_arena)
+		raviX_init_arena_allocator(&allocator);
+	else
+		create_allocator(&allocator);
+	Ravi_CompilerInterface ravi_interface;
+	memset(&ravi_interface, 0, sizeof ravi_interface);
+	ravi_interface.source = input->source;
+	ravi_interface.source_len = input->len;
+	ravi_interface.source_name = input->name;
+	ravi_interface.compiler_options = compiler_options;
+	ravi_interface.memory_allocator = &allocator;
+	ravi_interface.cache = compile_cache;
+	ravi_interface.debug_message = debug_message;
+	ravi_interface.error_message = error_message;
+	raviX_string_copy(ravi_interface.main_func_name, "setup", sizeof ravi_interface.main_func_name);
+
+	struct timespec start, end;
+	timespec_get(&start, TIME_UTC);
+	int rc = shared_compiler_state ? raviX_compile_with_state(shared_compiler_state, &ravi_interface)
+				       : raviX_compile(&ravi_interface);
+	timespec_get(&end, TIME_UTC);
+	if (rc == 0) {
+		BenchTotals *targets[2] = {totals, input_totals};
+		for (int t = 0; t < 2; t++) {
+			BenchTotals *target = targets[t];
+			for (int i = 0; i < RAVI_PHASE_COUNT; i++) {
+				target->phase_ms[i] += ravi_interface.stats.phases[i].elapsed_ms;
+				target->alloc_bytes += ravi_interface.stats.phases[i].alloc_bytes;
+			}
+			target->wall_ms += elapsed_ms(&start, &end);
+			target->lines += input->lines;
+			target->tokens += input->tokens;
+			target->source_bytes += input->len;
+			target->C_bytes += ravi_interface.stats.generated_code_size;
+			target->compiles++;
+		}
+	}
+	raviX_release(&ravi_interface);
+	allocator.destroy_arena(allocator.arena);
+	return rc;
+}
+
+static double total_ms(const BenchTotals *totals)
+{
+	double ms = 0.0;
+	for (int i = 0; i < RAVI_PHASE_COUNT; i++)
+		ms += totals->phase_ms[i];
+	return ms;
+}
+
+static double per_second(unsigned long long count, double ms)
+{
+	return ms > 0.0 ? (double)count * 1000.0 / ms : 0.0;
+}
+
+static void report_phase(const char *name, double ms, const BenchTotals *totals, int show_C_bytes)
+{
+	printf("%-12s %12.3f %14.0f %14.0f", name, ms, per_second(totals->lines, ms), per_second(totals->tokens, ms));
+	if (show_C_bytes)
+		printf(" %14.0f", per_second(totals->C_bytes, ms));
+	printf("\n");
+}
+
+static void report(const BenchTotals *totals)
+{
+	printf("\n%u compiles (%u failed), %llu lines, %llu tokens, %llu source bytes, %llu C bytes, %llu bytes allocated\n\n",
+	       totals->compiles, totals->failures, totals->lines, totals->tokens, totals->source_bytes,
+	       totals->C_bytes, totals->alloc_bytes);
+	printf("%-12s %12s %14s %14s %14s\n", "phase", "ms", "lines/sec", "tokens/sec", "C bytes/sec");
+	report_phase("lex", totals->lex_ms, totals, 0);
+	for (int i = 0; i < RAVI_PHASE_COUNT; i++) {
+		report_phase(raviX_compiler_phase_name((enum Ravi_CompilerPhase)i), totals->phase_ms[i], totals,
+			     i == RAVI_PHASE_CODEGEN);
+	}
+	report_phase("total", total_ms(totals), totals, 1);
+	report_phase("wall", totals->wall_ms, totals, 1);
+}
+
+/* Compiles all inputs that compile successfully using raviX_compile_batch() and reports wall clock throughput */
+static void run_batch(unsigned iterations, unsigned threads)
+{
+	unsigned num_jobs = 0;
+	unsigned long long lines = 0;
+	for (BenchInput *input = inputs; input != NULL; input = input->next) {
+		if (input->compiles) {
+			num_jobs += iterations;
+			lines += (unsigned long long)input->lines * iterations;
+		}
+	}
+	if (num_jobs == 0)
+		return;
+	Ravi_CompilerInterface *jobs = (Ravi_CompilerInterface *)calloc(num_jobs, sizeof(Ravi_CompilerInterface));
+	if (jobs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	unsigned job = 0;
+	for (BenchInput *input = inputs; input != NULL; input = input->next) {
+		if (!input->compiles)
+			continue;
+		for (unsigned i = 0; i < iterations; i++, job++) {
+			jobs[job].source = input->source;
+			jobs[job].source_len = input->len;
+			jobs[job].source_name = input->name;
+			jobs[job].compiler_options = "";
+			jobs[job].cache = compile_cache;
+			jobs[job].debug_message = debug_message;
+			jobs[job].error_message = error_message;
+			raviX_string_copy(jobs[job].main_func_name, "setup", sizeof jobs[job].main_func_name);
+		}
+	}
+	struct timespec start, end;
+	timespec_get(&start, TIME_UTC);
+	int failures = raviX_compile_batch(jobs, num_jobs, threads, NULL);
+	timespec_get(&end, TIME_UTC);
+	double ms = elapsed_ms(&start, &end);
+	for (unsigned i = 0; i < num_jobs; i++)
+		raviX_release(&jobs[i]);
+	free(jobs);
+	printf("\nbatch: %u jobs (%d failed) on %u threads, %.3f ms wall clock, %.0f lines/sec\n", num_jobs, failures,
+	       threads, ms, per_second(lines, ms));
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: ravicomp_bench [-n iterations] [--no-synthetic] [--arena] [--reuse] [--threads n] [--cache] [--cache-dir dir] [--compiler-options options] [--verbose] [files...]\n");
+	exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned iterations = 10;
+	int synthetic = 1;
+	int verbose = 0;
+	int reuse = 0;
+	unsigned threads = 0;
+	int use_cache = 0;
+	const char *cache_dir = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0) {
+			if (i == argc - 1)
+				usage();
+			iterations = (unsigned)atoi(argv[++i]);
+			if (iterations == 0)
+				usage();
+		} else if (strcmp(argv[i], "--no-synthetic") == 0) {
+			synthetic = 0;
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			if (i == argc - 1)
+				usage();
+			threads = (unsigned)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--cache") == 0) {
+			use_cache = 1;
+		} else if (strcmp(argv[i], "--cache-dir") == 0) {
+			if (i == argc - 1)
+				usage();
+			cache_dir = argv[++i];
+			use_cache = 1;
+		} else if (strcmp(argv[i], "--compiler-options") == 0) {
+			if (i == argc - 1)
+				usage();
+			snprintf(compiler_options, sizeof compiler_options, "--stats %s", argv[++i]);
+		} else if (strcmp(argv[i], "--reuse") == 0) {
+			reuse = 1;
+		} else if (strcmp(argv[i], "--arena") == 0) {
+			use_builtin_arena = 1;
+		} else if (strcmp(argv[i], "--verbose") == 0) {
+			verbose = 1;
+		} else if (argv[i][0] == '-') {
+			usage();
+		} else {
+			add_file(argv[i]);
+		}
+	}
+	if (synthetic) {
+		for (unsigned n = 10; n <= 1000; n *= 10)
+			add_synthetic(n);
+	}
+	if (inputs == NULL)
+		usage();
+
+	if (use_cache) {
+		compile_cache = raviX_create_compile_cache(cache_dir, 0);
+		if (compile_cache == NULL) {
+			fprintf(stderr, "unable to create cache directory %s\n", cache_dir);
+			exit(1);
+		}
+	}
+
+	C_MemoryAllocator shared_allocator;
+	if (reuse) {
+		if (!use_builtin_arena)
+			create_allocator(&shared_allocator);
+		shared_compiler_state = raviX_init_compiler(use_builtin_arena ? NULL : &shared_allocator);
+	}
+
+	BenchTotals totals;
+	memset(&totals, 0, sizeof totals);
+	for (BenchInput *input = inputs; input != NULL; input = input->next) {
+		BenchTotals input_totals;
+		memset(&input_totals, 0, sizeof input_totals);
+		double lex_ms = 0.0;
+		int tokens = count_tokens(input->source, input->len, &lex_ms);
+		/* Check that the input compiles before including it in the benchmark */
+		if (tokens < 0 || compile_input(input, &input_totals, &input_totals) != 0) {
+			if (verbose)
+				printf("%-40s failed to compile, skipped\n", input->name);
+			totals.failures++;
+			continue;
+		}
+		input->tokens = (unsigned)tokens;
+		input->compiles = 1;
+		memset(&input_totals, 0, sizeof input_totals);
+		for (unsigned i = 0; i < iterations; i++) {
+			lex_ms = 0.0;
+			count_tokens(input->source, input->len, &lex_ms);
+			totals.lex_ms += lex_ms;
+			if (compile_input(input, &totals, &input_totals) != 0)
+				totals.failures++;
+		}
+		if (verbose) {
+			double ms = total_ms(&input_totals);
+			printf("%-40s %8u lines %8u tokens %10.3f ms/compile %12.0f lines/sec\n", input->name, input->lines,
+			       input->tokens, ms / iterations, per_second(input_totals.lines, ms));
+		}
+	}
+	report(&totals);
+	if (threads > 0)
+		run_batch(iterations, threads);
+
+	if (compile_cache) {
+		Ravi_CompileCacheStats cache_stats;
+		raviX_compile_cache_stats(compile_cache, &cache_stats);
+		printf("\ncache: %llu memory hits, %llu disk hits, %llu misses, %llu stores, %llu evictions\n",
+		       cache_stats.memory_hits, cache_stats.disk_hits, cache_stats.misses, cache_stats.stores,
+		       cache_stats.evictions);
+		raviX_destroy_compile_cache(compile_cache);
+	}
+	if (shared_compiler_state) {
+		raviX_destroy_compiler(shared_compiler_state);
+		if (!use_builtin_arena)
+			destroy_allocator(&shared_allocator);
+	}
+
+	while (inputs != NULL) {
+		BenchInput *next = inputs->next;
+		free(inputs->name);
+		free(inputs->source);
+		free(inputs);
+		inputs = next;
+	}
+	return 0;
+}
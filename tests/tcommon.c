@@ -42,6 +42,14 @@ void parse_arguments(struct arguments *args, int argc, const char *argv[])
 	args->remove_unreachable_blocks = 0;
 	args->gen_C = 0;
 	args->opt_upvalue = 0;
+	args->ssa = 0;
+	args->sccp = 0;
+	args->dce = 0;
+	args->licm = 0;
+	args->stable_globals = 0;
+	args->inline_procs = 0;
+	args->replace_tables = 0;
+	args->inline_caches = 0;
 	args->mainfunc = "setup";
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--notypecheck") == 0) {
@@ -64,6 +72,23 @@ void parse_arguments(struct arguments *args, int argc, const char *argv[])
 			args->gen_C = 1;
 		} else if (strcmp(argv[i], "--opt-upvalues") == 0) {
 			args->opt_upvalue = 1;
+		} else if (strcmp(argv[i], "--ssa") == 0) {
+			args->ssa = 1;
+		} else if (strcmp(argv[i], "--sccp") == 0) {
+			args->ssa = 1;
+			args->sccp = 1;
+		} else if (strcmp(argv[i], "--dce") == 0) {
+			args->dce = 1;
+		} else if (strcmp(argv[i], "--licm") == 0) {
+			args->licm = 1;
+		} else if (strcmp(argv[i], "--stable-globals") == 0) {
+			args->stable_globals = 1;
+		} else if (strcmp(argv[i], "--inline-functions") == 0) {
+			args->inline_procs = 1;
+		} else if (strcmp(argv[i], "--replace-tables") == 0) {
+			args->replace_tables = 1;
+		} else if (strcmp(argv[i], "--inline-caches") == 0) {
+			args->inline_caches = 1;
 		} else if (strcmp(argv[i], "--table-ast") == 0) {
 			args->table_ast = 1;
 		} else if (strcmp(argv[i], "-main") == 0) {
@@ -30,7 +30,8 @@ struct arguments {
 	const char *filename;
 	const char *code;
 	unsigned typecheck : 1, linearize : 1, astdump : 1, irdump : 1, cfgdump : 1, codump : 1, simplify_ast : 1,
-	    remove_unreachable_blocks: 1, gen_C: 1, opt_upvalue: 1, table_ast : 1;
+	    remove_unreachable_blocks: 1, gen_C: 1, opt_upvalue: 1, table_ast : 1, ssa : 1, sccp : 1, dce : 1, licm : 1,
+	    stable_globals : 1, inline_procs : 1, replace_tables : 1, inline_caches : 1;
 	const char *mainfunc; /* name of the main function in generated code, only applies if gen_C is on */
 };
 extern void parse_arguments(struct arguments *args, int argc, const char *argv[]);
@@ -22,12 +22,24 @@
  ******************************************************************************/
 
 #include <allocate.h>
+#include <ravi_api.h>
 #include <ravi_compiler.h>
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <bitset.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
 #include "ravi_alloc.h"
 
 static void create_allocator(C_MemoryAllocator *allocator) {
@@ -63,11 +75,81 @@ static int test_stringset(void)
 		rc++;
 	if (s2->hash != s3->hash)
 		rc++;
+	/* Keywords, including Ravi's, are recognized; names that merely look like them are not */
+	if (raviX_create_string(compiler_state, "C__unsafe", 9)->reserved != TOK_C__unsafe - FIRST_RESERVED)
+		rc++;
+	if (raviX_create_string(compiler_state, "@closure", 8)->reserved != TOK_TO_CLOSURE - FIRST_RESERVED)
+		rc++;
+	const char *names[] = {"ands", "nol", "C__ne", "@integer[", "thenn", "e", "whilf"};
+	for (int i = 0; i < (int)(sizeof names / sizeof names[0]); i++) {
+		if (raviX_create_string(compiler_state, names[i], (uint32_t)strlen(names[i]))->reserved != -1)
+			rc++;
+	}
 	raviX_destroy_compiler(compiler_state);
 	destroy_allocator(&allocator);
 	return rc;
 }
 
+static int test_string_pool(void)
+{
+	/* Enough strings to fill several chunks of the string pool, plus one too large for it */
+	CompilerState *compiler_state = raviX_init_compiler(NULL);
+	int rc = 0;
+	char name[4096];
+	for (int round = 0; round < 2; round++) {
+		const StringObject *strings[2000];
+		for (int i = 0; i < 2000; i++) {
+			snprintf(name, sizeof name, "name_%d", i);
+			strings[i] = raviX_create_string(compiler_state, name, (uint32_t)strlen(name));
+			if (((uintptr_t)strings[i] & (sizeof(void *) - 1)) != 0)
+				rc++;
+		}
+		for (int i = 0; i < 2000; i++) {
+			snprintf(name, sizeof name, "name_%d", i);
+			if (strcmp(strings[i]->str, name) != 0 ||
+			    raviX_create_string(compiler_state, name, (uint32_t)strlen(name)) != strings[i])
+				rc++;
+		}
+		memset(name, 'x', sizeof name - 1);
+		const StringObject *large = raviX_create_string(compiler_state, name, sizeof name - 1);
+		if (large->len != sizeof name - 1 || large->str[sizeof name - 1] != 0 ||
+		    memcmp(large->str, name, sizeof name - 1) != 0)
+			rc++;
+		/* Reserved words survive a reset */
+		if (raviX_create_string(compiler_state, "while", 5)->reserved != TOK_while - FIRST_RESERVED)
+			rc++;
+		raviX_reset_compiler(compiler_state);
+	}
+	raviX_destroy_compiler(compiler_state);
+	return rc;
+}
+
+static int test_zero_copy_strings(void)
+{
+	/* Names and literals without escapes refer to the source, the literal with an escape is a copy */
+	const char source[] = "local alpha = 'beta' local gamma = 'del\\ta' return alpha, gamma";
+	CompilerState *compiler_state = raviX_init_compiler(NULL);
+	raviX_set_zero_copy_strings(compiler_state, true);
+	int rc = raviX_parse(compiler_state, source, sizeof source - 1, "test") != 0;
+	const char *end = source + sizeof source - 1;
+	const char *names[] = {"alpha", "beta", "gamma"};
+	for (int i = 0; i < 3; i++) {
+		const StringObject *s = raviX_create_string(compiler_state, names[i], (uint32_t)strlen(names[i]));
+		if (s->str < source || s->str >= end || s->len != strlen(names[i]) ||
+		    memcmp(s->str, names[i], s->len) != 0)
+			rc++;
+	}
+	const StringObject *escaped = raviX_create_string(compiler_state, "del\ta", 5);
+	if (escaped->str >= source && escaped->str < end)
+		rc++;
+	/* Strings created through the API are always copied */
+	const StringObject *copy = raviX_create_string(compiler_state, "epsilon", 7);
+	if (copy->str[7] != 0)
+		rc++;
+	raviX_destroy_compiler(compiler_state);
+	return rc;
+}
+
 static int test_memalloc(void)
 {
 	int arry[5] = {1, 2, 3, 4, 5}; // 5 is extra sentinel
@@ -81,6 +163,398 @@ static int test_memalloc(void)
 	return 0;
 }
 
+static int test_arena(void)
+{
+	int rc = 0;
+	C_MemoryAllocator allocator;
+	raviX_init_arena_allocator(&allocator);
+	char *prev = NULL;
+	for (int i = 0; i < 10000; i++) {
+		size_t n = (size_t)(i % 100) + 1;
+		char *p = (char *)allocator.calloc(allocator.arena, n, sizeof(double));
+		if (((uintptr_t)p & 15) != 0)
+			rc++;
+		for (size_t j = 0; j < n * sizeof(double); j++)
+			if (p[j] != 0)
+				rc++;
+		memset(p, 0xff, n * sizeof(double));
+		if (p == prev)
+			rc++;
+		prev = p;
+	}
+	/* large objects */
+	char *big = (char *)allocator.calloc(allocator.arena, 1, 1024 * 1024);
+	if (big[0] != 0 || big[1024 * 1024 - 1] != 0)
+		rc++;
+	/* growing the most recent allocation */
+	char *s = (char *)allocator.realloc(allocator.arena, NULL, 8);
+	memcpy(s, "abcdefg", 8);
+	s = (char *)allocator.realloc(allocator.arena, s, 100);
+	if (strcmp(s, "abcdefg") != 0)
+		rc++;
+	/* growing an older allocation */
+	char *t = (char *)allocator.calloc(allocator.arena, 1, 16);
+	memcpy(t, "xyz", 4);
+	(void)allocator.calloc(allocator.arena, 1, 16);
+	t = (char *)allocator.realloc(allocator.arena, t, 200000);
+	if (strcmp(t, "xyz") != 0)
+		rc++;
+	allocator.free(allocator.arena, t);
+	allocator.destroy_arena(allocator.arena);
+
+	/* compiler state that owns its arena */
+	CompilerState *compiler_state = raviX_init_compiler(NULL);
+	const StringObject *s1 = raviX_create_string(compiler_state, "hello", 5);
+	const StringObject *s2 = raviX_create_string(compiler_state, "hello", 5);
+	if (s1 != s2 || strcmp(s1->str, "hello") != 0)
+		rc++;
+	const StringObject *kw = raviX_create_string(compiler_state, "while", 5);
+	/* reset keeps the reserved words but discards other strings */
+	for (int i = 0; i < 3; i++) {
+		raviX_reset_compiler(compiler_state);
+		if (raviX_create_string(compiler_state, "while", 5) != kw)
+			rc++;
+		s1 = raviX_create_string(compiler_state, "hello", 5);
+		if (strcmp(s1->str, "hello") != 0)
+			rc++;
+		if (raviX_parse(compiler_state, "local a = 1 return a", 20, "test") != 0)
+			rc++;
+	}
+	raviX_destroy_compiler(compiler_state);
+	return rc;
+}
+
+static void quiet_error_message(void *context, const char *message) {}
+
+static int compile_with_options(Ravi_CompileCache *cache, const char *options, const char *source, char **code)
+{
+	Ravi_CompilerInterface ravi_interface;
+	memset(&ravi_interface, 0, sizeof ravi_interface);
+	ravi_interface.source = source;
+	ravi_interface.source_len = strlen(source);
+	ravi_interface.source_name = "test";
+	ravi_interface.compiler_options = options;
+	ravi_interface.cache = cache;
+	ravi_interface.error_message = quiet_error_message;
+	strcpy(ravi_interface.main_func_name, "setup");
+	int rc = raviX_compile(&ravi_interface);
+	*code = rc == 0 ? strdup(ravi_interface.generated_code) : NULL;
+	raviX_release(&ravi_interface);
+	return rc;
+}
+
+static int compile_with_cache(Ravi_CompileCache *cache, const char *source, char **code)
+{
+	return compile_with_options(cache, "", source, code);
+}
+
+static int test_compile_cache(void)
+{
+	int rc = 0;
+	const char *a = "local x = 1 return x + 1";
+	const char *b = "local y = 2 return y * 3";
+	Ravi_CompileCache *cache = raviX_create_compile_cache(NULL, 1);
+	char *a1, *a2, *b1;
+	rc += compile_with_cache(cache, a, &a1) != 0;
+	rc += compile_with_cache(cache, a, &a2) != 0;
+	if (rc == 0 && strcmp(a1, a2) != 0)
+		rc++;
+	/* b evicts a as the cache only holds one entry */
+	rc += compile_with_cache(cache, b, &b1) != 0;
+	free(a2);
+	rc += compile_with_cache(cache, a, &a2) != 0;
+	/* failed compilations are not cached */
+	char *bad;
+	if (compile_with_cache(cache, "local = ", &bad) == 0 || compile_with_cache(cache, "local = ", &bad) == 0)
+		rc++;
+	Ravi_CompileCacheStats stats;
+	raviX_compile_cache_stats(cache, &stats);
+	if (stats.memory_hits != 1 || stats.disk_hits != 0 || stats.misses != 5 || stats.stores != 3 ||
+	    stats.evictions != 2)
+		rc++;
+	raviX_destroy_compile_cache(cache);
+	free(a1);
+	free(a2);
+	free(b1);
+	return rc;
+}
+
+/* Creates an empty directory under the system's temporary directory, returns 0 on success */
+static int make_temp_dir(char *path, size_t n)
+{
+#ifdef _WIN32
+	char base[MAX_PATH];
+	if (GetTempPathA(sizeof base, base) == 0)
+		return -1;
+	snprintf(path, n, "%stmisc_XXXXXX", base);
+	if (_mktemp_s(path, n) != 0)
+		return -1;
+	return _mkdir(path);
+#else
+	const char *base = getenv("TMPDIR");
+	snprintf(path, n, "%s/tmisc_XXXXXX", base != NULL ? base : "/tmp");
+	return mkdtemp(path) != NULL ? 0 : -1;
+#endif
+}
+
+/* Removes a directory and the files in it */
+static void remove_temp_dir(const char *path)
+{
+	char file[1024];
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	snprintf(file, sizeof file, "%s/*", path);
+	HANDLE h = FindFirstFileA(file, &data);
+	if (h != INVALID_HANDLE_VALUE) {
+		do {
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				snprintf(file, sizeof file, "%s/%s", path, data.cFileName);
+				remove(file);
+			}
+		} while (FindNextFileA(h, &data));
+		FindClose(h);
+	}
+	_rmdir(path);
+#else
+	DIR *dir = opendir(path);
+	if (dir != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+				continue;
+			snprintf(file, sizeof file, "%s/%s", path, entry->d_name);
+			remove(file);
+		}
+		closedir(dir);
+	}
+	rmdir(path);
+#endif
+}
+
+static int test_disk_cache(void)
+{
+	const char *source = "local x = 1 return x + 2";
+	char directory[1024];
+	if (make_temp_dir(directory, sizeof directory) != 0)
+		return 1;
+	int rc = 0;
+	char *a1 = NULL, *a2 = NULL, *a3 = NULL;
+	Ravi_CompileCacheStats stats;
+	Ravi_CompileCache *cache = raviX_create_compile_cache(directory, 4);
+	if (cache == NULL) {
+		remove_temp_dir(directory);
+		return 1;
+	}
+	rc += compile_with_cache(cache, source, &a1) != 0;
+	raviX_compile_cache_stats(cache, &stats);
+	if (stats.misses != 1 || stats.stores != 1)
+		rc++;
+	raviX_destroy_compile_cache(cache);
+	/* A new cache finds the entry written by the first one */
+	cache = raviX_create_compile_cache(directory, 4);
+	rc += compile_with_cache(cache, source, &a2) != 0;
+	/* Different options make a different entry */
+	rc += compile_with_options(cache, "-O2", source, &a3) != 0;
+	raviX_compile_cache_stats(cache, &stats);
+	if (stats.disk_hits != 1 || stats.misses != 1 || stats.stores != 1)
+		rc++;
+	if (rc == 0 && strcmp(a1, a2) != 0)
+		rc++;
+	raviX_destroy_compile_cache(cache);
+	remove_temp_dir(directory);
+	free(a1);
+	free(a2);
+	free(a3);
+	return rc;
+}
+
+static int test_compile_batch(void)
+{
+	const char *sources[] = {"local x = 1 return x + 1", "local = ", "return function(a) return a * 2 end",
+				 "local t = {1, 2} return #t", "for i = 1, 10 do print(i) end"};
+	enum { NUM_JOBS = sizeof sources / sizeof sources[0] };
+	int rc = 0;
+	unsigned thread_counts[] = {1, 4};
+	for (unsigned n = 0; n < sizeof thread_counts / sizeof thread_counts[0]; n++) {
+		Ravi_CompilerInterface jobs[NUM_JOBS];
+		int results[NUM_JOBS];
+		memset(jobs, 0, sizeof jobs);
+		for (int i = 0; i < NUM_JOBS; i++) {
+			jobs[i].source = sources[i];
+			jobs[i].source_len = strlen(sources[i]);
+			jobs[i].source_name = "test";
+			jobs[i].compiler_options = "";
+			jobs[i].error_message = quiet_error_message;
+			strcpy(jobs[i].main_func_name, "setup");
+		}
+		if (raviX_compile_batch(jobs, NUM_JOBS, thread_counts[n], results) != 1)
+			rc++;
+		/* Each job produces the same code as a compilation on its own */
+		for (int i = 0; i < NUM_JOBS; i++) {
+			char *code;
+			int expected = compile_with_cache(NULL, sources[i], &code);
+			if (results[i] != expected || (expected != 0) != (i == 1))
+				rc++;
+			else if (expected == 0 && strcmp(code, jobs[i].generated_code) != 0)
+				rc++;
+			free(code);
+			raviX_release(&jobs[i]);
+		}
+	}
+	return rc;
+}
+
+static void append_code(void *context, const char *code, size_t len)
+{
+	TextBuffer *mb = (TextBuffer *)context;
+	raviX_buffer_add_bytes(mb, code, len);
+}
+
+static int test_streamed_output(void)
+{
+	int rc = 0;
+	const char *source = "local function f(a) return a + 1 end local function g(b) return f(b) * 2 end return g(3)";
+	char *code;
+	if (compile_with_cache(NULL, source, &code) != 0)
+		return 1;
+	TextBuffer mb;
+	raviX_buffer_init(&mb, 16);
+	Ravi_CompilerInterface ravi_interface;
+	memset(&ravi_interface, 0, sizeof ravi_interface);
+	ravi_interface.source = source;
+	ravi_interface.source_len = strlen(source);
+	ravi_interface.source_name = "test";
+	ravi_interface.compiler_options = "";
+	ravi_interface.context = &mb;
+	ravi_interface.error_message = quiet_error_message;
+	ravi_interface.emit_code = append_code;
+	strcpy(ravi_interface.main_func_name, "setup");
+	if (raviX_compile(&ravi_interface) != 0 || ravi_interface.generated_code != NULL)
+		rc++;
+	if (strcmp(raviX_buffer_data(&mb), code) != 0 || ravi_interface.stats.generated_code_size != strlen(code))
+		rc++;
+	raviX_release(&ravi_interface);
+	raviX_buffer_free(&mb);
+	free(code);
+	return rc;
+}
+
+static int test_stats_with_embedded_C(void)
+{
+	/* Statistics are collected through a wrapper of the built-in allocator, which the embedded C parser must not use */
+	const char *source = "C__decl [[ typedef struct { long a; } MyStruct; ]]\n"
+			     "local i: integer = 1\n"
+			     "local k: integer\n"
+			     "C__unsafe(i, k) [[ k = i + 1; ]]\n"
+			     "local u = C__new('MyStruct', 1)\n"
+			     "return k, u\n";
+	char *code;
+	int rc = compile_with_options(NULL, "--stats", source, &code) != 0;
+	free(code);
+	/* Batch jobs without an allocator are compiled with a reused compiler state */
+	Ravi_CompilerInterface job;
+	memset(&job, 0, sizeof job);
+	job.source = source;
+	job.source_len = strlen(source);
+	job.source_name = "test";
+	job.compiler_options = "--stats";
+	job.error_message = quiet_error_message;
+	strcpy(job.main_func_name, "setup");
+	if (raviX_compile_batch(&job, 1, 1, NULL) != 0 || job.stats.generated_code_size == 0)
+		rc++;
+	raviX_release(&job);
+	return rc;
+}
+
+static unsigned count_occurrences(const char *s, const char *what)
+{
+	unsigned n = 0;
+	for (const char *p = strstr(s, what); p != NULL; p = strstr(p + 1, what))
+		n++;
+	return n;
+}
+
+static int test_array_bounds_checks(void)
+{
+	/* Only the accesses in the second loop need their index checked */
+	const char *source = "local function f(a: integer[], b: number[], n: integer)\n"
+			     "  local s = 0\n"
+			     "  for i = 1, #a do s = s + a[i]; a[i] = 0 end\n"
+			     "  for i = 1, #b - 1 do b[i] = b[i + 1] end\n"
+			     "  for i = 1, n do s = s + a[i]; a[i] = 0 end\n"
+			     "  return s\n"
+			     "end\n"
+			     "return f\n";
+	char *code;
+	if (compile_with_cache(NULL, source, &code) != 0)
+		return 1;
+	int rc = count_occurrences(code, "arr->len") != 3;
+	free(code);
+	return rc;
+}
+
+static int test_inline_caches(void)
+{
+	/* Every access with a constant string key gets a cache, other keys don't; see also t19_inline_caches */
+	const char *source = "local function f(o, k)\n"
+			     "  o.count = o.count + 1\n"
+			     "  o[k] = o.x\n"
+			     "  return o[k]\n"
+			     "end\n"
+			     "return f\n";
+	char *code;
+	if (compile_with_options(NULL, "--inline-caches", source, &code) != 0)
+		return 1;
+	int rc = count_occurrences(code, "static unsigned int slot") != 3;
+	free(code);
+	return rc;
+}
+
+static int test_direct_calls(void)
+{
+	/* Calls through locals bound to a function are direct, the call through a reassigned local is not */
+	const char *source = "local function add(a, b) return a + b end\n"
+			     "local function twice(x) return add(x, x) end\n"
+			     "local g = add\n"
+			     "g = print\n"
+			     "return twice(add(1, 2)), g(3)\n";
+	char *code;
+	if (compile_with_options(NULL, "", source, &code) != 0)
+		return 1;
+	int rc = count_occurrences(code, "raviX__enter_frame(L, ra,") != 3;
+	free(code);
+	return rc;
+}
+
+static int test_typed_entry(void)
+{
+	/* Arguments of known types are passed unboxed, the call with an untyped argument boxes them */
+	const char *source = "local function mix(a: integer, x: number) return a * x end\n"
+			     "local function f(t) return mix(1, 2) + mix(t, 1) end\n"
+			     "return f\n";
+	char *code;
+	if (compile_with_options(NULL, "", source, &code) != 0)
+		return 1;
+	int rc = count_occurrences(code, "_typed(L, 1, (lua_Number)2)") != 1;
+	free(code);
+	return rc;
+}
+
+static int test_table_size_hints(void)
+{
+	/* Sizes are encoded like the B and C arguments of OP_NEWTABLE; 20 list items encode as 18 */
+	const char *source = "local t = {1, 2, 3, x = 1}\n"
+			     "local u = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20}\n"
+			     "local v = {}\n"
+			     "return t, u, v\n";
+	char *code;
+	if (compile_with_options(NULL, "", source, &code) != 0)
+		return 1;
+	int rc = count_occurrences(code, "raviV_op_newtable(L, ci, ra, 18, 0);") != 1;
+	free(code);
+	return rc;
+}
+
 static int test_bitset(void)
 {
 	int status;
@@ -182,6 +656,15 @@ static int test_bitset(void)
 	status &= raviX_bitset_clear_bit_range_p(&b1, 30, 362);
 	status &= raviX_bitset_empty_p(&b1);
 
+	/* Bits set before a clear must not reappear when the set grows again */
+	status &= raviX_bitset_set_bit_p(&b1, 300);
+	raviX_bitset_clear(&b1);
+	status &= raviX_bitset_set_bit_p(&b1, 1);
+	status &= raviX_bitset_set_bit_p(&b1, 400);
+	status &= !raviX_bitset_bit_p(&b1, 300);
+	status &= raviX_bitset_bit_count(&b1) == 2;
+	raviX_bitset_clear(&b1);
+
 	status &= raviX_bitset_set_bit_range_p(&b1, 30, 362);
 
 	BitSetIterator iter;
@@ -206,31 +689,23 @@ static int test_bitset(void)
 /* TODO the test below duplicates code from linearizer */
 
 typedef struct PseudoGenerator {
-	uint64_t bits[4]; /* bitset of registers */
+	uint64_t *bits;	  /* bitset of registers */
+	unsigned n_words; /* size of bits array */
 	unsigned max_reg;
 } PseudoGenerator;
 static inline unsigned raviX_max_reg(PseudoGenerator *generator) { return generator->max_reg; }
 
-#define FIELD_SIZEOF(t, f) (sizeof(((t *)0)->f))
-#define FIELD_E_SIZEOF(t, f) (sizeof(((t *)0)->f[0]))
-
 enum {
-	BITSET_SIZE = FIELD_SIZEOF(PseudoGenerator, bits),    /* total size of bits in #bytes */
-	BITSET_ESIZE = FIELD_E_SIZEOF(PseudoGenerator, bits), /* sizeof bits[0] in #bytes */
-	N_WORDS = BITSET_SIZE / BITSET_ESIZE,		      /* bits array size in #bytes */
-	ESIZE = BITSET_ESIZE * 8,			      /* bits in bits[0] */
-	MAXBIT = N_WORDS * ESIZE			      /* total bits */
+	ESIZE = sizeof(uint64_t) * 8 /* bits in bits[0] */
 };
 
-static_assert(N_WORDS == 4, "Invalid computation of bitset size"); /* must be kept in sync with PseudoGeneraotor.bits */
-
 /* Identify the top most register allocated; this is useful when we need
  * to ensure that the next register goes to the top of the stack
  */
 static int top_reg(PseudoGenerator *generator)
 {
 	/* start from the last element of bits */
-	for (int i = N_WORDS - 1; i >= 0; i--) {
+	for (int i = (int)generator->n_words - 1; i >= 0; i--) {
 		if (!generator->bits[i]) // no bit set
 			continue;
 		uint64_t bit = generator->bits[i];
@@ -261,18 +736,43 @@ static int pseudo_gen_is_top(PseudoGenerator *generator, unsigned reg)
  */
 static void pseudo_gen_free(PseudoGenerator *generator, unsigned reg)
 {
-	assert(reg < MAXBIT);
+	assert(reg < generator->max_reg);
 	unsigned n = reg / ESIZE;
 	reg = reg % ESIZE;
 	generator->bits[n] &= ~(1ull << reg);
 }
 
+/**
+ * Marks the given register as in use, growing the bit set if necessary
+ */
+static void pseudo_gen_set(C_MemoryAllocator *allocator, PseudoGenerator *generator, unsigned reg)
+{
+	unsigned i = reg / ESIZE;
+	unsigned j = reg % ESIZE;
+	if (i >= generator->n_words) {
+		unsigned new_size = generator->n_words ? generator->n_words * 2 : 4;
+		while (new_size <= i)
+			new_size *= 2;
+		uint64_t *new_bits = (uint64_t *)allocator->calloc(allocator->arena, new_size, sizeof(uint64_t));
+		assert(new_bits != NULL);
+		if (generator->n_words > 0) {
+			memcpy(new_bits, generator->bits, generator->n_words * sizeof(uint64_t));
+		}
+		generator->n_words = new_size;
+		generator->bits = new_bits;
+	}
+	generator->bits[i] |= (1ull << j);
+	assert(reg <= generator->max_reg);
+	if (reg == generator->max_reg)
+		generator->max_reg += 1;
+}
+
 /**
  * Allocate a register, if top is specified then ensure it is top of the
  * stack else look for a free register. Not the most efficient as we
  * don't yet use hardware intrinsics for bit scans.
  */
-static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
+static unsigned pseudo_gen_alloc(C_MemoryAllocator *allocator, PseudoGenerator *generator, bool top)
 {
 	unsigned reg;
 	if (top) {
@@ -282,13 +782,13 @@ static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
 		/* look for the first free reg */
 		reg = 0;
 		int is_set = 1;
-		for (int i = 0; is_set && i < N_WORDS; i++) {
+		for (unsigned i = 0; is_set && i < generator->n_words; i++) {
 			uint64_t bit = generator->bits[i];
 			if (bit == ~0ull) {
-				/* all bits set? skip */ 
+				/* all bits set? skip */
 				reg += ESIZE;
 				continue;
-			} 
+			}
 			for (int j = 0; is_set && j < ESIZE; j++) {
 				is_set = (bit & (1ull << j)) != 0;
 				if (is_set)
@@ -296,24 +796,21 @@ static unsigned pseudo_gen_alloc(PseudoGenerator *generator, bool top)
 			}
 		}
 	}
-	unsigned i = reg / ESIZE;
-	unsigned j = reg % ESIZE;
-	generator->bits[i] |= (1ull << j);
-	assert(reg <= generator->max_reg);
-	if (reg == generator->max_reg)
-		generator->max_reg += 1;
+	pseudo_gen_set(allocator, generator, reg);
 	return reg;
 }
 
 static int test_pseudo_reg() 
 {
+	C_MemoryAllocator allocator;
+	raviX_init_arena_allocator(&allocator);
 	PseudoGenerator generator = {0};
 	/* as we keep allocating top reg is updated */
 	for (int i = 0; i < 255; i++) {
 		unsigned max_reg = raviX_max_reg(&generator);
 		if (i != max_reg)
 			assert(max_reg == i);
-		unsigned reg = pseudo_gen_alloc(&generator, false);
+		unsigned reg = pseudo_gen_alloc(&allocator, &generator, false);
 		if (top_reg(&generator) != reg)
 			assert(pseudo_gen_is_top(&generator, reg));
 	}
@@ -322,7 +819,7 @@ static int test_pseudo_reg()
 	pseudo_gen_free(&generator, 240);
 	assert(raviX_max_reg(&generator) == 255);
 	/* next alloc picks free reg */
-	unsigned reg = pseudo_gen_alloc(&generator, false);
+	unsigned reg = pseudo_gen_alloc(&allocator, &generator, false);
 	assert(reg == 240);
 
 	/* repeat test for free and alloc, no change to top reg */
@@ -330,9 +827,9 @@ static int test_pseudo_reg()
 		pseudo_gen_free(&generator, 63);
 		pseudo_gen_free(&generator, 64);
 		assert(raviX_max_reg(&generator) == 255);
-		reg = pseudo_gen_alloc(&generator, false);
+		reg = pseudo_gen_alloc(&allocator, &generator, false);
 		assert(reg == 63);
-		reg = pseudo_gen_alloc(&generator, false);
+		reg = pseudo_gen_alloc(&allocator, &generator, false);
 		assert(reg == 64);
 	}
 
@@ -342,21 +839,34 @@ static int test_pseudo_reg()
 		unsigned max_reg = raviX_max_reg(&generator);
 		if (i != max_reg)
 			assert(max_reg == i);
-		unsigned reg = pseudo_gen_alloc(&generator, false);
+		unsigned reg = pseudo_gen_alloc(&allocator, &generator, false);
 		assert(pseudo_gen_is_top(&generator, reg));
 	}
 
 	assert(pseudo_gen_is_top(&generator, 99));
 	/* no free reg so top will be bumped */
-	reg = pseudo_gen_alloc(&generator, true);
+	reg = pseudo_gen_alloc(&allocator, &generator, true);
 	assert(reg == 100);
 	pseudo_gen_free(&generator, reg);
 	/* 100 free now */
-	reg = pseudo_gen_alloc(&generator, true);
+	reg = pseudo_gen_alloc(&allocator, &generator, true);
 	assert(reg == 100);
 	/* none free so next is 101 */
-	reg = pseudo_gen_alloc(&generator, true);
+	reg = pseudo_gen_alloc(&allocator, &generator, true);
 	assert(reg == 101);
+
+	/* there is no fixed limit on the number of registers */
+	generator = (PseudoGenerator){0};
+	for (int i = 0; i < 1000; i++) {
+		unsigned reg = pseudo_gen_alloc(&allocator, &generator, true);
+		assert(reg == i);
+	}
+	assert(raviX_max_reg(&generator) == 1000);
+	pseudo_gen_free(&generator, 700);
+	reg = pseudo_gen_alloc(&allocator, &generator, false);
+	assert(reg == 700);
+	assert(top_reg(&generator) == 999);
+	allocator.destroy_arena(allocator.arena);
 	fprintf(stderr, "PseudoGenerator OK\n");
 	return 0;
 }
@@ -364,7 +874,20 @@ static int test_pseudo_reg()
 int main(int argc, const char *argv[])
 {	
 	int rc = test_stringset();
+	rc += test_string_pool();
+	rc += test_zero_copy_strings();
 	rc += test_memalloc();
+	rc += test_arena();
+	rc += test_compile_cache();
+	rc += test_disk_cache();
+	rc += test_compile_batch();
+	rc += test_streamed_output();
+	rc += test_stats_with_embedded_C();
+	rc += test_array_bounds_checks();
+	rc += test_inline_caches();
+	rc += test_direct_calls();
+	rc += test_typed_entry();
+	rc += test_table_size_hints();
 	rc += test_bitset();
 	rc += test_pseudo_reg();
 	if (rc == 0)
@@ -188,9 +188,50 @@ static int do_code(C_MemoryAllocator *allocator, const char *code, const struct
 			raviX_output_linearizer(linearizer, stdout);
 		}
 	}
+	if (args->inline_procs) {
+		raviX_inline_procs(linearizer);
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+	}
+	if (args->replace_tables) {
+		raviX_replace_tables(linearizer);
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+	}
+	if (args->ssa) {
+		raviX_construct_ssa(linearizer->main_proc);
+		if (args->sccp) {
+			raviX_propagate_constants(linearizer);
+			raviX_remove_unreachable_blocks(linearizer);
+		}
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+		raviX_destruct_ssa(linearizer->main_proc);
+	}
+	if (args->licm) {
+		raviX_hoist_loop_invariants(linearizer);
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+	}
+	if (args->dce) {
+		raviX_remove_dead_code(linearizer);
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+	}
+	if (args->stable_globals) {
+		raviX_cache_globals(linearizer);
+		if (args->irdump) {
+			raviX_output_linearizer(linearizer, stdout);
+		}
+	}
 	if (args->gen_C) {
 		fprintf(stdout, "\n#endif\n");
-		raviX_generate_C_tofile(linearizer, args->mainfunc, stdout);
+		raviX_generate_C_tofile(linearizer, args->mainfunc, args->inline_caches ? "--inline-caches" : "", stdout);
 	}
 
 L_linend:
@@ -65,4 +65,66 @@ echo "testing t10_embed_C"
 $command -f input/t10_embed_C.in > results.out
 #cp results.out expected/t10_embed_C.expected
 diff expected/t10_embed_C.expected results.out
-rm results.out
\ No newline at end of file
+rm results.out
+echo "testing t11_ssa"
+$command -f input/t11_ssa.in --noastdump --nocfgdump --remove-unreachable-blocks --ssa > results.out
+#cp results.out expected/t11_ssa.expected
+diff expected/t11_ssa.expected results.out
+rm results.out
+
+echo "testing t12_sccp"
+$command -f input/t12_sccp.in --noastdump --nocfgdump --remove-unreachable-blocks --sccp > results.out
+#cp results.out expected/t12_sccp.expected
+diff expected/t12_sccp.expected results.out
+rm results.out
+
+echo "testing t13_dce"
+$command -f input/t13_dce.in --noastdump --nocfgdump --remove-unreachable-blocks --sccp --dce > results.out
+#cp results.out expected/t13_dce.expected
+diff expected/t13_dce.expected results.out
+rm results.out
+echo "testing t14_licm"
+$command -f input/t14_licm.in --noastdump --nocfgdump --remove-unreachable-blocks --licm > results.out
+#cp results.out expected/t14_licm.expected
+diff expected/t14_licm.expected results.out
+rm results.out
+echo "testing t15_globals"
+$command -f input/t15_globals.in --noastdump --nocfgdump --remove-unreachable-blocks --stable-globals > results.out
+#cp results.out expected/t15_globals.expected
+diff expected/t15_globals.expected results.out
+rm results.out
+echo "testing t16_inline"
+$command -f input/t16_inline.in --noastdump --nocfgdump --remove-unreachable-blocks --inline-functions > results.out
+#cp results.out expected/t16_inline.expected
+diff expected/t16_inline.expected results.out
+rm results.out
+echo "testing t17_tables"
+$command -f input/t17_tables.in --noastdump --nocfgdump --remove-unreachable-blocks --replace-tables > results.out
+#cp results.out expected/t17_tables.expected
+diff expected/t17_tables.expected results.out
+rm results.out
+echo "testing t18_array_bounds"
+$command -f input/t18_array_bounds.in --noastdump --noirdump --nocfgdump --remove-unreachable-blocks --gen-C > results.out
+#cp results.out expected/t18_array_bounds.expected
+diff expected/t18_array_bounds.expected results.out
+rm results.out
+echo "testing t19_inline_caches"
+$command -f input/t19_inline_caches.in --noastdump --noirdump --nocfgdump --remove-unreachable-blocks --inline-caches --gen-C > results.out
+#cp results.out expected/t19_inline_caches.expected
+diff expected/t19_inline_caches.expected results.out
+rm results.out
+echo "testing t20_direct_calls"
+$command -f input/t20_direct_calls.in --noastdump --noirdump --nocfgdump --remove-unreachable-blocks --gen-C > results.out
+#cp results.out expected/t20_direct_calls.expected
+diff expected/t20_direct_calls.expected results.out
+rm results.out
+echo "testing t21_typed_entry"
+$command -f input/t21_typed_entry.in --noastdump --noirdump --nocfgdump --remove-unreachable-blocks --gen-C > results.out
+#cp results.out expected/t21_typed_entry.expected
+diff expected/t21_typed_entry.expected results.out
+rm results.out
+echo "testing t22_table_sizes"
+$command -f input/t22_table_sizes.in --noastdump --nocfgdump --remove-unreachable-blocks --gen-C > results.out
+#cp results.out expected/t22_table_sizes.expected
+diff expected/t22_table_sizes.expected results.out
+rm results.out